@@ -199,9 +199,11 @@ OBJS = strlcat.obj &
 	$(SYSOBJ_SND) &
 	$(SYSOBJ_CDA) &
 	$(SYSOBJ_NET) &
+	net_comp.obj &
 	net_dgrm.obj &
 	net_loop.obj &
 	net_main.obj &
+	net_sim.obj &
 	chase.obj &
 	cl_demo.obj &
 	cl_input.obj &
@@ -221,12 +223,14 @@ OBJS = strlcat.obj &
 	crc.obj &
 	cvar.obj &
 	cfgfile.obj &
+	bench.obj &
 	host.obj &
 	host_cmd.obj &
 	mathlib.obj &
 	pr_cmds.obj &
 	pr_edict.obj &
 	pr_exec.obj &
+	pr_prof.obj &
 	sv_main.obj &
 	sv_move.obj &
 	sv_phys.obj &
@@ -0,0 +1,512 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// bench.c -- dedicated server benchmark with scripted clients
+
+#include "quakedef.h"
+
+/*
+==============================================================================
+
+quake -bench [clients] [-benchticks <n>] [-benchseed <n>] [-benchload <ms>] [+map <name>]
+
+Runs a dedicated server (no video, sound or input) on the map from the
+command line, "start" if there is none, and connects the given number of
+clients to it from inside the process, 8 by default and at most
+MAX_SCOREBOARD. The clients go through the loopback driver, so what is
+measured is the server rather than the network stack. They answer the
+signon stages like a real client would, then run around at random: each
+one picks a direction, a turn rate, and whether to hold attack or jump
+every second or so. The same seed gives the same inputs.
+
+Once everyone has spawned, the server runs the given number of ticks
+back to back, each sys_ticrate of game time, and a report goes to stdout:
+percentiles of the wall time per tick, how it splits between reading
+client messages, physics, QC and sending, and the bytes each client got
+and sent, and how much of that the loopback driver copied (see
+net_loopcopy). Last, the map is changed to itself and the report says how
+long it took until everyone was back in the game. Then the program quits,
+so this can run on a build machine.
+
+With -benchload, the ticks run in real time instead, as a listen server
+runs them, while the main thread stands in for a renderer that takes the
+given time to draw each frame. This is done twice, with host_serverthread
+off and on, and the report is sys_tickstats for each: how regular the
+ticks were while the main thread was busy.
+
+Delta snapshots aren't requested, every client gets full updates.
+
+==============================================================================
+*/
+
+#define BENCH_TICKS			1000	// measured ticks by default
+#define BENCH_SPAWNTICKS	600		// ticks to wait for the clients to spawn
+
+typedef struct
+{
+	struct qsocket_s	*sock;
+	struct qsocket_s	*server;	// the server's end of sock
+	sizebuf_t	message;		// reliable commands not sent yet
+	byte		msgbuf[256];
+	int			signon;			// last stage answered, SIGNONS when in the game
+	qboolean	dropped;
+
+	vec3_t		angles;
+	float		turn;			// degrees per second
+	int			forward, side;
+	int			buttons;
+	int			changetime;		// ticks until the next random choice
+
+	double		bytesin;
+	double		bytesout;
+} benchclient_t;
+
+static benchclient_t	*bench_clients;
+static int				bench_numclients;
+static unsigned int		bench_seed;
+
+/*
+================
+Bench_Random
+
+Returns a random number in [0, 1)
+================
+*/
+static float Bench_Random (void)
+{
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 17;
+	bench_seed ^= bench_seed << 5;
+	return (bench_seed >> 8) * (1.f / (1 << 24));
+}
+
+/*
+================
+Bench_SignonReply
+
+Same answers as CL_SignonReply
+================
+*/
+static void Bench_SignonReply (benchclient_t *bc, int stage)
+{
+	switch (stage)
+	{
+	case 1:
+		MSG_WriteByte (&bc->message, clc_stringcmd);
+		MSG_WriteString (&bc->message, "prespawn");
+		break;
+
+	case 2:
+		MSG_WriteByte (&bc->message, clc_stringcmd);
+		MSG_WriteString (&bc->message, va ("name \"bot%i\"\n", (int)(bc - bench_clients)));
+
+		MSG_WriteByte (&bc->message, clc_stringcmd);
+		MSG_WriteString (&bc->message, va ("color %i %i\n", (int)(bc - bench_clients) % 14, (int)(bc - bench_clients) % 14));
+
+		MSG_WriteByte (&bc->message, clc_stringcmd);
+		MSG_WriteString (&bc->message, "spawn ");
+		break;
+
+	case 3:
+		MSG_WriteByte (&bc->message, clc_stringcmd);
+		MSG_WriteString (&bc->message, "begin");
+		stage = SIGNONS;
+		break;
+
+	default:
+		return;
+	}
+
+	bc->signon = stage;
+}
+
+/*
+================
+Bench_ServerWaiting
+
+Returns true when the server has sent everything for the signon stage and
+waits for the client's answer. The messages themselves aren't parsed, and
+the svc_signonnum ending a stage can be followed by anything the server
+adds to every client's message, like other clients' names, so this looks
+at the server's side of the connection instead. It has always read the
+client's last answer by the time this is called, in the next frame.
+================
+*/
+static qboolean Bench_ServerWaiting (benchclient_t *bc)
+{
+	client_t	*cl;
+	int			i;
+
+	for (i = 0, cl = svs.clients; i < svs.maxclients; i++, cl++)
+		if (cl->active && cl->netconnection == bc->server)
+			return !cl->spawned && !cl->sendsignon && !cl->signon && !cl->message.cursize;
+
+	return false;	// not connected yet
+}
+
+/*
+================
+Bench_ReadMessages
+
+Takes whatever the server sent, and answers the next signon stage once
+the server is done with the last one
+================
+*/
+static void Bench_ReadMessages (benchclient_t *bc)
+{
+	int		ret;
+
+	while ((ret = NET_GetMessage (bc->sock)) > 0)
+		bc->bytesin += net_message.cursize;
+
+	if (ret == -1)
+	{
+		Con_Printf ("bot%i lost the connection\n", (int)(bc - bench_clients));
+		bc->dropped = true;
+		return;
+	}
+
+	if (!bc->message.cursize && Bench_ServerWaiting (bc))
+	{
+		if (bc->signon == SIGNONS)
+			bc->signon = 0;		// the map changed, sign on again
+		Bench_SignonReply (bc, bc->signon + 1);
+	}
+}
+
+/*
+================
+Bench_SendMove
+
+Same message as CL_SendMove, the buttons are attack and jump
+================
+*/
+static void Bench_SendMove (benchclient_t *bc, float frametime)
+{
+	sizebuf_t	buf;
+	byte		data[128];
+	int			i;
+
+	if (--bc->changetime <= 0)
+	{
+		bc->turn = (Bench_Random () - 0.5f) * 360.f;
+		bc->forward = Bench_Random () < 0.8f ? 400 : -400;
+		bc->side = (int)(Bench_Random () * 3.f) * 350 - 350;
+		bc->buttons = (Bench_Random () < 0.3f ? 1 : 0) | (Bench_Random () < 0.1f ? 2 : 0);
+		bc->angles[PITCH] = (Bench_Random () - 0.5f) * 60.f;
+		bc->changetime = 10 + (int)(Bench_Random () * 30.f);
+	}
+	bc->angles[YAW] = anglemod (bc->angles[YAW] + bc->turn * frametime);
+
+	buf.maxsize = sizeof (data);
+	buf.cursize = 0;
+	buf.data = data;
+
+	MSG_WriteByte (&buf, clc_move);
+	MSG_WriteFloat (&buf, sv.time);
+	for (i = 0; i < 3; i++)
+		if (sv.protocol == PROTOCOL_NETQUAKE)
+			MSG_WriteAngle (&buf, bc->angles[i], sv.protocolflags);
+		else
+			MSG_WriteAngle16 (&buf, bc->angles[i], sv.protocolflags);
+	MSG_WriteShort (&buf, bc->forward);
+	MSG_WriteShort (&buf, bc->side);
+	MSG_WriteShort (&buf, 0);
+	MSG_WriteByte (&buf, bc->buttons);
+	MSG_WriteByte (&buf, 0);
+
+	if (NET_SendUnreliableMessage (bc->sock, &buf) == -1)
+		bc->dropped = true;
+	else
+		bc->bytesout += buf.cursize;
+}
+
+/*
+================
+Bench_RunClients
+
+Reads what the server sent each client last tick, and sends its reply
+================
+*/
+static void Bench_RunClients (float frametime)
+{
+	benchclient_t	*bc;
+	int				i;
+
+	for (i = 0, bc = bench_clients; i < bench_numclients; i++, bc++)
+	{
+		if (bc->dropped)
+			continue;
+
+		Bench_ReadMessages (bc);
+		if (bc->dropped)
+			continue;
+
+		if (bc->message.cursize && NET_CanSendMessage (bc->sock))
+		{
+			if (NET_SendMessage (bc->sock, &bc->message) == -1)
+			{
+				bc->dropped = true;
+				continue;
+			}
+			bc->bytesout += bc->message.cursize;
+			SZ_Clear (&bc->message);
+		}
+
+		if (bc->signon == SIGNONS)
+			Bench_SendMove (bc, frametime);
+	}
+}
+
+/*
+================
+Bench_Spawned
+
+Returns the number of clients the server has put in the game
+================
+*/
+static int Bench_Spawned (void)
+{
+	int		i, count;
+
+	for (i = 0, count = 0; i < svs.maxclients; i++)
+		if (svs.clients[i].active && svs.clients[i].spawned)
+			count++;
+
+	return count;
+}
+
+/*
+================
+Bench_SortTimes
+================
+*/
+static int Bench_SortTimes (const void *a, const void *b)
+{
+	double	t1 = *(const double *)a, t2 = *(const double *)b;
+
+	return (t1 > t2) - (t1 < t2);
+}
+
+/*
+================
+Bench_Draw
+
+Stands in for drawing a frame: busy for ms outside host_svlock, looking up
+every alias model in the cache like R_DrawAliasModel does
+================
+*/
+static void Bench_Draw (double ms)
+{
+	double	end;
+	int		i;
+
+	end = Sys_DoubleTime () + ms / 1000.0;
+	do
+	{
+		for (i = 1; i < MAX_MODELS && sv.models[i]; i++)
+			if (sv.models[i]->type == mod_alias)
+				Mod_Extradata (sv.models[i]);
+	} while (Sys_DoubleTime () < end);
+}
+
+/*
+================
+Bench_RunLoaded
+
+Runs the game for the given wall time the way a listen server's main loop
+does, with each frame taking ms to draw, and reports sys_tickstats
+================
+*/
+static void Bench_RunLoaded (double seconds, double ms, qboolean threaded)
+{
+	double	oldtime, newtime, end;
+
+	Cvar_Set ("host_serverthread", threaded ? "1" : "0");
+	if (threaded && !Host_ServerThreaded ())
+	{
+		Con_Printf ("server thread on: not available\n");
+		return;
+	}
+
+	Con_Printf ("server thread %s:\n", threaded ? "on" : "off");
+	Host_ResetTickStats ();
+	oldtime = Sys_DoubleTime ();
+	end = oldtime + seconds;
+	while ((newtime = Sys_DoubleTime ()) < end)
+	{
+		// the clients are where the client code would be, inside the lock
+		Host_LockServer ();
+		Bench_RunClients (newtime - oldtime);
+		Host_UnlockServer ();
+
+		Host_Frame (newtime - oldtime);
+		oldtime = newtime;
+		Bench_Draw (ms);
+	}
+	Cmd_ExecuteString ("sys_tickstats", src_command);
+
+	Cvar_Set ("host_serverthread", "0");
+}
+
+/*
+================
+Bench_Run
+
+Runs the benchmark and quits
+================
+*/
+void Bench_Run (void)
+{
+	double		*times;
+	double		frametime, start, read, physics, send, qc, total, in, out;
+	double		load;
+	int			i, ticks, spawned, alive;
+	char		mapname[MAX_QPATH];
+
+	i = COM_CheckParm ("-benchticks");
+	ticks = (i && i < com_argc - 1) ? Q_atoi (com_argv[i + 1]) : BENCH_TICKS;
+	ticks = CLAMP (1, ticks, 1000000);
+	i = COM_CheckParm ("-benchseed");
+	bench_seed = (i && i < com_argc - 1) ? (unsigned int) Q_atoi (com_argv[i + 1]) : 1;
+	if (!bench_seed)
+		bench_seed = 1;
+	i = COM_CheckParm ("-benchload");
+	load = (i && i < com_argc - 1) ? CLAMP (0.0, Q_atof (com_argv[i + 1]), 1000.0) : -1.0;
+	frametime = sys_ticrate.value > 0.f ? sys_ticrate.value : 0.05;
+
+// let the command line start a map
+	Host_Frame (frametime);
+	if (!sv.active)
+	{
+		Cbuf_AddText ("map start\n");
+		Host_Frame (frametime);
+	}
+	if (!sv.active)
+		Sys_Error ("Bench_Run: no map running");
+
+	bench_numclients = svs.maxclients;
+	bench_clients = (benchclient_t *) calloc (bench_numclients, sizeof (benchclient_t));
+	times = (double *) malloc (ticks * sizeof (double));
+	if (!bench_clients || !times)
+		Sys_Error ("Bench_Run: out of memory");
+
+	for (i = 0; i < bench_numclients; i++)
+	{
+		bench_clients[i].sock = NET_ConnectBot (&bench_clients[i].server);
+		if (!bench_clients[i].sock)
+			Sys_Error ("Bench_Run: couldn't connect client %i", i);
+		bench_clients[i].message.data = bench_clients[i].msgbuf;
+		bench_clients[i].message.maxsize = sizeof (bench_clients[i].msgbuf);
+	}
+
+// wait for everyone to get in the game
+	for (i = 0; i < BENCH_SPAWNTICKS; i++)
+	{
+		Bench_RunClients (frametime);
+		Host_Frame (frametime);
+		spawned = Bench_Spawned ();
+		if (spawned == bench_numclients)
+			break;
+	}
+	if (i == BENCH_SPAWNTICKS)
+		Sys_Error ("Bench_Run: only %i of %i clients spawned", Bench_Spawned (), bench_numclients);
+
+	Con_Printf ("bench: %i clients on %s, %i ticks of %.1f ms\n", bench_numclients, sv.name, ticks, frametime * 1000.0);
+
+	if (load >= 0)
+	{
+		Con_Printf ("in real time, drawing a frame takes %.1f ms\n", load);
+		Bench_RunLoaded (ticks * frametime, load, false);
+		Bench_RunLoaded (ticks * frametime, load, true);
+		free (times);
+		Sys_Quit ();
+	}
+
+	for (i = 0; i < bench_numclients; i++)
+		bench_clients[i].bytesin = bench_clients[i].bytesout = 0.0;
+	read = physics = send = 0.0;
+	net_loopcopied = 0.0;
+	pr_exectime = 0.0;
+	pr_timing = true;
+
+	for (i = 0; i < ticks; i++)
+	{
+		Bench_RunClients (frametime);
+
+		memset (&sv_frametimes, 0, sizeof (sv_frametimes));
+		start = Sys_DoubleTime ();
+		Host_Frame (frametime);
+		times[i] = Sys_DoubleTime () - start;
+
+		read += sv_frametimes.read;
+		physics += sv_frametimes.physics;
+		send += sv_frametimes.send;
+	}
+
+	pr_timing = false;
+	qc = pr_exectime;
+
+	for (i = 0, total = 0.0; i < ticks; i++)
+		total += times[i];
+	for (i = 0, in = out = 0.0, alive = 0; i < bench_numclients; i++)
+	{
+		in += bench_clients[i].bytesin;
+		out += bench_clients[i].bytesout;
+		if (!bench_clients[i].dropped)
+			alive++;
+	}
+	qsort (times, ticks, sizeof (times[0]), Bench_SortTimes);
+
+	Con_Printf ("tick ms: mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+		total / ticks * 1000.0, times[ticks / 2] * 1000.0, times[ticks * 9 / 10] * 1000.0,
+		times[ticks * 99 / 100] * 1000.0, times[ticks - 1] * 1000.0);
+	Con_Printf ("ms per tick: read %.3f, physics %.3f, send %.3f, other %.3f; qc %.3f of it\n",
+		read / ticks * 1000.0, physics / ticks * 1000.0, send / ticks * 1000.0,
+		(total - read - physics - send) / ticks * 1000.0, qc / ticks * 1000.0);
+	Con_Printf ("bytes per client: %.0f down, %.0f up per tick; %.0f down, %.0f up per second\n",
+		in / bench_numclients / ticks, out / bench_numclients / ticks,
+		in / bench_numclients / (ticks * frametime), out / bench_numclients / (ticks * frametime));
+	Con_Printf ("loopback copies: %.0f bytes per tick\n", net_loopcopied / ticks);
+	if (alive < bench_numclients)
+		Con_Printf ("%i clients were dropped\n", bench_numclients - alive);
+
+// change to the same map and wait for everyone to get back in
+	q_strlcpy (mapname, sv.name, sizeof (mapname));
+	start = Sys_DoubleTime ();
+	Cbuf_AddText (va ("changelevel %s\n", mapname));
+	Host_Frame (frametime);
+	for (i = 1; i < BENCH_SPAWNTICKS; i++)
+	{
+		spawned = Bench_Spawned ();
+		if (spawned >= alive)
+			break;
+		Bench_RunClients (frametime);
+		Host_Frame (frametime);
+	}
+	total = Sys_DoubleTime () - start;
+	if (spawned >= alive)
+		Con_Printf ("changelevel: all %i clients back in after %i ticks, %.1f ms\n", alive, i, total * 1000.0);
+	else
+		Con_Printf ("changelevel: only %i of %i clients back in after %i ticks\n", spawned, alive, i);
+
+	free (times);
+	Sys_Quit ();
+}
@@ -105,7 +105,11 @@ static int CL_GetDemoMessage (void)
 		// if this is the second frame, grab the real td_starttime
 		// so the bogus time on the first frame doesn't count
 			if (host_framecount == cls.td_startframe + 1)
+			{
 				cls.td_starttime = realtime;
+				cls.td_startmtime = cl.mtime[0];
+				cls.td_bytes = 0;
+			}
 		}
 		else if (/* cl.time > 0 && */ cl.time <= cl.mtime[0])
 		{
@@ -133,6 +137,8 @@ static int CL_GetDemoMessage (void)
 		CL_StopPlayback ();
 		return 0;
 	}
+	if (cls.timedemo)
+		cls.td_bytes += net_message.cursize;
 
 	return 1;
 }
@@ -373,6 +379,10 @@ void CL_Record_f (void)
 		// restore net_message
 		net_message.data = data;
 		net_message.cursize = cursize;
+
+		// the demo doesn't have the frames snapshots are deltas from,
+		// so ask for one from the baselines
+		cl.snapshot_ack = 0;
 	}
 }
 
@@ -446,6 +456,7 @@ static void CL_FinishTimeDemo (void)
 {
 	int	frames;
 	float	time;
+	double	gametime;
 
 	cls.timedemo = false;
 
@@ -455,6 +466,11 @@ static void CL_FinishTimeDemo (void)
 	if (!time)
 		time = 1;
 	Con_Printf ("%i frames %5.1f seconds %5.1f fps\n", frames, time, frames/time);
+
+// what the server sent, per second of game time
+	gametime = cl.mtime[0] - cls.td_startmtime;
+	if (gametime > 0)
+		Con_Printf ("%i bytes in %5.1f game seconds, %.0f bytes/s\n", cls.td_bytes, gametime, cls.td_bytes / gametime);
 }
 
 /*
@@ -419,6 +419,12 @@ void CL_SendMove (const usercmd_t *cmd)
 		in_impulse = 0;
 	}
 
+	if (cl.snapshots)
+	{
+		MSG_WriteByte (&buf, clc_ackframe);
+		MSG_WriteLong (&buf, cl.snapshot_ack);
+	}
+
 //
 // deliver the message
 //
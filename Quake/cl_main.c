@@ -33,6 +33,7 @@ cvar_t	cl_color = {"_cl_color", "0", CVAR_ARCHIVE};
 
 cvar_t	cl_shownet = {"cl_shownet","0",CVAR_NONE};	// can be 0, 1, or 2
 cvar_t	cl_nolerp = {"cl_nolerp","0",CVAR_NONE};
+cvar_t	cl_deltasnapshots = {"cl_deltasnapshots","1",CVAR_ARCHIVE};
 
 cvar_t	cfg_unbindall = {"cfg_unbindall", "1", CVAR_ARCHIVE};
 
@@ -91,6 +92,7 @@ void CL_ClearState (void)
 	memset (cl_lightstyle, 0, sizeof(cl_lightstyle));
 	memset (cl_temp_entities, 0, sizeof(cl_temp_entities));
 	memset (cl_beams, 0, sizeof(cl_beams));
+	CL_ClearSnapshots ();
 
 	//johnfitz -- cl_entities is now dynamically allocated
 	cl_max_edicts = CLAMP (MIN_EDICTS,(int)max_edicts.value,MAX_EDICTS);
@@ -198,6 +200,12 @@ void CL_SignonReply (void)
 	switch (cls.signon)
 	{
 	case 1:
+		// servers that don't know about snapshots ignore this
+		if (cl_deltasnapshots.value && cl.protocol != PROTOCOL_NETQUAKE)
+		{
+			MSG_WriteByte (&cls.message, clc_stringcmd);
+			MSG_WriteString (&cls.message, va("snapshots %i", SNAPSHOT_VERSION));
+		}
 		MSG_WriteByte (&cls.message, clc_stringcmd);
 		MSG_WriteString (&cls.message, "prespawn");
 		break;
@@ -878,6 +886,7 @@ void CL_Init (void)
 	Cvar_RegisterVariable (&cl_pitchspeed);
 	Cvar_RegisterVariable (&cl_anglespeedkey);
 	Cvar_RegisterVariable (&cl_shownet);
+	Cvar_RegisterVariable (&cl_deltasnapshots);
 	Cvar_RegisterVariable (&cl_nolerp);
 	Cvar_RegisterVariable (&freelook);
 	Cvar_RegisterVariable (&lookspring);
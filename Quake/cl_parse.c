@@ -95,7 +95,8 @@ const char *svc_strings[] =
 	"svc_chat", // 53
 	"svc_levelcompleted", // 54
 	"svc_backtolobby", // 55
-	"svc_localsound" // 56
+	"svc_localsound", // 56
+	"svc_snapshot" // 57
 };
 #define	NUM_SVC_STRINGS	(sizeof(svc_strings) / sizeof(svc_strings[0]))
 
@@ -439,49 +440,117 @@ void CL_ParseServerInfo (void)
 
 /*
 ==================
-CL_ParseUpdate
+CL_ReadEntityDelta
 
-Parse an entity update message from the server
-If an entities model or origin changes from frame to frame, it must be
-relinked.  Other attributes can change without relinking.
+Reads the fields of an entity update that are in bits into to, the others
+are the same as in from
 ==================
 */
-void CL_ParseUpdate (int bits)
+static void CL_ReadEntityDelta (int bits, const snapentity_t *from, snapentity_t *to)
 {
 	int		i;
-	qmodel_t	*model;
 	int		modnum;
-	qboolean	forcelink;
-	entity_t	*ent;
-	int		num;
-	int		skin;
 
-	if (cls.signon == SIGNONS - 1)
-	{	// first update is the final signon stage
-		cls.signon = SIGNONS;
-		CL_SignonReply ();
+	*to = *from;
+
+	if (bits & U_MODEL)
+	{
+		modnum = MSG_ReadByte ();
+		if (modnum >= MAX_MODELS)
+			Host_Error ("CL_ParseModel: bad modnum");
+		to->state.modelindex = modnum;
 	}
 
-	if (bits & U_MOREBITS)
+	if (bits & U_FRAME)
+		to->state.frame = MSG_ReadByte ();
+
+	if (bits & U_COLORMAP)
+		to->state.colormap = MSG_ReadByte();
+	if (bits & U_SKIN)
+		to->state.skin = MSG_ReadByte();
+	if (bits & U_EFFECTS)
+		to->state.effects = MSG_ReadByte();
+
+	for (i=0 ; i<3 ; i++)
 	{
-		i = MSG_ReadByte ();
-		bits |= (i<<8);
+		if (bits & (U_ORIGIN1<<i))
+			to->state.origin[i] = MSG_ReadCoord (cl.protocolflags);
+		if (bits & (i == 0 ? U_ANGLE1 : i == 1 ? U_ANGLE2 : U_ANGLE3))
+			to->state.angles[i] = MSG_ReadAngle (cl.protocolflags);
 	}
 
-	//johnfitz -- PROTOCOL_FITZQUAKE
+	to->flags = bits & U_STEP;
+	to->lerpfinish = 0;
+
+	//johnfitz -- PROTOCOL_FITZQUAKE and PROTOCOL_NEHAHRA
 	if (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ)
 	{
-		if (bits & U_EXTEND1)
-			bits |= MSG_ReadByte() << 16;
-		if (bits & U_EXTEND2)
-			bits |= MSG_ReadByte() << 24;
+		if (bits & U_ALPHA)
+			to->state.alpha = MSG_ReadByte();
+		if (bits & U_SCALE)
+			MSG_ReadByte(); // PROTOCOL_RMQ: currently ignored
+		if (bits & U_FRAME2)
+			to->state.frame = (to->state.frame & 0x00FF) | (MSG_ReadByte() << 8);
+		if (bits & U_MODEL2)
+			to->state.modelindex = (to->state.modelindex & 0x00FF) | (MSG_ReadByte() << 8);
+		if (bits & U_LERPFINISH)
+		{
+			to->lerpfinish = MSG_ReadByte();
+			to->flags |= U_LERPFINISH;
+		}
+	}
+	else if (cl.protocol == PROTOCOL_NETQUAKE)
+	{
+		//HACK: if this bit is set, assume this is PROTOCOL_NEHAHRA
+		if (bits & U_TRANS)
+		{
+			float a, b;
+
+			if (warn_about_nehahra_protocol)
+			{
+				Con_Warning ("nonstandard update bit, assuming Nehahra protocol\n");
+				warn_about_nehahra_protocol = false;
+			}
+
+			a = MSG_ReadFloat();
+			b = MSG_ReadFloat(); //alpha
+			if (a == 2)
+				MSG_ReadFloat(); //fullbright (not using this yet)
+			to->state.alpha = ENTALPHA_ENCODE(b);
+		}
 	}
 	//johnfitz
+}
 
-	if (bits & U_LONGENTITY)
-		num = MSG_ReadShort ();
-	else
-		num = MSG_ReadByte ();
+/*
+==================
+CL_EntityState
+
+An update with no fields in it, for deltas from the baseline
+==================
+*/
+static void CL_EntityState (int num, snapentity_t *s)
+{
+	s->num = num;
+	s->flags = 0;
+	s->lerpfinish = 0;
+	s->state = CL_EntityNum (num)->baseline;
+}
+
+/*
+==================
+CL_SetEntityState
+
+If an entities model or origin changes from frame to frame, it must be
+relinked.  Other attributes can change without relinking.
+==================
+*/
+static void CL_SetEntityState (const snapentity_t *s)
+{
+	qmodel_t	*model;
+	qboolean	forcelink;
+	entity_t	*ent;
+	int			num = s->num;
 
 	ent = CL_EntityNum (num);
 
@@ -497,80 +566,32 @@ void CL_ParseUpdate (int bits)
 
 	ent->msgtime = cl.mtime[0];
 
-	if (bits & U_MODEL)
-	{
-		modnum = MSG_ReadByte ();
-		if (modnum >= MAX_MODELS)
-			Host_Error ("CL_ParseModel: bad modnum");
-	}
-	else
-		modnum = ent->baseline.modelindex;
+	ent->frame = s->state.frame;
 
-	if (bits & U_FRAME)
-		ent->frame = MSG_ReadByte ();
-	else
-		ent->frame = ent->baseline.frame;
-
-	if (bits & U_COLORMAP)
-		i = MSG_ReadByte();
-	else
-		i = ent->baseline.colormap;
-	if (!i)
+	if (!s->state.colormap)
 		ent->colormap = vid.colormap;
 	else
 	{
-		if (i > cl.maxclients)
+		if (s->state.colormap > cl.maxclients)
 			Sys_Error ("i >= cl.maxclients");
-		ent->colormap = cl.scores[i-1].translations;
+		ent->colormap = cl.scores[s->state.colormap-1].translations;
 	}
-	if (bits & U_SKIN)
-		skin = MSG_ReadByte();
-	else
-		skin = ent->baseline.skin;
-	if (skin != ent->skinnum)
+	if (s->state.skin != ent->skinnum)
 	{
-		ent->skinnum = skin;
+		ent->skinnum = s->state.skin;
 		if (num > 0 && num <= cl.maxclients)
 			R_TranslateNewPlayerSkin (num - 1); //johnfitz -- was R_TranslatePlayerSkin
 	}
-	if (bits & U_EFFECTS)
-		ent->effects = MSG_ReadByte();
-	else
-		ent->effects = ent->baseline.effects;
+	ent->effects = s->state.effects;
 
 // shift the known values for interpolation
 	VectorCopy (ent->msg_origins[0], ent->msg_origins[1]);
 	VectorCopy (ent->msg_angles[0], ent->msg_angles[1]);
-
-	if (bits & U_ORIGIN1)
-		ent->msg_origins[0][0] = MSG_ReadCoord (cl.protocolflags);
-	else
-		ent->msg_origins[0][0] = ent->baseline.origin[0];
-	if (bits & U_ANGLE1)
-		ent->msg_angles[0][0] = MSG_ReadAngle(cl.protocolflags);
-	else
-		ent->msg_angles[0][0] = ent->baseline.angles[0];
-
-	if (bits & U_ORIGIN2)
-		ent->msg_origins[0][1] = MSG_ReadCoord (cl.protocolflags);
-	else
-		ent->msg_origins[0][1] = ent->baseline.origin[1];
-	if (bits & U_ANGLE2)
-		ent->msg_angles[0][1] = MSG_ReadAngle(cl.protocolflags);
-	else
-		ent->msg_angles[0][1] = ent->baseline.angles[1];
-
-	if (bits & U_ORIGIN3)
-		ent->msg_origins[0][2] = MSG_ReadCoord (cl.protocolflags);
-	else
-		ent->msg_origins[0][2] = ent->baseline.origin[2];
-	if (bits & U_ANGLE3)
-		ent->msg_angles[0][2] = MSG_ReadAngle(cl.protocolflags);
-	else
-		ent->msg_angles[0][2] = ent->baseline.angles[2];
+	VectorCopy (s->state.origin, ent->msg_origins[0]);
+	VectorCopy (s->state.angles, ent->msg_angles[0]);
 
 	//johnfitz -- lerping for movetype_step entities
-	if (bits & U_STEP)
+	if (s->flags & U_STEP)
 	{
 		ent->lerpflags |= LERP_MOVESTEP;
 		ent->forcelink = true;
@@ -579,53 +600,20 @@ void CL_ParseUpdate (int bits)
 		ent->lerpflags &= ~LERP_MOVESTEP;
 	//johnfitz
 
-	//johnfitz -- PROTOCOL_FITZQUAKE and PROTOCOL_NEHAHRA
+	ent->alpha = s->state.alpha;
 	if (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ)
 	{
-		if (bits & U_ALPHA)
-			ent->alpha = MSG_ReadByte();
-		else
-			ent->alpha = ent->baseline.alpha;
-		if (bits & U_SCALE)
-			MSG_ReadByte(); // PROTOCOL_RMQ: currently ignored
-		if (bits & U_FRAME2)
-			ent->frame = (ent->frame & 0x00FF) | (MSG_ReadByte() << 8);
-		if (bits & U_MODEL2)
-			modnum = (modnum & 0x00FF) | (MSG_ReadByte() << 8);
-		if (bits & U_LERPFINISH)
+		if (s->flags & U_LERPFINISH)
 		{
-			ent->lerpfinish = ent->msgtime + ((float)(MSG_ReadByte()) / 255);
+			ent->lerpfinish = ent->msgtime + ((float)(s->lerpfinish) / 255);
 			ent->lerpflags |= LERP_FINISH;
 		}
 		else
 			ent->lerpflags &= ~LERP_FINISH;
 	}
-	else if (cl.protocol == PROTOCOL_NETQUAKE)
-	{
-		//HACK: if this bit is set, assume this is PROTOCOL_NEHAHRA
-		if (bits & U_TRANS)
-		{
-			float a, b;
-
-			if (warn_about_nehahra_protocol)
-			{
-				Con_Warning ("nonstandard update bit, assuming Nehahra protocol\n");
-				warn_about_nehahra_protocol = false;
-			}
-
-			a = MSG_ReadFloat();
-			b = MSG_ReadFloat(); //alpha
-			if (a == 2)
-				MSG_ReadFloat(); //fullbright (not using this yet)
-			ent->alpha = ENTALPHA_ENCODE(b);
-		}
-		else
-			ent->alpha = ent->baseline.alpha;
-	}
-	//johnfitz
 
 	//johnfitz -- moved here from above
-	model = cl.model_precache[modnum];
+	model = cl.model_precache[s->state.modelindex];
 	if (model != ent->model)
 	{
 		ent->model = model;
@@ -657,6 +645,180 @@ void CL_ParseUpdate (int bits)
 	}
 }
 
+/*
+==================
+CL_ParseUpdate
+
+Parse an entity update message from the server
+==================
+*/
+void CL_ParseUpdate (int bits)
+{
+	int				i;
+	int				num;
+	snapentity_t	base, s;
+
+	if (cls.signon == SIGNONS - 1)
+	{	// first update is the final signon stage
+		cls.signon = SIGNONS;
+		CL_SignonReply ();
+	}
+
+	if (bits & U_MOREBITS)
+	{
+		i = MSG_ReadByte ();
+		bits |= (i<<8);
+	}
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ)
+	{
+		if (bits & U_EXTEND1)
+			bits |= MSG_ReadByte() << 16;
+		if (bits & U_EXTEND2)
+			bits |= MSG_ReadByte() << 24;
+	}
+	//johnfitz
+
+	if (bits & U_LONGENTITY)
+		num = MSG_ReadShort ();
+	else
+		num = MSG_ReadByte ();
+
+	CL_EntityState (num, &base);
+	CL_ReadEntityDelta (bits, &base, &s);
+	CL_SetEntityState (&s);
+}
+
+/*
+==============================================================================
+
+DELTA SNAPSHOTS
+
+==============================================================================
+*/
+
+static snapframe_t	cl_snapshots[SNAPSHOT_BACKUP];
+
+/*
+==================
+CL_ClearSnapshots
+==================
+*/
+void CL_ClearSnapshots (void)
+{
+	int		i;
+
+	for (i = 0; i < SNAPSHOT_BACKUP; i++)
+		cl_snapshots[i].sequence = 0;
+}
+
+/*
+==================
+CL_AddSnapshotEntity
+==================
+*/
+static snapentity_t *CL_AddSnapshotEntity (snapframe_t *frame)
+{
+	if (frame->numentities == frame->maxentities)
+	{
+		frame->maxentities = q_max (64, frame->maxentities * 2);
+		frame->entities = (snapentity_t *) realloc (frame->entities, frame->maxentities * sizeof(snapentity_t));
+		if (!frame->entities)
+			Sys_Error ("CL_AddSnapshotEntity: out of memory");
+	}
+	return &frame->entities[frame->numentities++];
+}
+
+/*
+==================
+CL_ParseSnapshot
+
+Entities that aren't mentioned are the same as in the frame the snapshot
+is a delta from. If that frame is gone, the snapshot is read but not used,
+and the next acknowledgement asks for one from the baselines.
+==================
+*/
+static void CL_ParseSnapshot (void)
+{
+	snapframe_t		*from, *to;
+	snapentity_t	base, *old;
+	int				sequence, delta, word, num, bits;
+	int				i, r, numref;
+
+	if (cls.signon == SIGNONS - 1)
+	{	// first update is the final signon stage
+		cls.signon = SIGNONS;
+		CL_SignonReply ();
+	}
+
+	sequence = MSG_ReadLong ();
+	delta = MSG_ReadLong ();
+	if (sequence <= 0)
+		Host_Error ("CL_ParseSnapshot: bad sequence %i", sequence);
+
+	from = NULL;
+	if (delta > 0 && delta < sequence && sequence - delta < SNAPSHOT_BACKUP &&
+		cl_snapshots[delta & SNAPSHOT_MASK].sequence == delta)
+		from = &cl_snapshots[delta & SNAPSHOT_MASK];
+	numref = from ? from->numentities : 0;
+
+	to = &cl_snapshots[sequence & SNAPSHOT_MASK];
+	to->sequence = 0;
+	to->numentities = 0;
+
+	r = 0;
+	while (1)
+	{
+		word = (unsigned short) MSG_ReadShort ();
+		if (msg_badread)
+			Host_Error ("CL_ParseSnapshot: Bad server message");
+		if (!word)
+			break;
+		num = word & ~SNAP_REMOVE;
+
+		// the entities before this one haven't changed
+		for ( ; r < numref && from->entities[r].num < num; r++)
+			*CL_AddSnapshotEntity (to) = from->entities[r];
+
+		if (r < numref && from->entities[r].num == num)
+			old = &from->entities[r++];
+		else
+		{
+			CL_EntityState (num, &base);
+			old = &base;
+		}
+
+		if (word & SNAP_REMOVE)
+			continue;
+
+		bits = MSG_ReadByte ();
+		if (bits & U_MOREBITS)
+			bits |= MSG_ReadByte () << 8;
+		if (bits & U_EXTEND1)
+			bits |= MSG_ReadByte () << 16;
+		if (bits & U_EXTEND2)
+			bits |= MSG_ReadByte () << 24;
+
+		CL_ReadEntityDelta (bits, old, CL_AddSnapshotEntity (to));
+	}
+	for ( ; r < numref; r++)
+		*CL_AddSnapshotEntity (to) = from->entities[r];
+
+	cl.snapshots = true;
+	if (delta && !from)
+	{
+		Con_DPrintf ("snapshot %i: frame %i is gone\n", sequence, delta);
+		cl.snapshot_ack = 0;
+		return;
+	}
+
+	to->sequence = sequence;
+	cl.snapshot_ack = sequence;
+	for (i = 0; i < to->numentities; i++)
+		CL_SetEntityState (&to->entities[i]);
+}
+
 /*
 ==================
 CL_ParseBaseline
@@ -1062,6 +1224,10 @@ void CL_ParseServerMessage (void)
 			cl.mtime[0] = MSG_ReadFloat ();
 			break;
 
+		case svc_snapshot:
+			CL_ParseSnapshot ();
+			break;
+
 		case svc_clientdata:
 			CL_ParseClientdata (); //johnfitz -- removed bits parameter, we will read this inside CL_ParseClientdata()
 			break;
@@ -126,6 +126,8 @@ typedef struct
 	int		td_lastframe;		// to meter out one message a frame
 	int		td_startframe;		// host_framecount at start
 	float		td_starttime;		// realtime at second frame of timedemo
+	double		td_startmtime;		// cl.mtime[0] at second frame of timedemo
+	int		td_bytes;		// server messages read since then
 
 // connection information
 	int		signon;			// 0 to SIGNONS
@@ -228,6 +230,10 @@ typedef struct
 
 	unsigned	protocol; //johnfitz
 	unsigned	protocolflags;
+
+// delta snapshots
+	qboolean	snapshots;			// the server sends svc_snapshot, acknowledge them
+	int			snapshot_ack;		// last good sequence, 0 to ask for one from the baselines
 } client_state_t;
 
 
@@ -254,6 +260,7 @@ extern	cvar_t	cl_alwaysrun; // QuakeSpasm
 extern	cvar_t	cl_autofire;
 
 extern	cvar_t	cl_shownet;
+extern	cvar_t	cl_deltasnapshots;
 extern	cvar_t	cl_nolerp;
 
 extern	cvar_t	cfg_unbindall;
@@ -349,6 +356,7 @@ void CL_TimeDemo_f (void);
 //
 void CL_ParseServerMessage (void);
 void CL_NewTranslation (int slot);
+void CL_ClearSnapshots (void);
 
 //
 // view
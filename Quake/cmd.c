@@ -492,6 +492,9 @@ typedef struct cmd_function_s
 
 static	int			cmd_argc;
 static	char		*cmd_argv[MAX_ARGS];
+// where cmd_argv points, not the zone: client commands are tokenized on
+// the server thread with host_serverthread
+static	char		cmd_tokens[MAX_ARGS * sizeof(com_token)];
 static	char		cmd_null_string[] = "";
 static	const char	*cmd_args = NULL;
 
@@ -681,14 +684,13 @@ Parses the given string into command line tokens.
 */
 void Cmd_TokenizeString (const char *text)
 {
-	int		i;
+	char	*token;
+	size_t	len;
 
 // clear the args from the last string
-	for (i=0 ; i<cmd_argc ; i++)
-		Z_Free (cmd_argv[i]);
-
 	cmd_argc = 0;
 	cmd_args = NULL;
+	token = cmd_tokens;
 
 	while (1)
 	{
@@ -716,7 +718,10 @@ void Cmd_TokenizeString (const char *text)
 
 		if (cmd_argc < MAX_ARGS)
 		{
-			cmd_argv[cmd_argc] = Z_Strdup (com_token);
+			len = strlen (com_token) + 1;
+			memcpy (token, com_token, len);
+			cmd_argv[cmd_argc] = token;
+			token += len;
 			cmd_argc++;
 		}
 	}
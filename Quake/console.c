@@ -487,6 +487,36 @@ Handles cursor positioning, line wrapping, etc
 ================
 */
 #define	MAXPRINTMSG	4096
+
+// what the server thread printed, see Con_FlushDeferred; kept off the zone
+static char		*con_deferred;
+static size_t	con_deferredlen, con_deferredsize;
+
+/*
+================
+Con_Defer
+================
+*/
+static void Con_Defer (const char *msg)
+{
+	size_t	len, size;
+	char	*buf;
+
+	len = strlen (msg);
+	if (con_deferredlen + len + 1 > con_deferredsize)
+	{
+		size = q_max (con_deferredsize * 2, con_deferredlen + len + 1);
+		size = q_max (size, MAXPRINTMSG);
+		buf = (char *) realloc (con_deferred, size);
+		if (!buf)
+			return;
+		con_deferred = buf;
+		con_deferredsize = size;
+	}
+	memcpy (con_deferred + con_deferredlen, msg, len + 1);
+	con_deferredlen += len;
+}
+
 void Con_Printf (const char *fmt, ...)
 {
 	va_list		argptr;
@@ -510,6 +540,13 @@ void Con_Printf (const char *fmt, ...)
 	if (cls.state == ca_dedicated)
 		return;		// no graphics mode
 
+// the main thread might be drawing the console right now
+	if (Host_OnServerThread ())
+	{
+		Con_Defer (msg);
+		return;
+	}
+
 // write it to the scrollable buffer
 	Con_Print (msg);
 
@@ -527,6 +564,23 @@ void Con_Printf (const char *fmt, ...)
 	}
 }
 
+/*
+================
+Con_FlushDeferred
+
+Prints what the server thread had to leave for the main thread
+================
+*/
+void Con_FlushDeferred (void)
+{
+	if (!con_deferredlen)
+		return;
+
+	Con_Print (con_deferred);
+	con_deferredlen = 0;
+	con_deferred[0] = 0;
+}
+
 /*
 ================
 Con_DWarning -- ericw
@@ -631,6 +685,12 @@ void Con_SafePrintf (const char *fmt, ...)
 	q_vsnprintf (msg, sizeof(msg), fmt, argptr);
 	va_end (argptr);
 
+	if (Host_OnServerThread ())
+	{
+		Con_Printf ("%s", msg);	// never updates the screen
+		return;
+	}
+
 	temp = scr_disabled_for_loading;
 	scr_disabled_for_loading = true;
 	Con_Printf ("%s", msg);
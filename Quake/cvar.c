@@ -26,6 +26,17 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 static cvar_t	*cvar_vars;
 static char	cvar_null_string[] = "";
 
+typedef struct cvarset_s
+{
+	struct cvarset_s	*next;
+	cvar_t				*var;
+	char				value[1];	// allocated to fit
+} cvarset_t;
+
+// sets from the server thread, see Cvar_RunDeferredSets; not zone memory,
+// the zone allocator isn't thread safe
+static cvarset_t	*cvar_sets, **cvar_setstail = &cvar_sets;
+
 //==============================================================================
 //
 //  USER COMMANDS
@@ -323,7 +334,7 @@ float	Cvar_VariableValue (const char *var_name)
 	var = Cvar_FindVar (var_name);
 	if (!var)
 		return 0;
-	return Q_atof (var->string);
+	return var->value;	// already set while the string waits, see Cvar_DeferSet
 }
 
 
@@ -335,11 +346,20 @@ Cvar_VariableString
 const char *Cvar_VariableString (const char *var_name)
 {
 	cvar_t *var;
+	cvarset_t *set;
+	const char *pending;
 
 	var = Cvar_FindVar (var_name);
 	if (!var)
 		return cvar_null_string;
-	return var->string;
+
+	// a set the server thread is still waiting on
+	pending = NULL;
+	if (Host_OnServerThread ())
+		for (set = cvar_sets; set; set = set->next)
+			if (set->var == var)
+				pending = set->value;
+	return pending ? pending : var->string;
 }
 
 
@@ -383,13 +403,13 @@ void Cvar_Reset (const char *name)
 		Cvar_SetQuick (var, var->default_string);
 }
 
-void Cvar_SetQuick (cvar_t *var, const char *value)
+/*
+============
+Cvar_Apply
+============
+*/
+static void Cvar_Apply (cvar_t *var, const char *value)
 {
-	if (var->flags & (CVAR_ROM|CVAR_LOCKED))
-		return;
-	if (!(var->flags & CVAR_REGISTERED))
-		return;
-
 	if (!var->string)
 		var->string = Z_Strdup (value);
 	else
@@ -428,6 +448,71 @@ void Cvar_SetQuick (cvar_t *var, const char *value)
 		var->callback (var);
 }
 
+/*
+============
+Cvar_DeferSet
+
+The server thread can't touch the zone, so the new string and the callback
+wait for the main thread. The value changes right away, so QC and the
+server code reading it see the set at once; Cvar_VariableString looks in
+the queue for the string.
+============
+*/
+static void Cvar_DeferSet (cvar_t *var, const char *value)
+{
+	cvarset_t	*set;
+	size_t		len;
+
+	len = strlen (value);
+	set = (cvarset_t *) malloc (sizeof (*set) + len);
+	if (!set)
+		Sys_Error ("Cvar_DeferSet: out of memory setting %s", var->name);
+	set->next = NULL;
+	set->var = var;
+	memcpy (set->value, value, len + 1);
+
+	*cvar_setstail = set;
+	cvar_setstail = &set->next;
+
+	var->value = Q_atof (value);
+}
+
+/*
+============
+Cvar_RunDeferredSets
+
+Applies the sets the server thread left, in order, on the main one
+============
+*/
+void Cvar_RunDeferredSets (void)
+{
+	cvarset_t	*set, *next;
+
+	set = cvar_sets;
+	cvar_sets = NULL;
+	cvar_setstail = &cvar_sets;
+
+	for ( ; set; set = next)
+	{
+		next = set->next;
+		Cvar_Apply (set->var, set->value);
+		free (set);
+	}
+}
+
+void Cvar_SetQuick (cvar_t *var, const char *value)
+{
+	if (var->flags & (CVAR_ROM|CVAR_LOCKED))
+		return;
+	if (!(var->flags & CVAR_REGISTERED))
+		return;
+
+	if (Host_OnServerThread ())
+		Cvar_DeferSet (var, value);
+	else
+		Cvar_Apply (var, value);
+}
+
 void Cvar_SetValueQuick (cvar_t *var, const float value)
 {
 	char	val[32], *ptr = val;
@@ -111,6 +111,10 @@ void Cvar_SetValueQuick (cvar_t *var, const float value);
 // but are otherwise identical to the "non-Quick" versions.
 // the cvar MUST be registered.
 
+void Cvar_RunDeferredSets (void);
+// vars set on the server thread get their strings and callbacks here, on
+// the main one; their values change at once
+
 float	Cvar_VariableValue (const char *var_name);
 // returns 0 if not defined or non numeric
 
@@ -194,6 +194,40 @@ byte *Mod_LeafPVS (mleaf_t *leaf, qmodel_t *model)
 	return Mod_DecompressVis (leaf->compressed_vis, model);
 }
 
+/*
+===================
+Mod_AddLeafPVS
+
+ORs the leaf's PVS into pvs. Unlike Mod_LeafPVS this doesn't go through a
+shared buffer, so it can be called from any thread.
+===================
+*/
+void Mod_AddLeafPVS (mleaf_t *leaf, qmodel_t *model, byte *pvs)
+{
+	byte	*in;
+	int		row, i, c;
+
+	row = (model->numleafs+7)>>3;
+	in = leaf->compressed_vis;
+	if (leaf == model->leafs || !in)
+	{	// no vis info, so everything is visible
+		memset (pvs, 0xff, row);
+		return;
+	}
+
+	for (i = 0; i < row; )
+	{
+		if (*in)
+		{
+			pvs[i++] |= *in++;
+			continue;
+		}
+		c = in[1];
+		in += 2;
+		i += q_min (c, row - i);
+	}
+}
+
 byte *Mod_NoVisPVS (qmodel_t *model)
 {
 	int pvsbytes;
@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "bgmusic.h"
 #include <setjmp.h>
+#include <time.h>
 
 /*
 
@@ -41,7 +42,7 @@ quakeparms_t *host_parms;
 
 qboolean	host_initialized;		// true if into command execution
 
-double		host_frametime;
+THREAD_LOCAL double	host_frametime;
 double		realtime;				// without any filtering or bounding
 double		oldrealtime;			// last frame run
 
@@ -55,6 +56,16 @@ client_t	*host_client;			// current client
 
 jmp_buf 	host_abortserver;
 
+#if defined(USE_SDL2)
+static SDL_Thread	*host_svthread;		// see Host_ServerThread
+static SDL_threadID	host_svthreadid;
+static SDL_mutex	*host_svlock;
+static qboolean		host_svlocked;		// by the main thread
+static qboolean		host_svquit;
+static jmp_buf		host_svabort;
+static char			host_sverror[1024];	// Host_Error on the server thread
+#endif
+
 byte		*host_colormap;
 float	host_netinterval;
 cvar_t	host_framerate = {"host_framerate","0",CVAR_NONE};	// set for slow motion
@@ -64,6 +75,11 @@ cvar_t	host_timescale = {"host_timescale", "0", CVAR_NONE}; //johnfitz
 cvar_t	max_edicts = {"max_edicts", "16384", CVAR_NONE}; //johnfitz //ericw -- changed from 2048 to 8192, removed CVAR_ARCHIVE
 
 cvar_t	sys_ticrate = {"sys_ticrate","0.05",CVAR_NONE}; // dedicated server
+cvar_t	sys_idlewait = {"sys_idlewait","1",CVAR_NONE}; // dedicated server: sleep on the sockets between ticks
+cvar_t	sv_hibernate = {"sv_hibernate","1",CVAR_NONE}; // dedicated server: stop the world while nobody is connected
+cvar_t	host_serverthread = {"host_serverthread","0",CVAR_NONE}; // listen server: run the ticks on a thread of their own
+static void Host_TickStats_f (void);
+static void Host_ServerThread_f (cvar_t *var);
 cvar_t	serverprofile = {"serverprofile","0",CVAR_NONE};
 
 cvar_t	fraglimit = {"fraglimit","0",CVAR_NOTIFY|CVAR_SERVERINFO};
@@ -168,6 +184,17 @@ void Host_Error (const char *error, ...)
 	char		string[1024];
 	static	qboolean inerror = false;
 
+#if defined(USE_SDL2)
+	if (Host_OnServerThread ())
+	{
+		// the main thread shuts everything down, see Host_ServerThreadEvents
+		va_start (argptr,error);
+		q_vsnprintf (host_sverror, sizeof(host_sverror), error, argptr);
+		va_end (argptr);
+		longjmp (host_svabort, 1);
+	}
+#endif
+
 	if (inerror)
 		Sys_Error ("Host_Error: recursively entered");
 	inerror = true;
@@ -206,6 +233,8 @@ void	Host_FindMaxClients (void)
 	svs.maxclients = 1;
 
 	i = COM_CheckParm ("-dedicated");
+	if (!i)
+		i = COM_CheckParm ("-bench");	// a dedicated server with its own clients
 	if (i)
 	{
 		cls.state = ca_dedicated;
@@ -285,6 +314,11 @@ void Host_InitLocal (void)
 	Cvar_RegisterVariable (&cl_titlestats);
 
 	Cvar_RegisterVariable (&sys_ticrate);
+	Cvar_RegisterVariable (&sys_idlewait);
+	Cvar_RegisterVariable (&sv_hibernate);
+	Cvar_RegisterVariable (&host_serverthread);
+	Cvar_SetCallback (&host_serverthread, Host_ServerThread_f);
+	Cmd_AddCommand ("sys_tickstats", Host_TickStats_f);
 	Cvar_RegisterVariable (&serverprofile);
 
 	Cvar_RegisterVariable (&fraglimit);
@@ -455,6 +489,7 @@ void SV_DropClient (qboolean crash)
 
 // break the net connection
 	NET_Close (host_client->netconnection);
+	SV_ReleaseSignon (host_client);
 	host_client->netconnection = NULL;
 
 // free the client (the body stays around)
@@ -548,6 +583,8 @@ void Host_ShutdownServer(qboolean crash)
 //
 //	memset (&sv, 0, sizeof(sv)); // ServerSpawn already do this by Host_ClearMemory
 	memset (svs.clients, 0, svs.maxclientslimit*sizeof(client_t));
+
+	SV_Shutdown ();
 }
 
 
@@ -660,6 +697,31 @@ void Host_GetConsoleCommands (void)
 	}
 }
 
+/*
+==================
+Host_Hibernating
+
+A dedicated server with nobody on it has nothing to simulate: it only
+needs to notice the next connection request or console command
+==================
+*/
+qboolean Host_Hibernating (void)
+{
+	extern sizebuf_t	cmd_text;
+	int		i;
+
+	if (!isDedicated || !sv_hibernate.value || cmd_text.cursize)
+		return false;
+	if (!sv.active)
+		return true;
+	for (i = 0; i < svs.maxclients; i++)
+		if (svs.clients[i].active)
+			return false;
+	return true;
+}
+
+svframetimes_t	sv_frametimes;
+
 /*
 ==================
 Host_ServerFrame
@@ -669,6 +731,10 @@ void Host_ServerFrame (void)
 {
 	int		i, active; //johnfitz
 	edict_t	*ent; //johnfitz
+	double	time1, time2, time3;
+
+	time1 = Sys_DoubleTime ();
+	sv_frametimes.physics = sv_frametimes.send = 0.0;
 
 // run the world state
 	pr_global_struct->frametime = host_frametime;
@@ -679,9 +745,18 @@ void Host_ServerFrame (void)
 // check for new clients
 	SV_CheckForNewClients ();
 
+// nobody to run the world for
+	if (Host_Hibernating ())
+	{
+		sv_frametimes.read = Sys_DoubleTime () - time1;
+		return;
+	}
+
 // read client messages
 	SV_RunClients ();
 
+	time2 = Sys_DoubleTime ();
+
 // move things around and think
 // always pause in single player if in console or menus
 	if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game) )
@@ -703,8 +778,378 @@ void Host_ServerFrame (void)
 	}
 //johnfitz
 
+	time3 = Sys_DoubleTime ();
+
 // send all messages to the clients
 	SV_SendClientMessages ();
+
+	sv_frametimes.read = time2 - time1;
+	sv_frametimes.physics = time3 - time2;
+	sv_frametimes.send = Sys_DoubleTime () - time3;
+}
+
+/*
+==============================================================================
+
+SERVER TICKS
+
+Between ticks a dedicated server used to nap for a millisecond at a time,
+checking the clock after each nap. Instead it now blocks in NET_Wait until
+the next tick is due, and while hibernating until a packet or a console
+command shows up.
+
+A listen server can run its ticks on a thread of their own, so that a slow
+frame doesn't hold them up (host_serverthread). The main thread holds
+host_svlock for all of its frame except drawing and mixing sound, the
+server thread takes it for each tick. Between the two only the loopback
+driver carries messages, as before. What the server thread can't do while
+the main thread draws is left for the main thread to pick up once it
+holds the lock again: console output, cvar callbacks and Host_Error. Nor
+can it use the hunk, the cache or the zone, which drawing and mixing do,
+so what a tick allocates comes from malloc.
+
+sys_tickstats reports how late the ticks were and how much CPU went by in
+the meantime.
+
+==============================================================================
+*/
+
+static struct {
+	double	start;			// wall clock when the stats were reset
+	clock_t	cpu;			// process time when the stats were reset
+	int		ticks;			// frames run
+	int		idle;			// frames run while hibernating
+	int		late;			// ticks measured
+	double	latesum;		// seconds past the tick interval
+	double	latesq;
+	double	latemax;
+	double	last;			// time of the previous tick
+} tickstats;
+
+/*
+==================
+Host_RecordTick
+
+Interval is how long after the previous one the tick was due, 0 if it
+wasn't
+==================
+*/
+static void Host_RecordTick (double time, double interval)
+{
+	double	late;
+
+	if (!tickstats.start)
+	{
+		tickstats.start = time;
+		tickstats.cpu = clock ();
+	}
+	tickstats.ticks++;
+
+	if (tickstats.last && interval > 0)
+	{
+		late = time - tickstats.last - interval;
+		tickstats.late++;
+		tickstats.latesum += late;
+		tickstats.latesq += late * late;
+		tickstats.latemax = q_max (tickstats.latemax, late);
+	}
+	tickstats.last = time;
+}
+
+/*
+==================
+Host_TickStats_f
+==================
+*/
+static void Host_TickStats_f (void)
+{
+	double	wall, cpu, mean, dev;
+
+	wall = Sys_DoubleTime () - tickstats.start;
+	cpu = (double) (clock () - tickstats.cpu) / CLOCKS_PER_SEC;
+	mean = tickstats.late ? tickstats.latesum / tickstats.late : 0.0;
+	dev = tickstats.late ? tickstats.latesq / tickstats.late - mean * mean : 0.0;
+
+	if (isDedicated)
+		Con_Printf ("%.1f seconds, %.2f%% cpu, idle wait %s\n", wall, wall > 0 ? 100.0 * cpu / wall : 0.0,
+			sys_idlewait.value ? "on" : "off");
+	else
+		Con_Printf ("%.1f seconds, %.2f%% cpu, server thread %s\n", wall, wall > 0 ? 100.0 * cpu / wall : 0.0,
+			Host_ServerThreaded () ? "on" : "off");
+	Con_Printf ("%i ticks, %i hibernating\n", tickstats.ticks, tickstats.idle);
+	Con_Printf ("tick lateness: %.3f ms mean, %.3f ms stddev, %.3f ms max\n",
+		mean * 1000.0, sqrt (q_max (dev, 0.0)) * 1000.0, tickstats.latemax * 1000.0);
+
+	Host_ResetTickStats ();
+}
+
+/*
+==================
+Host_ResetTickStats
+==================
+*/
+void Host_ResetTickStats (void)
+{
+	memset (&tickstats, 0, sizeof (tickstats));
+	tickstats.start = Sys_DoubleTime ();
+	tickstats.cpu = clock ();
+}
+
+/*
+==================
+Host_DedicatedWait
+
+Waits for the next dedicated server tick and returns the time it's run at
+==================
+*/
+double Host_DedicatedWait (double oldtime)
+{
+	double	newtime;
+
+	if (Host_Hibernating () && sys_idlewait.value && NET_Wait (-1, true))
+	{
+		newtime = Sys_DoubleTime ();
+		Host_RecordTick (newtime, 0.0);
+		tickstats.idle++;
+		return newtime;
+	}
+
+	while (1)
+	{
+		newtime = Sys_DoubleTime ();
+		if (newtime - oldtime >= sys_ticrate.value)
+			break;
+		if (!sys_idlewait.value || !NET_Wait (sys_ticrate.value - (newtime - oldtime), false))
+			SDL_Delay (1);
+	}
+
+	Host_RecordTick (newtime, sys_ticrate.value);
+
+	return newtime;
+}
+
+/*
+==================
+Host_ServerInterval
+
+Time between listen server ticks
+==================
+*/
+static double Host_ServerInterval (void)
+{
+	if (host_netinterval)
+		return host_netinterval;
+	return 1.0 / CLAMP (10.0, host_maxfps.value, 72.0);
+}
+
+/*
+==================
+Host_OnServerThread
+==================
+*/
+qboolean Host_OnServerThread (void)
+{
+#if defined(USE_SDL2)
+	return host_svthread && SDL_ThreadID () == host_svthreadid;
+#else
+	return false;
+#endif
+}
+
+/*
+==================
+Host_ServerThreaded
+==================
+*/
+qboolean Host_ServerThreaded (void)
+{
+#if defined(USE_SDL2)
+	return host_svthread != NULL;
+#else
+	return false;
+#endif
+}
+
+/*
+==================
+Host_LockServer
+
+Keeps the server thread from running a tick until Host_UnlockServer, for
+the main thread
+==================
+*/
+void Host_LockServer (void)
+{
+#if defined(USE_SDL2)
+	if (host_svlock && !host_svlocked)
+	{
+		SDL_LockMutex (host_svlock);
+		host_svlocked = true;
+	}
+#endif
+}
+
+/*
+==================
+Host_UnlockServer
+==================
+*/
+void Host_UnlockServer (void)
+{
+#if defined(USE_SDL2)
+	if (host_svlocked)
+	{
+		host_svlocked = false;
+		SDL_UnlockMutex (host_svlock);
+	}
+#endif
+}
+
+/*
+==================
+Host_ServerThreadEvents
+
+Does what the server thread left for the main thread, which holds the lock
+==================
+*/
+static void Host_ServerThreadEvents (void)
+{
+#if defined(USE_SDL2)
+	char	error[sizeof(host_sverror)];
+#endif
+
+	Con_FlushDeferred ();
+	Cvar_RunDeferredSets ();
+
+#if defined(USE_SDL2)
+	if (host_sverror[0])
+	{
+		q_strlcpy (error, host_sverror, sizeof (error));
+		host_sverror[0] = 0;
+		Host_Error ("%s", error);
+	}
+#endif
+}
+
+#if defined(USE_SDL2)
+/*
+==================
+Host_ServerThread
+==================
+*/
+static int SDLCALL Host_ServerThread (void *data)
+{
+	double	next, last, now, interval;
+	int		ms;
+
+	next = last = Sys_DoubleTime ();
+	while (!host_svquit)
+	{
+		interval = Host_ServerInterval ();
+		now = Sys_DoubleTime ();
+		if (now < next)
+		{
+			ms = (int) ((next - now) * 1000.0);
+			SDL_Delay (q_max (ms, 1));
+			continue;
+		}
+		// keep to the schedule unless a whole tick was missed
+		next = (now - next < interval) ? next + interval : now + interval;
+
+		SDL_LockMutex (host_svlock);
+		now = Sys_DoubleTime ();
+		if (sv.active && !host_svquit && !host_sverror[0])
+		{
+			host_frametime = CLAMP (0.0001, now - last, 0.1);
+			if (host_timescale.value > 0)
+				host_frametime *= host_timescale.value;
+			else if (host_framerate.value > 0)
+				host_frametime = host_framerate.value;
+			Host_RecordTick (now, interval);
+			if (!setjmp (host_svabort))
+				Host_ServerFrame ();
+		}
+		last = now;
+		SDL_UnlockMutex (host_svlock);
+	}
+
+	return 0;
+}
+
+/*
+==================
+Host_StopServerThread
+==================
+*/
+static void Host_StopServerThread (void)
+{
+	if (!host_svthread || Host_OnServerThread ())
+		return;
+
+	Host_LockServer ();
+	host_svquit = true;
+	Host_UnlockServer ();
+	SDL_WaitThread (host_svthread, NULL);
+
+	host_svthread = NULL;
+	host_svthreadid = 0;
+	host_svquit = false;
+	SDL_DestroyMutex (host_svlock);
+	host_svlock = NULL;
+}
+
+/*
+==================
+Host_StartServerThread
+==================
+*/
+static void Host_StartServerThread (void)
+{
+	if (host_svthread)
+		return;
+
+	host_svlock = SDL_CreateMutex ();
+	if (!host_svlock)
+	{
+		Con_Warning ("host_serverthread: couldn't create mutex: %s\n", SDL_GetError ());
+		return;
+	}
+
+	// the main thread is in the middle of its frame
+	Host_LockServer ();
+
+	host_svthread = SDL_CreateThread (Host_ServerThread, "server", NULL);
+	if (!host_svthread)
+	{
+		Con_Warning ("host_serverthread: couldn't create thread: %s\n", SDL_GetError ());
+		Host_UnlockServer ();
+		SDL_DestroyMutex (host_svlock);
+		host_svlock = NULL;
+		return;
+	}
+	host_svthreadid = SDL_GetThreadID (host_svthread);
+}
+#endif
+
+/*
+==================
+Host_ServerThread_f
+
+host_serverthread callback
+==================
+*/
+static void Host_ServerThread_f (cvar_t *var)
+{
+#if defined(USE_SDL2)
+	// the bench stands in for a renderer, see Bench_RunLoaded
+	if (var->value && (!isDedicated || COM_CheckParm ("-benchload")))
+		Host_StartServerThread ();
+	else
+		Host_StopServerThread ();
+#else
+	if (var->value)
+		Con_Printf ("host_serverthread: not supported in this build\n");
+#endif
 }
 
 typedef struct summary_s {
@@ -798,15 +1243,25 @@ void _Host_Frame (double time)
 	int			pass1, pass2, pass3;
 
 	if (setjmp (host_abortserver) )
+	{
+		Host_UnlockServer ();
 		return;			// something bad happened, or the server disconnected
+	}
 
 // keep the random time dependent
 	rand ();
 
+// keep the server thread out until it's time to draw
+	Host_LockServer ();
+	Host_ServerThreadEvents ();
+
 // decide the simulation time
 	accumtime += host_netinterval?CLAMP(0, time, 0.2):0;	//for renderer/server isolation
 	if (!Host_FilterTime (time))
+	{
+		Host_UnlockServer ();
 		return;			// don't run too fast, or packets will flood out
+	}
 
 // get new key events
 	Key_UpdateForDest ();
@@ -842,8 +1297,9 @@ void _Host_Frame (double time)
 		else
 			accumtime -= host_netinterval;
 		CL_SendCmd ();
-		if (sv.active)
+		if (sv.active && !Host_ServerThreaded ())
 		{
+			Host_RecordTick (Sys_DoubleTime (), Host_ServerInterval ());
 			Host_ServerFrame ();
 		}
 		host_frametime = realframetime;
@@ -854,6 +1310,8 @@ void _Host_Frame (double time)
 	if (cls.state == ca_connected)
 		CL_ReadFromServer ();
 
+	Host_UnlockServer ();
+
 // update video
 	if (host_speeds.value)
 		time1 = Sys_DoubleTime ();
@@ -866,7 +1324,9 @@ void _Host_Frame (double time)
 		time2 = Sys_DoubleTime ();
 
 // update audio
+	Host_LockServer ();	// the codecs allocate from the zone
 	BGM_Update();	// adds music raw samples and/or advances midi driver
+	Host_UnlockServer ();
 	if (cls.signon == SIGNONS)
 	{
 		S_Update (r_origin, vpn, vright, vup);
@@ -1043,11 +1503,16 @@ void Host_Shutdown(void)
 	}
 	isdown = true;
 
+#if defined(USE_SDL2)
+	Host_StopServerThread ();
+#endif
+
 // keep Con_Printf from trying to update the screen
 	scr_disabled_for_loading = true;
 
 	Host_WriteConfiguration ();
 
+	SV_Shutdown ();
 	NET_Shutdown ();
 
 	if (cls.state != ca_dedicated)
@@ -1302,6 +1302,7 @@ static void Host_Name_f (void)
 	}
 	Q_strcpy (host_client->name, newName);
 	host_client->edict->v.netname = PR_SetEngineString(host_client->name);
+	PR_FindIndexDirty (host_client->edict, -1);
 
 // send notification to all clients
 	MSG_WriteByte (&sv.reliable_datagram, svc_updatename);
@@ -1597,12 +1598,34 @@ static void Host_PreSpawn_f (void)
 		return;
 	}
 
-	SZ_Write (&host_client->message, sv.signon.data, sv.signon.cursize);
-	MSG_WriteByte (&host_client->message, svc_signonnum);
-	MSG_WriteByte (&host_client->message, 2);
+	SV_QueueSignon (host_client, SIGNON_PRESPAWN);
 	host_client->sendsignon = true;
 }
 
+/*
+==================
+Host_Snapshots_f
+
+snapshots <version>, sent by clients that can parse svc_snapshot
+==================
+*/
+static void Host_Snapshots_f (void)
+{
+	if (cmd_source == src_command)
+	{
+		Con_Printf ("snapshots is not valid from the console\n");
+		return;
+	}
+
+	if (host_client->spawned)
+	{
+		Con_Printf ("snapshots not valid -- already spawned\n");
+		return;
+	}
+
+	SV_EnableSnapshots (host_client, atoi (Cmd_Argv (1)));
+}
+
 /*
 ==================
 Host_Spawn_f
@@ -1638,6 +1661,9 @@ static void Host_Spawn_f (void)
 		ent = host_client->edict;
 
 		memset (&ent->v, 0, progs->entityfields * 4);
+		SV_RadiusGridDirty (ent);
+		PR_FindIndexDirty (ent, -1);
+		SV_ScheduleThink (ent);
 		ent->v.colormap = NUM_FOR_EDICT(ent);
 		ent->v.team = (host_client->colors & 15) + 1;
 		ent->v.netname = PR_SetEngineString(host_client->name);
@@ -1658,6 +1684,7 @@ static void Host_Spawn_f (void)
 
 // send all current names, colors, and frag counts
 	SZ_Clear (&host_client->message);
+	SV_ReleaseSignon (host_client);
 
 // send time of update
 	MSG_WriteByte (&host_client->message, svc_time);
@@ -1739,6 +1766,7 @@ static void Host_Begin_f (void)
 	}
 
 	host_client->spawned = true;
+	SV_ClientSpawned (host_client);
 }
 
 //===========================================================================
@@ -1899,7 +1927,7 @@ static void Host_Give_f (void)
 	case 's':
 		if (rogue)
 		{
-		    val = GetEdictFieldValue(sv_player, "ammo_shells1");
+		    val = E_EXTFIELD(sv_player, ammo_shells1);
 		    if (val)
 			val->_float = v;
 		}
@@ -1909,7 +1937,7 @@ static void Host_Give_f (void)
 	case 'n':
 		if (rogue)
 		{
-		    val = GetEdictFieldValue(sv_player, "ammo_nails1");
+		    val = E_EXTFIELD(sv_player, ammo_nails1);
 		    if (val)
 		    {
 			val->_float = v;
@@ -1926,7 +1954,7 @@ static void Host_Give_f (void)
 	case 'l':
 		if (rogue)
 		{
-		    val = GetEdictFieldValue(sv_player, "ammo_lava_nails");
+		    val = E_EXTFIELD(sv_player, ammo_lava_nails);
 		    if (val)
 		    {
 			val->_float = v;
@@ -1939,7 +1967,7 @@ static void Host_Give_f (void)
 	case 'r':
 		if (rogue)
 		{
-		    val = GetEdictFieldValue(sv_player, "ammo_rockets1");
+		    val = E_EXTFIELD(sv_player, ammo_rockets1);
 		    if (val)
 		    {
 			val->_float = v;
@@ -1956,7 +1984,7 @@ static void Host_Give_f (void)
 	case 'm':
 		if (rogue)
 		{
-		    val = GetEdictFieldValue(sv_player, "ammo_multi_rockets");
+		    val = E_EXTFIELD(sv_player, ammo_multi_rockets);
 		    if (val)
 		    {
 			val->_float = v;
@@ -1973,7 +2001,7 @@ static void Host_Give_f (void)
 	case 'c':
 		if (rogue)
 		{
-		    val = GetEdictFieldValue(sv_player, "ammo_cells1");
+		    val = E_EXTFIELD(sv_player, ammo_cells1);
 		    if (val)
 		    {
 			val->_float = v;
@@ -1990,7 +2018,7 @@ static void Host_Give_f (void)
 	case 'p':
 		if (rogue)
 		{
-		    val = GetEdictFieldValue(sv_player, "ammo_plasma");
+		    val = E_EXTFIELD(sv_player, ammo_plasma);
 		    if (val)
 		    {
 			val->_float = v;
@@ -2309,6 +2337,7 @@ void Host_InitCommands (void)
 	Cmd_AddCommand ("spawn", Host_Spawn_f);
 	Cmd_AddCommand ("begin", Host_Begin_f);
 	Cmd_AddCommand ("prespawn", Host_PreSpawn_f);
+	Cmd_AddCommand ("snapshots", Host_Snapshots_f);
 	Cmd_AddCommand ("kick", Host_Kick_f);
 	Cmd_AddCommand ("ping", Host_Ping_f);
 	Cmd_AddCommand ("load", Host_Loadgame_f);
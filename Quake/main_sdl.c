@@ -90,7 +90,7 @@ int main(int argc, char *argv[])
 
 	COM_InitArgv(parms.argc, parms.argv);
 
-	isDedicated = (COM_CheckParm("-dedicated") != 0);
+	isDedicated = (COM_CheckParm("-dedicated") != 0 || COM_CheckParm("-bench") != 0);
 
 	Sys_InitSDL ();
 
@@ -119,20 +119,15 @@ int main(int argc, char *argv[])
 	Host_Init();
 
 	oldtime = Sys_DoubleTime();
-	if (isDedicated)
+	if (COM_CheckParm("-bench"))
+		Bench_Run ();	// doesn't return
+	else if (isDedicated)
 	{
 		while (1)
 		{
-			newtime = Sys_DoubleTime ();
+			newtime = Host_DedicatedWait (oldtime);
 			time = newtime - oldtime;
 
-			while (time < sys_ticrate.value )
-			{
-				SDL_Delay(1);
-				newtime = Sys_DoubleTime ();
-				time = newtime - oldtime;
-			}
-
 			Host_Frame (time);
 			oldtime = newtime;
 		}
@@ -44,6 +44,7 @@ extern cvar_t		hostname;
 extern	double		net_time;
 extern	sizebuf_t	net_message;
 extern	int		net_activeconnections;
+extern	double		net_loopcopied;		// bytes the loopback driver copied
 
 
 void	NET_Init (void);
@@ -55,6 +56,10 @@ struct qsocket_s	*NET_CheckNewConnections (void);
 struct qsocket_s	*NET_Connect (const char *host);
 // called by client to connect to a host.  Returns -1 if not able to
 
+struct qsocket_s	*NET_ConnectBot (struct qsocket_s **server);
+// connects a client inside this process to the local server, see bench.c;
+// server is set to the end the server's client_t will get
+
 double NET_QSocketGetTime (const struct qsocket_s *sock);
 const char *NET_QSocketGetAddressString (const struct qsocket_s *sock);
 
@@ -76,6 +81,22 @@ int	NET_SendUnreliableMessage (struct qsocket_s *sock, sizebuf_t *data);
 // returns 1 if the message was sent properly
 // returns -1 if the connection died
 
+typedef struct
+{
+	const byte	*data;
+	int			size;
+} netpart_t;
+
+int	NET_SendMessageParts (struct qsocket_s *sock, const netpart_t *parts, int numparts);
+// NET_SendMessage of the parts one after the other, so a message made of
+// shared data doesn't have to be put together first: the driver's copy
+// into its own buffer is the only one
+
+qboolean NET_GetSendBuffer (struct qsocket_s *sock, sizebuf_t *buf);
+// sets buf up to build the next message for the socket in, when the driver
+// can take it over without a copy; returns false if the caller has to use
+// a buffer of its own
+
 int	NET_SendToAll(sizebuf_t *data, double blocktime);
 // This is a reliable *blocking* send to all attached clients.
 
@@ -90,6 +111,14 @@ void	NET_Close (struct qsocket_s *sock);
 
 void	NET_Poll (void);
 
+void	NET_BatchSends (qboolean state);
+// while on, drivers that can may hold datagrams back and send them
+// together when it is turned off
+
+qboolean NET_Wait (double timeout, qboolean wake);
+// sleeps for timeout seconds, forever if it's negative; with wake set, a
+// packet on a listen socket or console input ends the sleep early
+
 
 // Server list related globals:
 extern	qboolean	slistInProgress;
@@ -0,0 +1,607 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// net_comp.c -- raw deflate for datagram payloads
+
+#include "q_stdinc.h"
+#include "arch_def.h"
+#include "net_sys.h"
+#include "quakedef.h"
+#include "net_defs.h"
+#include "miniz.h"
+
+/*
+==============================================================================
+
+Messages are compressed as a single raw deflate block (RFC 1951) whose
+window starts out holding a preset dictionary of strings that show up in
+svc_* traffic: precache names, lightstyles, stufftext and obituaries. The
+bundled miniz only has the inflate side, so the encoder is here: LZ77
+over hash chains, then whichever of the fixed and a dynamic Huffman code
+comes out shorter. Decoding is tinfl's, with the dictionary in front of
+the output buffer.
+
+Both ends must use the same dictionary; change NET_COMPRESSMAGIC along
+with it.
+
+==============================================================================
+*/
+
+static const char comp_dictionary[] =
+	// stufftext and prints
+	"reconnect\n\0bf\n\0cmd spawn \0cmd begin\0cmd prespawn\0fov 90\n\0v_cshift 0 0 0 0\n\0"
+	"cd track \0changelevel \0 entered the game\n\0 left the game with \0 frags\n\0"
+	" was gibbed by \0 was nailed by \0 was punctured by \0 rides \0's rocket\n\0"
+	" chewed on \0's boomstick\n\0 ate 2 loads of \0's buckshot\n\0 eats \0's pineapple\n\0"
+	" accepts \0's shaft\n\0 was ax-murdered by \0 squishes \0 becomes bored with life\n\0"
+	" discharges into the water.\n\0 tried to leave\n\0 was telefragged by \0"
+	"You got the \0You got \0You receive \0 health\n\0You got armor\n\0"
+	" shells\n\0 nails\n\0 rockets\n\0 cells\n\0Double-barrelled Shotgun\n\0Nailgun\n\0"
+	"Super Nailgun\n\0Grenade Launcher\n\0Rocket Launcher\n\0Thunderbolt\n\0"
+	"Quad Damage\n\0Pentagram of Protection\n\0Ring of Shadows\n\0Biosuit\n\0"
+	// lightstyles
+	"m\0mmnmmommommnonmmonqnmmo\0abcdefghijklmnopqrstuvwxyzyxwvutsrqponmlkjihgfedcba\0"
+	"mmmmmaaaaammmmmaaaaaabcdefgabcdefg\0mamamamamama\0jklmnopqrstuvwxyzyxwvutsrqponmlkj\0"
+	"nmonqnmomnmomomno\0mmmaaaabcdefgmmmmaaaammmaamm\0mmmaaammmaaammmabcdefaaaammmmabcdefmmmaaaa\0"
+	"aaaaaaaazzzzzzzz\0mmamammmmammamamaaamammma\0abcdefghijklmnopqrrqponmlkjihgfedcba\0"
+	// sound precaches
+	"ambience/water1.wav\0ambience/wind2.wav\0ambience/fire1.wav\0ambience/hum1.wav\0"
+	"ambience/drip1.wav\0ambience/comp1.wav\0ambience/buzz1.wav\0ambience/suck1.wav\0"
+	"ambience/swamp1.wav\0ambience/swamp2.wav\0ambience/windfly.wav\0"
+	"buttons/switch21.wav\0buttons/switch02.wav\0buttons/airbut1.wav\0"
+	"doors/drclos4.wav\0doors/doormv1.wav\0doors/stndr1.wav\0doors/stndr2.wav\0"
+	"plats/plat1.wav\0plats/plat2.wav\0plats/medplat1.wav\0plats/medplat2.wav\0"
+	"misc/null.wav\0misc/talk.wav\0misc/h2ohit1.wav\0misc/water1.wav\0misc/water2.wav\0"
+	"misc/r_tele1.wav\0misc/r_tele2.wav\0misc/r_tele3.wav\0misc/r_tele4.wav\0misc/r_tele5.wav\0"
+	"misc/outwater.wav\0misc/power.wav\0misc/secret.wav\0misc/trigger1.wav\0"
+	"demon/dland2.wav\0items/itembk2.wav\0items/health1.wav\0items/r_item1.wav\0items/r_item2.wav\0"
+	"items/armor1.wav\0items/damage.wav\0items/damage2.wav\0items/damage3.wav\0"
+	"items/protect.wav\0items/protect2.wav\0items/protect3.wav\0items/suit.wav\0items/suit2.wav\0"
+	"items/inv1.wav\0items/inv2.wav\0items/inv3.wav\0"
+	"player/plyrjmp8.wav\0player/land.wav\0player/land2.wav\0player/drown1.wav\0player/drown2.wav\0"
+	"player/gasp1.wav\0player/gasp2.wav\0player/h2odeath.wav\0player/teledth1.wav\0"
+	"player/pain1.wav\0player/pain2.wav\0player/pain3.wav\0player/pain4.wav\0player/pain5.wav\0player/pain6.wav\0"
+	"player/death1.wav\0player/death2.wav\0player/death3.wav\0player/death4.wav\0player/death5.wav\0"
+	"player/udeath.wav\0player/gib.wav\0player/slimbrn2.wav\0player/h2ojump.wav\0player/inh2o.wav\0"
+	"player/lburn1.wav\0player/lburn2.wav\0player/tornoff2.wav\0player/axhit1.wav\0player/axhit2.wav\0"
+	"weapons/r_exp3.wav\0weapons/rocket1i.wav\0weapons/sgun1.wav\0weapons/guncock.wav\0"
+	"weapons/ric1.wav\0weapons/ric2.wav\0weapons/ric3.wav\0weapons/spike2.wav\0weapons/tink1.wav\0"
+	"weapons/grenade.wav\0weapons/bounce.wav\0weapons/shotgn2.wav\0weapons/lhit.wav\0"
+	"weapons/lstart.wav\0weapons/ax1.wav\0weapons/pkup.wav\0weapons/lock4.wav\0"
+	// model precaches
+	"progs/player.mdl\0progs/eyes.mdl\0progs/h_player.mdl\0progs/gib1.mdl\0progs/gib2.mdl\0progs/gib3.mdl\0"
+	"progs/s_bubble.spr\0progs/s_explod.spr\0progs/s_light.spr\0progs/v_axe.mdl\0progs/v_shot.mdl\0"
+	"progs/v_nail.mdl\0progs/v_rock.mdl\0progs/v_shot2.mdl\0progs/v_nail2.mdl\0progs/v_rock2.mdl\0"
+	"progs/v_light.mdl\0progs/bolt.mdl\0progs/bolt2.mdl\0progs/bolt3.mdl\0progs/lavaball.mdl\0"
+	"progs/missile.mdl\0progs/grenade.mdl\0progs/spike.mdl\0progs/s_spike.mdl\0progs/backpack.mdl\0"
+	"progs/zom_gib.mdl\0progs/armor.mdl\0progs/g_shot.mdl\0progs/g_nail.mdl\0progs/g_nail2.mdl\0"
+	"progs/g_rock.mdl\0progs/g_rock2.mdl\0progs/g_light.mdl\0progs/quaddama.mdl\0progs/invulner.mdl\0"
+	"progs/suit.mdl\0progs/invisibl.mdl\0progs/w_s_key.mdl\0progs/w_g_key.mdl\0progs/flame.mdl\0"
+	"progs/flame2.mdl\0progs/soldier.mdl\0progs/h_guard.mdl\0progs/dog.mdl\0progs/h_dog.mdl\0"
+	"progs/ogre.mdl\0progs/h_ogre.mdl\0progs/knight.mdl\0progs/h_knight.mdl\0progs/zombie.mdl\0"
+	"progs/h_zombie.mdl\0progs/demon.mdl\0progs/h_demon.mdl\0progs/shambler.mdl\0progs/h_shams.mdl\0"
+	"progs/wizard.mdl\0progs/h_wizard.mdl\0progs/w_spike.mdl\0progs/enforcer.mdl\0progs/h_mega.mdl\0"
+	"progs/laser.mdl\0progs/fish.mdl\0progs/hknight.mdl\0progs/h_hellkn.mdl\0progs/k_spike.mdl\0"
+	"maps/b_bh10.bsp\0maps/b_bh25.bsp\0maps/b_bh100.bsp\0maps/b_shell0.bsp\0maps/b_shell1.bsp\0"
+	"maps/b_nail0.bsp\0maps/b_nail1.bsp\0maps/b_rock0.bsp\0maps/b_rock1.bsp\0maps/b_batt0.bsp\0"
+	"maps/b_batt1.bsp\0maps/b_explob.bsp\0maps/start.bsp\0maps/e1m1.bsp\0*1\0*2\0*3\0*4\0*5\0*6\0*7\0*8\0*9\0";
+
+#define COMP_DICTSIZE	((int) sizeof(comp_dictionary) - 1)
+#define COMP_BUFSIZE	(COMP_DICTSIZE + NET_MAXMESSAGE)
+
+#define COMP_WINDOW		32768
+#define COMP_HASHBITS	13
+#define COMP_HASHSIZE	(1 << COMP_HASHBITS)
+#define COMP_MAXCHAIN	32		// candidates looked at per position
+#define COMP_MINMATCH	3
+#define COMP_MAXMATCH	258
+#define COMP_NICEMATCH	64		// long enough, stop looking
+
+#define COMP_LITCODES	288		// literals, end of block, lengths, two unused
+#define COMP_DISTCODES	30
+#define COMP_CLCODES	19		// code length alphabet
+#define COMP_EOB		256
+
+static const unsigned short comp_lenbase[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const byte comp_lenextra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const unsigned short comp_distbase[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+static const byte comp_distextra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+static const byte comp_clorder[COMP_CLCODES] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+
+static qboolean	comp_initialized;
+static byte		comp_lencode[COMP_MAXMATCH + 1];	// match length -> length code - 257
+static byte		comp_distcode[512];					// see Comp_DistCode
+static byte		comp_fixedlit[COMP_LITCODES];
+static byte		comp_fixeddist[COMP_DISTCODES];
+
+// compression, the message goes right after the dictionary
+static byte				comp_buf[COMP_BUFSIZE];
+static int				comp_head[COMP_HASHSIZE];
+static int				comp_dicthead[COMP_HASHSIZE];
+static int				comp_prev[COMP_BUFSIZE];
+static unsigned short	comp_toklen[NET_MAXMESSAGE];	// 0 for a literal
+static unsigned short	comp_tokval[NET_MAXMESSAGE];	// literal or distance
+
+// decompression
+static byte					decomp_buf[COMP_BUFSIZE];
+static tinfl_decompressor	decomp;
+
+typedef struct
+{
+	byte		*data;
+	int			size;
+	int			maxsize;
+	uint32_t	bits;
+	int			numbits;
+	qboolean	overflowed;
+} bitbuf_t;
+
+
+static int Comp_DistCode (int dist)
+{
+	dist--;
+	return dist < 256 ? comp_distcode[dist] : comp_distcode[256 + (dist >> 7)];
+}
+
+static unsigned int Comp_Hash (const byte *p)
+{
+	return ((p[0] | (p[1] << 8) | (p[2] << 16)) * 2654435761u) >> (32 - COMP_HASHBITS);
+}
+
+static void Comp_Insert (int pos)
+{
+	unsigned int h = Comp_Hash (comp_buf + pos);
+
+	comp_prev[pos] = comp_head[h];
+	comp_head[h] = pos;
+}
+
+static void Comp_Init (void)
+{
+	int	i, j, d;
+
+	for (i = 0; i < 29; i++)
+		for (j = 0; j < (1 << comp_lenextra[i]) && comp_lenbase[i] + j <= COMP_MAXMATCH; j++)
+			comp_lencode[comp_lenbase[i] + j] = i;
+	for (i = 0; i < COMP_DISTCODES; i++)
+	{
+		for (j = 0; j < (1 << comp_distextra[i]); j++)
+		{
+			d = comp_distbase[i] - 1 + j;
+			if (d < 256)
+				comp_distcode[d] = i;
+			else
+				comp_distcode[256 + (d >> 7)] = i;
+		}
+	}
+
+	for (i = 0; i < COMP_LITCODES; i++)
+		comp_fixedlit[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+	for (i = 0; i < COMP_DISTCODES; i++)
+		comp_fixeddist[i] = 5;
+
+	// the dictionary's hash chains are the same for every message
+	memcpy (comp_buf, comp_dictionary, COMP_DICTSIZE);
+	for (i = 0; i < COMP_HASHSIZE; i++)
+		comp_head[i] = -1;
+	for (i = 0; i + COMP_MINMATCH <= COMP_DICTSIZE; i++)
+		Comp_Insert (i);
+	memcpy (comp_dicthead, comp_head, sizeof(comp_head));
+
+	memcpy (decomp_buf, comp_dictionary, COMP_DICTSIZE);
+
+	comp_initialized = true;
+}
+
+// a code needs at least two symbols to be complete
+static void Comp_FillCode (int *freq, int num)
+{
+	int	i, used;
+
+	for (i = 0, used = 0; i < num; i++)
+		used += freq[i] != 0;
+	for (i = 0; used < 2; i++)
+	{
+		if (!freq[i])
+		{
+			freq[i] = 1;
+			used++;
+		}
+	}
+}
+
+/*
+Huffman code lengths for freq, none longer than limit. Frequencies are
+halved until the tree is shallow enough.
+*/
+static void Comp_BuildLengths (const int *freq, int num, int limit, byte *lengths)
+{
+	int		weight[2 * COMP_LITCODES], parent[2 * COMP_LITCODES], depth[2 * COMP_LITCODES];
+	int		leaves[COMP_LITCODES], scaled[COMP_LITCODES];
+	int		numleaves, numnodes, i, j, a, b, nextleaf, nextnode, maxdepth;
+
+	for (i = 0; i < num; i++)
+		scaled[i] = freq[i];
+
+	while (1)
+	{
+		memset (lengths, 0, num);
+
+		// leaves sorted by weight, smallest first
+		for (i = 0, numleaves = 0; i < num; i++)
+		{
+			if (!scaled[i])
+				continue;
+			for (j = numleaves++; j > 0 && scaled[leaves[j - 1]] > scaled[i]; j--)
+				leaves[j] = leaves[j - 1];
+			leaves[j] = i;
+		}
+		if (numleaves < 2)
+		{
+			if (numleaves)
+				lengths[leaves[0]] = 1;
+			return;
+		}
+
+		for (i = 0; i < numleaves; i++)
+			weight[i] = scaled[leaves[i]];
+
+		// internal nodes come out in order of weight, so two queues do
+		numnodes = numleaves;
+		nextleaf = 0;
+		nextnode = numleaves;
+		for (i = 0; i < numleaves - 1; i++)
+		{
+			if (nextleaf < numleaves && (nextnode >= numnodes || weight[nextleaf] <= weight[nextnode]))
+				a = nextleaf++;
+			else
+				a = nextnode++;
+			if (nextleaf < numleaves && (nextnode >= numnodes || weight[nextleaf] <= weight[nextnode]))
+				b = nextleaf++;
+			else
+				b = nextnode++;
+			weight[numnodes] = weight[a] + weight[b];
+			parent[a] = parent[b] = numnodes;
+			numnodes++;
+		}
+
+		depth[numnodes - 1] = 0;
+		maxdepth = 0;
+		for (i = numnodes - 2; i >= 0; i--)
+		{
+			depth[i] = depth[parent[i]] + 1;
+			if (i < numleaves)
+				maxdepth = q_max (maxdepth, depth[i]);
+		}
+
+		if (maxdepth <= limit)
+		{
+			for (i = 0; i < numleaves; i++)
+				lengths[leaves[i]] = depth[i];
+			return;
+		}
+
+		for (i = 0; i < num; i++)
+			if (scaled[i])
+				scaled[i] = (scaled[i] + 1) >> 1;
+	}
+}
+
+// canonical codes for lengths, bit reversed for the LSB first output
+static void Comp_BuildCodes (const byte *lengths, int num, unsigned short *codes)
+{
+	int		count[16], next[16];
+	int		i, code, rev, len;
+
+	memset (count, 0, sizeof(count));
+	for (i = 0; i < num; i++)
+		count[lengths[i]]++;
+	count[0] = 0;
+
+	code = 0;
+	for (i = 1; i < 16; i++)
+	{
+		code = (code + count[i - 1]) << 1;
+		next[i] = code;
+	}
+
+	for (i = 0; i < num; i++)
+	{
+		len = lengths[i];
+		if (!len)
+			continue;
+		code = next[len]++;
+		for (rev = 0; len; len--, code >>= 1)
+			rev = (rev << 1) | (code & 1);
+		codes[i] = rev;
+	}
+}
+
+/*
+Run length codes (16, 17 and 18) for a sequence of code lengths. Returns
+the number of symbols, extra holds each one's repeat count.
+*/
+static int Comp_RunLengths (const byte *lengths, int num, byte *syms, byte *extra)
+{
+	int		i, run, n, count;
+
+	for (i = 0, count = 0; i < num; i += run)
+	{
+		for (run = 1; i + run < num && lengths[i + run] == lengths[i]; run++)
+			;
+
+		if (!lengths[i])
+		{
+			for (n = run; n >= 11; n -= q_min (n, 138))
+			{
+				syms[count] = 18;
+				extra[count++] = q_min (n, 138) - 11;
+			}
+			if (n >= 3)
+			{
+				syms[count] = 17;
+				extra[count++] = n - 3;
+				n = 0;
+			}
+			for ( ; n > 0; n--)
+				syms[count++] = 0;
+			continue;
+		}
+
+		syms[count++] = lengths[i];
+		for (n = run - 1; n >= 3; n -= q_min (n, 6))
+		{
+			syms[count] = 16;
+			extra[count++] = q_min (n, 6) - 3;
+		}
+		for ( ; n > 0; n--)
+			syms[count++] = lengths[i];
+	}
+
+	return count;
+}
+
+static void Comp_PutBits (bitbuf_t *b, unsigned int value, int numbits)
+{
+	b->bits |= (uint32_t)value << b->numbits;
+	b->numbits += numbits;
+	while (b->numbits >= 8)
+	{
+		if (b->size < b->maxsize)
+			b->data[b->size++] = (byte)b->bits;
+		else
+			b->overflowed = true;
+		b->bits >>= 8;
+		b->numbits -= 8;
+	}
+}
+
+static void Comp_PutTokens (bitbuf_t *b, int numtokens, const byte *litlen, const byte *distlen)
+{
+	unsigned short	litcodes[COMP_LITCODES], distcodes[COMP_DISTCODES];
+	int				i, len, dist, code;
+
+	Comp_BuildCodes (litlen, COMP_LITCODES, litcodes);
+	Comp_BuildCodes (distlen, COMP_DISTCODES, distcodes);
+
+	for (i = 0; i < numtokens && !b->overflowed; i++)
+	{
+		len = comp_toklen[i];
+		if (!len)
+		{
+			Comp_PutBits (b, litcodes[comp_tokval[i]], litlen[comp_tokval[i]]);
+			continue;
+		}
+		code = comp_lencode[len];
+		Comp_PutBits (b, litcodes[257 + code], litlen[257 + code]);
+		Comp_PutBits (b, len - comp_lenbase[code], comp_lenextra[code]);
+		dist = comp_tokval[i];
+		code = Comp_DistCode (dist);
+		Comp_PutBits (b, distcodes[code], distlen[code]);
+		Comp_PutBits (b, dist - comp_distbase[code], comp_distextra[code]);
+	}
+	Comp_PutBits (b, litcodes[COMP_EOB], litlen[COMP_EOB]);
+}
+
+/*
+==================
+NET_Compress
+
+Deflates length bytes of data into out. Returns the compressed size, or 0
+if it wouldn't fit in maxsize bytes.
+==================
+*/
+int NET_Compress (const byte *data, int length, byte *out, int maxsize)
+{
+	int			litfreq[COMP_LITCODES], distfreq[COMP_DISTCODES], clfreq[COMP_CLCODES];
+	byte		litlen[COMP_LITCODES], distlen[COMP_DISTCODES], cllen[COMP_CLCODES];
+	byte		lengths[COMP_LITCODES + COMP_DISTCODES];
+	byte		clsyms[COMP_LITCODES + COMP_DISTCODES], clextra[COMP_LITCODES + COMP_DISTCODES];
+	unsigned short	clcodes[COMP_CLCODES];
+	int			numtokens, pos, end, cand, chain, len, maxlen, bestlen, bestdist, i;
+	int			numlit, numdist, numcl, numclsyms;
+	int			fixedbits, dynamicbits, extrabits;
+	bitbuf_t	b;
+
+	if (length <= 0 || length > NET_MAXMESSAGE)
+		return 0;
+	if (!comp_initialized)
+		Comp_Init ();
+
+	memcpy (comp_head, comp_dicthead, sizeof(comp_head));
+	memcpy (comp_buf + COMP_DICTSIZE, data, length);
+	memset (litfreq, 0, sizeof(litfreq));
+	memset (distfreq, 0, sizeof(distfreq));
+
+	// greedy LZ77 over hash chains
+	numtokens = 0;
+	extrabits = 0;
+	end = COMP_DICTSIZE + length;
+	for (pos = COMP_DICTSIZE; pos < end; )
+	{
+		bestlen = bestdist = 0;
+		if (end - pos >= COMP_MINMATCH)
+		{
+			maxlen = q_min (end - pos, COMP_MAXMATCH);
+			cand = comp_head[Comp_Hash (comp_buf + pos)];
+			for (chain = COMP_MAXCHAIN; cand >= 0 && pos - cand <= COMP_WINDOW && chain; cand = comp_prev[cand], chain--)
+			{
+				if (comp_buf[cand + bestlen] != comp_buf[pos + bestlen])
+					continue;
+				for (len = 0; len < maxlen && comp_buf[cand + len] == comp_buf[pos + len]; len++)
+					;
+				if (len > bestlen)
+				{
+					bestlen = len;
+					bestdist = pos - cand;
+					if (len >= maxlen || len >= COMP_NICEMATCH)
+						break;
+				}
+			}
+			Comp_Insert (pos);
+		}
+
+		if (bestlen >= COMP_MINMATCH)
+		{
+			i = comp_lencode[bestlen];
+			litfreq[257 + i]++;
+			extrabits += comp_lenextra[i];
+			i = Comp_DistCode (bestdist);
+			distfreq[i]++;
+			extrabits += comp_distextra[i];
+			comp_toklen[numtokens] = bestlen;
+			comp_tokval[numtokens++] = bestdist;
+			for (i = 1; i < bestlen; i++)
+				if (pos + i + COMP_MINMATCH <= end)
+					Comp_Insert (pos + i);
+			pos += bestlen;
+		}
+		else
+		{
+			litfreq[comp_buf[pos]]++;
+			comp_toklen[numtokens] = 0;
+			comp_tokval[numtokens++] = comp_buf[pos];
+			pos++;
+		}
+	}
+	litfreq[COMP_EOB] = 1;
+
+	Comp_FillCode (distfreq, COMP_DISTCODES);
+
+	Comp_BuildLengths (litfreq, COMP_LITCODES, 15, litlen);
+	Comp_BuildLengths (distfreq, COMP_DISTCODES, 15, distlen);
+	for (numlit = COMP_LITCODES; numlit > 257 && !litlen[numlit - 1]; numlit--)
+		;
+	for (numdist = COMP_DISTCODES; numdist > 1 && !distlen[numdist - 1]; numdist--)
+		;
+	memcpy (lengths, litlen, numlit);
+	memcpy (lengths + numlit, distlen, numdist);
+	numclsyms = Comp_RunLengths (lengths, numlit + numdist, clsyms, clextra);
+
+	memset (clfreq, 0, sizeof(clfreq));
+	for (i = 0; i < numclsyms; i++)
+		clfreq[clsyms[i]]++;
+	Comp_FillCode (clfreq, COMP_CLCODES);
+	Comp_BuildLengths (clfreq, COMP_CLCODES, 7, cllen);
+	for (numcl = COMP_CLCODES; numcl > 4 && !cllen[comp_clorder[numcl - 1]]; numcl--)
+		;
+
+	// pick the smaller of the fixed and the dynamic code
+	fixedbits = 3 + extrabits;
+	dynamicbits = 3 + 14 + numcl * 3 + extrabits;
+	for (i = 0; i < COMP_LITCODES; i++)
+	{
+		fixedbits += litfreq[i] * comp_fixedlit[i];
+		dynamicbits += litfreq[i] * litlen[i];
+	}
+	for (i = 0; i < COMP_DISTCODES; i++)
+	{
+		fixedbits += distfreq[i] * comp_fixeddist[i];
+		dynamicbits += distfreq[i] * distlen[i];
+	}
+	for (i = 0; i < numclsyms; i++)
+		dynamicbits += cllen[clsyms[i]] + (clsyms[i] == 16 ? 2 : clsyms[i] == 17 ? 3 : clsyms[i] == 18 ? 7 : 0);
+
+	if ((q_min (fixedbits, dynamicbits) + 7) / 8 > maxsize)
+		return 0;
+
+	memset (&b, 0, sizeof(b));
+	b.data = out;
+	b.maxsize = maxsize;
+
+	if (fixedbits <= dynamicbits)
+	{
+		Comp_PutBits (&b, 1 | (1 << 1), 3);		// final, fixed
+		Comp_PutTokens (&b, numtokens, comp_fixedlit, comp_fixeddist);
+	}
+	else
+	{
+		Comp_PutBits (&b, 1 | (2 << 1), 3);		// final, dynamic
+		Comp_PutBits (&b, numlit - 257, 5);
+		Comp_PutBits (&b, numdist - 1, 5);
+		Comp_PutBits (&b, numcl - 4, 4);
+		for (i = 0; i < numcl; i++)
+			Comp_PutBits (&b, cllen[comp_clorder[i]], 3);
+		Comp_BuildCodes (cllen, COMP_CLCODES, clcodes);
+		for (i = 0; i < numclsyms; i++)
+		{
+			Comp_PutBits (&b, clcodes[clsyms[i]], cllen[clsyms[i]]);
+			if (clsyms[i] == 16)
+				Comp_PutBits (&b, clextra[i], 2);
+			else if (clsyms[i] == 17)
+				Comp_PutBits (&b, clextra[i], 3);
+			else if (clsyms[i] == 18)
+				Comp_PutBits (&b, clextra[i], 7);
+		}
+		Comp_PutTokens (&b, numtokens, litlen, distlen);
+	}
+	if (b.numbits)
+		Comp_PutBits (&b, 0, 8 - b.numbits);
+
+	return b.overflowed ? 0 : b.size;
+}
+
+/*
+==================
+NET_Decompress
+
+Inflates length bytes of data into out. Returns the decompressed size, or
+-1 if the data is corrupt or doesn't fit in maxsize bytes.
+==================
+*/
+int NET_Decompress (const byte *data, int length, byte *out, int maxsize)
+{
+	size_t			insize, outsize;
+	tinfl_status	status;
+
+	if (!comp_initialized)
+		Comp_Init ();
+
+	insize = length;
+	outsize = q_min (maxsize, NET_MAXMESSAGE);
+	tinfl_init (&decomp);
+	status = tinfl_decompress (&decomp, data, &insize, decomp_buf, decomp_buf + COMP_DICTSIZE, &outsize,
+		TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+	if (status != TINFL_STATUS_DONE)
+		return -1;
+
+	memcpy (out, decomp_buf + COMP_DICTSIZE, outsize);
+	return (int) outsize;
+}
@@ -45,6 +45,7 @@ struct qsockaddr
 #define NETFLAG_NAK		0x00040000
 #define NETFLAG_EOM		0x00080000
 #define NETFLAG_UNRELIABLE	0x00100000
+#define NETFLAG_COMPRESSED	0x00200000
 #define NETFLAG_CTL		0x80000000
 
 #if (NETFLAG_LENGTH_MASK & NET_MAXMESSAGE) != NET_MAXMESSAGE
@@ -53,6 +54,19 @@ struct qsockaddr
 
 #define NET_PROTOCOL_VERSION	3
 
+// windowed reliable transport, see net_dgrm.c
+#define NET_WINDOWMAGIC		0x57494e44	// "WIND", sent after the version in CCREQ_CONNECT
+										// and echoed after the port in CCREP_ACCEPT
+#define NET_WINDOWFRAG		1400		// reliable bytes per packet
+#define NET_MSGFRAGS		((NET_MAXMESSAGE + NET_WINDOWFRAG - 1) / NET_WINDOWFRAG)
+#define NET_MAXFRAGS		128			// packets queued per connection, a power of two
+										// at least twice NET_MSGFRAGS
+#define NET_MAXWINDOW		64			// packets in flight, and buffered out of order
+
+// payload compression, see net_comp.c
+#define NET_COMPRESSMAGIC	0x44464c31	// "DFL1", sent and echoed after NET_WINDOWMAGIC
+#define NET_COMPRESSMIN		128			// smaller messages are always sent as they are
+
 /**
 
 This is the network info/connection protocol.  It is used to find Quake
@@ -157,6 +171,19 @@ typedef struct qsocket_s
 	struct qsockaddr	addr;
 	char		address[NET_NAMELEN];
 
+	struct netwindow_s	*window;	// NULL for stop-and-wait
+
+	struct qsocket_s	*hashnext;	// address hash chains, see net_dgrm.c
+	struct qsocket_s	*hostnext;
+	qboolean	hashed;
+	qboolean	shared;		// talks through the listen socket
+	struct netqueue_s	*queue;		// packets routed to a shared socket
+
+	qboolean	compress;		// both ends agreed on NETFLAG_COMPRESSED
+	qboolean	sendCompressed;	// sendMessage holds deflated data
+
+	struct loopring_s	*ring;		// loopback messages waiting, see net_loop.c
+
 } qsocket_t;
 
 extern qsocket_t	*net_activeSockets;
@@ -186,6 +213,9 @@ typedef struct
 	int		(*AddrCompare) (struct qsockaddr *addr1, struct qsockaddr *addr2);
 	int		(*GetSocketPort) (struct qsockaddr *addr);
 	int		(*SetSocketPort) (struct qsockaddr *addr, int port);
+	void		(*Batch) (qboolean state);	// optional, see NET_BatchSends
+	unsigned int	(*AddrHash) (struct qsockaddr *addr, qboolean port);	// optional
+	sys_socket_t	(*ListenSocket) (void);	// optional, see NET_Wait
 } net_landriver_t;
 
 #define	MAX_NET_DRIVERS		8
@@ -202,7 +232,7 @@ typedef struct
 	qsocket_t	*(*Connect) (const char *host);
 	qsocket_t	*(*CheckNewConnections) (void);
 	int		(*QGetMessage) (qsocket_t *sock);
-	int		(*QSendMessage) (qsocket_t *sock, sizebuf_t *data);
+	int		(*QSendMessage) (qsocket_t *sock, const netpart_t *parts, int numparts);
 	int		(*SendUnreliableMessage) (qsocket_t *sock, sizebuf_t *data);
 	qboolean	(*CanSendMessage) (qsocket_t *sock);
 	qboolean	(*CanSendUnreliableMessage) (qsocket_t *sock);
@@ -227,6 +257,22 @@ qsocket_t *NET_NewQSocket (void);
 void NET_FreeQSocket(qsocket_t *);
 double SetNetTime(void);
 
+int NET_PartsSize (const netpart_t *parts, int numparts);
+void NET_GatherParts (const netpart_t *parts, int numparts, int offset, byte *out, int length);
+
+int NET_Compress (const byte *data, int length, byte *out, int maxsize);
+int NET_Decompress (const byte *data, int length, byte *out, int maxsize);
+
+void NET_SimInit (void);
+void NET_SimPoll (void);
+double NET_SimNextTime (void);
+void NET_SimStats (void);
+void NET_SimListen (int driver);
+void NET_SimFlush (int driver, sys_socket_t socket);
+sys_socket_t NET_SimCheckNewConnections (int driver);
+int NET_SimRead (int driver, sys_socket_t socket, byte *buf, int len, struct qsockaddr *addr);
+int NET_SimWrite (int driver, sys_socket_t socket, byte *buf, int len, struct qsockaddr *addr);
+
 
 #define HOSTCACHESIZE	8
 
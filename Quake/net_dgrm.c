@@ -129,29 +129,876 @@ static void NET_Ban_f (void)
 #endif	// BAN_TEST
 
 
-int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
+/*
+==============================================================================
+
+PAYLOAD COMPRESSION
+
+When both ends set net_compress at connect time, reliable messages and
+unreliable ones of at least NET_COMPRESSMIN bytes are deflated before they
+go out (see net_comp.c) and flagged NETFLAG_COMPRESSED. Anything that
+doesn't get smaller is sent as it is, so the flag is decided per message.
+Every packet of a reliable message carries it, and the receiver inflates
+the message once its last packet is in. Packets flagged on a connection that
+didn't agree to it are dropped as corrupt, so no one can make the other
+end inflate without asking first.
+
+==============================================================================
+*/
+
+cvar_t	net_compress = {"net_compress", "0", CVAR_NONE};
+
+/* statistic counters */
+static int compressedMessages = 0;
+static int uncompressedMessages = 0;	// tried, but didn't get smaller
+static int corruptMessages = 0;
+static double compressAttempted = 0;	// bytes
+static double compressedIn = 0;
+static double compressedOut = 0;
+static double compressTime = 0;
+static double decompressedBytes = 0;
+static double decompressTime = 0;
+
+static byte compressBuffer[NET_MAXMESSAGE];
+static byte gatherBuffer[NET_MAXMESSAGE];
+
+
+/*
+Deflates data into out if that's worth it. Returns the compressed size, or
+0 if the message should be sent as it is.
+*/
+static int Datagram_Pack (qsocket_t *sock, const byte *data, int length, byte *out)
+{
+	double	start;
+	int		size;
+
+	if (!sock->compress || length < NET_COMPRESSMIN)
+		return 0;
+
+	start = Sys_DoubleTime ();
+	size = NET_Compress (data, length, out, length - 1);
+	compressTime += Sys_DoubleTime () - start;
+	compressAttempted += length;
+
+	if (!size)
+	{
+		uncompressedMessages++;
+		return 0;
+	}
+	compressedMessages++;
+	compressedIn += length;
+	compressedOut += size;
+	return size;
+}
+
+
+/*
+Datagram_Pack for a message in parts. They only have to be put together
+first when it is going to be compressed.
+*/
+static int Datagram_PackParts (qsocket_t *sock, const netpart_t *parts, int numparts, int length, byte *out)
+{
+	if (numparts == 1)
+		return Datagram_Pack (sock, parts[0].data, length, out);
+	if (!sock->compress || length < NET_COMPRESSMIN)
+		return 0;
+
+	NET_GatherParts (parts, numparts, 0, gatherBuffer, length);
+	return Datagram_Pack (sock, gatherBuffer, length, out);
+}
+
+
+/*
+Inflates a compressed message into net_message
+*/
+static qboolean Datagram_Unpack (const byte *data, int length)
+{
+	double	start;
+	int		size;
+
+	start = Sys_DoubleTime ();
+	size = NET_Decompress (data, length, net_message.data, net_message.maxsize);
+	decompressTime += Sys_DoubleTime () - start;
+
+	if (size < 0)
+	{
+		corruptMessages++;
+		SZ_Clear (&net_message);
+		return false;
+	}
+	decompressedBytes += size;
+	net_message.cursize = size;
+	return true;
+}
+
+
+/*
+==============================================================================
+
+WINDOWED RELIABLE TRANSPORT
+
+Used instead of the stop-and-wait scheme below when both ends asked for it
+at connect time. Reliable messages are cut into NET_WINDOWFRAG byte
+packets, numbered like before, and up to net_window of them are in flight
+at once. The receiver keeps packets that arrive out of order and answers
+every one with an ACK carrying the next sequence it expects and a bit mask
+of the packets after that it already has. A packet is sent again when it
+isn't acknowledged within a timeout derived from the measured round trip
+time, or as soon as three packets sent after it have been. A new message
+can be queued while the previous one is still in flight; messages come
+out on the other end whole and in order, as before.
+
+To compare it with stop-and-wait over a bad link, start a server with the
+simulator in net_sim.c set to 100 ms round trips, 10% jitter and 2% loss
+each way:
+
+	quake -dedicated 4 +net_sim_seed 1 +net_sim_in_delay 50 +net_sim_out_delay 50
+		+net_sim_in_jitter 5 +net_sim_out_jitter 5 +net_sim_in_loss 2
+		+net_sim_out_loss 2 +map e1m1
+
+Connect a client to it with "connect 127.0.0.1", then run "changelevel
+e1m1" on the server and, once the client is back in, "sv_signonstats": it
+prints the time from the map start until every client had spawned,
+including the client loading the map. Running the client with net_window 0
+gives stop-and-wait; repeat each setting a few times and compare medians.
+The simulator drops whole datagrams where a real link loses IP fragments,
+so at the same loss rate it is kinder to stop-and-wait's big datagrams.
+
+==============================================================================
+*/
+
+typedef struct
+{
+	int			length;
+	qboolean	eom;
+	qboolean	compressed;
+	qboolean	acked;
+	qboolean	resend;		// sent again without waiting for the timeout
+	qboolean	fastResent;
+	int			sends;
+	double		sendTime;
+	byte		data[NET_WINDOWFRAG];
+} netfrag_t;
+
+typedef struct netwindow_s
+{
+// sending: sock->ackSequence is the oldest packet not acknowledged,
+// sock->sendSequence the first one not sent yet
+	unsigned int	queueSequence;		// the next to be queued
+	netfrag_t		frags[NET_MAXFRAGS];	// by sequence % NET_MAXFRAGS
+	double			srtt;
+	double			rttvar;
+	double			rto;
+	qboolean		rttValid;
+
+// receiving: packets after sock->receiveSequence
+	qboolean		recvValid[NET_MAXWINDOW];	// by sequence % NET_MAXWINDOW
+	unsigned int	recvSequence[NET_MAXWINDOW];
+	int				recvLength[NET_MAXWINDOW];
+	qboolean		recvEom[NET_MAXWINDOW];
+	qboolean		recvCompressed[NET_MAXWINDOW];
+	byte			recvData[NET_MAXWINDOW][NET_WINDOWFRAG];
+} netwindow_t;
+
+#define NET_MINRTO		0.05
+#define NET_MAXRTO		3.0
+
+cvar_t	net_window = {"net_window", "48", CVAR_NONE};
+
+/* statistic counters */
+static int fastReSent = 0;
+static int windowStalls = 0;
+
+
+static void Window_Open (qsocket_t *sock)
+{
+	sock->window = (netwindow_t *) calloc (1, sizeof(netwindow_t));
+	if (!sock->window)
+		Sys_Error ("Window_Open: out of memory");
+	sock->window->queueSequence = sock->sendSequence;
+	sock->window->rto = 1.0;
+}
+
+
+static qboolean Window_CanQueue (qsocket_t *sock)
+{
+	return sock->window->queueSequence - sock->ackSequence + NET_MSGFRAGS <= NET_MAXFRAGS;
+}
+
+
+static int Window_SendPacket (qsocket_t *sock, unsigned int sequence)
+{
+	netfrag_t		*f = &sock->window->frags[sequence % NET_MAXFRAGS];
+	unsigned int	packetLen;
+
+	packetLen = NET_HEADERSIZE + f->length;
+	packetBuffer.length = BigLong(packetLen | NETFLAG_DATA | (f->eom ? NETFLAG_EOM : 0) |
+		(f->compressed ? NETFLAG_COMPRESSED : 0));
+	packetBuffer.sequence = BigLong(sequence);
+	Q_memcpy (packetBuffer.data, f->data, f->length);
+
+	if (f->sends)
+		packetsReSent++;
+	else
+		packetsSent++;
+	f->sends++;
+	f->sendTime = net_time;
+	f->resend = false;
+
+	if (NET_SimWrite (sock->landriver, sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+		return -1;
+
+	sock->lastSendTime = net_time;
+	return 1;
+}
+
+
+/*
+Sends whatever is due: packets that timed out or were found missing, then
+new ones as far as the window allows
+*/
+static int Window_Transmit (qsocket_t *sock)
+{
+	netwindow_t		*w = sock->window;
+	netfrag_t		*f;
+	unsigned int	s, window;
+	qboolean		timedOut = false;
+
+	for (s = sock->ackSequence; s != sock->sendSequence; s++)
+	{
+		f = &w->frags[s % NET_MAXFRAGS];
+		if (f->acked)
+			continue;
+		if (!f->resend)
+		{
+			if (net_time - f->sendTime <= w->rto)
+				continue;
+			timedOut = true;
+		}
+		if (Window_SendPacket (sock, s) == -1)
+			return -1;
+	}
+	if (timedOut)
+		w->rto = q_min (w->rto * 2.0, NET_MAXRTO);	// back off until an ACK gets through
+
+	window = (unsigned int) CLAMP (1, (int) net_window.value, NET_MAXWINDOW);
+	while (sock->sendSequence != w->queueSequence)
+	{
+		if (sock->sendSequence - sock->ackSequence >= window)
+		{
+			windowStalls++;
+			break;
+		}
+		if (Window_SendPacket (sock, sock->sendSequence++) == -1)
+			return -1;
+	}
+
+	return 1;
+}
+
+
+static int Window_SendMessage (qsocket_t *sock, const netpart_t *parts, int numparts, int size)
+{
+	netwindow_t	*w = sock->window;
+	netfrag_t	*f;
+	netpart_t	packed;
+	int			offset, length;
+	qboolean	compressed;
+
+	if (!Window_CanQueue (sock))
+		return 0;
+
+	packed.size = Datagram_PackParts (sock, parts, numparts, size, compressBuffer);
+	compressed = (packed.size != 0);
+	if (compressed)
+	{
+		packed.data = compressBuffer;
+		parts = &packed;
+		numparts = 1;
+		size = packed.size;
+	}
+
+	offset = 0;
+	do
+	{
+		length = q_min (size - offset, NET_WINDOWFRAG);
+		f = &w->frags[w->queueSequence++ % NET_MAXFRAGS];
+		f->length = length;
+		f->eom = (offset + length == size);
+		f->compressed = compressed;
+		f->acked = false;
+		f->resend = false;
+		f->fastResent = false;
+		f->sends = 0;
+		NET_GatherParts (parts, numparts, offset, f->data, length);
+		offset += length;
+	} while (offset < size);
+
+	sock->canSend = Window_CanQueue (sock);
+
+	return Window_Transmit (sock);
+}
+
+
+static void Window_Acked (netwindow_t *w, unsigned int sequence)
+{
+	netfrag_t	*f = &w->frags[sequence % NET_MAXFRAGS];
+	double		rtt;
+
+	if (f->acked)
+		return;
+	f->acked = true;
+
+	// only packets sent once say how long the round trip took
+	if (f->sends != 1)
+		return;
+	rtt = net_time - f->sendTime;
+	if (!w->rttValid)
+	{
+		w->srtt = rtt;
+		w->rttvar = rtt / 2;
+		w->rttValid = true;
+	}
+	else
+	{
+		w->rttvar = 0.75 * w->rttvar + 0.25 * fabs (w->srtt - rtt);
+		w->srtt = 0.875 * w->srtt + 0.125 * rtt;
+	}
+	w->rto = CLAMP (NET_MINRTO, w->srtt + 4 * w->rttvar, NET_MAXRTO);
+}
+
+
+static void Window_ReceiveAck (qsocket_t *sock, unsigned int next, byte *data, int length)
+{
+	netwindow_t		*w = sock->window;
+	netfrag_t		*f;
+	unsigned int	mask[2], s, highest;
+	int				i;
+
+	if (next - sock->ackSequence > sock->sendSequence - sock->ackSequence)
+	{
+		Con_DPrintf("Stale ACK received\n");
+		return;
+	}
+
+	for (s = sock->ackSequence; s != next; s++)
+		Window_Acked (w, s);
+	sock->ackSequence = next;
+
+	highest = next;
+	if (length >= 8)
+	{
+		mask[0] = BigLong (((unsigned int *)data)[0]);
+		mask[1] = BigLong (((unsigned int *)data)[1]);
+		for (i = 0; i < NET_MAXWINDOW - 1; i++)
+		{
+			if (!(mask[i >> 5] & (1u << (i & 31))))
+				continue;
+			s = next + 1 + i;
+			if (s - next >= sock->sendSequence - next)
+				break;
+			Window_Acked (w, s);
+			highest = s;
+		}
+	}
+
+	// anything three or more packets older than one that got through is lost
+	for (s = next; s - next + 3 <= highest - next; s++)
+	{
+		f = &w->frags[s % NET_MAXFRAGS];
+		if (!f->acked && !f->fastResent)
+		{
+			f->resend = f->fastResent = true;
+			fastReSent++;
+		}
+	}
+
+	sock->canSend = Window_CanQueue (sock);
+}
+
+
+static void Window_SendAck (qsocket_t *sock, struct qsockaddr *addr)
+{
+	netwindow_t		*w = sock->window;
+	unsigned int	ack[4], mask[2], s;
+	int				i, slot;
+
+	mask[0] = mask[1] = 0;
+	for (i = 0; i < NET_MAXWINDOW - 1; i++)
+	{
+		s = sock->receiveSequence + 1 + i;
+		slot = s % NET_MAXWINDOW;
+		if (w->recvValid[slot] && w->recvSequence[slot] == s)
+			mask[i >> 5] |= 1u << (i & 31);
+	}
+
+	ack[0] = BigLong((NET_HEADERSIZE + 8) | NETFLAG_ACK);
+	ack[1] = BigLong(sock->receiveSequence);
+	ack[2] = BigLong(mask[0]);
+	ack[3] = BigLong(mask[1]);
+	NET_SimWrite (sock->landriver, sock->socket, (byte *)ack, sizeof(ack), addr);
+}
+
+
+static void Window_ReceiveData (qsocket_t *sock, unsigned int sequence, unsigned int flags, byte *data, int length)
+{
+	netwindow_t	*w = sock->window;
+	int			slot;
+
+	if (sequence - sock->receiveSequence >= NET_MAXWINDOW || length < 0 || length > NET_WINDOWFRAG)
+	{
+		receivedDuplicateCount++;	// already have it, or it's too far ahead
+		return;
+	}
+
+	slot = sequence % NET_MAXWINDOW;
+	if (w->recvValid[slot] && w->recvSequence[slot] == sequence)
+	{
+		receivedDuplicateCount++;
+		return;
+	}
+	w->recvValid[slot] = true;
+	w->recvSequence[slot] = sequence;
+	w->recvLength[slot] = length;
+	w->recvEom[slot] = (flags & NETFLAG_EOM) != 0;
+	w->recvCompressed[slot] = (flags & NETFLAG_COMPRESSED) != 0;
+	Q_memcpy (w->recvData[slot], data, length);
+}
+
+
+/*
+Puts the next complete message into net_message and returns 1, or returns 0,
+or -1 if the message couldn't be inflated
+*/
+static int Window_Deliver (qsocket_t *sock)
+{
+	netwindow_t	*w = sock->window;
+	int			slot, length;
+
+	while (1)
+	{
+		slot = sock->receiveSequence % NET_MAXWINDOW;
+		if (!w->recvValid[slot] || w->recvSequence[slot] != sock->receiveSequence)
+			return 0;
+		w->recvValid[slot] = false;
+		sock->receiveSequence++;
+
+		if (sock->receiveMessageLength + w->recvLength[slot] > NET_MAXMESSAGE)
+		{
+			Con_DPrintf("Oversized reliable message dropped\n");
+			sock->receiveMessageLength = 0;
+			continue;
+		}
+		Q_memcpy(sock->receiveMessage + sock->receiveMessageLength, w->recvData[slot], w->recvLength[slot]);
+		sock->receiveMessageLength += w->recvLength[slot];
+
+		if (w->recvEom[slot])
+		{
+			length = sock->receiveMessageLength;
+			sock->receiveMessageLength = 0;
+			if (w->recvCompressed[slot])
+			{
+				if (Datagram_Unpack (sock->receiveMessage, length))
+					return 1;
+				Con_Printf("Corrupt compressed message\n");
+				return -1;
+			}
+			SZ_Clear(&net_message);
+			SZ_Write(&net_message, sock->receiveMessage, length);
+			return 1;
+		}
+	}
+}
+
+
+/*
+==============================================================================
+
+ADDRESS HASH
+
+Connections are kept in two hash tables, one keyed by remote address and
+port and one by address alone, so finding the connection a packet belongs
+to, or the one a reconnecting client left behind, doesn't mean comparing
+against every active socket. Land drivers without an AddrHash function
+fall back to that walk.
+
+With net_sharedport set, accepted clients keep talking to the listen port
+instead of being given a socket of their own. Datagram_Drain reads all
+that is waiting on the listen socket in one pass and queues every packet
+on the connection it came from, control packets on a queue of their own
+for _Datagram_CheckNewConnections.
+
+==============================================================================
+*/
+
+#define NET_HASHSIZE		256
+#define NET_MAXQUEUE		(256 * 1024)	// bytes queued per connection
+#define NET_MAXDRAIN		1024			// packets read per drain
+#define NET_DRAININTERVAL	0.005
+#define NET_HASHBENCH		(1 << 20)	// lookups per net_hashbench run
+
+typedef struct netqueue_s
+{
+	byte	*data;
+	int		size;
+	int		head;
+	int		tail;
+} netqueue_t;
+
+typedef struct
+{
+	qsocket_t	*addr[NET_HASHSIZE];	// by address and port
+	qsocket_t	*host[NET_HASHSIZE];	// by address
+} nethash_t;
+
+cvar_t	net_sharedport = {"net_sharedport", "0", CVAR_NONE};
+
+static nethash_t	net_hash;
+static netqueue_t	controlQueue[MAX_NET_DRIVERS];
+static sys_socket_t	controlSocket[MAX_NET_DRIVERS];
+static double		lastDrain[MAX_NET_DRIVERS];
+
+/* statistic counters */
+static int drainedPackets = 0;
+static int strayPackets = 0;
+static int queueDrops = 0;
+
+
+static void Hash_Insert (nethash_t *hash, qsocket_t *sock)
+{
+	unsigned int	h;
+
+	if (!sfunc.AddrHash || sock->hashed)
+		return;
+
+	h = sfunc.AddrHash (&sock->addr, true) & (NET_HASHSIZE - 1);
+	sock->hashnext = hash->addr[h];
+	hash->addr[h] = sock;
+
+	h = sfunc.AddrHash (&sock->addr, false) & (NET_HASHSIZE - 1);
+	sock->hostnext = hash->host[h];
+	hash->host[h] = sock;
+
+	sock->hashed = true;
+}
+
+static void Hash_Remove (nethash_t *hash, qsocket_t *sock)
+{
+	qsocket_t	**link;
+
+	if (!sock->hashed)
+		return;
+
+	link = &hash->addr[sfunc.AddrHash (&sock->addr, true) & (NET_HASHSIZE - 1)];
+	for ( ; *link; link = &(*link)->hashnext)
+	{
+		if (*link == sock)
+		{
+			*link = sock->hashnext;
+			break;
+		}
+	}
+
+	link = &hash->host[sfunc.AddrHash (&sock->addr, false) & (NET_HASHSIZE - 1)];
+	for ( ; *link; link = &(*link)->hostnext)
+	{
+		if (*link == sock)
+		{
+			*link = sock->hostnext;
+			break;
+		}
+	}
+
+	sock->hashnext = sock->hostnext = NULL;
+	sock->hashed = false;
+}
+
+// the connection on land driver l with address addr, or with only the same
+// host when port is false, found by comparing against every socket in list
+static qsocket_t *Hash_Walk (qsocket_t *list, int l, struct qsockaddr *addr, qboolean port)
+{
+	qsocket_t	*s;
+	qsocket_t	*host = NULL;
+	int			ret;
+
+	for (s = list; s; s = s->next)
+	{
+		if (s->driver != myDriverLevel || s->landriver != l)
+			continue;
+		ret = net_landrivers[l].AddrCompare (addr, &s->addr);
+		if (ret == 0)
+			return s;
+		if (ret > 0 && !host)
+			host = s;
+	}
+
+	return port ? NULL : host;
+}
+
+// same as Hash_Walk over net_activeSockets, an exact match is preferred
+static qsocket_t *Hash_Find (nethash_t *hash, int l, struct qsockaddr *addr, qboolean port)
+{
+	net_landriver_t	*driver = &net_landrivers[l];
+	qsocket_t	*s;
+
+	if (!driver->AddrHash)
+		return Hash_Walk (net_activeSockets, l, addr, port);
+
+	for (s = hash->addr[driver->AddrHash (addr, true) & (NET_HASHSIZE - 1)]; s; s = s->hashnext)
+		if (s->landriver == l && driver->AddrCompare (addr, &s->addr) == 0)
+			return s;
+	if (port)
+		return NULL;
+
+	for (s = hash->host[driver->AddrHash (addr, false) & (NET_HASHSIZE - 1)]; s; s = s->hostnext)
+		if (s->landriver == l && driver->AddrCompare (addr, &s->addr) >= 0)
+			return s;
+	return NULL;
+}
+
+
+static void Queue_Push (netqueue_t *q, struct qsockaddr *addr, byte *data, int length)
+{
+	int		need = sizeof(int) + sizeof(struct qsockaddr) + length;
+	int		size;
+
+	if (q->head == q->tail)
+		q->head = q->tail = 0;
+	else if (q->head && q->tail + need > q->size)
+	{
+		memmove (q->data, q->data + q->head, q->tail - q->head);
+		q->tail -= q->head;
+		q->head = 0;
+	}
+
+	if (q->tail + need > q->size)
+	{
+		if (q->tail + need > NET_MAXQUEUE)
+		{
+			queueDrops++;
+			return;
+		}
+		for (size = q->size ? q->size : 4096; size < q->tail + need; size *= 2)
+			;
+		size = q_min (size, NET_MAXQUEUE);
+		q->data = (byte *) realloc (q->data, size);
+		if (!q->data)
+			Sys_Error ("Queue_Push: out of memory");
+		q->size = size;
+	}
+
+	memcpy (q->data + q->tail, &length, sizeof(int));
+	memcpy (q->data + q->tail + sizeof(int), addr, sizeof(struct qsockaddr));
+	memcpy (q->data + q->tail + sizeof(int) + sizeof(struct qsockaddr), data, length);
+	q->tail += need;
+}
+
+// returns the length of the packet copied to data, 0 if the queue is empty
+static int Queue_Pop (netqueue_t *q, struct qsockaddr *addr, byte *data, int maxlen)
+{
+	int		length;
+
+	if (q->head == q->tail)
+		return 0;
+
+	memcpy (&length, q->data + q->head, sizeof(int));
+	memcpy (addr, q->data + q->head + sizeof(int), sizeof(struct qsockaddr));
+	memcpy (data, q->data + q->head + sizeof(int) + sizeof(struct qsockaddr), q_min (length, maxlen));
+	q->head += sizeof(int) + sizeof(struct qsockaddr) + length;
+
+	return q_min (length, maxlen);
+}
+
+static void Queue_Free (netqueue_t *q)
+{
+	free (q->data);
+	memset (q, 0, sizeof(*q));
+}
+
+
+/*
+Reads everything waiting on land driver l's listen socket and hands each
+packet to the shared connection it came from
+*/
+static void Datagram_Drain (int l)
+{
+	struct qsockaddr addr;
+	sys_socket_t	acceptsock;
+	qsocket_t		*s;
+	int				i, len, control;
+
+	lastDrain[l] = net_time;
+
+	for (i = 0; i < NET_MAXDRAIN; i++)
+	{
+		acceptsock = NET_SimCheckNewConnections (l);
+		if (acceptsock == INVALID_SOCKET)
+			break;
+		len = NET_SimRead (l, acceptsock, (byte *)&packetBuffer, NET_DATAGRAMSIZE, &addr);
+		if (len == -1)
+			break;
+		if (len < (int) sizeof(int))
+			continue;
+		drainedPackets++;
+
+		control = BigLong(packetBuffer.length);
+		if (control != -1 && (control & NETFLAG_CTL))
+		{
+			controlSocket[l] = acceptsock;
+			Queue_Push (&controlQueue[l], &addr, (byte *)&packetBuffer, len);
+			continue;
+		}
+
+		s = Hash_Find (&net_hash, l, &addr, true);
+		if (s && s->shared)
+			Queue_Push (s->queue, &addr, (byte *)&packetBuffer, len);
+		else
+			strayPackets++;
+	}
+}
+
+// Read for shared connections
+static int Datagram_ReadShared (qsocket_t *sock, struct qsockaddr *addr)
+{
+	if (sock->socket == INVALID_SOCKET)
+		return -1;
+	if (sock->queue->head == sock->queue->tail && net_time - lastDrain[sock->landriver] > NET_DRAININTERVAL)
+		Datagram_Drain (sock->landriver);
+	return Queue_Pop (sock->queue, addr, (byte *)&packetBuffer, NET_DATAGRAMSIZE);
+}
+
+
+/*
+net_hashbench [connections]
+
+Times finding the owner of random packets through the address hash and by
+comparing against every connection, for 4, 64 and 255 connections unless
+a count is given
+*/
+static void NET_HashBench_f (void)
+{
+	static const int	defaultcounts[] = {4, 64, 255};
+	const int	*counts = defaultcounts;
+	int			numcounts = countof(defaultcounts);
+	int			count, l, c, i, mismatches;
+	unsigned int	seed;
+	char		name[32];
+	qsocket_t	*socks, *s;
+	nethash_t	*hash;
+	struct qsockaddr *packets;
+	double		start, walktime, hashtime;
+
+	for (l = 0; l < net_numlandrivers; l++)
+		if (net_landrivers[l].initialized && net_landrivers[l].AddrHash)
+			break;
+	if (l == net_numlandrivers)
+	{
+		Con_Printf ("No land driver with an address hash\n");
+		return;
+	}
+
+	if (Cmd_Argc () >= 2)
+	{
+		count = q_max (Q_atoi (Cmd_Argv (1)), 1);
+		counts = &count;
+		numcounts = 1;
+	}
+
+	packets = (struct qsockaddr *) malloc (NET_HASHBENCH * sizeof(*packets));
+	hash = (nethash_t *) malloc (sizeof(*hash));
+	if (!packets || !hash)
+		Sys_Error ("NET_HashBench_f: out of memory");
+
+	for (c = 0; c < numcounts; c++)
+	{
+		// a few clients share an address, as if behind the same NAT
+		socks = (qsocket_t *) calloc (counts[c], sizeof(qsocket_t));
+		if (!socks)
+			Sys_Error ("NET_HashBench_f: out of memory");
+		memset (hash, 0, sizeof(*hash));
+		for (i = 0; i < counts[c]; i++)
+		{
+			s = &socks[i];
+			s->next = i + 1 < counts[c] ? &socks[i + 1] : NULL;
+			s->driver = myDriverLevel;
+			s->landriver = l;
+			q_snprintf (name, sizeof(name), "10.%i.%i.%i:%i", (i >> 10) & 255, (i >> 2) & 255, 1 + (i & 1), 26000 + (i & 3));
+			net_landrivers[l].StringToAddr (name, &s->addr);
+			Hash_Insert (hash, s);
+		}
+
+		seed = 1;
+		for (i = 0; i < NET_HASHBENCH; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			packets[i] = socks[(seed >> 16) % counts[c]].addr;
+		}
+
+		mismatches = 0;
+		start = Sys_DoubleTime ();
+		for (i = 0; i < NET_HASHBENCH; i++)
+			if (!Hash_Walk (socks, l, &packets[i], true))
+				mismatches++;
+		walktime = Sys_DoubleTime () - start;
+
+		start = Sys_DoubleTime ();
+		for (i = 0; i < NET_HASHBENCH; i++)
+			if (!Hash_Find (hash, l, &packets[i], true))
+				mismatches++;
+		hashtime = Sys_DoubleTime () - start;
+
+		for (i = 0; i < NET_HASHBENCH; i += 61)
+			if (Hash_Walk (socks, l, &packets[i], true) != Hash_Find (hash, l, &packets[i], true))
+				mismatches++;
+
+		Con_Printf ("%3i connections: walk %7.2f, hash %7.2f Mpackets/s%s\n", counts[c],
+			NET_HASHBENCH / (walktime * 1e6), NET_HASHBENCH / (hashtime * 1e6),
+			mismatches ? " (MISMATCH)" : "");
+
+		for (i = 0; i < counts[c]; i++)
+			Hash_Remove (hash, &socks[i]);
+		free (socks);
+	}
+
+	free (packets);
+	free (hash);
+}
+
+
+int Datagram_SendMessage (qsocket_t *sock, const netpart_t *parts, int numparts)
 {
 	unsigned int	packetLen;
 	unsigned int	dataLen;
 	unsigned int	eom;
+	int				size;
+
+	size = NET_PartsSize (parts, numparts);
 
 #ifdef DEBUG
-	if (data->cursize == 0)
+	if (size == 0)
 		Sys_Error("Datagram_SendMessage: zero length message");
 
-	if (data->cursize > NET_MAXMESSAGE)
-		Sys_Error("Datagram_SendMessage: message too big: %u", data->cursize);
+	if (size > NET_MAXMESSAGE)
+		Sys_Error("Datagram_SendMessage: message too big: %u", size);
 
 	if (sock->canSend == false)
 		Sys_Error("SendMessage: called with canSend == false");
 #endif
 
-	Q_memcpy(sock->sendMessage, data->data, data->cursize);
-	sock->sendMessageLength = data->cursize;
+	if (sock->window)
+		return Window_SendMessage (sock, parts, numparts, size);
 
-	if (data->cursize <= MAX_DATAGRAM)
+	sock->sendMessageLength = Datagram_PackParts (sock, parts, numparts, size, sock->sendMessage);
+	sock->sendCompressed = (sock->sendMessageLength != 0);
+	if (!sock->sendCompressed)
 	{
-		dataLen = data->cursize;
+		NET_GatherParts (parts, numparts, 0, sock->sendMessage, size);
+		sock->sendMessageLength = size;
+	}
+
+	if (sock->sendMessageLength <= MAX_DATAGRAM)
+	{
+		dataLen = sock->sendMessageLength;
 		eom = NETFLAG_EOM;
 	}
 	else
@@ -159,6 +1006,8 @@ int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 		dataLen = MAX_DATAGRAM;
 		eom = 0;
 	}
+	if (sock->sendCompressed)
+		eom |= NETFLAG_COMPRESSED;
 	packetLen = NET_HEADERSIZE + dataLen;
 
 	packetBuffer.length = BigLong(packetLen | (NETFLAG_DATA | eom));
@@ -167,7 +1016,7 @@ int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 
 	sock->canSend = false;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (NET_SimWrite (sock->landriver, sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -192,6 +1041,8 @@ static int SendMessageNext (qsocket_t *sock)
 		dataLen = MAX_DATAGRAM;
 		eom = 0;
 	}
+	if (sock->sendCompressed)
+		eom |= NETFLAG_COMPRESSED;
 	packetLen = NET_HEADERSIZE + dataLen;
 
 	packetBuffer.length = BigLong(packetLen | (NETFLAG_DATA | eom));
@@ -200,7 +1051,7 @@ static int SendMessageNext (qsocket_t *sock)
 
 	sock->sendNext = false;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (NET_SimWrite (sock->landriver, sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -225,6 +1076,8 @@ static int ReSendMessage (qsocket_t *sock)
 		dataLen = MAX_DATAGRAM;
 		eom = 0;
 	}
+	if (sock->sendCompressed)
+		eom |= NETFLAG_COMPRESSED;
 	packetLen = NET_HEADERSIZE + dataLen;
 
 	packetBuffer.length = BigLong(packetLen | (NETFLAG_DATA | eom));
@@ -233,7 +1086,7 @@ static int ReSendMessage (qsocket_t *sock)
 
 	sock->sendNext = false;
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (NET_SimWrite (sock->landriver, sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	sock->lastSendTime = net_time;
@@ -244,7 +1097,9 @@ static int ReSendMessage (qsocket_t *sock)
 
 qboolean Datagram_CanSendMessage (qsocket_t *sock)
 {
-	if (sock->sendNext)
+	if (sock->window)
+		Window_Transmit (sock);
+	else if (sock->sendNext)
 		SendMessageNext (sock);
 
 	return sock->canSend;
@@ -259,7 +1114,9 @@ qboolean Datagram_CanSendUnreliableMessage (qsocket_t *sock)
 
 int Datagram_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 {
-	int	packetLen;
+	int				packetLen;
+	int				dataLen;
+	unsigned int	flags;
 
 #ifdef DEBUG
 	if (data->cursize == 0)
@@ -269,13 +1126,21 @@ int Datagram_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 		Sys_Error("Datagram_SendUnreliableMessage: message too big: %u", data->cursize);
 #endif
 
-	packetLen = NET_HEADERSIZE + data->cursize;
+	dataLen = Datagram_Pack (sock, data->data, data->cursize, packetBuffer.data);
+	if (dataLen)
+		flags = NETFLAG_UNRELIABLE | NETFLAG_COMPRESSED;
+	else
+	{
+		Q_memcpy (packetBuffer.data, data->data, data->cursize);
+		dataLen = data->cursize;
+		flags = NETFLAG_UNRELIABLE;
+	}
+	packetLen = NET_HEADERSIZE + dataLen;
 
-	packetBuffer.length = BigLong(packetLen | NETFLAG_UNRELIABLE);
+	packetBuffer.length = BigLong(packetLen | flags);
 	packetBuffer.sequence = BigLong(sock->unreliableSendSequence++);
-	Q_memcpy (packetBuffer.data, data->data, data->cursize);
 
-	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+	if (NET_SimWrite (sock->landriver, sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
 		return -1;
 
 	packetsSent++;
@@ -292,14 +1157,25 @@ int	Datagram_GetMessage (qsocket_t *sock)
 	unsigned int	sequence;
 	unsigned int	count;
 
-	if (!sock->canSend)
+	if (sock->window)
+	{
+		Window_Transmit (sock);
+		// messages completed by an earlier packet come first
+		ret = Window_Deliver (sock);
+		if (ret)
+			return ret;
+	}
+	else if (!sock->canSend)
 		if ((net_time - sock->lastSendTime) > 1.0)
 			ReSendMessage (sock);
 
 	while (1)
 	{
-		length = (unsigned int) sfunc.Read(sock->socket, (byte *)&packetBuffer,
-							NET_DATAGRAMSIZE, &readaddr);
+		if (sock->shared)
+			length = (unsigned int) Datagram_ReadShared (sock, &readaddr);
+		else
+			length = (unsigned int) NET_SimRead (sock->landriver, sock->socket, (byte *)&packetBuffer,
+								NET_DATAGRAMSIZE, &readaddr);
 
 	//	if ((rand() & 255) > 220)
 	//		continue;
@@ -334,6 +1210,13 @@ int	Datagram_GetMessage (qsocket_t *sock)
 		if (flags & NETFLAG_CTL)
 			continue;
 
+		// only inflate for peers that asked for it at connect time
+		if ((flags & NETFLAG_COMPRESSED) && !sock->compress)
+		{
+			corruptMessages++;
+			continue;
+		}
+
 		sequence = BigLong(packetBuffer.sequence);
 		packetsReceived++;
 
@@ -355,8 +1238,16 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 			length -= NET_HEADERSIZE;
 
-			SZ_Clear (&net_message);
-			SZ_Write (&net_message, packetBuffer.data, length);
+			if (flags & NETFLAG_COMPRESSED)
+			{
+				if (!Datagram_Unpack (packetBuffer.data, length))
+					continue;	// lost, like any other datagram
+			}
+			else
+			{
+				SZ_Clear (&net_message);
+				SZ_Write (&net_message, packetBuffer.data, length);
+			}
 
 			ret = 2;
 			break;
@@ -364,6 +1255,11 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 		if (flags & NETFLAG_ACK)
 		{
+			if (sock->window)
+			{
+				Window_ReceiveAck (sock, sequence, packetBuffer.data, length - NET_HEADERSIZE);
+				continue;
+			}
 			if (sequence != (sock->sendSequence - 1))
 			{
 				Con_DPrintf("Stale ACK received\n");
@@ -396,9 +1292,19 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 		if (flags & NETFLAG_DATA)
 		{
+			if (sock->window)
+			{
+				Window_ReceiveData (sock, sequence, flags, packetBuffer.data, length - NET_HEADERSIZE);
+				ret = Window_Deliver (sock);
+				Window_SendAck (sock, &readaddr);
+				if (ret)
+					break;
+				continue;
+			}
+
 			packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
 			packetBuffer.sequence = BigLong(sequence);
-			sfunc.Write (sock->socket, (byte *)&packetBuffer, NET_HEADERSIZE, &readaddr);
+			NET_SimWrite (sock->landriver, sock->socket, (byte *)&packetBuffer, NET_HEADERSIZE, &readaddr);
 
 			if (sequence != sock->receiveSequence)
 			{
@@ -411,6 +1317,21 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 			if (flags & NETFLAG_EOM)
 			{
+				if (flags & NETFLAG_COMPRESSED)
+				{
+					ret = -1;
+					if (sock->receiveMessageLength + length <= NET_MAXMESSAGE)
+					{
+						Q_memcpy(sock->receiveMessage + sock->receiveMessageLength, packetBuffer.data, length);
+						if (Datagram_Unpack (sock->receiveMessage, sock->receiveMessageLength + length))
+							ret = 1;
+					}
+					sock->receiveMessageLength = 0;
+					if (ret == -1)
+						Con_Printf("Corrupt compressed message\n");
+					break;
+				}
+
 				SZ_Clear(&net_message);
 				SZ_Write(&net_message, sock->receiveMessage, sock->receiveMessageLength);
 				SZ_Write(&net_message, packetBuffer.data, length);
@@ -426,7 +1347,9 @@ int	Datagram_GetMessage (qsocket_t *sock)
 		}
 	}
 
-	if (sock->sendNext)
+	if (sock->window)
+		Window_Transmit (sock);
+	else if (sock->sendNext)
 		SendMessageNext (sock);
 
 	return ret;
@@ -438,6 +1361,12 @@ static void PrintStats(qsocket_t *s)
 	Con_Printf("canSend = %4u   \n", s->canSend);
 	Con_Printf("sendSeq = %4u   ", s->sendSequence);
 	Con_Printf("recvSeq = %4u   \n", s->receiveSequence);
+	if (s->window)
+	{
+		Con_Printf("ackSeq  = %4u   ", s->ackSequence);
+		Con_Printf("queued  = %4u   \n", s->window->queueSequence - s->ackSequence);
+		Con_Printf("rtt = %.1f ms   rto = %.1f ms\n", s->window->srtt * 1000.0, s->window->rto * 1000.0);
+	}
 	Con_Printf("\n");
 }
 
@@ -453,10 +1382,26 @@ static void NET_Stats_f (void)
 		Con_Printf("reliable messages received = %i\n", messagesReceived);
 		Con_Printf("packetsSent                = %i\n", packetsSent);
 		Con_Printf("packetsReSent              = %i\n", packetsReSent);
+		Con_Printf("fastReSent                 = %i\n", fastReSent);
+		Con_Printf("windowStalls               = %i\n", windowStalls);
 		Con_Printf("packetsReceived            = %i\n", packetsReceived);
+		Con_Printf("drainedPackets             = %i\n", drainedPackets);
+		Con_Printf("strayPackets               = %i\n", strayPackets);
+		Con_Printf("queueDrops                 = %i\n", queueDrops);
 		Con_Printf("receivedDuplicateCount     = %i\n", receivedDuplicateCount);
 		Con_Printf("shortPacketCount           = %i\n", shortPacketCount);
 		Con_Printf("droppedDatagrams           = %i\n", droppedDatagrams);
+		NET_SimStats ();
+		Con_Printf("compressedMessages         = %i\n", compressedMessages);
+		Con_Printf("uncompressedMessages       = %i\n", uncompressedMessages);
+		Con_Printf("corruptMessages            = %i\n", corruptMessages);
+		if (compressedIn)
+			Con_Printf("compression ratio          = %.1f%% (%.0f -> %.0f bytes)\n",
+				compressedOut * 100.0 / compressedIn, compressedIn, compressedOut);
+		if (compressAttempted)
+			Con_Printf("compress cost              = %.1f us/KB\n", compressTime * 1e6 * 1024.0 / compressAttempted);
+		if (decompressedBytes)
+			Con_Printf("decompress cost            = %.1f us/KB\n", decompressTime * 1e6 * 1024.0 / decompressedBytes);
 	}
 	else if (Q_strcmp(Cmd_Argv(1), "*") == 0)
 	{
@@ -537,7 +1482,7 @@ static void Test_Poll (void *unused)
 
 	while (1)
 	{
-		len = dfunc.Read (testSocket, net_message.data, net_message.maxsize, &clientaddr);
+		len = NET_SimRead (net_landriverlevel, testSocket, net_message.data, net_message.maxsize, &clientaddr);
 		if (len < (int) sizeof(int))
 			break;
 
@@ -573,6 +1518,7 @@ static void Test_Poll (void *unused)
 	}
 	else
 	{
+		NET_SimFlush (net_landriverlevel, testSocket);
 		dfunc.Close_Socket(testSocket);
 		testInProgress = false;
 	}
@@ -642,7 +1588,7 @@ JustDoIt:
 		MSG_WriteByte(&net_message, CCREQ_PLAYER_INFO);
 		MSG_WriteByte(&net_message, n);
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (testSocket, net_message.data, net_message.cursize, &sendaddr);
+		NET_SimWrite (net_landriverlevel, testSocket, net_message.data, net_message.cursize, &sendaddr);
 	}
 	SZ_Clear(&net_message);
 	SchedulePollProcedure(&testPollProcedure, 0.1);
@@ -667,7 +1613,7 @@ static void Test2_Poll (void *unused)
 	net_landriverlevel = test2Driver;
 	name[0] = 0;
 
-	len = dfunc.Read (test2Socket, net_message.data, net_message.maxsize, &clientaddr);
+	len = NET_SimRead (net_landriverlevel, test2Socket, net_message.data, net_message.maxsize, &clientaddr);
 	if (len < (int) sizeof(int))
 		goto Reschedule;
 
@@ -699,7 +1645,7 @@ static void Test2_Poll (void *unused)
 	MSG_WriteByte(&net_message, CCREQ_RULE_INFO);
 	MSG_WriteString(&net_message, name);
 	*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-	dfunc.Write (test2Socket, net_message.data, net_message.cursize, &clientaddr);
+	NET_SimWrite (net_landriverlevel, test2Socket, net_message.data, net_message.cursize, &clientaddr);
 	SZ_Clear(&net_message);
 
 Reschedule:
@@ -709,6 +1655,7 @@ Reschedule:
 Error:
 	Con_Printf("Unexpected response to Rule Info request\n");
 Done:
+	NET_SimFlush (net_landriverlevel, test2Socket);
 	dfunc.Close_Socket(test2Socket);
 	test2InProgress = false;
 	return;
@@ -773,7 +1720,7 @@ JustDoIt:
 	MSG_WriteByte(&net_message, CCREQ_RULE_INFO);
 	MSG_WriteString(&net_message, "");
 	*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-	dfunc.Write (test2Socket, net_message.data, net_message.cursize, &sendaddr);
+	NET_SimWrite (net_landriverlevel, test2Socket, net_message.data, net_message.cursize, &sendaddr);
 	SZ_Clear(&net_message);
 	SchedulePollProcedure(&test2PollProcedure, 0.05);
 }
@@ -791,6 +1738,10 @@ int Datagram_Init (void)
 	myDriverLevel = net_driverlevel;
 
 	Cmd_AddCommand ("net_stats", NET_Stats_f);
+	Cvar_RegisterVariable (&net_window);
+	Cvar_RegisterVariable (&net_compress);
+	Cvar_RegisterVariable (&net_sharedport);
+	Cmd_AddCommand ("net_hashbench", NET_HashBench_f);
 
 	if (safemode || COM_CheckParm("-nolan"))
 		return -1;
@@ -839,19 +1790,43 @@ void Datagram_Shutdown (void)
 
 void Datagram_Close (qsocket_t *sock)
 {
-	sfunc.Close_Socket(sock->socket);
+	Hash_Remove (&net_hash, sock);
+	if (sock->shared)
+	{
+		Queue_Free (sock->queue);
+		free (sock->queue);
+		sock->queue = NULL;
+		sock->shared = false;
+	}
+	else
+	{
+		NET_SimFlush (sock->landriver, sock->socket);
+		sfunc.Close_Socket(sock->socket);
+	}
+	free (sock->window);
+	sock->window = NULL;
 }
 
 
 void Datagram_Listen (qboolean state)
 {
+	qsocket_t	*s;
 	int i;
 
 	for (i = 0; i < net_numlandrivers; i++)
 	{
+		// requests read from the old listen socket can't be answered
+		Queue_Free (&controlQueue[i]);
+		NET_SimListen (i);
 		if (net_landrivers[i].initialized)
 			net_landrivers[i].Listen (state);
 	}
+
+	// shared connections go with the listen socket
+	if (!state)
+		for (s = net_activeSockets; s; s = s->next)
+			if (s->driver == myDriverLevel && s->shared)
+				s->socket = INVALID_SOCKET;
 }
 
 
@@ -866,17 +1841,18 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	int			len;
 	int			command;
 	int			control;
-	int			ret;
+	qboolean	windowed, compressed;
+	int			magic;
 
-	acceptsock = dfunc.CheckNewConnections();
-	if (acceptsock == INVALID_SOCKET)
-		return NULL;
+	if (controlQueue[net_landriverlevel].head == controlQueue[net_landriverlevel].tail)
+		Datagram_Drain (net_landriverlevel);
 
 	SZ_Clear(&net_message);
 
-	len = dfunc.Read (acceptsock, net_message.data, net_message.maxsize, &clientaddr);
+	len = Queue_Pop (&controlQueue[net_landriverlevel], &clientaddr, net_message.data, net_message.maxsize);
 	if (len < (int) sizeof(int))
 		return NULL;
+	acceptsock = controlSocket[net_landriverlevel];
 	net_message.cursize = len;
 
 	MSG_BeginReading ();
@@ -907,7 +1883,7 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 		MSG_WriteByte(&net_message, svs.maxclients);
 		MSG_WriteByte(&net_message, NET_PROTOCOL_VERSION);
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
+		NET_SimWrite (net_landriverlevel, acceptsock, net_message.data, net_message.cursize, &clientaddr);
 		SZ_Clear(&net_message);
 		return NULL;
 	}
@@ -946,7 +1922,7 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 		MSG_WriteLong(&net_message, (int)(net_time - client->netconnection->connecttime));
 		MSG_WriteString(&net_message, client->netconnection->address);
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
+		NET_SimWrite (net_landriverlevel, acceptsock, net_message.data, net_message.cursize, &clientaddr);
 		SZ_Clear(&net_message);
 
 		return NULL;
@@ -972,7 +1948,7 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 			MSG_WriteString(&net_message, var->string);
 		}
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
+		NET_SimWrite (net_landriverlevel, acceptsock, net_message.data, net_message.cursize, &clientaddr);
 		SZ_Clear(&net_message);
 
 		return NULL;
@@ -992,11 +1968,22 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 		MSG_WriteByte(&net_message, CCREP_REJECT);
 		MSG_WriteString(&net_message, "Incompatible version.\n");
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
+		NET_SimWrite (net_landriverlevel, acceptsock, net_message.data, net_message.cursize, &clientaddr);
 		SZ_Clear(&net_message);
 		return NULL;
 	}
 
+	// older clients don't send these
+	windowed = compressed = false;
+	while (msg_readcount + 4 <= net_message.cursize)
+	{
+		magic = MSG_ReadLong();
+		if (magic == NET_WINDOWMAGIC)
+			windowed = (net_window.value > 0);
+		else if (magic == NET_COMPRESSMAGIC)
+			compressed = (net_compress.value != 0);
+	}
+
 #ifdef BAN_TEST
 	// check for a ban
 	if (clientaddr.qsa_family == AF_INET)
@@ -1011,7 +1998,7 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 			MSG_WriteByte(&net_message, CCREP_REJECT);
 			MSG_WriteString(&net_message, "You have been banned.\n");
 			*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-			dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
+			NET_SimWrite (net_landriverlevel, acceptsock, net_message.data, net_message.cursize, &clientaddr);
 			SZ_Clear(&net_message);
 			return NULL;
 		}
@@ -1019,33 +2006,32 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 #endif
 
 	// see if this guy is already connected
-	for (s = net_activeSockets; s; s = s->next)
+	s = Hash_Find (&net_hash, net_landriverlevel, &clientaddr, false);
+	if (s)
 	{
-		if (s->driver != net_driverlevel)
-			continue;
-		ret = dfunc.AddrCompare(&clientaddr, &s->addr);
-		if (ret >= 0)
+		// is this a duplicate connection reqeust?
+		if (dfunc.AddrCompare(&clientaddr, &s->addr) == 0 && net_time - s->connecttime < 2.0)
 		{
-			// is this a duplicate connection reqeust?
-			if (ret == 0 && net_time - s->connecttime < 2.0)
-			{
-				// yes, so send a duplicate reply
-				SZ_Clear(&net_message);
-				// save space for the header, filled in later
-				MSG_WriteLong(&net_message, 0);
-				MSG_WriteByte(&net_message, CCREP_ACCEPT);
-				dfunc.GetSocketAddr(s->socket, &newaddr);
-				MSG_WriteLong(&net_message, dfunc.GetSocketPort(&newaddr));
-				*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-				dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
-				SZ_Clear(&net_message);
-				return NULL;
-			}
-			// it's somebody coming back in from a crash/disconnect
-			// so close the old qsocket and let their retry get them back in
-			NET_Close(s);
+			// yes, so send a duplicate reply
+			SZ_Clear(&net_message);
+			// save space for the header, filled in later
+			MSG_WriteLong(&net_message, 0);
+			MSG_WriteByte(&net_message, CCREP_ACCEPT);
+			dfunc.GetSocketAddr(s->socket, &newaddr);
+			MSG_WriteLong(&net_message, dfunc.GetSocketPort(&newaddr));
+			if (s->window)
+				MSG_WriteLong(&net_message, NET_WINDOWMAGIC);
+			if (s->compress)
+				MSG_WriteLong(&net_message, NET_COMPRESSMAGIC);
+			*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
+			NET_SimWrite (net_landriverlevel, acceptsock, net_message.data, net_message.cursize, &clientaddr);
+			SZ_Clear(&net_message);
 			return NULL;
 		}
+		// it's somebody coming back in from a crash/disconnect
+		// so close the old qsocket and let their retry get them back in
+		NET_Close(s);
+		return NULL;
 	}
 
 	// allocate a QSocket
@@ -1058,25 +2044,38 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 		MSG_WriteByte(&net_message, CCREP_REJECT);
 		MSG_WriteString(&net_message, "Server is full.\n");
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
+		NET_SimWrite (net_landriverlevel, acceptsock, net_message.data, net_message.cursize, &clientaddr);
 		SZ_Clear(&net_message);
 		return NULL;
 	}
 
-	// allocate a network socket
-	newsock = dfunc.Open_Socket(0);
-	if (newsock == INVALID_SOCKET)
+	if (net_sharedport.value)
 	{
-		NET_FreeQSocket(sock);
-		return NULL;
+		// stay on the listen socket, Datagram_Drain routes its packets
+		newsock = acceptsock;
+		sock->shared = true;
+		sock->queue = (netqueue_t *) calloc (1, sizeof(netqueue_t));
+		if (!sock->queue)
+			Sys_Error ("_Datagram_CheckNewConnections: out of memory");
 	}
-
-	// connect to the client
-	if (dfunc.Connect (newsock, &clientaddr) == -1)
+	else
 	{
-		dfunc.Close_Socket(newsock);
-		NET_FreeQSocket(sock);
-		return NULL;
+		// allocate a network socket
+		newsock = dfunc.Open_Socket(0);
+		if (newsock == INVALID_SOCKET)
+		{
+			NET_FreeQSocket(sock);
+			return NULL;
+		}
+
+		// connect to the client
+		if (dfunc.Connect (newsock, &clientaddr) == -1)
+		{
+			NET_SimFlush (net_landriverlevel, newsock);
+			dfunc.Close_Socket(newsock);
+			NET_FreeQSocket(sock);
+			return NULL;
+		}
 	}
 
 	// everything is allocated, just fill in the details
@@ -1084,6 +2083,10 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	sock->landriver = net_landriverlevel;
 	sock->addr = clientaddr;
 	Q_strcpy(sock->address, dfunc.AddrToString(&clientaddr));
+	if (windowed)
+		Window_Open (sock);
+	sock->compress = compressed;
+	Hash_Insert (&net_hash, sock);
 
 	// send him back the info about the server connection he has been allocated
 	SZ_Clear(&net_message);
@@ -1092,9 +2095,13 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	MSG_WriteByte(&net_message, CCREP_ACCEPT);
 	dfunc.GetSocketAddr(newsock, &newaddr);
 	MSG_WriteLong(&net_message, dfunc.GetSocketPort(&newaddr));
+	if (sock->window)
+		MSG_WriteLong(&net_message, NET_WINDOWMAGIC);
+	if (sock->compress)
+		MSG_WriteLong(&net_message, NET_COMPRESSMAGIC);
 //	MSG_WriteString(&net_message, dfunc.AddrToString(&newaddr));
 	*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-	dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
+	NET_SimWrite (net_landriverlevel, acceptsock, net_message.data, net_message.cursize, &clientaddr);
 	SZ_Clear(&net_message);
 
 	return sock;
@@ -1139,7 +2146,7 @@ static void _Datagram_SearchForHosts (qboolean xmit)
 		SZ_Clear(&net_message);
 	}
 
-	while ((ret = dfunc.Read (dfunc.controlSock, net_message.data, net_message.maxsize, &readaddr)) > 0)
+	while ((ret = NET_SimRead (net_landriverlevel, dfunc.controlSock, net_message.data, net_message.maxsize, &readaddr)) > 0)
 	{
 		if (ret < (int) sizeof(int))
 			continue;
@@ -1240,6 +2247,7 @@ static qsocket_t *_Datagram_Connect (const char *host)
 	int			reps;
 	double		start_time;
 	int			control;
+	int			magic;
 	const char		*reason;
 
 	// see if we can resolve the host name
@@ -1276,12 +2284,16 @@ static qsocket_t *_Datagram_Connect (const char *host)
 		MSG_WriteByte(&net_message, CCREQ_CONNECT);
 		MSG_WriteString(&net_message, "QUAKE");
 		MSG_WriteByte(&net_message, NET_PROTOCOL_VERSION);
+		if (net_window.value > 0)
+			MSG_WriteLong(&net_message, NET_WINDOWMAGIC);
+		if (net_compress.value)
+			MSG_WriteLong(&net_message, NET_COMPRESSMAGIC);
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
-		dfunc.Write (newsock, net_message.data, net_message.cursize, &sendaddr);
+		NET_SimWrite (net_landriverlevel, newsock, net_message.data, net_message.cursize, &sendaddr);
 		SZ_Clear(&net_message);
 		do
 		{
-			ret = dfunc.Read (newsock, net_message.data, net_message.maxsize, &readaddr);
+			ret = NET_SimRead (net_landriverlevel, newsock, net_message.data, net_message.maxsize, &readaddr);
 			// if we got something, validate it
 			if (ret > 0)
 			{
@@ -1363,6 +2375,15 @@ static qsocket_t *_Datagram_Connect (const char *host)
 	{
 		Q_memcpy(&sock->addr, &sendaddr, sizeof(struct qsockaddr));
 		dfunc.SetSocketPort (&sock->addr, MSG_ReadLong());
+		// older servers don't send these
+		while (msg_readcount + 4 <= net_message.cursize)
+		{
+			magic = MSG_ReadLong();
+			if (magic == NET_WINDOWMAGIC && net_window.value > 0 && !sock->window)
+				Window_Open (sock);
+			else if (magic == NET_COMPRESSMAGIC && net_compress.value)
+				sock->compress = true;
+		}
 	}
 	else
 	{
@@ -1386,12 +2407,14 @@ static qsocket_t *_Datagram_Connect (const char *host)
 		goto ErrorReturn;
 	}
 
+	Hash_Insert (&net_hash, sock);
 	m_return_onerror = false;
 	return sock;
 
 ErrorReturn:
 	NET_FreeQSocket(sock);
 ErrorReturn2:
+	NET_SimFlush (net_landriverlevel, newsock);
 	dfunc.Close_Socket(newsock);
 	if (m_return_onerror)
 	{
@@ -28,7 +28,7 @@ void		Datagram_SearchForHosts (qboolean xmit);
 qsocket_t	*Datagram_Connect (const char *host);
 qsocket_t	*Datagram_CheckNewConnections (void);
 int			Datagram_GetMessage (qsocket_t *sock);
-int			Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data);
+int			Datagram_SendMessage (qsocket_t *sock, const netpart_t *parts, int numparts);
 int			Datagram_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data);
 qboolean	Datagram_CanSendMessage (qsocket_t *sock);
 qboolean	Datagram_CanSendUnreliableMessage (qsocket_t *sock);
@@ -30,9 +30,52 @@ static qboolean	localconnectpending = false;
 static qsocket_t	*loop_client = NULL;
 static qsocket_t	*loop_server = NULL;
 
+static qsocket_t	*loop_bots[MAX_SCOREBOARD];	// server ends not accepted yet
+static int			loop_numbots = 0;
+
+/*
+Messages wait in a small ring on the receiving socket, each one in a
+buffer of its own, and are passed on by handing over the buffer rather than
+copying it: NET_GetSendBuffer gives the sender an empty one to write into,
+sending puts it in the peer's ring, and reading lends it to net_message
+until the next NET_GetMessage. Senders with a buffer of their own still
+get it copied once. net_loopcopy 1 goes back to copying everything twice,
+to compare the two.
+*/
+#define LOOP_RINGSIZE	8					// messages waiting per socket
+#define LOOP_BUFFERS	(LOOP_RINGSIZE + 2)	// one may be lent, one handed out
+
+typedef struct
+{
+	byte		*data;
+	int			size;
+	int			type;		// as returned by Loop_GetMessage
+} loopmsg_t;
+
+typedef struct loopring_s
+{
+	loopmsg_t	msgs[LOOP_RINGSIZE];	// oldest first from head
+	int			head;
+	int			count;
+	byte		*free[LOOP_BUFFERS];	// buffers nobody owns
+	int			numfree;
+	int			numbuffers;
+} loopring_t;
+
+static byte			*loop_lent;			// net_message.data when lent
+static loopring_t	*loop_lentring;
+static byte			*loop_netdata;		// net_message.data otherwise
+static byte			*loop_handed;		// given out by Loop_GetSendBuffer
+static loopring_t	*loop_handedring;
+
+static cvar_t	net_loopcopy = {"net_loopcopy", "0", CVAR_NONE};
+double			net_loopcopied;			// bytes copied by the loopback driver
+
 int Loop_Init (void)
 {
-	if (cls.state == ca_dedicated)
+	Cvar_RegisterVariable (&net_loopcopy);
+
+	if (cls.state == ca_dedicated && !COM_CheckParm ("-bench"))
 		return -1;
 	return 0;
 }
@@ -43,6 +86,132 @@ void Loop_Shutdown (void)
 }
 
 
+/*
+Takes a buffer for a message to the socket from its ring, NULL if they are
+all in use
+*/
+static byte *Loop_TakeBuffer (qsocket_t *sock)
+{
+	loopring_t	*ring;
+	byte		*buffer;
+
+	if (!sock->ring)
+	{
+		sock->ring = (loopring_t *) calloc (1, sizeof(loopring_t));
+		if (!sock->ring)
+			Sys_Error ("Loop_TakeBuffer: out of memory");
+	}
+	ring = sock->ring;
+
+	if (ring->numfree)
+		return ring->free[--ring->numfree];
+	if (ring->numbuffers == LOOP_BUFFERS)
+		return NULL;
+
+	buffer = (byte *) malloc (NET_MAXMESSAGE);
+	if (!buffer)
+		Sys_Error ("Loop_TakeBuffer: out of memory");
+	ring->numbuffers++;
+	return buffer;
+}
+
+
+/*
+Gives net_message its own buffer back
+*/
+void Loop_ReturnMessage (void)
+{
+	if (!loop_lent)
+		return;
+
+	if (net_message.data == loop_lent)
+		net_message.data = loop_netdata;
+	loop_lentring->free[loop_lentring->numfree++] = loop_lent;
+	loop_lent = NULL;
+	loop_lentring = NULL;
+}
+
+
+/*
+Gives the buffer from Loop_GetSendBuffer back if it wasn't sent
+*/
+static void Loop_ReturnSendBuffer (void)
+{
+	if (!loop_handed)
+		return;
+
+	loop_handedring->free[loop_handedring->numfree++] = loop_handed;
+	loop_handed = NULL;
+	loop_handedring = NULL;
+}
+
+
+/*
+Drops the messages waiting for the socket
+*/
+static void Loop_ClearRing (qsocket_t *sock)
+{
+	loopring_t	*ring = sock->ring;
+
+	if (!ring)
+		return;
+
+	while (ring->count)
+	{
+		ring->free[ring->numfree++] = ring->msgs[ring->head].data;
+		ring->head = (ring->head + 1) % LOOP_RINGSIZE;
+		ring->count--;
+	}
+	ring->head = 0;
+}
+
+
+static void Loop_FreeRing (qsocket_t *sock)
+{
+	loopring_t	*ring = sock->ring;
+
+	if (!ring)
+		return;
+
+	if (loop_lentring == ring)
+		Loop_ReturnMessage ();
+	if (loop_handedring == ring)
+		Loop_ReturnSendBuffer ();
+	Loop_ClearRing (sock);
+
+	while (ring->numfree)
+		free (ring->free[--ring->numfree]);
+	free (ring);
+	sock->ring = NULL;
+}
+
+
+/*
+Hands out an empty buffer for the next message to the socket, which is
+passed on as it is if the message is sent on the same socket. Returns
+false when the caller has to use a buffer of its own.
+*/
+qboolean Loop_GetSendBuffer (qsocket_t *sock, sizebuf_t *buf)
+{
+	qsocket_t	*peer = (qsocket_t *)sock->driverdata;
+
+	Loop_ReturnSendBuffer ();
+
+	if (!peer || net_loopcopy.value)
+		return false;
+
+	loop_handed = Loop_TakeBuffer (peer);
+	if (!loop_handed)
+		return false;
+	loop_handedring = peer->ring;
+
+	buf->data = loop_handed;
+	buf->maxsize = NET_MAXMESSAGE;
+	buf->cursize = 0;
+	return true;
+}
+
+
 void Loop_Listen (qboolean state)
 {
 }
@@ -82,8 +251,7 @@ qsocket_t *Loop_Connect (const char *host)
 		}
 		Q_strcpy (loop_client->address, "localhost");
 	}
-	loop_client->receiveMessageLength = 0;
-	loop_client->sendMessageLength = 0;
+	Loop_ClearRing (loop_client);
 	loop_client->canSend = true;
 
 	if (!loop_server)
@@ -95,8 +263,7 @@ qsocket_t *Loop_Connect (const char *host)
 		}
 		Q_strcpy (loop_server->address, "LOCAL");
 	}
-	loop_server->receiveMessageLength = 0;
-	loop_server->sendMessageLength = 0;
+	Loop_ClearRing (loop_server);
 	loop_server->canSend = true;
 
 	loop_client->driverdata = (void *)loop_server;
@@ -106,83 +273,149 @@ qsocket_t *Loop_Connect (const char *host)
 }
 
 
+/*
+Makes another connected pair for a client living in this process, the
+server end, also returned in server_out, turns up in Loop_CheckNewConnections
+like the local client.
+*/
+qsocket_t *Loop_ConnectBot (qsocket_t **server_out)
+{
+	qsocket_t	*client, *server;
+
+	if (loop_numbots == countof (loop_bots))
+		return NULL;
+
+	if ((client = NET_NewQSocket ()) == NULL)
+	{
+		Con_Printf("Loop_ConnectBot: no qsocket available\n");
+		return NULL;
+	}
+	if ((server = NET_NewQSocket ()) == NULL)
+	{
+		Con_Printf("Loop_ConnectBot: no qsocket available\n");
+		NET_FreeQSocket (client);
+		return NULL;
+	}
+	Q_strcpy (client->address, "localhost");
+	Q_strcpy (server->address, "BOT");
+
+	client->driverdata = (void *)server;
+	server->driverdata = (void *)client;
+	loop_bots[loop_numbots++] = server;
+	*server_out = server;
+
+	return client;
+}
+
+
 qsocket_t *Loop_CheckNewConnections (void)
 {
+	qsocket_t	*sock;
+
+	if (loop_numbots)
+	{
+		sock = loop_bots[0];
+		memmove (loop_bots, loop_bots + 1, --loop_numbots * sizeof (loop_bots[0]));
+		return sock;
+	}
+
 	if (!localconnectpending)
 		return NULL;
 
 	localconnectpending = false;
-	loop_server->sendMessageLength = 0;
-	loop_server->receiveMessageLength = 0;
+	Loop_ClearRing (loop_server);
 	loop_server->canSend = true;
-	loop_client->sendMessageLength = 0;
-	loop_client->receiveMessageLength = 0;
+	Loop_ClearRing (loop_client);
 	loop_client->canSend = true;
 	return loop_server;
 }
 
 
-static int IntAlign(int value)
-{
-	return (value + (sizeof(int) - 1)) & (~(sizeof(int) - 1));
-}
-
-
 int Loop_GetMessage (qsocket_t *sock)
 {
-	int		ret;
-	int		length;
+	loopring_t	*ring = sock->ring;
+	loopmsg_t	*msg;
 
-	if (sock->receiveMessageLength == 0)
-		return 0;
+	Loop_ReturnMessage ();
 
-	ret = sock->receiveMessage[0];
-	length = sock->receiveMessage[1] + (sock->receiveMessage[2] << 8);
-	// alignment byte skipped here
-	SZ_Clear (&net_message);
-	SZ_Write (&net_message, &sock->receiveMessage[4], length);
+	if (!ring || !ring->count)
+		return 0;
 
-	length = IntAlign(length + 4);
-	sock->receiveMessageLength -= length;
+	msg = &ring->msgs[ring->head];
+	ring->head = (ring->head + 1) % LOOP_RINGSIZE;
+	ring->count--;
 
-	if (sock->receiveMessageLength)
-		memmove (sock->receiveMessage, &sock->receiveMessage[length], sock->receiveMessageLength);
+	if (net_loopcopy.value)
+	{
+		SZ_Clear (&net_message);
+		SZ_Write (&net_message, msg->data, msg->size);
+		ring->free[ring->numfree++] = msg->data;
+		net_loopcopied += msg->size;
+	}
+	else
+	{
+		// net_message has it until the next read
+		loop_netdata = net_message.data;
+		loop_lent = msg->data;
+		loop_lentring = ring;
+		net_message.data = msg->data;
+		net_message.cursize = msg->size;
+		net_message.overflowed = false;
+	}
 
-	if (sock->driverdata && ret == 1)
+	if (sock->driverdata && msg->type == 1)
 		((qsocket_t *)sock->driverdata)->canSend = true;
 
-	return ret;
+	return msg->type;
 }
 
 
-int Loop_SendMessage (qsocket_t *sock, sizebuf_t *data)
+/*
+Puts the message in the peer's ring, returns false if there's no room
+*/
+static qboolean Loop_Queue (qsocket_t *peer, const netpart_t *parts, int numparts, int type)
 {
-	byte *buffer;
-	int  *bufferLength;
+	loopring_t	*ring;
+	loopmsg_t	*msg;
+	byte		*buffer;
+	int			size;
 
-	if (!sock->driverdata)
-		return -1;
-
-	bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
+	size = NET_PartsSize (parts, numparts);
+	if (numparts == 1 && parts[0].data == loop_handed && peer->ring == loop_handedring)
+	{
+		// the sender wrote it in place
+		buffer = loop_handed;
+		loop_handed = NULL;
+		loop_handedring = NULL;
+	}
+	else
+	{
+		Loop_ReturnSendBuffer ();
+		if (size > NET_MAXMESSAGE || !(buffer = Loop_TakeBuffer (peer)))
+			return false;
+		NET_GatherParts (parts, numparts, 0, buffer, size);
+		net_loopcopied += size;
+	}
 
-	if ((*bufferLength + data->cursize + 4) > NET_MAXMESSAGE)
-		Sys_Error("Loop_SendMessage: overflow");
+	ring = peer->ring;
+	msg = &ring->msgs[(ring->head + ring->count++) % LOOP_RINGSIZE];
+	msg->data = buffer;
+	msg->size = size;
+	msg->type = type;
 
-	buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
+	return true;
+}
 
-	// message type
-	*buffer++ = 1;
 
-	// length
-	*buffer++ = data->cursize & 0xff;
-	*buffer++ = data->cursize >> 8;
+int Loop_SendMessage (qsocket_t *sock, const netpart_t *parts, int numparts)
+{
+	qsocket_t	*peer = (qsocket_t *)sock->driverdata;
 
-	// align
-	buffer++;
+	if (!peer)
+		return -1;
 
-	// message
-	Q_memcpy(buffer, data->data, data->cursize);
-	*bufferLength = IntAlign(*bufferLength + data->cursize + 4);
+	if ((peer->ring && peer->ring->count == LOOP_RINGSIZE) || !Loop_Queue (peer, parts, numparts, 1))
+		Sys_Error("Loop_SendMessage: overflow");
 
 	sock->canSend = false;
 	return 1;
@@ -191,33 +424,24 @@ int Loop_SendMessage (qsocket_t *sock, sizebuf_t *data)
 
 int Loop_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 {
-	byte *buffer;
-	int  *bufferLength;
+	qsocket_t	*peer = (qsocket_t *)sock->driverdata;
+	netpart_t	part;
 
-	if (!sock->driverdata)
+	if (!peer)
 		return -1;
 
-	bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
-
-	if ((*bufferLength + data->cursize + sizeof(byte) + sizeof(short)) > NET_MAXMESSAGE)
+	// with host_serverthread the server can send several before the client
+	// reads them, keep a place for a reliable one
+	if (peer->ring && peer->ring->count >= LOOP_RINGSIZE - 1)
+	{
+		if (data->data == loop_handed)
+			Loop_ReturnSendBuffer ();
 		return 0;
+	}
 
-	buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
-
-	// message type
-	*buffer++ = 2;
-
-	// length
-	*buffer++ = data->cursize & 0xff;
-	*buffer++ = data->cursize >> 8;
-
-	// align
-	buffer++;
-
-	// message
-	Q_memcpy(buffer, data->data, data->cursize);
-	*bufferLength = IntAlign(*bufferLength + data->cursize + 4);
-	return 1;
+	part.data = data->data;
+	part.size = data->cursize;
+	return Loop_Queue (peer, &part, 1, 2) ? 1 : 0;
 }
 
 
@@ -237,14 +461,24 @@ qboolean Loop_CanSendUnreliableMessage (qsocket_t *sock)
 
 void Loop_Close (qsocket_t *sock)
 {
+	int		i;
+
 	if (sock->driverdata)
 		((qsocket_t *)sock->driverdata)->driverdata = NULL;
-	sock->receiveMessageLength = 0;
-	sock->sendMessageLength = 0;
+	Loop_FreeRing (sock);
 	sock->canSend = true;
 	if (sock == loop_client)
 		loop_client = NULL;
-	else
+	else if (sock == loop_server)
 		loop_server = NULL;
+
+	for (i = 0; i < loop_numbots; i++)
+	{
+		if (loop_bots[i] == sock)
+		{
+			memmove (loop_bots + i, loop_bots + i + 1, (--loop_numbots - i) * sizeof (loop_bots[0]));
+			break;
+		}
+	}
 }
 
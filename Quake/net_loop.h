@@ -27,13 +27,16 @@ int		Loop_Init (void);
 void		Loop_Listen (qboolean state);
 void		Loop_SearchForHosts (qboolean xmit);
 qsocket_t	*Loop_Connect (const char *host);
+qsocket_t	*Loop_ConnectBot (qsocket_t **server);
 qsocket_t	*Loop_CheckNewConnections (void);
 int		Loop_GetMessage (qsocket_t *sock);
-int		Loop_SendMessage (qsocket_t *sock, sizebuf_t *data);
+int		Loop_SendMessage (qsocket_t *sock, const netpart_t *parts, int numparts);
 int		Loop_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data);
 qboolean	Loop_CanSendMessage (qsocket_t *sock);
 qboolean	Loop_CanSendUnreliableMessage (qsocket_t *sock);
 void		Loop_Close (qsocket_t *sock);
+qboolean	Loop_GetSendBuffer (qsocket_t *sock, sizebuf_t *buf);
+void		Loop_ReturnMessage (void);
 void		Loop_Shutdown (void);
 
 #endif	/* __NET_LOOP_H */
@@ -19,11 +19,21 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* for ppoll */
+#endif
+
 #include "q_stdinc.h"
 #include "arch_def.h"
 #include "net_sys.h"
 #include "quakedef.h"
 #include "net_defs.h"
+#include "net_loop.h"
+
+#if defined(PLATFORM_UNIX)
+#include <poll.h>
+#include <sys/stat.h>
+#endif
 
 qsocket_t	*net_activeSockets = NULL;
 qsocket_t	*net_freeSockets = NULL;
@@ -110,6 +120,15 @@ qsocket_t *NET_NewQSocket (void)
 	sock->driver = net_driverlevel;
 	sock->socket = 0;
 	sock->driverdata = NULL;
+	sock->window = NULL;
+	sock->hashnext = NULL;
+	sock->hostnext = NULL;
+	sock->hashed = false;
+	sock->shared = false;
+	sock->queue = NULL;
+	sock->compress = false;
+	sock->sendCompressed = false;
+	sock->ring = NULL;
 	sock->canSend = true;
 	sock->sendNext = false;
 	sock->lastMessageTime = net_time;
@@ -129,6 +148,10 @@ void NET_FreeQSocket(qsocket_t *sock)
 {
 	qsocket_t	*s;
 
+	// the driver's Close must have taken it out of the address hash
+	if (sock->hashed)
+		Sys_Error ("NET_FreeQSocket: still hashed");
+
 	// remove it from active list
 	if (sock == net_activeSockets)
 		net_activeSockets = net_activeSockets->next;
@@ -492,6 +515,45 @@ JustDoIt:
 }
 
 
+/*
+===================
+NET_ConnectBot
+
+Connects a client living in this process to the local server over the
+loopback driver, any number of times
+===================
+*/
+qsocket_t *NET_ConnectBot (qsocket_t **server)
+{
+	SetNetTime();
+
+	for (net_driverlevel = 0; net_driverlevel < net_numdrivers; net_driverlevel++)
+		if (IS_LOOP_DRIVER(net_driverlevel))
+			break;
+	if (net_driverlevel == net_numdrivers || !net_drivers[net_driverlevel].initialized)
+		return NULL;
+
+	return Loop_ConnectBot (server);
+}
+
+
+/*
+===================
+NET_GetSendBuffer
+
+Gives the caller a buffer to build its next message to the socket in, if
+the driver can pass it on without a copy. Returns false otherwise.
+===================
+*/
+qboolean NET_GetSendBuffer (qsocket_t *sock, sizebuf_t *buf)
+{
+	if (!sock || sock->disconnected || !IS_LOOP_DRIVER(sock->driver))
+		return false;
+
+	return Loop_GetSendBuffer (sock, buf);
+}
+
+
 /*
 ===================
 NET_CheckNewConnections
@@ -567,6 +629,9 @@ int	NET_GetMessage (qsocket_t *sock)
 
 	SetNetTime();
 
+	// whatever the loopback driver lent net_message is done with
+	Loop_ReturnMessage ();
+
 	ret = sfunc.QGetMessage(sock);
 
 	// see if this connection has timed out
@@ -595,6 +660,46 @@ int	NET_GetMessage (qsocket_t *sock)
 }
 
 
+/*
+==================
+NET_PartsSize
+==================
+*/
+int NET_PartsSize (const netpart_t *parts, int numparts)
+{
+	int		i, size;
+
+	for (i = size = 0; i < numparts; i++)
+		size += parts[i].size;
+	return size;
+}
+
+/*
+==================
+NET_GatherParts
+
+Copies length bytes, from offset on in the parts put together, to out
+==================
+*/
+void NET_GatherParts (const netpart_t *parts, int numparts, int offset, byte *out, int length)
+{
+	int		i, n;
+
+	for (i = 0; i < numparts && length > 0; i++)
+	{
+		if (offset >= parts[i].size)
+		{
+			offset -= parts[i].size;
+			continue;
+		}
+		n = q_min (parts[i].size - offset, length);
+		memcpy (out, parts[i].data + offset, n);
+		out += n;
+		length -= n;
+		offset = 0;
+	}
+}
+
 /*
 ==================
 NET_SendMessage
@@ -607,6 +712,15 @@ returns -1 if the connection died
 ==================
 */
 int NET_SendMessage (qsocket_t *sock, sizebuf_t *data)
+{
+	netpart_t	part;
+
+	part.data = data->data;
+	part.size = data->cursize;
+	return NET_SendMessageParts (sock, &part, 1);
+}
+
+int NET_SendMessageParts (qsocket_t *sock, const netpart_t *parts, int numparts)
 {
 	int		r;
 
@@ -620,7 +734,7 @@ int NET_SendMessage (qsocket_t *sock, sizebuf_t *data)
 	}
 
 	SetNetTime();
-	r = sfunc.QSendMessage(sock, data);
+	r = sfunc.QSendMessage(sock, parts, numparts);
 	if (r == 1 && !IS_LOOP_DRIVER(sock->driver))
 		messagesSent++;
 
@@ -780,6 +894,8 @@ void NET_Init (void)
 	net_numsockets = svs.maxclientslimit;
 	if (cls.state != ca_dedicated)
 		net_numsockets++;
+	if (COM_CheckParm("-bench"))
+		net_numsockets += svs.maxclientslimit;	// the client ends of the bots
 	if (COM_CheckParm("-listen") || cls.state == ca_dedicated)
 		listening = true;
 
@@ -804,6 +920,8 @@ void NET_Init (void)
 	Cmd_AddCommand ("maxplayers", MaxPlayers_f);
 	Cmd_AddCommand ("port", NET_Port_f);
 
+	NET_SimInit ();
+
 	// initialize all the drivers
 	for (i = net_driverlevel = 0; net_driverlevel < net_numdrivers; net_driverlevel++)
 	{
@@ -863,6 +981,21 @@ void NET_Shutdown (void)
 }
 
 
+/*
+=================
+NET_BatchSends
+=================
+*/
+void NET_BatchSends (qboolean state)
+{
+	int	i;
+
+	for (i = 0; i < net_numlandrivers; i++)
+		if (net_landrivers[i].initialized && net_landrivers[i].Batch)
+			net_landrivers[i].Batch (state);
+}
+
+
 static PollProcedure *pollProcedureList = NULL;
 
 void NET_Poll(void)
@@ -870,6 +1003,7 @@ void NET_Poll(void)
 	PollProcedure *pp;
 
 	SetNetTime();
+	NET_SimPoll();
 
 	for (pp = pollProcedureList; pp; pp = pp->next)
 	{
@@ -904,3 +1038,88 @@ void SchedulePollProcedure(PollProcedure *proc, double timeOffset)
 	prev->next = proc;
 }
 
+
+/*
+====================
+NET_Wait
+
+Sleeps for timeout seconds, or until there is something to do if timeout
+is negative. With wake set, a packet on a listen socket or a line on stdin
+ends the sleep, so this is only for when nothing else is going to read
+them. Poll procedures and packets held by the network simulator coming due
+cut it short as well. Returns false if it can't sleep here, the caller has
+to find some other way then.
+====================
+*/
+qboolean NET_Wait (double timeout, qboolean wake)
+{
+#if defined(PLATFORM_UNIX)
+	static int		console = -1;	// poll stdin, found out on first use
+	struct pollfd	fds[MAX_NET_DRIVERS + 1];
+	struct stat		st;
+	double			now, next;
+	sys_socket_t	sock;
+	int				i, num;
+#if defined(__linux__)
+	struct timespec	ts;
+#endif
+
+	now = Sys_DoubleTime ();
+	next = NET_SimNextTime ();
+	if (pollProcedureList && (next < 0 || pollProcedureList->nextTime < next))
+		next = pollProcedureList->nextTime;
+	if (next >= 0 && (timeout < 0 || next - now < timeout))
+		timeout = q_max (next - now, 0.0);
+
+	num = 0;
+	if (wake)
+	{
+		for (i = 0; i < net_numlandrivers; i++)
+		{
+			if (!net_landrivers[i].initialized || !net_landrivers[i].ListenSocket)
+				continue;
+			sock = net_landrivers[i].ListenSocket ();
+			if (sock == INVALID_SOCKET)
+				continue;
+			fds[num].fd = sock;
+			fds[num].events = POLLIN;
+			num++;
+		}
+
+		// a terminal or a pipe; /dev/null would always be readable
+		if (console == -1)
+			console = (isatty (0) || (fstat (0, &st) == 0 && (S_ISFIFO (st.st_mode) || S_ISSOCK (st.st_mode))));
+		if (console)
+		{
+			fds[num].fd = 0;
+			fds[num].events = POLLIN;
+			num++;
+		}
+	}
+
+	if (!num && timeout < 0)
+		return false;	// nothing could ever wake us
+
+#if defined(__linux__)
+	if (timeout >= 0)
+	{
+		ts.tv_sec = (time_t) timeout;
+		ts.tv_nsec = (long) ((timeout - ts.tv_sec) * 1e9);
+	}
+	if (ppoll (fds, num, timeout >= 0 ? &ts : NULL, NULL) <= 0)
+		return true;
+#else
+	if (poll (fds, num, timeout >= 0 ? (int) ceil (timeout * 1000.0) : -1) <= 0)
+		return true;
+#endif
+
+	// stdin was closed, don't wake up for it again
+	if (console && wake && (fds[num - 1].revents & (POLLHUP | POLLERR | POLLNVAL)))
+		console = 0;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
@@ -0,0 +1,487 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// net_sim.c -- network condition simulator for the datagram driver
+
+#include "q_stdinc.h"
+#include "arch_def.h"
+#include "net_sys.h"
+#include "quakedef.h"
+#include "net_defs.h"
+
+/*
+==============================================================================
+
+Every packet the datagram driver reads or writes goes through NET_SimRead
+and NET_SimWrite. Normally they just call the land driver. Once any of the
+net_sim_* cvars is set, packets are held in a queue instead and let
+through when they're due. Each direction has its own settings, <dir>
+being "in" or "out":
+
+	net_sim_<dir>_delay		one way latency in ms
+	net_sim_<dir>_jitter	up to this many ms more, picked per packet
+	net_sim_<dir>_loss		percentage of packets dropped
+	net_sim_<dir>_dup		percentage of packets delivered twice
+	net_sim_<dir>_reorder	percentage of packets that skip the delay and
+							overtake the ones queued before them
+	net_sim_<dir>_rate		bytes per second, 0 for no limit
+
+A packet is due once the packets before it have gone through the rate
+limit and its latency has passed. The queue is kept sorted by that time,
+so jitter can reorder packets as well. Outgoing packets are handed to the
+land driver from NET_Poll, and whenever the driver reads or writes.
+Incoming ones are read off the socket right away and returned by
+NET_SimRead when due; NET_SimCheckNewConnections reports the listen socket
+as readable while it has some. Random numbers come from net_sim_seed, so a
+run with the same traffic can be repeated.
+
+The loopback driver doesn't deal in packets. Connect to 127.0.0.1 to
+test against a local server.
+
+==============================================================================
+*/
+
+#define SIM_IN			0
+#define SIM_OUT			1
+#define SIM_MAXQUEUED	(4 * 1024 * 1024)	// bytes held at once, more are dropped
+
+typedef struct simpacket_s
+{
+	struct simpacket_s	*prev;
+	struct simpacket_s	*next;
+	double				time;		// when it's due
+	int					dir;
+	int					driver;
+	sys_socket_t		socket;
+	struct qsockaddr	addr;
+	int					length;
+	byte				*data;		// follows the struct
+} simpacket_t;
+
+typedef struct
+{
+	cvar_t	delay;
+	cvar_t	jitter;
+	cvar_t	loss;
+	cvar_t	dup;
+	cvar_t	reorder;
+	cvar_t	rate;
+	double	busy;		// when the rate limit lets the next packet through
+// stats
+	int		packets;
+	int		dropped;
+	int		duplicated;
+	int		reordered;
+	int		queued;		// packets held right now
+} simdir_t;
+
+static simdir_t sim_dirs[2] =
+{
+	{
+		{"net_sim_in_delay", "0", CVAR_NONE},
+		{"net_sim_in_jitter", "0", CVAR_NONE},
+		{"net_sim_in_loss", "0", CVAR_NONE},
+		{"net_sim_in_dup", "0", CVAR_NONE},
+		{"net_sim_in_reorder", "0", CVAR_NONE},
+		{"net_sim_in_rate", "0", CVAR_NONE},
+	},
+	{
+		{"net_sim_out_delay", "0", CVAR_NONE},
+		{"net_sim_out_jitter", "0", CVAR_NONE},
+		{"net_sim_out_loss", "0", CVAR_NONE},
+		{"net_sim_out_dup", "0", CVAR_NONE},
+		{"net_sim_out_reorder", "0", CVAR_NONE},
+		{"net_sim_out_rate", "0", CVAR_NONE},
+	},
+};
+
+static cvar_t	net_sim_seed = {"net_sim_seed", "1", CVAR_NONE};
+
+static qboolean		sim_active;
+static unsigned int	sim_random;
+static simpacket_t	*sim_head;
+static simpacket_t	*sim_tail;
+static int			sim_queuedbytes;
+static sys_socket_t	sim_acceptsock[MAX_NET_DRIVERS];	// last seen from CheckNewConnections
+static byte			sim_buf[NET_DATAGRAMSIZE];
+
+
+/*
+Returns a number in [0, 1)
+*/
+static double Sim_Random (void)
+{
+	// xorshift32
+	sim_random ^= sim_random << 13;
+	sim_random ^= sim_random >> 17;
+	sim_random ^= sim_random << 5;
+	return (sim_random >> 8) / 16777216.0;
+}
+
+
+static void Sim_Changed (cvar_t *var)
+{
+	simdir_t	*d;
+	qboolean	active;
+	int			i;
+
+	active = false;
+	for (i = 0, d = sim_dirs; i < 2; i++, d++)
+		if (d->delay.value || d->jitter.value || d->loss.value || d->dup.value ||
+			d->reorder.value || d->rate.value)
+			active = true;
+
+	// start over whenever the simulation is turned on, so runs can be repeated
+	if (var == &net_sim_seed || (active && !sim_active))
+	{
+		sim_random = (unsigned int) net_sim_seed.value;
+		if (!sim_random)
+			sim_random = 1;
+		sim_dirs[SIM_IN].busy = sim_dirs[SIM_OUT].busy = 0;
+	}
+	sim_active = active;
+}
+
+
+static void Sim_Insert (simpacket_t *p)
+{
+	simpacket_t	*after;
+
+	// usually due last, look from the end
+	for (after = sim_tail; after && after->time > p->time; after = after->prev)
+		;
+	p->prev = after;
+	p->next = after ? after->next : sim_head;
+	if (p->next)
+		p->next->prev = p;
+	else
+		sim_tail = p;
+	if (after)
+		after->next = p;
+	else
+		sim_head = p;
+
+	sim_dirs[p->dir].queued++;
+	sim_queuedbytes += p->length;
+}
+
+
+static void Sim_Remove (simpacket_t *p)
+{
+	if (p->prev)
+		p->prev->next = p->next;
+	else
+		sim_head = p->next;
+	if (p->next)
+		p->next->prev = p->prev;
+	else
+		sim_tail = p->prev;
+
+	sim_dirs[p->dir].queued--;
+	sim_queuedbytes -= p->length;
+	free (p);
+}
+
+
+static void Sim_Queue (int dir, int driver, sys_socket_t socket, byte *buf, int len, struct qsockaddr *addr)
+{
+	simdir_t	*d = &sim_dirs[dir];
+	simpacket_t	*p;
+	double		now, time;
+	int			copies;
+
+	d->packets++;
+	if (Sim_Random () * 100.0 < d->loss.value)
+	{
+		d->dropped++;
+		return;
+	}
+
+	copies = 1;
+	if (Sim_Random () * 100.0 < d->dup.value)
+	{
+		d->duplicated++;
+		copies = 2;
+	}
+
+	now = Sys_DoubleTime ();
+	while (copies--)
+	{
+		if (sim_queuedbytes + len > SIM_MAXQUEUED)
+		{
+			d->dropped++;	// as a router with a full queue would
+			return;
+		}
+
+		time = now;
+		if (d->rate.value > 0)
+		{
+			d->busy = q_max (d->busy, now) + len / d->rate.value;
+			time = d->busy;
+		}
+		if (Sim_Random () * 100.0 < d->reorder.value)
+			d->reordered++;
+		else
+			time += (d->delay.value + Sim_Random () * d->jitter.value) * 0.001;
+
+		p = (simpacket_t *) malloc (sizeof(simpacket_t) + len);
+		if (!p)
+			Sys_Error ("Sim_Queue: out of memory");
+		p->time = time;
+		p->dir = dir;
+		p->driver = driver;
+		p->socket = socket;
+		p->addr = *addr;
+		p->length = len;
+		p->data = (byte *)(p + 1);
+		memcpy (p->data, buf, len);
+		Sim_Insert (p);
+	}
+}
+
+
+/*
+Hands the outgoing packets that are due to the land driver, all of them
+once the simulation has been turned off
+*/
+static void Sim_Send (void)
+{
+	simpacket_t	*p, *next;
+	double		now;
+
+	now = sim_active ? Sys_DoubleTime () : 1e30;
+	for (p = sim_head; p && p->time <= now; p = next)
+	{
+		next = p->next;
+		if (p->dir != SIM_OUT)
+			continue;
+		net_landrivers[p->driver].Write (p->socket, p->data, p->length, &p->addr);
+		Sim_Remove (p);
+	}
+}
+
+
+/*
+================
+NET_SimRead
+================
+*/
+int NET_SimRead (int driver, sys_socket_t socket, byte *buf, int len, struct qsockaddr *addr)
+{
+	simpacket_t		*p;
+	struct qsockaddr readaddr;
+	double			now;
+	int				ret;
+
+	if (!sim_active && !sim_dirs[SIM_IN].queued)
+		return net_landrivers[driver].Read (socket, buf, len, addr);
+
+	Sim_Send ();
+
+	if (sim_active)
+	{
+		while ((ret = net_landrivers[driver].Read (socket, sim_buf, sizeof(sim_buf), &readaddr)) > 0)
+			Sim_Queue (SIM_IN, driver, socket, sim_buf, ret, &readaddr);
+		if (ret == -1)
+			return -1;
+		now = Sys_DoubleTime ();
+	}
+	else
+		now = 1e30;	// turned off, let out what's left first
+
+	for (p = sim_head; p && p->time <= now; p = p->next)
+	{
+		if (p->dir != SIM_IN || p->driver != driver || p->socket != socket)
+			continue;
+		ret = q_min (len, p->length);
+		memcpy (buf, p->data, ret);
+		*addr = p->addr;
+		Sim_Remove (p);
+		return ret;
+	}
+
+	if (!sim_active)
+		return net_landrivers[driver].Read (socket, buf, len, addr);
+	return 0;
+}
+
+
+/*
+================
+NET_SimCheckNewConnections
+================
+*/
+sys_socket_t NET_SimCheckNewConnections (int driver)
+{
+	simpacket_t		*p;
+	sys_socket_t	sock;
+	double			now;
+
+	sock = net_landrivers[driver].CheckNewConnections ();
+	if (sock != INVALID_SOCKET)
+	{
+		sim_acceptsock[driver] = sock;
+		return sock;
+	}
+	if (!sim_dirs[SIM_IN].queued)
+		return INVALID_SOCKET;
+
+	now = sim_active ? Sys_DoubleTime () : 1e30;
+	for (p = sim_head; p && p->time <= now; p = p->next)
+		if (p->dir == SIM_IN && p->driver == driver && p->socket == sim_acceptsock[driver])
+			return p->socket;
+
+	return INVALID_SOCKET;
+}
+
+
+/*
+================
+NET_SimListen
+
+The listen socket is about to be closed or opened
+================
+*/
+void NET_SimListen (int driver)
+{
+	if (sim_acceptsock[driver] != INVALID_SOCKET)
+		NET_SimFlush (driver, sim_acceptsock[driver]);
+	sim_acceptsock[driver] = INVALID_SOCKET;
+}
+
+
+/*
+================
+NET_SimWrite
+================
+*/
+int NET_SimWrite (int driver, sys_socket_t socket, byte *buf, int len, struct qsockaddr *addr)
+{
+	if (!sim_active && !sim_dirs[SIM_OUT].queued)
+		return net_landrivers[driver].Write (socket, buf, len, addr);
+
+	Sim_Send ();
+
+	if (!sim_active)
+		return net_landrivers[driver].Write (socket, buf, len, addr);
+
+	Sim_Queue (SIM_OUT, driver, socket, buf, len, addr);
+	return len;
+}
+
+
+/*
+================
+NET_SimFlush
+
+Drops everything queued for a socket that is about to be closed
+================
+*/
+void NET_SimFlush (int driver, sys_socket_t socket)
+{
+	simpacket_t	*p, *next;
+
+	for (p = sim_head; p; p = next)
+	{
+		next = p->next;
+		if (p->driver == driver && p->socket == socket)
+			Sim_Remove (p);
+	}
+}
+
+
+/*
+================
+NET_SimPoll
+================
+*/
+void NET_SimPoll (void)
+{
+	if (sim_dirs[SIM_OUT].queued)
+		Sim_Send ();
+}
+
+
+/*
+================
+NET_SimNextTime
+
+When the next held packet is due, or -1 if there are none
+================
+*/
+double NET_SimNextTime (void)
+{
+	return sim_head ? sim_head->time : -1.0;
+}
+
+
+/*
+================
+NET_SimStats
+================
+*/
+void NET_SimStats (void)
+{
+	static const char *names[2] = {"in", "out"};
+	simdir_t	*d;
+	int			i;
+
+	for (i = 0, d = sim_dirs; i < 2; i++, d++)
+	{
+		if (!d->packets)
+			continue;
+		Con_Printf("sim %-3s %i packets, %i dropped, %i duplicated, %i reordered, %i queued\n",
+			names[i], d->packets, d->dropped, d->duplicated, d->reordered, d->queued);
+	}
+}
+
+
+/*
+================
+NET_SimInit
+================
+*/
+void NET_SimInit (void)
+{
+	simdir_t	*d;
+	int			i;
+
+	for (i = 0; i < MAX_NET_DRIVERS; i++)
+		sim_acceptsock[i] = INVALID_SOCKET;
+
+	for (i = 0, d = sim_dirs; i < 2; i++, d++)
+	{
+		Cvar_RegisterVariable (&d->delay);
+		Cvar_RegisterVariable (&d->jitter);
+		Cvar_RegisterVariable (&d->loss);
+		Cvar_RegisterVariable (&d->dup);
+		Cvar_RegisterVariable (&d->reorder);
+		Cvar_RegisterVariable (&d->rate);
+		Cvar_SetCallback (&d->delay, Sim_Changed);
+		Cvar_SetCallback (&d->jitter, Sim_Changed);
+		Cvar_SetCallback (&d->loss, Sim_Changed);
+		Cvar_SetCallback (&d->dup, Sim_Changed);
+		Cvar_SetCallback (&d->reorder, Sim_Changed);
+		Cvar_SetCallback (&d->rate, Sim_Changed);
+	}
+	Cvar_RegisterVariable (&net_sim_seed);
+	Cvar_SetCallback (&net_sim_seed, Sim_Changed);
+	Sim_Changed (&net_sim_seed);
+}
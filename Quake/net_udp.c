@@ -20,12 +20,20 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* for recvmmsg and sendmmsg */
+#endif
+
 #include "q_stdinc.h"
 #include "arch_def.h"
 #include "net_sys.h"
 #include "quakedef.h"
 #include "net_defs.h"
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define UDP_MMSG
+#endif
+
 static sys_socket_t net_acceptsocket = INVALID_SOCKET;	// socket for fielding new connections
 static sys_socket_t net_controlsocket;
 static sys_socket_t net_broadcastsocket = 0;
@@ -37,6 +45,316 @@ static in_addr_t	myAddr;
 
 //=============================================================================
 
+/*
+==============================================================================
+
+BATCHED I/O
+
+On Linux, datagrams are read with recvmmsg, up to UDP_BATCH at a time, into
+a batch kept for each socket in a small hash table, and UDP_Read hands them
+out from there. Once a read finds a socket empty, it isn't asked again
+until net_time changes, which saves the final EWOULDBLOCK of every poll.
+While UDP_Batch is on, writes are queued the same way and go out with one
+sendmmsg per socket when it is turned off again or the batch fills up.
+A datagram that can't be sent is skipped and the rest still go, as with
+sendto; since the caller was already told it went out, the error is
+reported by the next write to the same address instead. -nommsg, or a
+kernel without the calls, falls back to one recvfrom/sendto per datagram.
+
+==============================================================================
+*/
+
+#ifdef UDP_MMSG
+
+#define UDP_BATCH		16
+#define UDP_BATCHHASH	64
+
+typedef struct udpbatch_s
+{
+	struct udpbatch_s	*next;			// in the hash chain
+	struct udpbatch_s	*nextsend;		// in udp_sendlist
+	sys_socket_t		socket;
+
+	int					numrecv;
+	int					nextrecv;
+	qboolean			drained;		// recvmmsg found no more
+	double				recvtime;		// net_time when it did
+	struct mmsghdr		recvmsg[UDP_BATCH];
+	struct iovec		recviov[UDP_BATCH];
+	struct qsockaddr	recvaddr[UDP_BATCH];
+	byte				*recvdata;		// UDP_BATCH * NET_DATAGRAMSIZE
+
+	int					numsend;
+	struct mmsghdr		sendmsg[UDP_BATCH];
+	struct iovec		sendiov[UDP_BATCH];
+	struct qsockaddr	sendaddr[UDP_BATCH];
+	byte				*senddata;		// UDP_BATCH * NET_DATAGRAMSIZE
+
+	int					numerrors;
+	struct qsockaddr	erroraddr[UDP_BATCH];	// where queued writes failed
+} udpbatch_t;
+
+static qboolean		udp_mmsg;			// recvmmsg and sendmmsg work
+static qboolean		udp_batching;		// queue writes
+static udpbatch_t	*udp_batches[UDP_BATCHHASH];
+static udpbatch_t	*udp_sendlist;
+
+/* statistic counters */
+static int udp_recvcalls = 0;
+static int udp_recvpackets = 0;
+static int udp_sendcalls = 0;
+static int udp_sendpackets = 0;
+static int udp_skippedpolls = 0;
+
+static udpbatch_t *UDP_GetBatch (sys_socket_t socketid)
+{
+	udpbatch_t	*b, **link;
+
+	link = &udp_batches[(unsigned int)socketid % UDP_BATCHHASH];
+	for (b = *link; b; b = b->next)
+		if (b->socket == socketid)
+			return b;
+
+	b = (udpbatch_t *) calloc (1, sizeof(udpbatch_t));
+	if (b)
+	{
+		b->recvdata = (byte *) malloc (UDP_BATCH * NET_DATAGRAMSIZE);
+		b->senddata = (byte *) malloc (UDP_BATCH * NET_DATAGRAMSIZE);
+	}
+	if (!b || !b->recvdata || !b->senddata)
+		Sys_Error ("UDP_GetBatch: out of memory");
+	b->socket = socketid;
+	b->next = *link;
+	*link = b;
+	return b;
+}
+
+/*
+Remembers that the queued write to addr failed, for UDP_QueueWrite to
+report
+*/
+static void UDP_SendFailed (udpbatch_t *b, struct qsockaddr *addr)
+{
+	int	i;
+
+	for (i = 0; i < b->numerrors; i++)
+		if (!UDP_AddrCompare (&b->erroraddr[i], addr))
+			return;
+	if (b->numerrors < UDP_BATCH)
+		b->erroraddr[b->numerrors++] = *addr;
+}
+
+static void UDP_FlushBatch (udpbatch_t *b)
+{
+	int	i, ret, err;
+
+	for (i = 0; i < b->numsend; i += ret)
+	{
+		if (udp_mmsg)
+			ret = sendmmsg (b->socket, b->sendmsg + i, b->numsend - i, 0);
+		else
+			ret = sendto (b->socket, b->sendiov[i].iov_base, b->sendiov[i].iov_len, 0,
+					(struct sockaddr *)&b->sendaddr[i], sizeof(struct qsockaddr));
+		udp_sendcalls++;
+		if (ret == SOCKET_ERROR)
+		{
+			err = SOCKETERRNO;
+			if (udp_mmsg && err == ENOSYS)
+			{
+				udp_mmsg = false;	// kernel too old, the rest go with sendto
+				udp_batching = false;
+				ret = 0;
+				continue;
+			}
+			if (err != NET_EWOULDBLOCK)
+			{
+				Con_SafePrintf ("UDP_Write, %s: %s\n", udp_mmsg ? "sendmmsg" : "sendto", socketerror(err));
+				UDP_SendFailed (b, &b->sendaddr[i]);
+			}
+			ret = 1;	// dropped, like sendto would, the others still go
+			continue;
+		}
+		if (!udp_mmsg)
+			ret = 1;
+		udp_sendpackets += ret;
+	}
+	b->numsend = 0;
+}
+
+static void UDP_FreeBatch (sys_socket_t socketid)
+{
+	udpbatch_t	*b, **link, **send;
+
+	for (link = &udp_batches[(unsigned int)socketid % UDP_BATCHHASH]; (b = *link) != NULL; link = &b->next)
+		if (b->socket == socketid)
+			break;
+	if (!b)
+		return;
+
+	// queued writes still go out
+	if (b->numsend)
+	{
+		UDP_FlushBatch (b);
+		for (send = &udp_sendlist; *send != b; send = &(*send)->nextsend)
+			;
+		*send = b->nextsend;
+	}
+
+	*link = b->next;
+	free (b->recvdata);
+	free (b->senddata);
+	free (b);
+}
+
+/*
+Returns the number of datagrams waiting in b, reading more if there are
+none, or -1 on an error
+*/
+static int UDP_FillBatch (udpbatch_t *b)
+{
+	int	i, ret;
+
+	while (1)
+	{
+		// quietly absorb empty packets
+		while (b->nextrecv < b->numrecv && !b->recvmsg[b->nextrecv].msg_len)
+			b->nextrecv++;
+		if (b->nextrecv < b->numrecv)
+			return b->numrecv - b->nextrecv;
+
+		if (b->drained && b->recvtime == net_time)
+		{
+			udp_skippedpolls++;
+			return 0;
+		}
+
+		for (i = 0; i < UDP_BATCH; i++)
+		{
+			b->recviov[i].iov_base = b->recvdata + i * NET_DATAGRAMSIZE;
+			b->recviov[i].iov_len = NET_DATAGRAMSIZE;
+			memset (&b->recvmsg[i], 0, sizeof(b->recvmsg[i]));
+			b->recvmsg[i].msg_hdr.msg_name = &b->recvaddr[i];
+			b->recvmsg[i].msg_hdr.msg_namelen = sizeof(struct qsockaddr);
+			b->recvmsg[i].msg_hdr.msg_iov = &b->recviov[i];
+			b->recvmsg[i].msg_hdr.msg_iovlen = 1;
+		}
+		ret = recvmmsg (b->socket, b->recvmsg, UDP_BATCH, MSG_DONTWAIT, NULL);
+		udp_recvcalls++;
+		b->nextrecv = 0;
+		b->numrecv = 0;
+		b->drained = true;
+		b->recvtime = net_time;
+		if (ret == SOCKET_ERROR)
+		{
+			int err = SOCKETERRNO;
+			if (err == NET_EWOULDBLOCK || err == NET_ECONNREFUSED)
+				return 0;
+			if (err == ENOSYS)
+			{
+				udp_mmsg = false;	// kernel too old, back to recvfrom
+				udp_batching = false;
+				return 0;
+			}
+			Con_SafePrintf ("UDP_Read, recvmmsg: %s\n", socketerror(err));
+			return -1;
+		}
+		b->numrecv = ret;
+		b->drained = (ret < UDP_BATCH);
+		udp_recvpackets += ret;
+		if (!ret)
+			return 0;
+	}
+}
+
+static int UDP_ReadBatch (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr)
+{
+	udpbatch_t	*b = UDP_GetBatch (socketid);
+	int			i, ret;
+
+	ret = UDP_FillBatch (b);
+	if (ret <= 0)
+		return ret;
+
+	i = b->nextrecv++;
+	ret = q_min ((int)b->recvmsg[i].msg_len, len);
+	memcpy (buf, b->recviov[i].iov_base, ret);
+	*addr = b->recvaddr[i];
+
+	return ret;
+}
+
+static int UDP_QueueWrite (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr)
+{
+	udpbatch_t	*b = UDP_GetBatch (socketid);
+	int			i;
+
+	// an earlier write here failed when the batch went out
+	for (i = 0; i < b->numerrors; i++)
+	{
+		if (!UDP_AddrCompare (&b->erroraddr[i], addr))
+		{
+			b->erroraddr[i] = b->erroraddr[--b->numerrors];
+			return SOCKET_ERROR;
+		}
+	}
+
+	if (b->numsend == UDP_BATCH)
+		UDP_FlushBatch (b);		// still on udp_sendlist
+	else if (!b->numsend)
+	{
+		b->nextsend = udp_sendlist;
+		udp_sendlist = b;
+	}
+
+	i = b->numsend++;
+	memcpy (b->senddata + i * NET_DATAGRAMSIZE, buf, len);
+	b->sendaddr[i] = *addr;
+	b->sendiov[i].iov_base = b->senddata + i * NET_DATAGRAMSIZE;
+	b->sendiov[i].iov_len = len;
+	memset (&b->sendmsg[i], 0, sizeof(b->sendmsg[i]));
+	b->sendmsg[i].msg_hdr.msg_name = &b->sendaddr[i];
+	b->sendmsg[i].msg_hdr.msg_namelen = sizeof(struct qsockaddr);
+	b->sendmsg[i].msg_hdr.msg_iov = &b->sendiov[i];
+	b->sendmsg[i].msg_hdr.msg_iovlen = 1;
+
+	return len;
+}
+
+static void UDP_Stats_f (void)
+{
+	Con_Printf ("%i recvmmsg calls, %.1f datagrams per call\n", udp_recvcalls,
+		udp_recvcalls ? (double) udp_recvpackets / udp_recvcalls : 0.0);
+	Con_Printf ("%i sendmmsg calls, %.1f datagrams per call\n", udp_sendcalls,
+		udp_sendcalls ? (double) udp_sendpackets / udp_sendcalls : 0.0);
+	Con_Printf ("%i reads answered without a call\n", udp_skippedpolls);
+	udp_recvcalls = udp_recvpackets = udp_sendcalls = udp_sendpackets = udp_skippedpolls = 0;
+}
+
+#endif	/* UDP_MMSG */
+
+/*
+============
+UDP_Batch
+
+While on, writes are queued and sent together when it's turned off
+============
+*/
+void UDP_Batch (qboolean state)
+{
+#ifdef UDP_MMSG
+	udpbatch_t	*b;
+
+	udp_batching = state && udp_mmsg;
+	if (udp_batching)
+		return;
+	for (b = udp_sendlist; b; b = b->nextsend)
+		UDP_FlushBatch (b);
+	udp_sendlist = NULL;
+#endif
+}
+
+//=============================================================================
+
 sys_socket_t UDP_Init (void)
 {
 	int	err;
@@ -103,6 +421,11 @@ sys_socket_t UDP_Init (void)
 	Con_SafePrintf("UDP Initialized\n");
 	tcpipAvailable = true;
 
+#ifdef UDP_MMSG
+	udp_mmsg = !COM_CheckParm ("-nommsg");
+	Cmd_AddCommand ("net_udpstats", UDP_Stats_f);
+#endif
+
 	return net_controlsocket;
 }
 
@@ -172,6 +495,9 @@ ErrorReturn:
 
 int UDP_CloseSocket (sys_socket_t socketid)
 {
+#ifdef UDP_MMSG
+	UDP_FreeBatch (socketid);
+#endif
 	if (socketid == net_broadcastsocket)
 		net_broadcastsocket = 0;
 	return closesocket (socketid);
@@ -252,6 +578,15 @@ sys_socket_t UDP_CheckNewConnections (void)
 	if (net_acceptsocket == INVALID_SOCKET)
 		return INVALID_SOCKET;
 
+#ifdef UDP_MMSG
+	if (udp_mmsg)
+	{
+		if (UDP_FillBatch (UDP_GetBatch (net_acceptsocket)) <= 0)
+			return INVALID_SOCKET;
+		return net_acceptsocket;
+	}
+#endif
+
 	if (ioctl (net_acceptsocket, FIONREAD, &available) == -1)
 	{
 		int err = SOCKETERRNO;
@@ -264,6 +599,11 @@ sys_socket_t UDP_CheckNewConnections (void)
 	return INVALID_SOCKET;
 }
 
+sys_socket_t UDP_ListenSocket (void)
+{
+	return net_acceptsocket;
+}
+
 //=============================================================================
 
 int UDP_Read (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr)
@@ -271,6 +611,11 @@ int UDP_Read (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr)
 	socklen_t addrlen = sizeof(struct qsockaddr);
 	int ret;
 
+#ifdef UDP_MMSG
+	if (udp_mmsg)
+		return UDP_ReadBatch (socketid, buf, len, addr);
+#endif
+
 	ret = recvfrom (socketid, buf, len, 0, (struct sockaddr *)addr, &addrlen);
 	if (ret == SOCKET_ERROR)
 	{
@@ -328,6 +673,11 @@ int UDP_Write (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr
 {
 	int	ret;
 
+#ifdef UDP_MMSG
+	if (udp_batching)
+		return UDP_QueueWrite (socketid, buf, len, addr);
+#endif
+
 	ret = sendto (socketid, buf, len, 0, (struct sockaddr *)addr,
 							sizeof(struct qsockaddr));
 	if (ret == SOCKET_ERROR)
@@ -446,6 +796,20 @@ int UDP_AddrCompare (struct qsockaddr *addr1, struct qsockaddr *addr2)
 
 //=============================================================================
 
+unsigned int UDP_AddrHash (struct qsockaddr *addr, qboolean port)
+{
+	unsigned int	hash;
+
+	hash = ((struct sockaddr_in *)addr)->sin_addr.s_addr;
+	if (port)
+		hash ^= (unsigned int)((struct sockaddr_in *)addr)->sin_port * 0x10001;
+	hash *= 0x9e3779b1;
+
+	return hash ^ (hash >> 16);
+}
+
+//=============================================================================
+
 int UDP_GetSocketPort (struct qsockaddr *addr)
 {
 	return ntohs(((struct sockaddr_in *)addr)->sin_port);
@@ -29,6 +29,7 @@ sys_socket_t  UDP_OpenSocket (int port);
 int  UDP_CloseSocket (sys_socket_t socketid);
 int  UDP_Connect (sys_socket_t socketid, struct qsockaddr *addr);
 sys_socket_t  UDP_CheckNewConnections (void);
+sys_socket_t  UDP_ListenSocket (void);
 int  UDP_Read (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr);
 int  UDP_Write (sys_socket_t socketid, byte *buf, int len, struct qsockaddr *addr);
 int  UDP_Broadcast (sys_socket_t socketid, byte *buf, int len);
@@ -38,8 +39,10 @@ int  UDP_GetSocketAddr (sys_socket_t socketid, struct qsockaddr *addr);
 int  UDP_GetNameFromAddr (struct qsockaddr *addr, char *name);
 int  UDP_GetAddrFromName (const char *name, struct qsockaddr *addr);
 int  UDP_AddrCompare (struct qsockaddr *addr1, struct qsockaddr *addr2);
+unsigned int UDP_AddrHash (struct qsockaddr *addr, qboolean port);
 int  UDP_GetSocketPort (struct qsockaddr *addr);
 int  UDP_SetSocketPort (struct qsockaddr *addr, int port);
+void UDP_Batch (qboolean state);
 
 #endif	/* __net_udp_h */
 
@@ -528,6 +528,20 @@ int WINS_AddrCompare (struct qsockaddr *addr1, struct qsockaddr *addr2)
 
 //=============================================================================
 
+unsigned int WINS_AddrHash (struct qsockaddr *addr, qboolean port)
+{
+	unsigned int	hash;
+
+	hash = ((struct sockaddr_in *)addr)->sin_addr.s_addr;
+	if (port)
+		hash ^= (unsigned int)((struct sockaddr_in *)addr)->sin_port * 0x10001;
+	hash *= 0x9e3779b1;
+
+	return hash ^ (hash >> 16);
+}
+
+//=============================================================================
+
 int WINS_GetSocketPort (struct qsockaddr *addr)
 {
 	return ntohs(((struct sockaddr_in *)addr)->sin_port);
@@ -38,6 +38,7 @@ int  WINS_GetSocketAddr (sys_socket_t socketid, struct qsockaddr *addr);
 int  WINS_GetNameFromAddr (struct qsockaddr *addr, char *name);
 int  WINS_GetAddrFromName (const char *name, struct qsockaddr *addr);
 int  WINS_AddrCompare (struct qsockaddr *addr1, struct qsockaddr *addr2);
+unsigned int WINS_AddrHash (struct qsockaddr *addr, qboolean port);
 int  WINS_GetSocketPort (struct qsockaddr *addr);
 int  WINS_SetSocketPort (struct qsockaddr *addr, int port);
 
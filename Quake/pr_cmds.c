@@ -315,6 +315,7 @@ static void PF_setmodel (void)
 	}
 	e->v.model = PR_SetEngineString(*check);
 	e->v.modelindex = i; //SV_ModelIndex (m);
+	PR_FindIndexDirty (e, -1);
 
 	mod = sv.models[ (int)e->v.modelindex];  // Mod_ForName (m, true);
 
@@ -963,44 +964,315 @@ findradius (origin, radius)
 */
 static void PF_findradius (void)
 {
-	edict_t	*ent, *chain;
-	float	rad;
-	float	*org;
+	RETURN_EDICT(SV_FindRadius (G_VECTOR(OFS_PARM0), G_FLOAT(OFS_PARM1)));
+}
+
+/*
+===============================================================================
+
+FIND INDEX
+
+find() on a string field is answered from a per-field index of
+(content hash, edict) pairs sorted by hash, then edict number, so a lookup
+only visits edicts whose value hashes the same. An index is created the
+first time a field is searched. QC stores to an indexed field (seen by the
+interpreter's OP_ADDRESS) and engine writes put the edict on the field's
+pending list, which is checked directly on every lookup. The index is
+rebuilt once that list gets long. Strings whose contents can change in
+place (temp strings, client names) are always pending. Candidates are
+verified with the same strcmp as the linear scan, so the result is the
+same edict the scan would return.
+
+===============================================================================
+*/
+
+#define	MAX_FINDINDEX		16
+
+typedef struct
+{
+	unsigned	hash;
+	int			num;
+} findentry_t;
+
+typedef struct
+{
+	int			fofs;
+	char		name[32];
+	qboolean	valid;
+	findentry_t	*entries;
+	int			numentries;
+	int			*pending;
+	int			numpending;
+	byte		*ispending;
+// stats
+	int			finds;
+	int			hits;
+	int			misses;
+	int			rebuilds;
+	double		visited;	// edicts looked at
+} findindex_t;
+
+static findindex_t	pr_findindex[MAX_FINDINDEX];
+static int			pr_numfindindex;
+static int			pr_findmaxedicts;
+static int			pr_findscans;		// lookups that walked every edict
+static double		pr_findscanvisited;
+
+cvar_t	pr_findindex_enable = {"pr_findindex", "1", CVAR_NONE};
+
+/*
+=================
+PR_FindIndexReset
+
+Called when the progs are (re)loaded
+=================
+*/
+void PR_FindIndexReset (void)
+{
 	int		i;
 
-	chain = (edict_t *)sv.edicts;
+	for (i = 0; i < pr_numfindindex; i++)
+	{
+		free (pr_findindex[i].entries);
+		free (pr_findindex[i].pending);
+		free (pr_findindex[i].ispending);
+	}
+	memset (pr_findindex, 0, sizeof(pr_findindex));
+	pr_numfindindex = 0;
+	pr_findmaxedicts = 0;
+	pr_findscans = 0;
+	pr_findscanvisited = 0;
+}
 
-	org = G_VECTOR(OFS_PARM0);
-	rad = G_FLOAT(OFS_PARM1);
-	rad *= rad;
+/*
+=================
+PR_FindVolatile
+
+True for strings that can change without the field being written
+=================
+*/
+static qboolean PR_FindVolatile (int str)
+{
+	const char *s = PR_GetString (str);
 
-	ent = NEXT_EDICT(sv.edicts);
-	for (i = 1; i < sv.num_edicts; i++, ent = NEXT_EDICT(ent))
+	if (s >= (const char *)pr_string_temp && s < (const char *)pr_string_temp + sizeof(pr_string_temp))
+		return true;
+	if (s >= (const char *)svs.clients && s < (const char *)(svs.clients + svs.maxclientslimit))
+		return true;
+	return false;
+}
+
+/*
+=================
+PR_FindAddPending
+=================
+*/
+static void PR_FindAddPending (findindex_t *fi, int num)
+{
+	if (fi->ispending[num])
+		return;
+	fi->ispending[num] = true;
+	fi->pending[fi->numpending++] = num;
+	// too much to check on every lookup, start over on the next one
+	if (fi->numpending > 64 + fi->numentries / 4)
+		fi->valid = false;
+}
+
+/*
+=================
+PR_FindIndexDirty
+
+ed's value for field fofs (or for every indexed field, if fofs is -1) may
+have changed
+=================
+*/
+void PR_FindIndexDirty (edict_t *ed, int fofs)
+{
+	findindex_t	*fi;
+	int			i, num;
+
+	if (!pr_numfindindex)
+		return;
+	num = NUM_FOR_EDICT (ed);
+	if (num >= pr_findmaxedicts)
+		return;
+
+	for (i = 0, fi = pr_findindex; i < pr_numfindindex; i++, fi++)
+		if (fi->valid && (fofs == -1 || fi->fofs == fofs))
+			PR_FindAddPending (fi, num);
+}
+
+static int PR_FindCompareEntries (const void *a, const void *b)
+{
+	const findentry_t *ea = (const findentry_t *)a;
+	const findentry_t *eb = (const findentry_t *)b;
+
+	if (ea->hash != eb->hash)
+		return ea->hash < eb->hash ? -1 : 1;
+	return ea->num - eb->num;
+}
+
+/*
+=================
+PR_FindRebuild
+=================
+*/
+static void PR_FindRebuild (findindex_t *fi)
+{
+	edict_t	*ed;
+	int		e, str;
+
+	if (!fi->entries)
 	{
-		float d, lensq;
-		if (ent->free)
-			continue;
-		if (ent->v.solid == SOLID_NOT)
-			continue;
+		fi->entries = (findentry_t *) malloc (pr_findmaxedicts * sizeof(findentry_t));
+		fi->pending = (int *) malloc (pr_findmaxedicts * sizeof(int));
+		fi->ispending = (byte *) calloc (pr_findmaxedicts, 1);
+		if (!fi->entries || !fi->pending || !fi->ispending)
+			Sys_Error ("PR_FindRebuild: out of memory");
+	}
+
+	while (fi->numpending)
+		fi->ispending[fi->pending[--fi->numpending]] = false;
+	fi->numentries = 0;
+	fi->valid = true;
+	fi->rebuilds++;
+
+	for (e = 1; e < sv.num_edicts; e++)
+	{
+		ed = EDICT_NUM(e);
+		if (ed->free)
+			continue;	// ED_Alloc will mark it
+		str = E_INT(ed, fi->fofs);
+		if (PR_FindVolatile (str))
+			PR_FindAddPending (fi, e);
+		else
+		{
+			fi->entries[fi->numentries].hash = COM_HashString (PR_GetString (str));
+			fi->entries[fi->numentries].num = e;
+			fi->numentries++;
+		}
+	}
+	fi->valid = true;	// even if everything ended up pending
+
+	qsort (fi->entries, fi->numentries, sizeof(findentry_t), PR_FindCompareEntries);
+}
+
+/*
+=================
+PR_FindGetIndex
+
+Returns the index for field fofs, creating it if there is room
+=================
+*/
+static findindex_t *PR_FindGetIndex (int fofs)
+{
+	findindex_t	*fi;
+	ddef_t		*def;
+	int			i;
+
+	if (!pr_findindex_enable.value || (unsigned)fofs >= (unsigned)progs->entityfields)
+		return NULL;
+
+	for (i = 0, fi = pr_findindex; i < pr_numfindindex; i++, fi++)
+		if (fi->fofs == fofs)
+			return fi;
+
+	if (pr_numfindindex == MAX_FINDINDEX)
+		return NULL;
+	if (!pr_findmaxedicts)
+		pr_findmaxedicts = sv.max_edicts;
+
+	fi = &pr_findindex[pr_numfindindex++];
+	fi->fofs = fofs;
+	def = ED_FieldAtOfs (fofs);
+	if (def)
+		q_strlcpy (fi->name, PR_GetString (def->s_name), sizeof(fi->name));
+	else
+		q_snprintf (fi->name, sizeof(fi->name), "field %d", fofs);
+	pr_fieldwatch[fofs] |= FIELDWATCH_FIND;
+
+	return fi;
+}
+
+/*
+=================
+PR_FindIndexed
+
+Returns the first edict after start whose field matches s, or 0
+=================
+*/
+static int PR_FindIndexed (findindex_t *fi, int start, const char *s)
+{
+	findentry_t	*entry, *end;
+	edict_t		*ed;
+	unsigned	hash;
+	int			lo, hi, mid, i, num, best;
+
+	if (!fi->valid)
+		PR_FindRebuild (fi);
+
+	hash = COM_HashString (s);
+	best = 0;
 
-		d = org[0] - (ent->v.origin[0] + (ent->v.mins[0] + ent->v.maxs[0]) * 0.5);
-		lensq = d * d;
-		if (lensq > rad)
+	// first entry with this hash after start
+	lo = 0;
+	hi = fi->numentries;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		entry = &fi->entries[mid];
+		if (entry->hash < hash || (entry->hash == hash && entry->num <= start))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (entry = &fi->entries[lo], end = fi->entries + fi->numentries; entry < end && entry->hash == hash; entry++)
+	{
+		fi->visited++;
+		if (fi->ispending[entry->num])
+			continue;	// checked below with its current value
+		ed = EDICT_NUM(entry->num);
+		if (ed->free)
 			continue;
-		d = org[1] - (ent->v.origin[1] + (ent->v.mins[1] + ent->v.maxs[1]) * 0.5);
-		lensq += d * d;
-		if (lensq > rad)
+		if (!strcmp (E_STRING(ed, fi->fofs), s))
+		{
+			best = entry->num;
+			break;
+		}
+	}
+
+	for (i = 0; i < fi->numpending; i++)
+	{
+		num = fi->pending[i];
+		if (num <= start || num >= sv.num_edicts || (best && num > best))
 			continue;
-		d = org[2] - (ent->v.origin[2] + (ent->v.mins[2] + ent->v.maxs[2]) * 0.5);
-		lensq += d * d;
-		if (lensq > rad)
+		fi->visited++;
+		ed = EDICT_NUM(num);
+		if (ed->free)
 			continue;
-
-		ent->v.chain = EDICT_TO_PROG(chain);
-		chain = ent;
+		if (!strcmp (E_STRING(ed, fi->fofs), s))
+			best = num;
 	}
 
-	RETURN_EDICT(chain);
+	return best;
+}
+
+/*
+=================
+PR_FindStats_f
+=================
+*/
+void PR_FindStats_f (void)
+{
+	findindex_t	*fi;
+	int			i;
+
+	Con_Printf ("%-16s %8s %8s %8s %8s %9s %8s\n", "field", "finds", "hits", "misses", "rebuilds", "visits/f", "pending");
+	for (i = 0, fi = pr_findindex; i < pr_numfindindex; i++, fi++)
+		Con_Printf ("%-16s %8i %8i %8i %8i %9.1f %8i\n", fi->name, fi->finds, fi->hits, fi->misses,
+			fi->rebuilds, fi->finds ? fi->visited / fi->finds : 0.0, fi->numpending);
+	Con_Printf ("%i unindexed finds, %.1f edicts visited per find\n", pr_findscans,
+		pr_findscans ? pr_findscanvisited / pr_findscans : 0.0);
 }
 
 /*
@@ -1068,6 +1340,7 @@ static void PF_Find (void)
 	int		f;
 	const char	*s, *t;
 	edict_t	*ed;
+	findindex_t	*fi;
 
 	e = G_EDICTNUM(OFS_PARM0);
 	f = G_INT(OFS_PARM1);
@@ -1075,8 +1348,28 @@ static void PF_Find (void)
 	if (!s)
 		PR_RunError ("PF_Find: bad search string");
 
+	fi = PR_FindGetIndex (f);
+	if (fi)
+	{
+		fi->finds++;
+		e = PR_FindIndexed (fi, e, s);
+		if (e)
+		{
+			fi->hits++;
+			RETURN_EDICT(EDICT_NUM(e));
+		}
+		else
+		{
+			fi->misses++;
+			RETURN_EDICT(sv.edicts);
+		}
+		return;
+	}
+
+	pr_findscans++;
 	for (e++ ; e < sv.num_edicts ; e++)
 	{
+		pr_findscanvisited++;
 		ed = EDICT_NUM(e);
 		if (ed->free)
 			continue;
@@ -33,7 +33,7 @@ static	int		pr_maxknownstrings;
 static	int		pr_numknownstrings;
 static	const char **pr_firstfreeknownstring; // free list (singly linked)
 static	ddef_t		*pr_fielddefs;
-static	ddef_t		*pr_globaldefs;
+ddef_t		*pr_globaldefs;
 
 qboolean	pr_alpha_supported; //johnfitz
 int			pr_effects_mask; // only enable 2021 rerelease quad/penta dlights when applicable
@@ -56,21 +56,26 @@ int		type_size[8] = {
 	1	// sizeof(void *) / 4		// ev_pointer
 };
 
-static ddef_t	*ED_FieldAtOfs (int ofs);
 static qboolean	ED_ParseEpair (void *base, ddef_t *key, const char *s);
 
-#define	MAX_FIELD_LEN	64
-#define	GEFV_CACHESIZE	2
+extfields_t	pr_extfields;
 
-typedef struct {
-	ddef_t	*pcache;
-	char	field[MAX_FIELD_LEN];
-} gefv_cache;
-
-static gefv_cache	gefvCache[GEFV_CACHESIZE] =
+static const struct
+{
+	const char	*name;
+	size_t		ofs;
+} pr_extfielddefs[] =
 {
-		{ NULL,	"" },
-		{ NULL,	"" }
+	{ "alpha",		offsetof(extfields_t, alpha) },
+	{ "items2",		offsetof(extfields_t, items2) },
+	{ "gravity",		offsetof(extfields_t, gravity) },
+	{ "ammo_shells1",	offsetof(extfields_t, ammo_shells1) },
+	{ "ammo_nails1",	offsetof(extfields_t, ammo_nails1) },
+	{ "ammo_lava_nails",	offsetof(extfields_t, ammo_lava_nails) },
+	{ "ammo_rockets1",	offsetof(extfields_t, ammo_rockets1) },
+	{ "ammo_multi_rockets",	offsetof(extfields_t, ammo_multi_rockets) },
+	{ "ammo_cells1",	offsetof(extfields_t, ammo_cells1) },
+	{ "ammo_plasma",	offsetof(extfields_t, ammo_plasma) },
 };
 
 cvar_t	nomonsters = {"nomonsters", "0", CVAR_NONE};
@@ -252,6 +257,9 @@ edict_t *ED_Alloc (void)
 		if (e->freetime < 2 || sv.time - e->freetime > 0.5)
 		{
 			ED_ClearEdict (e);
+			SV_RadiusGridDirty (e);
+			PR_FindIndexDirty (e, -1);
+			SV_ScheduleThink (e);
 			return e;
 		}
 	}
@@ -261,6 +269,9 @@ edict_t *ED_Alloc (void)
 
 	e = EDICT_NUM(sv.num_edicts++);
 	memset(e, 0, pr_edict_size); // ericw -- switched sv.edicts to malloc(), so we are accessing uninitialized memory and must fully zero it, not just ED_ClearEdict
+	SV_RadiusGridDirty (e);
+	PR_FindIndexDirty (e, -1);
+	SV_ScheduleThink (e);
 
 	return e;
 }
@@ -319,7 +330,7 @@ static ddef_t *ED_GlobalAtOfs (int ofs)
 ED_FieldAtOfs
 ============
 */
-static ddef_t *ED_FieldAtOfs (int ofs)
+ddef_t *ED_FieldAtOfs (int ofs)
 {
 	ddef_t		*def;
 	int			i;
@@ -418,41 +429,24 @@ static dfunction_t *ED_FindFunction (const char *fn_name)
 
 /*
 ============
-GetEdictFieldValue
+PR_FindExtFields
+
+Looks up the offsets of the optional fields in pr_extfields, so the engine
+doesn't have to search for them by name every time
 ============
 */
-eval_t *GetEdictFieldValue(edict_t *ed, const char *field)
+static void PR_FindExtFields (void)
 {
-	ddef_t			*def = NULL;
-	int				i;
-	static int		rep = 0;
-
-	for (i = 0; i < GEFV_CACHESIZE; i++)
-	{
-		if (!strcmp(field, gefvCache[i].field))
-		{
-			def = gefvCache[i].pcache;
-			goto Done;
-		}
-	}
-
-	def = ED_FindField (field);
+	ddef_t	*def;
+	int		i;
 
-	if (strlen(field) < MAX_FIELD_LEN)
+	for (i = 0; i < (int) countof(pr_extfielddefs); i++)
 	{
-		gefvCache[rep].pcache = def;
-		strcpy (gefvCache[rep].field, field);
-		rep ^= 1;
+		def = ED_FindField (pr_extfielddefs[i].name);
+		*(int *)((byte *)&pr_extfields + pr_extfielddefs[i].ofs) = def ? def->ofs : -1;
 	}
-
-Done:
-	if (!def)
-		return NULL;
-
-	return (eval_t *)((char *)&ed->v + def->ofs*4);
 }
 
-
 /*
 ============
 PR_ValueString
@@ -1025,7 +1019,12 @@ const char *ED_ParseEdict (const char *data, edict_t *ent)
 
 	// clear it
 	if (ent != sv.edicts)	// hack
+	{
 		memset (&ent->v, 0, progs->entityfields * 4);
+		SV_RadiusGridDirty (ent);
+		PR_FindIndexDirty (ent, -1);
+		SV_ScheduleThink (ent);
+	}
 
 	// go through all the dictionary pairs
 	while (1)
@@ -1308,10 +1307,6 @@ void PR_LoadProgs (void)
 {
 	int			i;
 
-	// flush the non-C variable lookup cache
-	for (i = 0; i < GEFV_CACHESIZE; i++)
-		gefvCache[i].field[0] = 0;
-
 	CRC_Init (&pr_crc);
 
 	progs = (dprograms_t *)COM_LoadHunkFile ("progs.dat", NULL);
@@ -1340,8 +1335,7 @@ void PR_LoadProgs (void)
 	pr_numknownstrings = 0;
 	pr_maxknownstrings = 0;
 	pr_stringssize = progs->numstrings;
-	if (pr_knownstrings)
-		Z_Free ((void *)pr_knownstrings);
+	free ((void *)pr_knownstrings);
 	pr_knownstrings = NULL;
 	pr_firstfreeknownstring = NULL;
 	PR_SetEngineString("");
@@ -1406,8 +1400,11 @@ void PR_LoadProgs (void)
 	pr_edict_size &= ~(sizeof(void *) - 1);
 
 	PR_InitHashTables ();
+	PR_FindExtFields ();
 	PR_InitBuiltins ();
 	PR_PatchRereleaseBuiltins ();
+	PR_TranslateProgs ();
+	PR_FindIndexReset ();
 
 	pr_effects_mask = PR_FindSupportedEffects ();
 }
@@ -1424,6 +1421,15 @@ void PR_Init (void)
 	Cmd_AddCommand ("edicts", ED_PrintEdicts);
 	Cmd_AddCommand ("edictcount", ED_Count);
 	Cmd_AddCommand ("profile", PR_Profile_f);
+	Cmd_AddCommand ("pr_bench", PR_Bench_f);
+	Cmd_AddCommand ("prof_start", PR_ProfStart_f);
+	Cmd_AddCommand ("prof_stop", PR_ProfStop_f);
+	Cmd_AddCommand ("pr_findstats", PR_FindStats_f);
+	Cvar_RegisterVariable (&pr_threaded);
+	Cvar_RegisterVariable (&pr_fuse);
+	Cvar_RegisterVariable (&pr_regwindows);
+	Cvar_RegisterVariable (&pr_findindex_enable);
+	Cvar_SetCallback (&pr_fuse, PR_Fuse_f);
 	Cvar_RegisterVariable (&nomonsters);
 	Cvar_RegisterVariable (&gamecfg);
 	Cvar_RegisterVariable (&scratch1);
@@ -1480,7 +1486,10 @@ static int PR_AllocStringSlot (void)
 		{
 			pr_maxknownstrings += PR_STRING_ALLOCSLOTS;
 			Con_DPrintf2 ("PR_AllocStringSlot: realloc'ing for %d slots\n", pr_maxknownstrings);
-			pr_knownstrings = (const char **) Z_Realloc ((void *)pr_knownstrings, pr_maxknownstrings * sizeof(char *));
+			// not the zone, this runs on the server thread for Host_Name_f
+			pr_knownstrings = (const char **) realloc ((void *)pr_knownstrings, pr_maxknownstrings * sizeof(char *));
+			if (!pr_knownstrings)
+				Sys_Error ("PR_AllocStringSlot: out of memory");
 		}
 	}
 
@@ -1517,6 +1526,21 @@ const char *PR_GetString (int num)
 	}
 }
 
+/*
+============
+PR_StringValid
+
+True if PR_GetString would return a string for num instead of raising an
+error
+============
+*/
+qboolean PR_StringValid (int num)
+{
+	if (num >= 0)
+		return num < pr_stringssize;
+	return num >= -pr_numknownstrings && pr_knownstrings[-1 - num];
+}
+
 int PR_SetEngineString (const char *s)
 {
 	int		i;
@@ -25,6 +25,7 @@ typedef struct
 {
 	int		s;
 	dfunction_t	*f;
+	int		saved;		// number of locals the callee put on localstack
 } prstack_t;
 
 #define	MAX_STACK_DEPTH		64	/* was 32 */
@@ -40,6 +41,137 @@ dfunction_t	*pr_xfunction;
 int		pr_xstatement;
 int		pr_argc;
 
+cvar_t	pr_threaded = {"pr_threaded", "1", CVAR_NONE};
+cvar_t	pr_fuse = {"pr_fuse", "1", CVAR_NONE};
+cvar_t	pr_regwindows = {"pr_regwindows", "1", CVAR_NONE};
+
+/*
+Functions flagged in pr_funcwindow own their locals outright: no other
+function's code touches them, and the function itself never reads a local
+before writing it. Their previous contents are therefore dead on entry, and
+unless the function is already somewhere on the call stack (pr_funcactive),
+PR_EnterFunction can skip saving and restoring them.
+*/
+static byte	*pr_funcwindow;
+static int	*pr_funcactive;
+
+/*
+Per entity field FIELDWATCH_* flags. The engine keeps indexes over some
+fields, and QC can only write an entity field through OP_ADDRESS, so that is
+where they learn about QC stores.
+*/
+byte		*pr_fieldwatch;
+
+/*
+The threaded engine runs a pre-decoded copy of pr_statements (pr_code), built
+once per progs load. Each instruction carries its operands as resolved global
+pointers and, when the compiler supports computed goto, the address of its
+handler. pr_code[i] always corresponds to pr_statements[i], so statement
+numbers (pr_xstatement, branch offsets, stack traces) stay interchangeable
+between the two engines.
+*/
+#if defined(__GNUC__) && !defined(PR_NO_COMPUTED_GOTO)
+#define PR_COMPUTED_GOTO
+#endif
+
+enum
+{
+	OP_BAD = OP_BITOR + 1,	// internal: invalid opcode or branch target
+
+	// superinstructions: each one runs its own statement and the next
+	OP_ADDRESS_STOREP,
+	OP_ADDRESS_STOREP_V,
+	OP_LOAD_F_ADD_F,
+	OP_LOAD_F_SUB_F,
+	OP_LOAD_F_MUL_F,
+	OP_LOAD_F_BITAND,
+	OP_EQ_F_IFNOT,		OP_EQ_F_IF,
+	OP_NE_F_IFNOT,		OP_NE_F_IF,
+	OP_EQ_S_IFNOT,		OP_EQ_S_IF,
+	OP_NE_S_IFNOT,		OP_NE_S_IF,
+	OP_EQ_E_IFNOT,		OP_EQ_E_IF,
+	OP_NE_E_IFNOT,		OP_NE_E_IF,
+	OP_EQ_FNC_IFNOT,	OP_EQ_FNC_IF,
+	OP_NE_FNC_IFNOT,	OP_NE_FNC_IF,
+	OP_NOT_F_IFNOT,		OP_NOT_F_IF,
+	OP_NOT_S_IFNOT,		OP_NOT_S_IF,
+	OP_NOT_ENT_IFNOT,	OP_NOT_ENT_IF,
+	OP_NOT_FNC_IFNOT,	OP_NOT_FNC_IF,
+	OP_LE_IFNOT,		OP_LE_IF,
+	OP_GE_IFNOT,		OP_GE_IF,
+	OP_LT_IFNOT,		OP_LT_IF,
+	OP_GT_IFNOT,		OP_GT_IF,
+	OP_AND_IFNOT,		OP_AND_IF,
+	OP_OR_IFNOT,		OP_OR_IF,
+	OP_BITAND_IFNOT,	OP_BITAND_IF,
+
+	PR_NUMOPS
+};
+
+typedef struct
+{
+	unsigned short	first, second, fused;
+} prfusion_t;
+
+#define FUSE_COND(op)	{op, OP_IFNOT, op##_IFNOT}, {op, OP_IF, op##_IF}
+
+static const prfusion_t pr_fusions[] =
+{
+	{OP_ADDRESS, OP_STOREP_F, OP_ADDRESS_STOREP},
+	{OP_ADDRESS, OP_STOREP_S, OP_ADDRESS_STOREP},
+	{OP_ADDRESS, OP_STOREP_ENT, OP_ADDRESS_STOREP},
+	{OP_ADDRESS, OP_STOREP_FLD, OP_ADDRESS_STOREP},
+	{OP_ADDRESS, OP_STOREP_FNC, OP_ADDRESS_STOREP},
+	{OP_ADDRESS, OP_STOREP_V, OP_ADDRESS_STOREP_V},
+	{OP_LOAD_F, OP_ADD_F, OP_LOAD_F_ADD_F},
+	{OP_LOAD_F, OP_SUB_F, OP_LOAD_F_SUB_F},
+	{OP_LOAD_F, OP_MUL_F, OP_LOAD_F_MUL_F},
+	{OP_LOAD_F, OP_BITAND, OP_LOAD_F_BITAND},
+	FUSE_COND (OP_EQ_F),
+	FUSE_COND (OP_NE_F),
+	FUSE_COND (OP_EQ_S),
+	FUSE_COND (OP_NE_S),
+	FUSE_COND (OP_EQ_E),
+	FUSE_COND (OP_NE_E),
+	FUSE_COND (OP_EQ_FNC),
+	FUSE_COND (OP_NE_FNC),
+	FUSE_COND (OP_NOT_F),
+	FUSE_COND (OP_NOT_S),
+	FUSE_COND (OP_NOT_ENT),
+	FUSE_COND (OP_NOT_FNC),
+	FUSE_COND (OP_LE),
+	FUSE_COND (OP_GE),
+	FUSE_COND (OP_LT),
+	FUSE_COND (OP_GT),
+	FUSE_COND (OP_AND),
+	FUSE_COND (OP_OR),
+	FUSE_COND (OP_BITAND),
+};
+
+#undef FUSE_COND
+
+typedef struct prinstr_s
+{
+	const void		*handler;	// label address (computed goto only)
+	int			opcode;
+	eval_t			*a, *b, *c;
+	struct prinstr_s	*jump;		// resolved branch target
+} prinstr_t;
+
+static prinstr_t	*pr_code;
+static byte		*pr_entrypoint;	// statements that can be reached other than by falling through
+static int		pr_numfused;
+
+#define PR_NUMENGINES	3	// switch, threaded, threaded + superinstructions
+
+static qboolean	pr_benchmarking;
+static int	pr_benchengine;
+static double	pr_benchtime[PR_NUMENGINES];
+static double	pr_benchstatements[PR_NUMENGINES];
+
+qboolean	pr_timing;
+double		pr_exectime;
+
 static const char *pr_opnames[] =
 {
 	"DONE",
@@ -247,6 +379,24 @@ void PR_Profile_f (void)
 }
 
 
+/*
+============
+PR_FieldWritten
+
+QC took the address of a watched field
+============
+*/
+void PR_FieldWritten (edict_t *ed, int fofs)
+{
+	if (pr_fieldwatch[fofs] & FIELDWATCH_MOVES)
+		SV_RadiusGridDirty (ed);
+	if (pr_fieldwatch[fofs] & FIELDWATCH_FIND)
+		PR_FindIndexDirty (ed, fofs);
+	if (pr_fieldwatch[fofs] & FIELDWATCH_THINK)
+		SV_ScheduleThink (ed);
+}
+
+
 /*
 ============
 PR_RunError
@@ -269,6 +419,8 @@ void PR_RunError (const char *error, ...)
 	Con_Printf("%s\n", string);
 
 	pr_depth = 0;	// dump the stack so host_error can shutdown functions
+	memset (pr_funcactive, 0, progs->numfunctions * sizeof(*pr_funcactive));
+	PR_ProfReset (false);
 
 	Host_Error("Program error");
 }
@@ -283,15 +435,25 @@ Returns the new program statement counter
 static int PR_EnterFunction (dfunction_t *f)
 {
 	int	i, j, c, o;
+	int	fnum = f - pr_functions;
+
+	// save off any locals that the new function steps on, unless
+	// nothing can observe them
+	if (pr_funcwindow[fnum] && !pr_funcactive[fnum] && pr_regwindows.value)
+		c = 0;
+	else
+		c = f->locals;
 
 	pr_stack[pr_depth].s = pr_xstatement;
 	pr_stack[pr_depth].f = pr_xfunction;
+	pr_stack[pr_depth].saved = c;
 	pr_depth++;
 	if (pr_depth >= MAX_STACK_DEPTH)
 		PR_RunError("stack overflow");
+	pr_funcactive[fnum]++;
+	if (pr_profiling)
+		PR_ProfEnter (f);
 
-	// save off any locals that the new function steps on
-	c = f->locals;
 	if (localstack_used + c > LOCALSTACK_SIZE)
 		PR_RunError("PR_ExecuteProgram: locals stack overflow");
 
@@ -326,8 +488,12 @@ static int PR_LeaveFunction (void)
 	if (pr_depth <= 0)
 		Host_Error("prog stack underflow");
 
+	pr_funcactive[pr_xfunction - pr_functions]--;
+	if (pr_profiling)
+		PR_ProfLeave ();
+
 	// Restore locals from the stack
-	c = pr_xfunction->locals;
+	c = pr_stack[pr_depth - 1].saved;
 	localstack_used -= c;
 	if (localstack_used < 0)
 		PR_RunError("PR_ExecuteProgram: locals stack underflow");
@@ -344,40 +510,22 @@ static int PR_LeaveFunction (void)
 
 /*
 ====================
-PR_ExecuteProgram
+PR_ExecuteSwitch
 
-The interpretation main loop
+The interpretation main loop. Starts executing after st, returns the number
+of statements run (including the counts it was handed) once the stack
+unwinds to exitdepth.
 ====================
 */
 #define OPA ((eval_t *)&pr_globals[(unsigned short)st->a])
 #define OPB ((eval_t *)&pr_globals[(unsigned short)st->b])
 #define OPC ((eval_t *)&pr_globals[(unsigned short)st->c])
 
-void PR_ExecuteProgram (func_t fnum)
+static int PR_ExecuteSwitch (dstatement_t *st, int exitdepth, int profile, int startprofile)
 {
 	eval_t		*ptr;
-	dstatement_t	*st;
-	dfunction_t	*f, *newf;
-	int profile, startprofile;
+	dfunction_t	*newf;
 	edict_t		*ed;
-	int		exitdepth;
-
-	if (!fnum || fnum >= progs->numfunctions)
-	{
-		if (pr_global_struct->self)
-			ED_Print (PROG_TO_EDICT(pr_global_struct->self));
-		Host_Error ("PR_ExecuteProgram: NULL function");
-	}
-
-	f = &pr_functions[fnum];
-
-	pr_trace = false;
-
-// make a stack frame
-	exitdepth = pr_depth;
-
-	st = &pr_statements[PR_EnterFunction(f)];
-	startprofile = profile = 0;
 
     while (1)
     {
@@ -552,6 +700,8 @@ void PR_ExecuteProgram (func_t fnum)
 			pr_xstatement = st - pr_statements;
 			PR_RunError("assignment to world entity");
 		}
+		if ((unsigned)OPB->_int < (unsigned)progs->entityfields && pr_fieldwatch[OPB->_int])
+			PR_FieldWritten (ed, OPB->_int);
 		OPC->_int = (byte *)((int *)&ed->v + OPB->_int) - (byte *)sv.edicts;
 		break;
 
@@ -613,7 +763,14 @@ void PR_ExecuteProgram (func_t fnum)
 			int i = -newf->first_statement;
 			if (i >= pr_numbuiltins)
 				PR_RunError("Bad builtin call number %d", i);
-			pr_builtins[i]();
+			if (pr_profiling)
+			{
+				PR_ProfEnter (newf);
+				pr_builtins[i]();
+				PR_ProfLeave ();
+			}
+			else
+				pr_builtins[i]();
 			break;
 		}
 		// Normal function
@@ -631,13 +788,14 @@ void PR_ExecuteProgram (func_t fnum)
 		st = &pr_statements[PR_LeaveFunction()];
 		if (pr_depth == exitdepth)
 		{ // Done
-			return;
+			return profile;
 		}
 		break;
 
 	case OP_STATE:
 		ed = PROG_TO_EDICT(pr_global_struct->self);
 		ed->v.nextthink = pr_global_struct->time + 0.1;
+		SV_ScheduleThink (ed);
 		ed->v.frame = OPA->_float;
 		ed->v.think = OPB->function;
 		break;
@@ -652,3 +810,1120 @@ void PR_ExecuteProgram (func_t fnum)
 #undef OPB
 #undef OPC
 
+
+
+/*
+====================
+PR_ExecuteThreaded
+
+Same semantics as PR_ExecuteSwitch, but runs the pre-decoded pr_code stream.
+Statement counts are only brought up to date when control leaves a
+straight-line run (taken branches, calls and returns), which is also where
+the runaway loop check happens: any endless loop has to branch backwards.
+
+Superinstructions run both of their statements with the same operand
+pointers the separate instructions would use and in the same order, so the
+intermediate (usually temporary) results are still written out.
+
+Called with a NULL ip to publish the handler table for PR_TranslateProgs.
+====================
+*/
+#ifdef PR_COMPUTED_GOTO
+static const void *const *pr_handlers;
+
+#define CASE(op)	L_##op:
+#define DISPATCH()	goto *ip->handler
+#else
+#define CASE(op)	case op:
+#define DISPATCH()	goto dispatch
+#endif
+
+#define NEXT()		do { ip++; DISPATCH (); } while (0)
+#define NEXT2()		do { ip += 2; DISPATCH (); } while (0)
+#define SYNC(next)	do { profile += (int)(ip - run) + 1; run = (next); } while (0)
+#define CHECK_RUNAWAY()						\
+	do {							\
+		if (profile > 100000)				\
+		{						\
+			pr_xstatement = ip - pr_code;		\
+			PR_RunError ("runaway loop error");	\
+		}						\
+	} while (0)
+#define JUMP(target)						\
+	do {							\
+		SYNC (target);					\
+		CHECK_RUNAWAY ();				\
+		ip = (target);					\
+		DISPATCH ();					\
+	} while (0)
+#define COND_BRANCH(op, expr)					\
+	CASE (op##_IFNOT)					\
+		ip->c->_float = (expr);				\
+		ip++;						\
+		if (!ip->a->_int)				\
+			JUMP (ip->jump);			\
+		NEXT ();					\
+	CASE (op##_IF)						\
+		ip->c->_float = (expr);				\
+		ip++;						\
+		if (ip->a->_int)				\
+			JUMP (ip->jump);			\
+		NEXT ();
+#define LOAD_ARITH(op, expr)					\
+	CASE (op)						\
+		ed = PROG_TO_EDICT(ip->a->edict);		\
+		ip->c->_int = ((eval_t *)((int *)&ed->v + ip->b->_int))->_int;	\
+		ip++;						\
+		ip->c->_float = (expr);				\
+		NEXT ();
+
+static int PR_ExecuteThreaded (prinstr_t *ip, int exitdepth)
+{
+#ifdef PR_COMPUTED_GOTO
+	static const void *const handlers[PR_NUMOPS] =
+	{
+		&&L_OP_DONE,
+		&&L_OP_MUL_F, &&L_OP_MUL_V, &&L_OP_MUL_FV, &&L_OP_MUL_VF,
+		&&L_OP_DIV_F,
+		&&L_OP_ADD_F, &&L_OP_ADD_V,
+		&&L_OP_SUB_F, &&L_OP_SUB_V,
+		&&L_OP_EQ_F, &&L_OP_EQ_V, &&L_OP_EQ_S, &&L_OP_EQ_E, &&L_OP_EQ_FNC,
+		&&L_OP_NE_F, &&L_OP_NE_V, &&L_OP_NE_S, &&L_OP_NE_E, &&L_OP_NE_FNC,
+		&&L_OP_LE, &&L_OP_GE, &&L_OP_LT, &&L_OP_GT,
+		&&L_OP_LOAD_F, &&L_OP_LOAD_V, &&L_OP_LOAD_S, &&L_OP_LOAD_ENT, &&L_OP_LOAD_FLD, &&L_OP_LOAD_FNC,
+		&&L_OP_ADDRESS,
+		&&L_OP_STORE_F, &&L_OP_STORE_V, &&L_OP_STORE_S, &&L_OP_STORE_ENT, &&L_OP_STORE_FLD, &&L_OP_STORE_FNC,
+		&&L_OP_STOREP_F, &&L_OP_STOREP_V, &&L_OP_STOREP_S, &&L_OP_STOREP_ENT, &&L_OP_STOREP_FLD, &&L_OP_STOREP_FNC,
+		&&L_OP_RETURN,
+		&&L_OP_NOT_F, &&L_OP_NOT_V, &&L_OP_NOT_S, &&L_OP_NOT_ENT, &&L_OP_NOT_FNC,
+		&&L_OP_IF, &&L_OP_IFNOT,
+		&&L_OP_CALL0, &&L_OP_CALL1, &&L_OP_CALL2, &&L_OP_CALL3, &&L_OP_CALL4,
+		&&L_OP_CALL5, &&L_OP_CALL6, &&L_OP_CALL7, &&L_OP_CALL8,
+		&&L_OP_STATE,
+		&&L_OP_GOTO,
+		&&L_OP_AND, &&L_OP_OR,
+		&&L_OP_BITAND, &&L_OP_BITOR,
+		&&L_OP_BAD,
+		&&L_OP_ADDRESS_STOREP,
+		&&L_OP_ADDRESS_STOREP_V,
+		&&L_OP_LOAD_F_ADD_F,
+		&&L_OP_LOAD_F_SUB_F,
+		&&L_OP_LOAD_F_MUL_F,
+		&&L_OP_LOAD_F_BITAND,
+		&&L_OP_EQ_F_IFNOT,	&&L_OP_EQ_F_IF,
+		&&L_OP_NE_F_IFNOT,	&&L_OP_NE_F_IF,
+		&&L_OP_EQ_S_IFNOT,	&&L_OP_EQ_S_IF,
+		&&L_OP_NE_S_IFNOT,	&&L_OP_NE_S_IF,
+		&&L_OP_EQ_E_IFNOT,	&&L_OP_EQ_E_IF,
+		&&L_OP_NE_E_IFNOT,	&&L_OP_NE_E_IF,
+		&&L_OP_EQ_FNC_IFNOT,	&&L_OP_EQ_FNC_IF,
+		&&L_OP_NE_FNC_IFNOT,	&&L_OP_NE_FNC_IF,
+		&&L_OP_NOT_F_IFNOT,	&&L_OP_NOT_F_IF,
+		&&L_OP_NOT_S_IFNOT,	&&L_OP_NOT_S_IF,
+		&&L_OP_NOT_ENT_IFNOT,	&&L_OP_NOT_ENT_IF,
+		&&L_OP_NOT_FNC_IFNOT,	&&L_OP_NOT_FNC_IF,
+		&&L_OP_LE_IFNOT,	&&L_OP_LE_IF,
+		&&L_OP_GE_IFNOT,	&&L_OP_GE_IF,
+		&&L_OP_LT_IFNOT,	&&L_OP_LT_IF,
+		&&L_OP_GT_IFNOT,	&&L_OP_GT_IF,
+		&&L_OP_AND_IFNOT,	&&L_OP_AND_IF,
+		&&L_OP_OR_IFNOT,	&&L_OP_OR_IF,
+		&&L_OP_BITAND_IFNOT,	&&L_OP_BITAND_IF,
+	};
+#endif
+	prinstr_t	*run;		// first instruction of the current straight-line run
+	int		profile, startprofile;
+	int		s;
+	eval_t		*ptr;
+	dfunction_t	*newf;
+	edict_t		*ed;
+
+	if (!ip)
+	{
+#ifdef PR_COMPUTED_GOTO
+		pr_handlers = handlers;
+#endif
+		return 0;
+	}
+
+	run = ip;
+	profile = startprofile = 0;
+
+	DISPATCH ();
+
+#ifndef PR_COMPUTED_GOTO
+dispatch:
+	switch (ip->opcode)
+	{
+#endif
+	CASE (OP_ADD_F)
+		ip->c->_float = ip->a->_float + ip->b->_float;
+		NEXT ();
+	CASE (OP_ADD_V)
+		ip->c->vector[0] = ip->a->vector[0] + ip->b->vector[0];
+		ip->c->vector[1] = ip->a->vector[1] + ip->b->vector[1];
+		ip->c->vector[2] = ip->a->vector[2] + ip->b->vector[2];
+		NEXT ();
+
+	CASE (OP_SUB_F)
+		ip->c->_float = ip->a->_float - ip->b->_float;
+		NEXT ();
+	CASE (OP_SUB_V)
+		ip->c->vector[0] = ip->a->vector[0] - ip->b->vector[0];
+		ip->c->vector[1] = ip->a->vector[1] - ip->b->vector[1];
+		ip->c->vector[2] = ip->a->vector[2] - ip->b->vector[2];
+		NEXT ();
+
+	CASE (OP_MUL_F)
+		ip->c->_float = ip->a->_float * ip->b->_float;
+		NEXT ();
+	CASE (OP_MUL_V)
+		ip->c->_float = ip->a->vector[0] * ip->b->vector[0] +
+				ip->a->vector[1] * ip->b->vector[1] +
+				ip->a->vector[2] * ip->b->vector[2];
+		NEXT ();
+	CASE (OP_MUL_FV)
+		ip->c->vector[0] = ip->a->_float * ip->b->vector[0];
+		ip->c->vector[1] = ip->a->_float * ip->b->vector[1];
+		ip->c->vector[2] = ip->a->_float * ip->b->vector[2];
+		NEXT ();
+	CASE (OP_MUL_VF)
+		ip->c->vector[0] = ip->b->_float * ip->a->vector[0];
+		ip->c->vector[1] = ip->b->_float * ip->a->vector[1];
+		ip->c->vector[2] = ip->b->_float * ip->a->vector[2];
+		NEXT ();
+
+	CASE (OP_DIV_F)
+		ip->c->_float = ip->a->_float / ip->b->_float;
+		NEXT ();
+
+	CASE (OP_BITAND)
+		ip->c->_float = (int)ip->a->_float & (int)ip->b->_float;
+		NEXT ();
+	CASE (OP_BITOR)
+		ip->c->_float = (int)ip->a->_float | (int)ip->b->_float;
+		NEXT ();
+
+	CASE (OP_GE)
+		ip->c->_float = ip->a->_float >= ip->b->_float;
+		NEXT ();
+	CASE (OP_LE)
+		ip->c->_float = ip->a->_float <= ip->b->_float;
+		NEXT ();
+	CASE (OP_GT)
+		ip->c->_float = ip->a->_float > ip->b->_float;
+		NEXT ();
+	CASE (OP_LT)
+		ip->c->_float = ip->a->_float < ip->b->_float;
+		NEXT ();
+	CASE (OP_AND)
+		ip->c->_float = ip->a->_float && ip->b->_float;
+		NEXT ();
+	CASE (OP_OR)
+		ip->c->_float = ip->a->_float || ip->b->_float;
+		NEXT ();
+
+	CASE (OP_NOT_F)
+		ip->c->_float = !ip->a->_float;
+		NEXT ();
+	CASE (OP_NOT_V)
+		ip->c->_float = !ip->a->vector[0] && !ip->a->vector[1] && !ip->a->vector[2];
+		NEXT ();
+	CASE (OP_NOT_S)
+		ip->c->_float = !ip->a->string || !*PR_GetString(ip->a->string);
+		NEXT ();
+	CASE (OP_NOT_FNC)
+		ip->c->_float = !ip->a->function;
+		NEXT ();
+	CASE (OP_NOT_ENT)
+		ip->c->_float = (PROG_TO_EDICT(ip->a->edict) == sv.edicts);
+		NEXT ();
+
+	CASE (OP_EQ_F)
+		ip->c->_float = ip->a->_float == ip->b->_float;
+		NEXT ();
+	CASE (OP_EQ_V)
+		ip->c->_float = (ip->a->vector[0] == ip->b->vector[0]) &&
+				(ip->a->vector[1] == ip->b->vector[1]) &&
+				(ip->a->vector[2] == ip->b->vector[2]);
+		NEXT ();
+	CASE (OP_EQ_S)
+		ip->c->_float = !strcmp(PR_GetString(ip->a->string), PR_GetString(ip->b->string));
+		NEXT ();
+	CASE (OP_EQ_E)
+		ip->c->_float = ip->a->_int == ip->b->_int;
+		NEXT ();
+	CASE (OP_EQ_FNC)
+		ip->c->_float = ip->a->function == ip->b->function;
+		NEXT ();
+
+	CASE (OP_NE_F)
+		ip->c->_float = ip->a->_float != ip->b->_float;
+		NEXT ();
+	CASE (OP_NE_V)
+		ip->c->_float = (ip->a->vector[0] != ip->b->vector[0]) ||
+				(ip->a->vector[1] != ip->b->vector[1]) ||
+				(ip->a->vector[2] != ip->b->vector[2]);
+		NEXT ();
+	CASE (OP_NE_S)
+		ip->c->_float = strcmp(PR_GetString(ip->a->string), PR_GetString(ip->b->string));
+		NEXT ();
+	CASE (OP_NE_E)
+		ip->c->_float = ip->a->_int != ip->b->_int;
+		NEXT ();
+	CASE (OP_NE_FNC)
+		ip->c->_float = ip->a->function != ip->b->function;
+		NEXT ();
+
+	CASE (OP_STORE_F)
+	CASE (OP_STORE_ENT)
+	CASE (OP_STORE_FLD)	// integers
+	CASE (OP_STORE_S)
+	CASE (OP_STORE_FNC)	// pointers
+		ip->b->_int = ip->a->_int;
+		NEXT ();
+	CASE (OP_STORE_V)
+		ip->b->vector[0] = ip->a->vector[0];
+		ip->b->vector[1] = ip->a->vector[1];
+		ip->b->vector[2] = ip->a->vector[2];
+		NEXT ();
+
+	CASE (OP_STOREP_F)
+	CASE (OP_STOREP_ENT)
+	CASE (OP_STOREP_FLD)	// integers
+	CASE (OP_STOREP_S)
+	CASE (OP_STOREP_FNC)	// pointers
+		ptr = (eval_t *)((byte *)sv.edicts + ip->b->_int);
+		ptr->_int = ip->a->_int;
+		NEXT ();
+	CASE (OP_STOREP_V)
+		ptr = (eval_t *)((byte *)sv.edicts + ip->b->_int);
+		ptr->vector[0] = ip->a->vector[0];
+		ptr->vector[1] = ip->a->vector[1];
+		ptr->vector[2] = ip->a->vector[2];
+		NEXT ();
+
+	CASE (OP_ADDRESS)
+		ed = PROG_TO_EDICT(ip->a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		{
+			pr_xstatement = ip - pr_code;
+			PR_RunError("assignment to world entity");
+		}
+		if ((unsigned)ip->b->_int < (unsigned)progs->entityfields && pr_fieldwatch[ip->b->_int])
+			PR_FieldWritten (ed, ip->b->_int);
+		ip->c->_int = (byte *)((int *)&ed->v + ip->b->_int) - (byte *)sv.edicts;
+		NEXT ();
+
+	CASE (OP_LOAD_F)
+	CASE (OP_LOAD_FLD)
+	CASE (OP_LOAD_ENT)
+	CASE (OP_LOAD_S)
+	CASE (OP_LOAD_FNC)
+		ed = PROG_TO_EDICT(ip->a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		ip->c->_int = ((eval_t *)((int *)&ed->v + ip->b->_int))->_int;
+		NEXT ();
+
+	CASE (OP_LOAD_V)
+		ed = PROG_TO_EDICT(ip->a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		ptr = (eval_t *)((int *)&ed->v + ip->b->_int);
+		ip->c->vector[0] = ptr->vector[0];
+		ip->c->vector[1] = ptr->vector[1];
+		ip->c->vector[2] = ptr->vector[2];
+		NEXT ();
+
+	CASE (OP_IFNOT)
+		if (!ip->a->_int)
+			JUMP (ip->jump);
+		NEXT ();
+
+	CASE (OP_IF)
+		if (ip->a->_int)
+			JUMP (ip->jump);
+		NEXT ();
+
+	CASE (OP_GOTO)
+		JUMP (ip->jump);
+
+	CASE (OP_CALL0)
+	CASE (OP_CALL1)
+	CASE (OP_CALL2)
+	CASE (OP_CALL3)
+	CASE (OP_CALL4)
+	CASE (OP_CALL5)
+	CASE (OP_CALL6)
+	CASE (OP_CALL7)
+	CASE (OP_CALL8)
+		SYNC (ip + 1);
+		CHECK_RUNAWAY ();
+		pr_xfunction->profile += profile - startprofile;
+		startprofile = profile;
+		pr_xstatement = ip - pr_code;
+		pr_argc = ip->opcode - OP_CALL0;
+		if (!ip->a->function)
+			PR_RunError("NULL function");
+		newf = &pr_functions[ip->a->function];
+		if (newf->first_statement < 0)
+		{ // Built-in function
+			int i = -newf->first_statement;
+			if (i >= pr_numbuiltins)
+				PR_RunError("Bad builtin call number %d", i);
+			if (pr_profiling)
+			{
+				PR_ProfEnter (newf);
+				pr_builtins[i]();
+				PR_ProfLeave ();
+			}
+			else
+				pr_builtins[i]();
+			// traceon: let the switch loop finish this call so every statement gets printed
+			if (pr_trace)
+				return PR_ExecuteSwitch (&pr_statements[ip - pr_code], exitdepth, profile, startprofile);
+			NEXT ();
+		}
+		// Normal function
+		ip = &pr_code[PR_EnterFunction(newf) + 1];
+		run = ip;
+		DISPATCH ();
+
+	CASE (OP_DONE)
+	CASE (OP_RETURN)
+		SYNC (NULL);
+		pr_xfunction->profile += profile - startprofile;
+		startprofile = profile;
+		pr_xstatement = ip - pr_code;
+		pr_globals[OFS_RETURN] = ip->a->vector[0];
+		pr_globals[OFS_RETURN + 1] = ip->a->vector[1];
+		pr_globals[OFS_RETURN + 2] = ip->a->vector[2];
+		s = PR_LeaveFunction();
+		if (pr_depth == exitdepth)
+		{ // Done
+			return profile;
+		}
+		ip = run = &pr_code[s + 1];
+		DISPATCH ();
+
+	CASE (OP_STATE)
+		ed = PROG_TO_EDICT(pr_global_struct->self);
+		ed->v.nextthink = pr_global_struct->time + 0.1;
+		SV_ScheduleThink (ed);
+		ed->v.frame = ip->a->_float;
+		ed->v.think = ip->b->function;
+		NEXT ();
+
+	CASE (OP_ADDRESS_STOREP)
+	CASE (OP_ADDRESS_STOREP_V)
+		ed = PROG_TO_EDICT(ip->a->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		{
+			pr_xstatement = ip - pr_code;
+			PR_RunError("assignment to world entity");
+		}
+		if ((unsigned)ip->b->_int < (unsigned)progs->entityfields && pr_fieldwatch[ip->b->_int])
+			PR_FieldWritten (ed, ip->b->_int);
+		ip->c->_int = (byte *)((int *)&ed->v + ip->b->_int) - (byte *)sv.edicts;
+		ptr = (eval_t *)((byte *)sv.edicts + ip[1].b->_int);
+		if (ip->opcode == OP_ADDRESS_STOREP)
+			ptr->_int = ip[1].a->_int;
+		else
+		{
+			ptr->vector[0] = ip[1].a->vector[0];
+			ptr->vector[1] = ip[1].a->vector[1];
+			ptr->vector[2] = ip[1].a->vector[2];
+		}
+		NEXT2 ();
+
+	LOAD_ARITH (OP_LOAD_F_ADD_F, ip->a->_float + ip->b->_float)
+	LOAD_ARITH (OP_LOAD_F_SUB_F, ip->a->_float - ip->b->_float)
+	LOAD_ARITH (OP_LOAD_F_MUL_F, ip->a->_float * ip->b->_float)
+	LOAD_ARITH (OP_LOAD_F_BITAND, (int)ip->a->_float & (int)ip->b->_float)
+
+	COND_BRANCH (OP_EQ_F, ip->a->_float == ip->b->_float)
+	COND_BRANCH (OP_NE_F, ip->a->_float != ip->b->_float)
+	COND_BRANCH (OP_EQ_S, !strcmp(PR_GetString(ip->a->string), PR_GetString(ip->b->string)))
+	COND_BRANCH (OP_NE_S, strcmp(PR_GetString(ip->a->string), PR_GetString(ip->b->string)))
+	COND_BRANCH (OP_EQ_E, ip->a->_int == ip->b->_int)
+	COND_BRANCH (OP_NE_E, ip->a->_int != ip->b->_int)
+	COND_BRANCH (OP_EQ_FNC, ip->a->function == ip->b->function)
+	COND_BRANCH (OP_NE_FNC, ip->a->function != ip->b->function)
+	COND_BRANCH (OP_NOT_F, !ip->a->_float)
+	COND_BRANCH (OP_NOT_S, !ip->a->string || !*PR_GetString(ip->a->string))
+	COND_BRANCH (OP_NOT_ENT, PROG_TO_EDICT(ip->a->edict) == sv.edicts)
+	COND_BRANCH (OP_NOT_FNC, !ip->a->function)
+	COND_BRANCH (OP_LE, ip->a->_float <= ip->b->_float)
+	COND_BRANCH (OP_GE, ip->a->_float >= ip->b->_float)
+	COND_BRANCH (OP_LT, ip->a->_float < ip->b->_float)
+	COND_BRANCH (OP_GT, ip->a->_float > ip->b->_float)
+	COND_BRANCH (OP_AND, ip->a->_float && ip->b->_float)
+	COND_BRANCH (OP_OR, ip->a->_float || ip->b->_float)
+	COND_BRANCH (OP_BITAND, (int)ip->a->_float & (int)ip->b->_float)
+
+	CASE (OP_BAD)
+		pr_xstatement = ip - pr_code;
+		if (pr_xstatement >= progs->numstatements)
+		{
+			pr_xstatement = progs->numstatements - 1;
+			PR_RunError("Execution past end of statements");
+		}
+		if (pr_statements[pr_xstatement].op < OP_BAD)
+			PR_RunError("Bad branch target in %s", pr_opnames[pr_statements[pr_xstatement].op]);
+		PR_RunError("Bad opcode %i", pr_statements[pr_xstatement].op);
+#ifndef PR_COMPUTED_GOTO
+	default:
+		pr_xstatement = ip - pr_code;
+		PR_RunError("Bad opcode %i", pr_statements[pr_xstatement].op);
+	}
+#endif
+}
+
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef NEXT2
+#undef SYNC
+#undef CHECK_RUNAWAY
+#undef JUMP
+#undef COND_BRANCH
+#undef LOAD_ARITH
+
+
+/*
+====================
+PR_FuseStatements
+
+Rewrites the first instruction of common statement pairs into a
+superinstruction (or undoes that when fuse is false). The second statement
+of a pair must not be reachable other than by falling through from the
+first one. pr_statements itself is never touched, so stack traces, statement
+printing and savegames keep seeing the original code.
+
+Returns the number of pairs fused.
+====================
+*/
+static int PR_FuseStatements (qboolean fuse)
+{
+	int		i, j, count;
+	int		numstatements = progs->numstatements;
+	prinstr_t	*in;
+
+	for (i = 0, in = pr_code; i < numstatements; i++, in++)
+	{
+		in->opcode = pr_statements[i].op < OP_BAD ? pr_statements[i].op : OP_BAD;
+		if ((in->opcode == OP_IF || in->opcode == OP_IFNOT || in->opcode == OP_GOTO) && !in->jump)
+			in->opcode = OP_BAD;
+	}
+
+	count = 0;
+	for (i = 0, in = pr_code; fuse && i < numstatements - 1; i++, in++)
+	{
+		if (pr_entrypoint[i + 1] || in[1].opcode == OP_BAD)
+			continue;
+		for (j = 0; j < (int) countof (pr_fusions); j++)
+		{
+			if (pr_fusions[j].first == in->opcode && pr_fusions[j].second == in[1].opcode)
+			{
+				in->opcode = pr_fusions[j].fused;
+				count++;
+				i++;	// pairs don't overlap
+				in++;
+				break;
+			}
+		}
+	}
+
+#ifdef PR_COMPUTED_GOTO
+	for (i = 0; i <= numstatements; i++)
+		pr_code[i].handler = pr_handlers[pr_code[i].opcode];
+#endif
+
+	return count;
+}
+
+/*
+====================
+PR_Fuse_f
+====================
+*/
+void PR_Fuse_f (cvar_t *var)
+{
+	if (!sv.active)	// pr_code goes away with the hunk
+		return;
+	pr_numfused = PR_FuseStatements (var->value != 0.f);
+	Con_DPrintf ("%i superinstructions\n", pr_numfused);
+}
+
+
+/*
+====================
+PR_GetOperands
+
+Lists the global slots a statement reads and writes as offset/size pairs.
+Returns the number of reads; the write, if any, goes in slots[3].
+====================
+*/
+typedef struct
+{
+	unsigned short	ofs;
+	unsigned short	size;
+} prslot_t;
+
+static int PR_GetOperands (const dstatement_t *st, prslot_t slots[4], int *numwrites)
+{
+	int	ra = 0, rb = 0, wb = 0, wc = 0, n;
+
+	switch (st->op)
+	{
+	case OP_MUL_F:	case OP_DIV_F:	case OP_ADD_F:	case OP_SUB_F:
+	case OP_EQ_F:	case OP_EQ_S:	case OP_EQ_E:	case OP_EQ_FNC:
+	case OP_NE_F:	case OP_NE_S:	case OP_NE_E:	case OP_NE_FNC:
+	case OP_LE:	case OP_GE:	case OP_LT:	case OP_GT:
+	case OP_AND:	case OP_OR:	case OP_BITAND:	case OP_BITOR:
+	case OP_LOAD_F:	case OP_LOAD_S:	case OP_LOAD_ENT: case OP_LOAD_FLD: case OP_LOAD_FNC:
+	case OP_ADDRESS:
+		ra = 1; rb = 1; wc = 1;
+		break;
+	case OP_LOAD_V:
+		ra = 1; rb = 1; wc = 3;
+		break;
+	case OP_MUL_V:	case OP_EQ_V:	case OP_NE_V:
+		ra = 3; rb = 3; wc = 1;
+		break;
+	case OP_ADD_V:	case OP_SUB_V:
+		ra = 3; rb = 3; wc = 3;
+		break;
+	case OP_MUL_FV:
+		ra = 1; rb = 3; wc = 3;
+		break;
+	case OP_MUL_VF:
+		ra = 3; rb = 1; wc = 3;
+		break;
+	case OP_STORE_F: case OP_STORE_S: case OP_STORE_ENT: case OP_STORE_FLD: case OP_STORE_FNC:
+		ra = 1; wb = 1;
+		break;
+	case OP_STORE_V:
+		ra = 3; wb = 3;
+		break;
+	case OP_STOREP_F: case OP_STOREP_S: case OP_STOREP_ENT: case OP_STOREP_FLD: case OP_STOREP_FNC:
+	case OP_STATE:
+		ra = 1; rb = 1;
+		break;
+	case OP_STOREP_V:
+		ra = 3; rb = 1;
+		break;
+	case OP_NOT_F:	case OP_NOT_S:	case OP_NOT_ENT: case OP_NOT_FNC:
+		ra = 1; wc = 1;
+		break;
+	case OP_NOT_V:
+		ra = 3; wc = 1;
+		break;
+	case OP_DONE:	case OP_RETURN:
+		ra = 3;
+		break;
+	case OP_IF:	case OP_IFNOT:
+	case OP_CALL0:	case OP_CALL1:	case OP_CALL2:	case OP_CALL3:	case OP_CALL4:
+	case OP_CALL5:	case OP_CALL6:	case OP_CALL7:	case OP_CALL8:
+		ra = 1;
+		break;
+	default:	// OP_GOTO
+		break;
+	}
+
+	n = 0;
+	if (ra)
+	{
+		slots[n].ofs = (unsigned short)st->a;
+		slots[n++].size = ra;
+	}
+	if (rb)
+	{
+		slots[n].ofs = (unsigned short)st->b;
+		slots[n++].size = rb;
+	}
+	*numwrites = 0;
+	if (wb || wc)
+	{
+		slots[3].ofs = (unsigned short)(wb ? st->b : st->c);
+		slots[3].size = wb ? wb : wc;
+		*numwrites = 1;
+	}
+	return n;
+}
+
+/*
+====================
+PR_CanSkipLocals
+
+Checks that no path through the function body (statements first_statement
+up to end) reads one of its locals before writing it. Parameters count as
+written on entry.
+====================
+*/
+static qboolean PR_CanSkipLocals (dfunction_t *f, int end)
+{
+	int		first = f->first_statement;
+	int		len = end - first;
+	int		words = (f->locals + 31) >> 5;
+	unsigned	*in, *cur, merged;
+	byte		*reached;
+	int		i, j, k, n, numwrites, ofs, target;
+	qboolean	changed, ok;
+	prslot_t	slots[4];
+	dstatement_t	*st;
+
+	in = (unsigned *) malloc (len * words * sizeof(*in));
+	cur = (unsigned *) malloc (words * sizeof(*cur));
+	reached = (byte *) calloc (len, 1);
+	if (!in || !cur || !reached)
+		Sys_Error ("PR_CanSkipLocals: out of memory");
+
+	// must-be-written analysis: start from "everything written" and
+	// narrow it down along every path from the entry point
+	memset (in, 0xff, len * words * sizeof(*in));
+	memset (in, 0, words * sizeof(*in));
+	for (i = 0, ofs = 0; i < f->numparms && i < MAX_PARMS; i++)
+	{
+		for (j = 0; j < f->parm_size[i] && ofs < f->locals; j++, ofs++)
+			in[ofs >> 5] |= 1u << (ofs & 31);
+	}
+	reached[0] = 1;
+
+	ok = true;
+	do
+	{
+		changed = false;
+		for (i = 0; i < len && ok; i++)
+		{
+			if (!reached[i])
+				continue;
+			st = &pr_statements[first + i];
+			memcpy (cur, &in[i * words], words * sizeof(*cur));
+
+			n = PR_GetOperands (st, slots, &numwrites);
+			for (j = 0; j < n; j++)
+			{
+				for (k = 0; k < slots[j].size; k++)
+				{
+					ofs = slots[j].ofs + k - f->parm_start;
+					if (ofs >= 0 && ofs < f->locals && !(cur[ofs >> 5] & (1u << (ofs & 31))))
+						ok = false;
+				}
+			}
+			for (k = 0; numwrites && k < slots[3].size; k++)
+			{
+				ofs = slots[3].ofs + k - f->parm_start;
+				if (ofs >= 0 && ofs < f->locals)
+					cur[ofs >> 5] |= 1u << (ofs & 31);
+			}
+
+			// propagate to the successors
+			for (j = 0; j < 2 && ok; j++)
+			{
+				if (st->op == OP_DONE || st->op == OP_RETURN)
+					break;
+				if (j == 0)
+				{
+					if (st->op == OP_GOTO)
+						continue;
+					target = i + 1;
+				}
+				else if (st->op == OP_GOTO)
+					target = i + st->a;
+				else if (st->op == OP_IF || st->op == OP_IFNOT)
+					target = i + st->b;
+				else
+					break;
+
+				if (target < 0 || target >= len)
+				{
+					ok = false;
+					break;
+				}
+				for (k = 0; k < words; k++)
+				{
+					merged = in[target * words + k] & cur[k];
+					if (merged != in[target * words + k])
+					{
+						in[target * words + k] = merged;
+						changed = true;
+					}
+				}
+				if (!reached[target])
+				{
+					reached[target] = 1;
+					changed = true;
+				}
+			}
+		}
+	} while (changed && ok);
+
+	free (in);
+	free (cur);
+	free (reached);
+	return ok;
+}
+
+/*
+====================
+PR_FindWindowFunctions
+
+Fills in pr_funcwindow and returns the number of functions flagged
+====================
+*/
+static int PR_FindWindowFunctions (void)
+{
+	int		i, j, k, n, numwrites, ofs, count;
+	int		numglobals = progs->numglobals;
+	int		numstatements = progs->numstatements;
+	int		*owner, *user, *end;
+	dfunction_t	*f;
+	prslot_t	slots[4];
+
+	// owner: function whose locals cover the slot, -2 if more than one
+	// user: function whose code references the slot, -2 if more than one
+	owner = (int *) malloc (numglobals * sizeof(*owner));
+	user = (int *) malloc (numglobals * sizeof(*user));
+	end = (int *) malloc (progs->numfunctions * sizeof(*end));
+	if (!owner || !user || !end)
+		Sys_Error ("PR_FindWindowFunctions: out of memory");
+	for (i = 0; i < numglobals; i++)
+		owner[i] = user[i] = -1;
+
+	for (i = 1; i < progs->numfunctions; i++)
+	{
+		f = &pr_functions[i];
+		end[i] = numstatements;
+		if (f->first_statement <= 0 || f->first_statement >= numstatements)
+			continue;
+		for (j = 0; j < f->locals; j++)
+		{
+			ofs = f->parm_start + j;
+			if (ofs >= 0 && ofs < numglobals)
+				owner[ofs] = owner[ofs] == -1 ? i : -2;
+		}
+		// function bodies are laid out back to back
+		for (j = 1; j < progs->numfunctions; j++)
+		{
+			k = pr_functions[j].first_statement;
+			if (k > f->first_statement && k < end[i])
+				end[i] = k;
+		}
+	}
+
+	for (i = 1; i < progs->numfunctions; i++)
+	{
+		f = &pr_functions[i];
+		if (f->first_statement <= 0 || f->first_statement >= numstatements)
+			continue;
+		for (j = f->first_statement; j < end[i]; j++)
+		{
+			n = PR_GetOperands (&pr_statements[j], slots, &numwrites);
+			if (numwrites)
+				slots[n++] = slots[3];
+			while (n--)
+			{
+				for (k = 0; k < slots[n].size; k++)
+				{
+					ofs = slots[n].ofs + k;
+					if (ofs < numglobals && user[ofs] != i)
+						user[ofs] = user[ofs] == -1 ? i : -2;
+				}
+			}
+		}
+	}
+
+	// savegames read and write these behind the code's back
+	for (i = 0; i < progs->numglobaldefs; i++)
+	{
+		if ((pr_globaldefs[i].type & DEF_SAVEGLOBAL) && pr_globaldefs[i].ofs < numglobals)
+			user[pr_globaldefs[i].ofs] = -2;
+	}
+
+	count = 0;
+	for (i = 1; i < progs->numfunctions; i++)
+	{
+		f = &pr_functions[i];
+		if (f->first_statement <= 0 || f->first_statement >= numstatements || f->locals <= 0)
+			continue;
+		if (f->parm_start < 0 || f->parm_start + f->locals > numglobals)
+			continue;
+		for (j = 0; j < f->locals; j++)
+		{
+			ofs = f->parm_start + j;
+			if (owner[ofs] != i || (user[ofs] != -1 && user[ofs] != i))
+				break;
+		}
+		if (j < f->locals || !PR_CanSkipLocals (f, end[i]))
+			continue;
+		pr_funcwindow[i] = 1;
+		count++;
+	}
+
+	free (owner);
+	free (user);
+	free (end);
+	return count;
+}
+
+/*
+====================
+PR_TranslateProgs
+
+Builds pr_code from pr_statements. Called by PR_LoadProgs once the lumps
+have been byte swapped.
+====================
+*/
+void PR_TranslateProgs (void)
+{
+	int		i, target;
+	int		numstatements = progs->numstatements;
+	dstatement_t	*st;
+	prinstr_t	*in;
+
+	pr_benchmarking = false;
+	PR_ProfReset (true);
+
+	// one extra instruction so running off the end hits OP_BAD
+	pr_code = (prinstr_t *) Hunk_AllocName ((numstatements + 1) * sizeof(*pr_code), "pr_code");
+	pr_entrypoint = (byte *) Hunk_AllocName (numstatements, "pr_code");
+	pr_funcwindow = (byte *) Hunk_AllocName (progs->numfunctions, "pr_code");
+	pr_funcactive = (int *) Hunk_AllocName (progs->numfunctions * sizeof(*pr_funcactive), "pr_code");
+
+	pr_fieldwatch = (byte *) Hunk_AllocName (progs->entityfields, "pr_code");
+	for (i = 0; i < 3; i++)
+		pr_fieldwatch[offsetof(entvars_t, origin) / 4 + i] |= FIELDWATCH_MOVES;
+	for (i = 0; i < 6; i++)	// mins and maxs
+		pr_fieldwatch[offsetof(entvars_t, mins) / 4 + i] |= FIELDWATCH_MOVES;
+	pr_fieldwatch[offsetof(entvars_t, nextthink) / 4] |= FIELDWATCH_THINK;
+	pr_fieldwatch[offsetof(entvars_t, movetype) / 4] |= FIELDWATCH_THINK;
+	pr_fieldwatch[offsetof(entvars_t, flags) / 4] |= FIELDWATCH_THINK;
+
+	for (i = 0; i < progs->numfunctions; i++)
+	{
+		if (pr_functions[i].first_statement > 0 && pr_functions[i].first_statement < numstatements)
+			pr_entrypoint[pr_functions[i].first_statement] = 1;
+	}
+
+	for (i = 0; i < numstatements; i++)
+	{
+		st = &pr_statements[i];
+		in = &pr_code[i];
+
+		in->opcode = st->op < OP_BAD ? st->op : OP_BAD;
+		in->a = (eval_t *)&pr_globals[(unsigned short)st->a];
+		in->b = (eval_t *)&pr_globals[(unsigned short)st->b];
+		in->c = (eval_t *)&pr_globals[(unsigned short)st->c];
+
+		if (st->op == OP_IF || st->op == OP_IFNOT || st->op == OP_GOTO)
+		{
+			target = i + (st->op == OP_GOTO ? st->a : st->b);
+			if (target < 0 || target >= numstatements)
+				in->opcode = OP_BAD;
+			else
+			{
+				in->jump = &pr_code[target];
+				pr_entrypoint[target] = 1;
+			}
+		}
+	}
+	pr_code[numstatements].opcode = OP_BAD;
+
+#ifdef PR_COMPUTED_GOTO
+	PR_ExecuteThreaded (NULL, 0);
+#endif
+	pr_numfused = PR_FuseStatements (pr_fuse.value != 0.f);
+	Con_DPrintf ("%i superinstructions\n", pr_numfused);
+
+	i = PR_FindWindowFunctions ();
+	Con_DPrintf ("%i/%i functions skip saving locals\n", i, progs->numfunctions);
+}
+
+
+/*
+====================
+PR_ExecuteProgram
+====================
+*/
+void PR_ExecuteProgram (func_t fnum)
+{
+	dfunction_t	*f;
+	int		s, profile;
+	int		exitdepth;
+	int		threaded;
+	double		time = 0;
+
+	if (!fnum || fnum >= progs->numfunctions)
+	{
+		if (pr_global_struct->self)
+			ED_Print (PROG_TO_EDICT(pr_global_struct->self));
+		Host_Error ("PR_ExecuteProgram: NULL function");
+	}
+
+	f = &pr_functions[fnum];
+
+	pr_trace = false;
+
+	if (pr_profiling && !pr_depth)
+		PR_ProfReset (false);	// in case a Host_Error left a stale stack
+
+	if (pr_benchmarking)
+		threaded = pr_benchengine != 0;
+	else
+		threaded = pr_threaded.value != 0.f;
+	if ((pr_benchmarking || pr_timing) && !pr_depth)
+		time = Sys_DoubleTime ();
+
+// make a stack frame
+	exitdepth = pr_depth;
+
+	s = PR_EnterFunction(f);
+	if (threaded)
+		profile = PR_ExecuteThreaded (&pr_code[s + 1], exitdepth);
+	else
+		profile = PR_ExecuteSwitch (&pr_statements[s], exitdepth, 0, 0);
+
+	if (pr_benchmarking)
+	{
+		pr_benchstatements[pr_benchengine] += profile;
+		if (!exitdepth)
+			pr_benchtime[pr_benchengine] += Sys_DoubleTime () - time;
+	}
+	if (pr_timing && !exitdepth)
+		pr_exectime += Sys_DoubleTime () - time;
+}
+
+
+typedef struct
+{
+	worldsave_t	*world;
+	int			*globals;
+	double		time;
+	sizebuf_t	reliable_datagram;
+	sizebuf_t	messages[MAX_SCOREBOARD];
+	const char	*lightstyles[MAX_LIGHTSTYLES];
+} prbenchsave_t;
+
+/*
+============
+PR_BenchSave
+
+What a physics frame can change: the edicts, the globals, the time, and
+what QC writes into reliable messages and lightstyles
+============
+*/
+static void PR_BenchSave (prbenchsave_t *save)
+{
+	int		i;
+
+	save->world = SV_SaveWorld ();
+	save->globals = (int *) malloc (progs->numglobals * sizeof(int));
+	if (!save->globals)
+		Sys_Error ("PR_BenchSave: out of memory");
+	memcpy (save->globals, pr_globals, progs->numglobals * sizeof(int));
+	save->time = sv.time;
+	save->reliable_datagram = sv.reliable_datagram;
+	for (i = 0; i < svs.maxclients; i++)
+		save->messages[i] = svs.clients[i].message;
+	memcpy (save->lightstyles, sv.lightstyles, sizeof(sv.lightstyles));
+}
+
+/*
+============
+PR_BenchRestore
+============
+*/
+static void PR_BenchRestore (prbenchsave_t *save)
+{
+	int		i;
+
+	SV_RestoreWorld (save->world);
+	memcpy (pr_globals, save->globals, progs->numglobals * sizeof(int));
+	sv.time = save->time;
+	sv.reliable_datagram = save->reliable_datagram;
+	for (i = 0; i < svs.maxclients; i++)
+		svs.clients[i].message = save->messages[i];
+	memcpy (sv.lightstyles, save->lightstyles, sizeof(sv.lightstyles));
+	SV_ClearDatagram ();
+}
+
+/*
+============
+PR_Bench_f
+
+Runs the same server physics frames with the switch engine, the threaded
+engine and the threaded engine with superinstructions, then reports QC
+throughput for each
+
+The frames are real ones, so the server is saved first and put back before
+each engine's run and at the end. rand() is seeded the same way for each
+run, so they all do the same work and the game doesn't move on.
+============
+*/
+void PR_Bench_f (void)
+{
+	static const char *const names[PR_NUMENGINES] = {"switch", "threaded", "fused"};
+	prbenchsave_t	save;
+	double	oldframetime, base;
+	int		i, j, frames;
+
+	if (!sv.active)
+	{
+		Con_Printf ("Not running a server\n");
+		return;
+	}
+
+	frames = Cmd_Argc () >= 2 ? atoi (Cmd_Argv (1)) : 500;
+	frames = CLAMP (1, frames, 100000);
+
+	memset (pr_benchtime, 0, sizeof (pr_benchtime));
+	memset (pr_benchstatements, 0, sizeof (pr_benchstatements));
+	oldframetime = host_frametime;
+	host_frametime = 1.0 / 72.0;
+	PR_BenchSave (&save);
+	pr_benchmarking = true;
+
+	for (i = 0; i < PR_NUMENGINES; i++)
+	{
+		pr_benchengine = i;
+		if (pr_benchengine == 1)
+			PR_FuseStatements (false);
+		else if (pr_benchengine == 2)
+			pr_numfused = PR_FuseStatements (true);
+		PR_BenchRestore (&save);
+		srand (0x5eed);
+		for (j = 0; j < frames; j++)
+		{
+			pr_global_struct->frametime = host_frametime;
+			SV_ClearDatagram ();
+			SV_Physics ();
+		}
+	}
+
+	pr_benchmarking = false;
+	PR_BenchRestore (&save);
+	SV_FreeWorld (save.world);
+	free (save.globals);
+	host_frametime = oldframetime;
+	PR_FuseStatements (pr_fuse.value != 0.f);
+
+	Con_Printf ("%i frames per engine, %i superinstructions:\n", frames, pr_numfused);
+	base = pr_benchtime[0] > 0.0 ? pr_benchstatements[0] / pr_benchtime[0] : 0.0;
+	for (i = 0; i < PR_NUMENGINES; i++)
+	{
+		double rate = pr_benchtime[i] > 0.0 ? pr_benchstatements[i] / pr_benchtime[i] : 0.0;
+		Con_Printf ("%-8s %10.0f statements %8.2f ms %8.2f M/s %5.2fx\n", names[i],
+			pr_benchstatements[i], pr_benchtime[i] * 1000.0,
+			rate / 1e6, base > 0.0 ? rate / base : 0.0);
+	}
+}
@@ -0,0 +1,396 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// pr_prof.c -- hierarchical QuakeC profiler
+
+#include "quakedef.h"
+
+/*
+==============================================================================
+
+Every distinct call path gets a node in a tree rooted at the engine. QC
+functions and builtins are both entered as nodes, so whatever the engine
+does on behalf of a builtin (SV_Move for traceline, touch functions run by
+SV_LinkEdict for setorigin, ...) is charged to that builtin under its QC
+caller. prof_stop writes the tree as folded stacks, one line per path with
+its exclusive time in microseconds, which flamegraph.pl and compatible
+tools read directly.
+
+==============================================================================
+*/
+
+#define PROF_MAXNODES		(1<<20)
+#define PROF_MAXDEPTH		256
+#define PROF_HASHSIZE		4096
+
+typedef struct
+{
+	int		parent;		// -1 for the root
+	int		func;		// pr_functions index, only valid for the current progs
+	int		hashnext;
+	int		calls;
+	double		inclusive;	// seconds, callees included
+	double		children;	// seconds spent in callees
+	qboolean	builtin;
+	char		name[64];
+} profnode_t;
+
+typedef struct
+{
+	int		node;
+	double		start;
+} profframe_t;
+
+qboolean		pr_profiling;
+
+static profnode_t	*prof_nodes;
+static int		prof_numnodes;
+static int		prof_maxnodes;
+static int		prof_hash[PROF_HASHSIZE];
+static profframe_t	prof_stack[PROF_MAXDEPTH];
+static int		prof_depth;
+static double		prof_starttime;
+
+/*
+================
+PR_ProfClearHash
+================
+*/
+static void PR_ProfClearHash (void)
+{
+	int i;
+
+	for (i = 0; i < PROF_HASHSIZE; i++)
+		prof_hash[i] = -1;
+	for (i = 0; i < prof_numnodes; i++)
+		prof_nodes[i].hashnext = -1;
+}
+
+/*
+================
+PR_ProfNewNode
+================
+*/
+static int PR_ProfNewNode (int parent, int func, const char *name, qboolean builtin)
+{
+	profnode_t *node;
+
+	if (prof_numnodes == prof_maxnodes)
+	{
+		if (prof_maxnodes >= PROF_MAXNODES)
+			return -1;
+		prof_maxnodes = prof_maxnodes ? prof_maxnodes * 2 : 1024;
+		prof_nodes = (profnode_t *) realloc (prof_nodes, prof_maxnodes * sizeof(*prof_nodes));
+		if (!prof_nodes)
+			Sys_Error ("PR_ProfNewNode: out of memory");
+	}
+
+	node = &prof_nodes[prof_numnodes];
+	memset (node, 0, sizeof(*node));
+	node->parent = parent;
+	node->func = func;
+	node->hashnext = -1;
+	node->builtin = builtin;
+	q_strlcpy (node->name, name, sizeof(node->name));
+
+	return prof_numnodes++;
+}
+
+/*
+================
+PR_ProfEnter
+
+Called when f (a QC function or a builtin) starts running
+================
+*/
+void PR_ProfEnter (dfunction_t *f)
+{
+	int		parent, func, i;
+	unsigned	h;
+
+	if (prof_depth >= PROF_MAXDEPTH)
+	{
+		prof_depth++;	// still balanced by PR_ProfLeave, just not recorded
+		return;
+	}
+
+	parent = prof_depth ? prof_stack[prof_depth - 1].node : 0;
+	func = f - pr_functions;
+	if (parent == -1)
+	{
+		i = -1;		// below a call that isn't recorded either
+		goto push;
+	}
+
+	h = ((unsigned)parent * 31u + (unsigned)func) & (PROF_HASHSIZE - 1);
+	for (i = prof_hash[h]; i != -1; i = prof_nodes[i].hashnext)
+		if (prof_nodes[i].parent == parent && prof_nodes[i].func == func)
+			break;
+	if (i == -1)
+	{
+		i = PR_ProfNewNode (parent, func, PR_GetString (f->s_name), f->first_statement < 0);
+		if (i == -1)
+			goto push;	// out of nodes, the time goes to the caller's self time
+		prof_nodes[i].hashnext = prof_hash[h];
+		prof_hash[h] = i;
+	}
+
+	prof_nodes[i].calls++;
+push:
+	prof_stack[prof_depth].node = i;
+	prof_stack[prof_depth].start = Sys_DoubleTime ();
+	prof_depth++;
+}
+
+/*
+================
+PR_ProfLeave
+================
+*/
+void PR_ProfLeave (void)
+{
+	profframe_t	*frame;
+	double		elapsed;
+
+	if (!prof_depth)
+		return;
+	if (--prof_depth >= PROF_MAXDEPTH)
+		return;
+
+	frame = &prof_stack[prof_depth];
+	if (frame->node == -1)
+		return;
+	elapsed = Sys_DoubleTime () - frame->start;
+	prof_nodes[frame->node].inclusive += elapsed;
+	if (prof_depth)
+		prof_nodes[prof_stack[prof_depth - 1].node].children += elapsed;
+}
+
+/*
+================
+PR_ProfReset
+
+Drops the current call stack, e.g. after a program error. When the progs
+are reloaded function numbers change, so lookups start over as well; nodes
+recorded so far are kept and merged by name on output.
+================
+*/
+void PR_ProfReset (qboolean newprogs)
+{
+	prof_depth = 0;
+	if (newprogs && prof_nodes)
+		PR_ProfClearHash ();
+}
+
+/*
+================
+PR_ProfStart_f
+================
+*/
+void PR_ProfStart_f (void)
+{
+	if (pr_profiling)
+	{
+		Con_Printf ("QC profiler already running\n");
+		return;
+	}
+
+	prof_numnodes = 0;
+	PR_ProfNewNode (-1, -1, "root", false);
+	PR_ProfClearHash ();
+	prof_depth = 0;
+	prof_starttime = Sys_DoubleTime ();
+	pr_profiling = true;
+
+	Con_Printf ("QC profiler started\n");
+}
+
+/*
+================
+PR_ProfWritePath
+
+Writes the names from the root's child down to node, separated by ';'
+================
+*/
+static void PR_ProfWritePath (FILE *f, int node)
+{
+	int	path[PROF_MAXDEPTH];
+	int	i, n;
+
+	for (n = 0; node > 0 && n < PROF_MAXDEPTH; node = prof_nodes[node].parent)
+		path[n++] = node;
+	for (i = n - 1; i >= 0; i--)
+		fprintf (f, i ? "%s;" : "%s", prof_nodes[path[i]].name);
+}
+
+/*
+================
+PR_ProfHasAncestor
+
+True if a node above this one has the same name (recursion), so that
+inclusive time isn't counted twice
+================
+*/
+static qboolean PR_ProfHasAncestor (int node)
+{
+	const char *name = prof_nodes[node].name;
+
+	for (node = prof_nodes[node].parent; node > 0; node = prof_nodes[node].parent)
+		if (!strcmp (prof_nodes[node].name, name))
+			return true;
+	return false;
+}
+
+typedef struct
+{
+	const char	*name;
+	qboolean	builtin;
+	int		calls;
+	double		inclusive;
+	double		exclusive;
+} profsummary_t;
+
+static int PR_ProfCompareNames (const void *a, const void *b)
+{
+	const profnode_t *na = &prof_nodes[*(const int *)a];
+	const profnode_t *nb = &prof_nodes[*(const int *)b];
+	if (na->builtin != nb->builtin)
+		return na->builtin - nb->builtin;
+	return strcmp (na->name, nb->name);
+}
+
+static int PR_ProfCompareExclusive (const void *a, const void *b)
+{
+	const profsummary_t *sa = (const profsummary_t *)a;
+	const profsummary_t *sb = (const profsummary_t *)b;
+	if (sa->exclusive == sb->exclusive)
+		return 0;
+	return sa->exclusive < sb->exclusive ? 1 : -1;
+}
+
+/*
+================
+PR_ProfPrintSummary
+================
+*/
+static void PR_ProfPrintSummary (double total)
+{
+	int		*order;
+	profsummary_t	*sum;
+	int		i, n, shown, builtins;
+
+	order = (int *) malloc (prof_numnodes * sizeof(*order));
+	sum = (profsummary_t *) calloc (prof_numnodes, sizeof(*sum));
+	if (!order || !sum)
+		Sys_Error ("PR_ProfPrintSummary: out of memory");
+
+	// merge all call paths of the same function
+	for (i = 1; i < prof_numnodes; i++)
+		order[i - 1] = i;
+	qsort (order, prof_numnodes - 1, sizeof(*order), PR_ProfCompareNames);
+
+	for (i = 0, n = -1; i < prof_numnodes - 1; i++)
+	{
+		profnode_t *node = &prof_nodes[order[i]];
+		if (n < 0 || strcmp (sum[n].name, node->name) || sum[n].builtin != node->builtin)
+		{
+			n++;
+			sum[n].name = node->name;
+			sum[n].builtin = node->builtin;
+		}
+		sum[n].calls += node->calls;
+		sum[n].exclusive += node->inclusive - node->children;
+		if (!PR_ProfHasAncestor (order[i]))
+			sum[n].inclusive += node->inclusive;
+	}
+	n++;
+	qsort (sum, n, sizeof(*sum), PR_ProfCompareExclusive);
+
+	for (builtins = 0; builtins < 2; builtins++)
+	{
+		Con_Printf ("\n%-24s %8s %10s %10s %6s\n", builtins ? "builtin" : "function",
+			"calls", "incl ms", "excl ms", "excl%");
+		for (i = 0, shown = 0; i < n && shown < 20; i++)
+		{
+			if (sum[i].builtin != builtins)
+				continue;
+			Con_Printf ("%-24s %8i %10.2f %10.2f %5.1f%%\n", sum[i].name, sum[i].calls,
+				sum[i].inclusive * 1000.0, sum[i].exclusive * 1000.0,
+				total > 0.0 ? sum[i].exclusive * 100.0 / total : 0.0);
+			shown++;
+		}
+	}
+
+	free (order);
+	free (sum);
+}
+
+/*
+================
+PR_ProfStop_f
+
+prof_stop [filename]
+================
+*/
+void PR_ProfStop_f (void)
+{
+	char		name[MAX_OSPATH], relname[MAX_QPATH];
+	FILE		*f;
+	int		i;
+	long long	us;
+	double		total, wall;
+
+	if (!pr_profiling)
+	{
+		Con_Printf ("QC profiler not running\n");
+		return;
+	}
+	pr_profiling = false;
+	wall = Sys_DoubleTime () - prof_starttime;
+
+	q_strlcpy (relname, Cmd_Argc () >= 2 ? Cmd_Argv (1) : "qcprofile", sizeof(relname));
+	COM_AddExtension (relname, ".txt", sizeof(relname));
+	q_snprintf (name, sizeof(name), "%s/%s", com_gamedir, relname);
+	COM_CreatePath (name);
+	f = Sys_fopen (name, "w");
+	if (!f)
+	{
+		Con_Printf ("ERROR: couldn't open file %s.\n", relname);
+		return;
+	}
+
+	total = 0.0;
+	for (i = 1; i < prof_numnodes; i++)
+	{
+		if (prof_nodes[i].parent == 0)
+			total += prof_nodes[i].inclusive;
+		us = (long long)((prof_nodes[i].inclusive - prof_nodes[i].children) * 1e6 + 0.5);
+		if (us <= 0)
+			continue;
+		PR_ProfWritePath (f, i);
+		fprintf (f, " %lld\n", us);
+	}
+	fclose (f);
+
+	Con_Printf ("QC profile: %.2f ms of QC in %.2f s, %i call paths\n",
+		total * 1000.0, wall, prof_numnodes - 1);
+	PR_ProfPrintSummary (total);
+	Con_Printf ("\nWrote folded stacks to %s\n", relname);
+}
@@ -42,6 +42,9 @@ typedef struct edict_s
 	qboolean	free;			/* don't modify directly, use ED_AddToFreeList/ED_RemoveFromFreeList */
 	link_t		freechain;
 	link_t		area;			/* linked to a division node or leaf */
+	int		areanode;		/* octree node << 1 | trigger, with sv_broadphase 1 */
+	int		areaorder;		/* areanode tree node and link count, so that */
+	unsigned int	areaseq;		/* octree results come in the same order */
 
 	int		num_leafs;
 	int		leafnums[MAX_ENT_LEAFS];
@@ -63,6 +66,7 @@ typedef struct edict_s
 extern	dprograms_t	*progs;
 extern	dfunction_t	*pr_functions;
 extern	dstatement_t	*pr_statements;
+extern	ddef_t		*pr_globaldefs;
 extern	globalvars_t	*pr_global_struct;
 extern	float		*pr_globals;	/* same as pr_global_struct */
 
@@ -73,12 +77,42 @@ void PR_Init (void);
 
 void PR_ExecuteProgram (func_t fnum);
 void PR_LoadProgs (void);
+void PR_TranslateProgs (void);
 
 const char *PR_GetString (int num);
+qboolean PR_StringValid (int num);
 int PR_SetEngineString (const char *s);
 int PR_AllocString (int bufferlength, char **ptr);
 
 void PR_Profile_f (void);
+void PR_Bench_f (void);
+
+void PR_ProfStart_f (void);
+void PR_ProfStop_f (void);
+void PR_ProfEnter (dfunction_t *f);
+void PR_ProfLeave (void);
+void PR_ProfReset (qboolean newprogs);
+extern	qboolean	pr_profiling;
+extern	qboolean	pr_timing;		/* accumulate pr_exectime */
+extern	double		pr_exectime;	/* seconds spent in QC, see PR_ExecuteProgram */
+
+#define FIELDWATCH_MOVES	1	// origin, mins, maxs: findradius grid
+#define FIELDWATCH_FIND		2	// string field with a find() index
+#define FIELDWATCH_THINK	4	// nextthink, movetype, flags: think scheduler
+extern	byte	*pr_fieldwatch;
+void PR_FieldWritten (edict_t *ed, int fofs);
+
+void PR_FindIndexReset (void);
+void PR_FindIndexDirty (edict_t *ed, int fofs);
+void PR_FindStats_f (void);
+extern	cvar_t	pr_findindex_enable;
+
+ddef_t *ED_FieldAtOfs (int ofs);
+
+extern	cvar_t	pr_threaded;
+extern	cvar_t	pr_fuse;
+extern	cvar_t	pr_regwindows;
+void PR_Fuse_f (cvar_t *var);
 
 edict_t *ED_Alloc (void);
 void ED_Free (edict_t *ed);
@@ -154,6 +188,25 @@ FUNC_NORETURN void PR_RunError (const char *error, ...) FUNC_PRINTF(1,2);
 void ED_PrintEdicts (void);
 void ED_PrintNum (int ent);
 
-eval_t *GetEdictFieldValue(edict_t *ed, const char *field);
+// optional fields the engine reads if the progs define them, resolved to
+// offsets by PR_LoadProgs; -1 when missing
+typedef struct
+{
+	int		alpha;
+	int		items2;
+	int		gravity;
+	int		ammo_shells1;
+	int		ammo_nails1;
+	int		ammo_lava_nails;
+	int		ammo_rockets1;
+	int		ammo_multi_rockets;
+	int		ammo_cells1;
+	int		ammo_plasma;
+} extfields_t;
+
+extern	extfields_t	pr_extfields;
+
+// NULL if the progs don't have the field
+#define	E_EXTFIELD(e,name)	(pr_extfields.name >= 0 ? (eval_t *)((int *)&(e)->v + pr_extfields.name) : NULL)
 
 #endif	/* QUAKE_PROGS_H */
@@ -121,6 +121,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	SND_LARGESOUND	(1<<4)	// a short soundindex (instead of a byte)
 //johnfitz
 
+// delta snapshots
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_BACKUP		64			// frames a delta can refer back to, power of two
+#define SNAPSHOT_MASK		(SNAPSHOT_BACKUP - 1)
+#define SNAP_REMOVE			(1<<15)		// in a svc_snapshot entnum: the entity left the snapshot
+
 //johnfitz -- PROTOCOL_FITZQUAKE -- flags for entity baseline messages
 #define B_LARGEMODEL	(1<<0)	// modelindex is short instead of byte
 #define B_LARGEFRAME	(1<<1)	// frame is short instead of byte
@@ -219,6 +225,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define svc_backtolobby		55
 #define svc_localsound		56
 
+// delta snapshots, only sent to clients that asked for them with "snapshots"
+#define	svc_snapshot		57	// [long] sequence [long] delta sequence, 0 for baselines
+								// ([short] entnum [entity delta])...[short] 0
+
 //
 // client to server
 //
@@ -227,6 +237,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	clc_disconnect	2
 #define	clc_move		3		// [usercmd_t]
 #define	clc_stringcmd	4		// [string] message
+#define	clc_ackframe	50		// [long] last svc_snapshot sequence received, 0 for none
 
 //
 // temp entity events
@@ -261,6 +272,22 @@ typedef struct
 	int		effects;
 } entity_state_t;
 
+typedef struct
+{
+	int				num;
+	int				flags;		// U_STEP and U_LERPFINISH
+	byte			lerpfinish;
+	entity_state_t	state;
+} snapentity_t;
+
+typedef struct
+{
+	int				sequence;	// 0 if the frame isn't valid
+	int				numentities;
+	int				maxentities;
+	snapentity_t	*entities;	// sorted by num
+} snapframe_t;
+
 typedef struct
 {
 	vec3_t	viewangles;
@@ -239,6 +239,15 @@ typedef ptrdiff_t	ssize_t;
 #define inline __inline
 #endif	/* _MSC_VER */
 
+/* for the few globals the listen server thread (host.c) can't share */
+#if defined(__GNUC__)
+#define THREAD_LOCAL	__thread
+#elif defined(_MSC_VER)
+#define THREAD_LOCAL	__declspec(thread)
+#else
+#define THREAD_LOCAL
+#endif
+
 /*==========================================================================*/
 
 
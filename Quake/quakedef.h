@@ -294,7 +294,7 @@ extern	cvar_t		developer;
 extern	cvar_t		max_edicts; //johnfitz
 
 extern	qboolean	host_initialized;	// true if into command execution
-extern	double		host_frametime;
+extern	THREAD_LOCAL double	host_frametime;	// the server thread has its own
 extern	byte		*host_colormap;
 extern	int		host_framecount;	// incremented every frame, never reset
 extern	double		realtime;		// not bounded in any way, changed at
@@ -324,6 +324,15 @@ FUNC_NORETURN void Host_EndGame (const char *message, ...) FUNC_PRINTF(1,2);
 #pragma aux Host_EndGame aborts;
 #endif
 void Host_Frame (double time);
+double Host_DedicatedWait (double oldtime);
+qboolean Host_Hibernating (void);
+qboolean Host_OnServerThread (void);
+qboolean Host_ServerThreaded (void);
+void Host_LockServer (void);
+void Host_UnlockServer (void);
+void Host_ResetTickStats (void);
+
+FUNC_NORETURN void Bench_Run (void);
 void Host_Quit_f (void);
 void Host_ClientCommands (const char *fmt, ...) FUNC_PRINTF(1,2);
 void Host_ShutdownServer (qboolean crash);
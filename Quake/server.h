@@ -79,6 +79,21 @@ typedef struct
 } server_t;
 
 
+// signon data built once per map and shared by every connecting client
+typedef struct signonbuf_s
+{
+	int			refcount;		// the server's and each client's still sending it
+	int			serverinfo;		// size of the svc_serverinfo stage, the prespawn stage follows
+	int			signonsize;		// sv.signon.cursize it was built from
+	int			gametype;
+	qboolean	overflowed;		// the serverinfo stage didn't fit in a message
+	int			cursize;
+	byte		*data;
+} signonbuf_t;
+
+#define	SIGNON_SERVERINFO	1
+#define	SIGNON_PRESPAWN		2
+
 #define	NUM_PING_TIMES		16
 #define	NUM_SPAWN_PARMS		16
 
@@ -112,6 +127,16 @@ typedef struct client_s
 
 // client known data for deltas
 	int				old_frags;
+
+// delta snapshots, see SV_WriteSnapshot
+	qboolean		snapshots;			// client asked for svc_snapshot
+	int				snapshot_acked;		// last sequence the client has, 0 for none
+
+// shared signon data still to be sent, see SV_SendSignon
+	signonbuf_t		*signon;
+	int				signon_start;		// range of signon->data
+	int				signon_end;
+	int				signon_split;		// bytes of message that go out first
 } client_t;
 
 
@@ -191,6 +216,15 @@ extern	client_t	*host_client;
 
 extern	edict_t		*sv_player;
 
+typedef struct
+{
+	double		read;		// accepting connections and reading client messages
+	double		physics;
+	double		send;
+} svframetimes_t;
+
+extern	svframetimes_t	sv_frametimes;	// spent in the last Host_ServerFrame
+
 //===========================================================
 
 void SV_Init (void);
@@ -203,6 +237,17 @@ void SV_LocalSound (client_t *client, const char *sample); // for 2021 rerelease
 void SV_DropClient (qboolean crash);
 
 void SV_SendClientMessages (void);
+void SV_SendThreads_f (cvar_t *var);
+void SV_Shutdown (void);
+void SV_SendStats_f (void);
+void SV_FatPVSStats_f (void);
+void SV_EnableSnapshots (client_t *client, int version);
+void SV_ResetInterest (client_t *client);
+void SV_QueueSignon (client_t *client, int stage);
+void SV_ReleaseSignon (client_t *client);
+void SV_ClientSpawned (client_t *client);
+void SV_SignonStats_f (void);
+void SV_InterestStats_f (void);
 void SV_ClearDatagram (void);
 
 int SV_ModelIndex (const char *name);
@@ -218,6 +263,10 @@ void SV_ClientPrintf (const char *fmt, ...) FUNC_PRINTF(1,2);
 void SV_BroadcastPrintf (const char *fmt, ...) FUNC_PRINTF(1,2);
 
 void SV_Physics (void);
+void SV_InitThinkQueue (void);
+void SV_ResetThinkQueue (void);
+void SV_ScheduleThink (edict_t *ent);
+void SV_ThinkStats_f (void);
 
 qboolean SV_CheckBottom (edict_t *ent);
 qboolean SV_movestep (edict_t *ent, vec3_t move, qboolean relink);
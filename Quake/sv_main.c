@@ -88,6 +88,18 @@ void SV_Init (void)
 	extern	cvar_t	sv_aim;
 	extern	cvar_t	sv_altnoclip; //johnfitz
 	extern	cvar_t	sv_gameplayfix_random;
+	extern	cvar_t	sv_findradius_grid;
+	extern	cvar_t	sv_thinkqueue;
+	extern	cvar_t	sv_broadphase;
+	extern	cvar_t	sv_hullbatch;
+	extern	cvar_t	sv_sendthreads;
+	extern	cvar_t	sv_sendverify;
+	extern	cvar_t	sv_deltasnapshots;
+	extern	cvar_t	sv_fatpvscache;
+	extern	cvar_t	sv_interest;
+	extern	cvar_t	sv_interest_near;
+	extern	cvar_t	sv_interest_far;
+	extern	cvar_t	sv_interest_interval;
 
 	sv.edicts = NULL; // ericw -- sv.edicts switched to use malloc()
 
@@ -107,8 +119,30 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_freezenonclients);
 	Cvar_RegisterVariable (&sv_altnoclip); //johnfitz
 	Cvar_RegisterVariable (&sv_gameplayfix_random);
+	Cvar_RegisterVariable (&sv_findradius_grid);
+	Cvar_RegisterVariable (&sv_thinkqueue);
+	Cvar_RegisterVariable (&sv_broadphase);
+	Cvar_SetCallback (&sv_broadphase, SV_BroadphaseChanged);
+	Cvar_RegisterVariable (&sv_hullbatch);
+	Cvar_RegisterVariable (&sv_sendthreads);
+	Cvar_SetCallback (&sv_sendthreads, SV_SendThreads_f);
+	Cvar_RegisterVariable (&sv_sendverify);
+	Cvar_RegisterVariable (&sv_deltasnapshots);
+	Cvar_RegisterVariable (&sv_fatpvscache);
+	Cvar_RegisterVariable (&sv_interest);
+	Cvar_RegisterVariable (&sv_interest_near);
+	Cvar_RegisterVariable (&sv_interest_far);
+	Cvar_RegisterVariable (&sv_interest_interval);
 
 	Cmd_AddCommand ("sv_protocol", &SV_Protocol_f); //johnfitz
+	Cmd_AddCommand ("sv_findradius_bench", SV_FindRadiusBench_f);
+	Cmd_AddCommand ("sv_thinkstats", SV_ThinkStats_f);
+	Cmd_AddCommand ("sv_tracebench", SV_TraceBench_f);
+	Cmd_AddCommand ("sv_hullbench", SV_HullBench_f);
+	Cmd_AddCommand ("sv_sendstats", SV_SendStats_f);
+	Cmd_AddCommand ("sv_fatpvsstats", SV_FatPVSStats_f);
+	Cmd_AddCommand ("sv_intereststats", SV_InterestStats_f);
+	Cmd_AddCommand ("sv_signonstats", SV_SignonStats_f);
 
 	for (i=0 ; i<MAX_MODELS ; i++)
 		sprintf (localmodels[i], "*%i", i);
@@ -304,65 +338,337 @@ void SV_LocalSound (client_t *client, const char *sample)
 }
 
 /*
-==============================================================================
+=============================================================================
 
-CLIENT SPAWNING
+SHARED SIGNON
 
-==============================================================================
+The serverinfo stage (precache lists and the rest of svc_serverinfo) and
+the prespawn stage (sv.signon with baselines, static entities and sounds)
+are the same for every client. They are built once into a reference
+counted signonbuf_t and each client is given a range of it to send, which
+goes out with the rest of the client's message around it straight from the
+shared copy, see SV_SendSignon. The
+buffer is rebuilt if sv.signon grows after the map has loaded; clients
+still sending the old one keep it alive until they are done.
+
+=============================================================================
 */
 
+static signonbuf_t	*sv_signonbuf;		// the current one, NULL until needed
+
+static struct
+{
+	int		builds;
+	int		builtbytes;
+	int		queued;			// stages handed to clients
+	double	sentbytes;		// sent from the shared buffers
+	double	spawnstart;		// when SV_SpawnServer started
+	double	spawntime;		// until every client had spawned, 0 if not yet
+	int		spawnclients;
+} sv_signonstats;
+
 /*
 ================
-SV_SendServerinfo
+SV_UnrefSignon
+================
+*/
+static void SV_UnrefSignon (signonbuf_t *buf)
+{
+	if (buf && --buf->refcount == 0)
+		free (buf);
+}
 
-Sends the first message from the server to a connected client.
-This will be sent on the initial connection and upon each server load.
+/*
+================
+SV_WriteServerinfo
+
+Writes the parts of the serverinfo stage that don't depend on the client
 ================
 */
-void SV_SendServerinfo (client_t *client)
+static void SV_WriteServerinfo (sizebuf_t *msg, int gametype)
 {
 	const char		**s;
 	char			message[2048];
 	int				i; //johnfitz
 
-	MSG_WriteByte (&client->message, svc_print);
+	MSG_WriteByte (msg, svc_print);
 	sprintf (message, "%c\nFITZQUAKE %1.2f SERVER (%i CRC)\n", 2, FITZQUAKE_VERSION, pr_crc); //johnfitz -- include fitzquake version
-	MSG_WriteString (&client->message,message);
+	MSG_WriteString (msg,message);
 
-	MSG_WriteByte (&client->message, svc_serverinfo);
-	MSG_WriteLong (&client->message, sv.protocol); //johnfitz -- sv.protocol instead of PROTOCOL_VERSION
+	MSG_WriteByte (msg, svc_serverinfo);
+	MSG_WriteLong (msg, sv.protocol); //johnfitz -- sv.protocol instead of PROTOCOL_VERSION
 	
 	if (sv.protocol == PROTOCOL_RMQ)
 	{
 		// mh - now send protocol flags so that the client knows the protocol features to expect
-		MSG_WriteLong (&client->message, sv.protocolflags);
+		MSG_WriteLong (msg, sv.protocolflags);
 	}
 	
-	MSG_WriteByte (&client->message, svs.maxclients);
+	MSG_WriteByte (msg, svs.maxclients);
+	MSG_WriteByte (msg, gametype);
 
-	if (!coop.value && deathmatch.value)
-		MSG_WriteByte (&client->message, GAME_DEATHMATCH);
-	else
-		MSG_WriteByte (&client->message, GAME_COOP);
-
-	MSG_WriteString (&client->message, PR_GetString(sv.edicts->v.message));
+	MSG_WriteString (msg, PR_GetString(sv.edicts->v.message));
 
 	//johnfitz -- only send the first 256 model and sound precaches if protocol is 15
 	for (i = 1, s = sv.model_precache+1; *s; s++,i++)
 		if (sv.protocol != PROTOCOL_NETQUAKE || i < 256)
-			MSG_WriteString (&client->message, *s);
-	MSG_WriteByte (&client->message, 0);
+			MSG_WriteString (msg, *s);
+	MSG_WriteByte (msg, 0);
 
 	for (i = 1, s = sv.sound_precache+1; *s; s++, i++)
 		if (sv.protocol != PROTOCOL_NETQUAKE || i < 256)
-			MSG_WriteString (&client->message, *s);
-	MSG_WriteByte (&client->message, 0);
+			MSG_WriteString (msg, *s);
+	MSG_WriteByte (msg, 0);
 	//johnfitz
 
 // send music
-	MSG_WriteByte (&client->message, svc_cdtrack);
-	MSG_WriteByte (&client->message, sv.edicts->v.sounds);
-	MSG_WriteByte (&client->message, sv.edicts->v.sounds);
+	MSG_WriteByte (msg, svc_cdtrack);
+	MSG_WriteByte (msg, sv.edicts->v.sounds);
+	MSG_WriteByte (msg, sv.edicts->v.sounds);
+}
+
+/*
+================
+SV_SignonBuffer
+
+Returns the signon data for the map as it is now
+================
+*/
+static signonbuf_t *SV_SignonBuffer (void)
+{
+	static byte		buf[MAX_MSGLEN];
+	signonbuf_t		*sb;
+	sizebuf_t		msg;
+	int				gametype, serverinfo;
+	qboolean		overflowed;
+
+	if (!coop.value && deathmatch.value)
+		gametype = GAME_DEATHMATCH;
+	else
+		gametype = GAME_COOP;
+
+	sb = sv_signonbuf;
+	if (sb && sb->signonsize == sv.signon.cursize && sb->gametype == gametype)
+		return sb;
+
+	memset (&msg, 0, sizeof(msg));
+	msg.data = buf;
+	msg.maxsize = sizeof(buf);
+	msg.allowoverflow = true;
+	SV_WriteServerinfo (&msg, gametype);
+	overflowed = msg.overflowed;
+	serverinfo = overflowed ? 0 : msg.cursize;
+
+	sb = (signonbuf_t *) malloc (sizeof(signonbuf_t) + serverinfo + sv.signon.cursize + 2);
+	if (!sb)
+		Sys_Error ("SV_SignonBuffer: out of memory");
+	sb->refcount = 1;
+	sb->serverinfo = serverinfo;
+	sb->signonsize = sv.signon.cursize;
+	sb->gametype = gametype;
+	sb->overflowed = overflowed;
+	sb->data = (byte *)(sb + 1);
+	memcpy (sb->data, buf, serverinfo);
+	memcpy (sb->data + serverinfo, sv.signon.data, sv.signon.cursize);
+	sb->cursize = serverinfo + sv.signon.cursize;
+	sb->data[sb->cursize++] = svc_signonnum;
+	sb->data[sb->cursize++] = 2;
+
+	SV_UnrefSignon (sv_signonbuf);
+	sv_signonbuf = sb;
+	sv_signonstats.builds++;
+	sv_signonstats.builtbytes += sb->cursize;
+
+	return sb;
+}
+
+/*
+================
+SV_ResetSignon
+
+Called when a new map is started
+================
+*/
+static void SV_ResetSignon (void)
+{
+	SV_UnrefSignon (sv_signonbuf);
+	sv_signonbuf = NULL;
+	sv_signonstats.spawnstart = Sys_DoubleTime ();
+	sv_signonstats.spawntime = 0;
+	sv_signonstats.spawnclients = 0;
+}
+
+/*
+================
+SV_ReleaseSignon
+
+Drops the client's pending shared signon data, if any
+================
+*/
+void SV_ReleaseSignon (client_t *client)
+{
+	SV_UnrefSignon (client->signon);
+	client->signon = NULL;
+	client->signon_split = 0;
+}
+
+/*
+================
+SV_QueueSignon
+
+Sends the client a signon stage from the shared buffer, after what is
+already in its message. Anything written to the message afterwards goes
+out after the stage.
+================
+*/
+void SV_QueueSignon (client_t *client, int stage)
+{
+	signonbuf_t	*sb = SV_SignonBuffer ();
+
+	SV_ReleaseSignon (client);
+
+	if (stage == SIGNON_SERVERINFO)
+	{
+		if (sb->overflowed)
+		{
+			client->message.overflowed = true;	// the client would have overflowed as well
+			return;
+		}
+		client->signon_start = 0;
+		client->signon_end = sb->serverinfo;
+	}
+	else
+	{
+		client->signon_start = sb->serverinfo;
+		client->signon_end = sb->cursize;
+	}
+
+	sb->refcount++;
+	client->signon = sb;
+	client->signon_split = client->message.cursize;
+	sv_signonstats.queued++;
+}
+
+/*
+================
+SV_SendSignon
+
+Sends the message of a client with shared signon data pending: what was
+in its message before the data, the data, and what was written after it,
+together so the stage costs one round trip. They go as parts, so the
+driver's copy is the only one. If they don't fit in one message, the part
+before the data goes first and the data on its own next. Returns -1 if the
+connection failed.
+================
+*/
+static int SV_SendSignon (client_t *client)
+{
+	netpart_t	parts[3];
+	sizebuf_t	msg;
+	int			ret, size;
+
+	memset (&msg, 0, sizeof(msg));
+	size = client->signon_end - client->signon_start;
+
+	if (client->message.cursize + size <= MAX_MSGLEN)
+	{
+		parts[0].data = client->message.data;
+		parts[0].size = client->signon_split;
+		parts[1].data = client->signon->data + client->signon_start;
+		parts[1].size = size;
+		parts[2].data = client->message.data + client->signon_split;
+		parts[2].size = client->message.cursize - client->signon_split;
+		ret = NET_SendMessageParts (client->netconnection, parts, 3);
+		sv_signonstats.sentbytes += size;
+		SZ_Clear (&client->message);
+		SV_ReleaseSignon (client);
+		return ret;
+	}
+
+	if (client->signon_split)
+	{
+		msg.data = client->message.data;
+		msg.maxsize = msg.cursize = client->signon_split;
+		ret = NET_SendMessage (client->netconnection, &msg);
+		client->message.cursize -= client->signon_split;
+		memmove (client->message.data, client->message.data + client->signon_split, client->message.cursize);
+		client->signon_split = 0;
+		return ret;
+	}
+
+	msg.data = client->signon->data + client->signon_start;
+	msg.maxsize = msg.cursize = size;
+	ret = NET_SendMessage (client->netconnection, &msg);
+	sv_signonstats.sentbytes += msg.cursize;
+	SV_ReleaseSignon (client);
+	return ret;
+}
+
+/*
+================
+SV_ClientSpawned
+
+Called when client has finished the signon
+================
+*/
+void SV_ClientSpawned (client_t *client)
+{
+	client_t	*cl;
+	int			i, count;
+
+	if (sv_signonstats.spawntime)
+		return;
+	for (i = 0, count = 0, cl = svs.clients; i < svs.maxclients; i++, cl++)
+	{
+		if (!cl->active)
+			continue;
+		if (!cl->spawned)
+			return;
+		count++;
+	}
+
+	sv_signonstats.spawntime = Sys_DoubleTime () - sv_signonstats.spawnstart;
+	sv_signonstats.spawnclients = count;
+	Con_DPrintf ("%i clients spawned %.1f ms after the map started\n", count, sv_signonstats.spawntime * 1000.0);
+}
+
+/*
+================
+SV_SignonStats_f
+================
+*/
+void SV_SignonStats_f (void)
+{
+	if (sv_signonstats.spawntime)
+		Con_Printf ("%i clients spawned %.1f ms after the map started\n", sv_signonstats.spawnclients,
+			sv_signonstats.spawntime * 1000.0);
+	else
+		Con_Printf ("not every client has spawned yet\n");
+	Con_Printf ("%i signon buffers built, %i bytes\n", sv_signonstats.builds, sv_signonstats.builtbytes);
+	Con_Printf ("%i stages sent, %.0f bytes from shared buffers\n", sv_signonstats.queued, sv_signonstats.sentbytes);
+	sv_signonstats.builds = sv_signonstats.builtbytes = sv_signonstats.queued = 0;
+	sv_signonstats.sentbytes = 0;
+}
+
+/*
+==============================================================================
+
+CLIENT SPAWNING
+
+==============================================================================
+*/
+
+/*
+================
+SV_SendServerinfo
+
+Sends the first message from the server to a connected client.
+This will be sent on the initial connection and upon each server load.
+================
+*/
+void SV_SendServerinfo (client_t *client)
+{
+	SV_QueueSignon (client, SIGNON_SERVERINFO);
 
 // set view
 	MSG_WriteByte (&client->message, svc_setview);
@@ -373,6 +679,9 @@ void SV_SendServerinfo (client_t *client)
 
 	client->sendsignon = true;
 	client->spawned = false;		// need prespawn, spawn, etc
+	client->snapshots = false;		// until the client asks again
+	client->snapshot_acked = 0;
+	SV_ResetInterest (client);
 }
 
 /*
@@ -405,6 +714,7 @@ void SV_ConnectClient (int clientnum)
 
 	if (sv.loadgame)
 		memcpy (spawn_parms, client->spawn_parms, sizeof(spawn_parms));
+	SV_ReleaseSignon (client);
 	memset (client, 0, sizeof(*client));
 	client->netconnection = netconnection;
 
@@ -494,17 +804,79 @@ or other small motion on the client side.  Otherwise, a bob might cause an
 entity that should be visible to not show up, especially when the bob
 crosses a waterline.
 
+The fat PVS of a client only depends on the set of leafs within 8 units of
+its eye, so the merged row is cached per client, keyed on that set, and
+reused until the client moves into a different set of leafs. A cache miss
+ORs the leafs' decompressed rows together, 16 bytes at a time where SSE2 is
+available, taking them from a small LRU of decompressed rows so that leafs
+the clients move between aren't decompressed again. Each fatpvs_t (one per
+thread building snapshots) has its own row LRU, so nothing is shared.
+
 =============================================================================
 */
 
-static int	fatbytes;
-static byte	*fatpvs;
-static int	fatpvs_capacity;
+#define	MAX_FATLEAFS		32		// larger sets aren't cached
+#define	FATPVS_ROWS			128		// decompressed rows kept per fatpvs_t
+#define	FATCACHE_ENTRIES	4		// merged rows kept per client
 
-void SV_AddToFatPVS (vec3_t org, mnode_t *node, qmodel_t *worldmodel) //johnfitz -- added worldmodel as a parameter
+typedef struct
+{
+	int		hits, misses;		// per-client cache
+	int		uncached;			// built the old way
+	int		rowhits, rowmisses;
+	double	hittime, misstime, uncachedtime;
+} fatpvsstats_t;
+
+typedef struct
+{
+	byte	*data;
+	int		bytes;
+	int		capacity;
+
+// leafs touched by the last SV_FatLeafs
+	int		leafs[MAX_FATLEAFS];
+	int		numleafs;
+
+// decompressed row LRU
+	qmodel_t	*model;
+	byte		*visdata;
+	byte		*rows;
+	int			rowbytes;
+	int			*leafrow;		// row holding each leaf's pvs, or -1
+	int			maxleafs;
+	int			rowleaf[FATPVS_ROWS];
+	int			rowused[FATPVS_ROWS];
+	int			rowclock;
+
+	fatpvsstats_t	stats;
+} fatpvs_t;
+
+typedef struct
+{
+	int		leafs[MAX_FATLEAFS];
+	int		numleafs;			// -1 if unused
+	int		used;
+	byte	*data;
+} fatcacheentry_t;
+
+typedef struct
+{
+	fatcacheentry_t	entries[FATCACHE_ENTRIES];
+	int				bytes;
+	int				clock;
+} fatcache_t;
+
+#define	MAX_SEND_THREADS	16
+
+static fatpvs_t		sv_fatpvs;	// SV_FatPVS's, the send threads have their own
+static fatpvs_t		sv_sendfatpvs[MAX_SEND_THREADS];
+static fatcache_t	*sv_fatcache;	// svs.maxclientslimit
+static int			sv_fatframes;
+
+cvar_t	sv_fatpvscache = {"sv_fatpvscache", "1", CVAR_NONE};
+
+static void SV_AddToFatPVS (fatpvs_t *fat, vec3_t org, mnode_t *node, qmodel_t *worldmodel) //johnfitz -- added worldmodel as a parameter
 {
-	int		i;
-	byte	*pvs;
 	mplane_t	*plane;
 	float	d;
 
@@ -514,11 +886,7 @@ void SV_AddToFatPVS (vec3_t org, mnode_t *node, qmodel_t *worldmodel) //johnfitz
 		if (node->contents < 0)
 		{
 			if (node->contents != CONTENTS_SOLID)
-			{
-				pvs = Mod_LeafPVS ( (mleaf_t *)node, worldmodel); //johnfitz -- worldmodel as a parameter
-				for (i=0 ; i<fatbytes ; i++)
-					fatpvs[i] |= pvs[i];
-			}
+				Mod_AddLeafPVS ((mleaf_t *)node, worldmodel, fat->data);
 			return;
 		}
 
@@ -530,7 +898,7 @@ void SV_AddToFatPVS (vec3_t org, mnode_t *node, qmodel_t *worldmodel) //johnfitz
 			node = node->children[1];
 		else
 		{	// go down both
-			SV_AddToFatPVS (org, node->children[0], worldmodel); //johnfitz -- worldmodel as a parameter
+			SV_AddToFatPVS (fat, org, node->children[0], worldmodel); //johnfitz -- worldmodel as a parameter
 			node = node->children[1];
 		}
 	}
@@ -538,125 +906,722 @@ void SV_AddToFatPVS (vec3_t org, mnode_t *node, qmodel_t *worldmodel) //johnfitz
 
 /*
 =============
-SV_FatPVS
+SV_FatLeafs
 
-Calculates a PVS that is the inclusive or of all leafs within 8 pixels of the
-given point.
+Collects the non-solid leafs SV_AddToFatPVS would visit, in the same order.
+numleafs ends up past MAX_FATLEAFS if they didn't all fit.
 =============
 */
-byte *SV_FatPVS (vec3_t org, qmodel_t *worldmodel) //johnfitz -- added worldmodel as a parameter
+static void SV_FatLeafs (fatpvs_t *fat, vec3_t org, mnode_t *node, qmodel_t *worldmodel)
 {
-	fatbytes = (worldmodel->numleafs+7)>>3; // ericw -- was +31, assumed to be a bug/typo
-	if (fatpvs == NULL || fatbytes > fatpvs_capacity)
+	mplane_t	*plane;
+	float	d;
+
+	while (1)
 	{
-		fatpvs_capacity = fatbytes;
-		fatpvs = (byte *) realloc (fatpvs, fatpvs_capacity);
-		if (!fatpvs)
-			Sys_Error ("SV_FatPVS: realloc() failed on %d bytes", fatpvs_capacity);
+		if (node->contents < 0)
+		{
+			if (node->contents != CONTENTS_SOLID)
+			{
+				if (fat->numleafs < MAX_FATLEAFS)
+					fat->leafs[fat->numleafs] = (mleaf_t *)node - worldmodel->leafs;
+				fat->numleafs++;
+			}
+			return;
+		}
+
+		plane = node->plane;
+		d = DotProduct (org, plane->normal) - plane->dist;
+		if (d > 8)
+			node = node->children[0];
+		else if (d < -8)
+			node = node->children[1];
+		else
+		{	// go down both
+			SV_FatLeafs (fat, org, node->children[0], worldmodel);
+			node = node->children[1];
+		}
 	}
-	
-	Q_memset (fatpvs, 0, fatbytes);
-	SV_AddToFatPVS (org, worldmodel->nodes, worldmodel); //johnfitz -- worldmodel as a parameter
-	return fatpvs;
 }
 
 /*
 =============
-SV_EdictInPVS
+SV_FatAlloc
 =============
 */
-qboolean SV_EdictInPVS (edict_t *test, byte *pvs)
+static void SV_FatAlloc (fatpvs_t *fat, qmodel_t *worldmodel)
 {
-	int i;
-	for (i = 0 ; i < test->num_leafs ; i++)
-		if (pvs[test->leafnums[i] >> 3] & (1 << (test->leafnums[i] & 7)))
-			return true;
-	return false;
+	fat->bytes = (worldmodel->numleafs+7)>>3; // ericw -- was +31, assumed to be a bug/typo
+	if (fat->data == NULL || fat->bytes > fat->capacity)
+	{
+		fat->capacity = fat->bytes;
+		fat->data = (byte *) realloc (fat->data, fat->capacity);
+		if (!fat->data)
+			Sys_Error ("SV_FatPVS: realloc() failed on %d bytes", fat->capacity);
+	}
 }
 
 /*
 =============
-SV_VisibleToClient -- johnfitz
+SV_FatRow
 
-PVS test encapsulated in a nice function
+Returns leaf's decompressed pvs from fat's row LRU
 =============
 */
-qboolean SV_VisibleToClient (edict_t *client, edict_t *test, qmodel_t *worldmodel)
+static byte *SV_FatRow (fatpvs_t *fat, int leaf, qmodel_t *worldmodel)
 {
-	byte	*pvs;
-	vec3_t	org;
+	byte	*row;
+	int		i, slot;
 
-	VectorAdd (client->v.origin, client->v.view_ofs, org);
-	pvs = SV_FatPVS (org, worldmodel);
+	if (fat->model != worldmodel || fat->visdata != worldmodel->visdata || fat->maxleafs != worldmodel->numleafs + 1)
+	{
+		fat->model = worldmodel;
+		fat->visdata = worldmodel->visdata;
+		fat->maxleafs = worldmodel->numleafs + 1;
+		fat->rowbytes = (worldmodel->numleafs+7)>>3;
+		fat->rows = (byte *) realloc (fat->rows, FATPVS_ROWS * fat->rowbytes);
+		fat->leafrow = (int *) realloc (fat->leafrow, fat->maxleafs * sizeof(int));
+		if (!fat->rows || !fat->leafrow)
+			Sys_Error ("SV_FatRow: out of memory");
+		for (i = 0; i < fat->maxleafs; i++)
+			fat->leafrow[i] = -1;
+		for (i = 0; i < FATPVS_ROWS; i++)
+		{
+			fat->rowleaf[i] = -1;
+			fat->rowused[i] = 0;
+		}
+		fat->rowclock = 0;
+	}
 
-	return SV_EdictInPVS (test, pvs);
+	slot = fat->leafrow[leaf];
+	if (slot >= 0)
+		fat->stats.rowhits++;
+	else
+	{
+		fat->stats.rowmisses++;
+		for (i = 1, slot = 0; i < FATPVS_ROWS; i++)
+			if (fat->rowused[i] < fat->rowused[slot])
+				slot = i;
+		if (fat->rowleaf[slot] >= 0)
+			fat->leafrow[fat->rowleaf[slot]] = -1;
+		fat->rowleaf[slot] = leaf;
+		fat->leafrow[leaf] = slot;
+
+		row = fat->rows + slot * fat->rowbytes;
+		memset (row, 0, fat->rowbytes);
+		Mod_AddLeafPVS (&worldmodel->leafs[leaf], worldmodel, row);
+	}
+
+	fat->rowused[slot] = ++fat->rowclock;
+	return fat->rows + slot * fat->rowbytes;
 }
 
-//=============================================================================
+/*
+=============
+SV_OrRows
+=============
+*/
+static void SV_OrRows (byte *out, const byte *in, int bytes)
+{
+	int		i = 0;
+
+#ifdef USE_SSE2
+	for (; i + 16 <= bytes; i += 16)
+	{
+		__m128i a = _mm_loadu_si128 ((const __m128i *)(out + i));
+		__m128i b = _mm_loadu_si128 ((const __m128i *)(in + i));
+		_mm_storeu_si128 ((__m128i *)(out + i), _mm_or_si128 (a, b));
+	}
+#endif
+	for (; i < bytes; i++)
+		out[i] |= in[i];
+}
 
 /*
 =============
-SV_WriteEntitiesToClient
+SV_MergeFatLeafs
 
+ORs the rows of the leafs collected by SV_FatLeafs into out
 =============
 */
-void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
+static void SV_MergeFatLeafs (fatpvs_t *fat, byte *out, qmodel_t *worldmodel)
 {
-	int		e, i;
-	int		bits;
-	byte	*pvs;
-	vec3_t	org;
-	float	miss;
-	edict_t	*ent;
-
-// find the client's PVS
-	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
-	pvs = SV_FatPVS (org, sv.worldmodel);
+	int		i, bytes;
 
-// send over all entities (excpet the client) that touch the pvs
-	ent = NEXT_EDICT(sv.edicts);
-	for (e=1 ; e<sv.num_edicts ; e++, ent = NEXT_EDICT(ent))
+	bytes = (worldmodel->numleafs+7)>>3;
+	if (!fat->numleafs)
 	{
+		memset (out, 0, bytes);
+		return;
+	}
 
-		if (ent != clent)	// clent is ALLWAYS sent
-		{
-			// ignore ents without visible models
-			if (!ent->v.modelindex || !PR_GetString(ent->v.model)[0])
-				continue;
+	memcpy (out, SV_FatRow (fat, fat->leafs[0], worldmodel), bytes);
+	for (i = 1; i < fat->numleafs; i++)
+		SV_OrRows (out, SV_FatRow (fat, fat->leafs[i], worldmodel), bytes);
+}
 
-			//johnfitz -- don't send model>255 entities if protocol is 15
-			if (sv.protocol == PROTOCOL_NETQUAKE && (int)ent->v.modelindex & 0xFF00)
-				continue;
+/*
+=============
+SV_BuildFatPVS
+=============
+*/
+static byte *SV_BuildFatPVS (fatpvs_t *fat, vec3_t org, qmodel_t *worldmodel)
+{
+	SV_FatAlloc (fat, worldmodel);
 
-			// ignore if not touching a PV leaf
-			for (i=0 ; i < ent->num_leafs ; i++)
-				if (pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i]&7) ))
-					break;
-			
-			// ericw -- added ent->num_leafs < MAX_ENT_LEAFS condition.
-			//
-			// if ent->num_leafs == MAX_ENT_LEAFS, the ent is visible from too many leafs
-			// for us to say whether it's in the PVS, so don't try to vis cull it.
-			// this commonly happens with rotators, because they often have huge bboxes
-			// spanning the entire map, or really tall lifts, etc.
-			if (i == ent->num_leafs && ent->num_leafs < MAX_ENT_LEAFS)
-				continue;		// not visible
-		}
+	fat->numleafs = 0;
+	SV_FatLeafs (fat, org, worldmodel->nodes, worldmodel);
+	if (fat->numleafs <= MAX_FATLEAFS)
+	{
+		SV_MergeFatLeafs (fat, fat->data, worldmodel);
+		return fat->data;
+	}
 
-		// johnfitz -- max size for protocol 15 is 18 bytes, not 16 as originally
-		// assumed here.  And, for protocol 85 the max size is actually 24 bytes.
-		// For float coords and angles the limit is 39. 
-		// FIXME: Use tighter limit according to protocol flags and send bits.
-		if (msg->cursize + 39 > msg->maxsize)
-		{
-			//johnfitz -- less spammy overflow message
-			if (!dev_overflows.packetsize || dev_overflows.packetsize + CONSOLE_RESPAM_TIME < realtime )
-			{
-				Con_Printf ("Packet overflow!\n");
-				dev_overflows.packetsize = realtime;
-			}
-			goto stats;
-			//johnfitz
+	Q_memset (fat->data, 0, fat->bytes);
+	SV_AddToFatPVS (fat, org, worldmodel->nodes, worldmodel); //johnfitz -- worldmodel as a parameter
+	return fat->data;
+}
+
+/*
+=============
+SV_FatPVS
+
+Calculates a PVS that is the inclusive or of all leafs within 8 pixels of the
+given point.
+=============
+*/
+byte *SV_FatPVS (vec3_t org, qmodel_t *worldmodel) //johnfitz -- added worldmodel as a parameter
+{
+	return SV_BuildFatPVS (&sv_fatpvs, org, worldmodel);
+}
+
+/*
+=============
+SV_ClearFatPVSCache
+
+Forgets every client's cached fat PVS, and the decompressed rows: a new
+map can get the old one's model slot and hunk addresses, so SV_FatRow
+can't always tell by itself
+=============
+*/
+static void SV_ClearFatPVSCache (void)
+{
+	fatcache_t	*cache;
+	int			i, j;
+
+	sv_fatpvs.model = NULL;
+	for (i = 0; i < MAX_SEND_THREADS; i++)
+		sv_sendfatpvs[i].model = NULL;
+
+	if (!sv_fatcache)
+	{
+		sv_fatcache = (fatcache_t *) calloc (svs.maxclientslimit, sizeof(fatcache_t));
+		if (!sv_fatcache)
+			Sys_Error ("SV_ClearFatPVSCache: out of memory");
+	}
+	for (i = 0, cache = sv_fatcache; i < svs.maxclientslimit; i++, cache++)
+		for (j = 0; j < FATCACHE_ENTRIES; j++)
+			cache->entries[j].numleafs = -1;
+}
+
+/*
+=============
+SV_ClientFatPVS
+
+The fat PVS at client's eye, from its cache when it hasn't moved into a
+different set of leafs. Runs on any thread, as long as each client is only
+looked at by one at a time. The returned row belongs to the client's cache,
+and stays valid until the next call for the same client.
+=============
+*/
+static byte *SV_ClientFatPVS (fatpvs_t *fat, client_t *client)
+{
+	fatcache_t		*cache;
+	fatcacheentry_t	*entry;
+	edict_t			*clent = client->edict;
+	vec3_t			org;
+	double			time;
+	int				i, j, bytes;
+
+	time = Sys_DoubleTime ();
+	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
+
+	if (sv_fatpvscache.value)
+	{
+		fat->numleafs = 0;
+		SV_FatLeafs (fat, org, sv.worldmodel->nodes, sv.worldmodel);
+	}
+	if (!sv_fatpvscache.value || fat->numleafs > MAX_FATLEAFS)
+	{
+		SV_FatAlloc (fat, sv.worldmodel);
+		Q_memset (fat->data, 0, fat->bytes);
+		SV_AddToFatPVS (fat, org, sv.worldmodel->nodes, sv.worldmodel);
+		fat->stats.uncached++;
+		fat->stats.uncachedtime += Sys_DoubleTime () - time;
+		return fat->data;
+	}
+
+	cache = &sv_fatcache[client - svs.clients];
+	bytes = (sv.worldmodel->numleafs+7)>>3;
+	if (cache->bytes != bytes)
+	{
+		for (i = 0; i < FATCACHE_ENTRIES; i++)
+		{
+			entry = &cache->entries[i];
+			entry->data = (byte *) realloc (entry->data, bytes);
+			if (!entry->data)
+				Sys_Error ("SV_ClientFatPVS: out of memory");
+			entry->numleafs = -1;
+		}
+		cache->bytes = bytes;
+	}
+
+	for (i = 0, j = 0; i < FATCACHE_ENTRIES; i++)
+	{
+		entry = &cache->entries[i];
+		if (entry->numleafs == fat->numleafs && !memcmp (entry->leafs, fat->leafs, fat->numleafs * sizeof(int)))
+		{
+			entry->used = ++cache->clock;
+			fat->stats.hits++;
+			fat->stats.hittime += Sys_DoubleTime () - time;
+			return entry->data;
+		}
+		if (entry->used < cache->entries[j].used)
+			j = i;
+	}
+
+	entry = &cache->entries[j];
+	entry->numleafs = fat->numleafs;
+	memcpy (entry->leafs, fat->leafs, fat->numleafs * sizeof(int));
+	entry->used = ++cache->clock;
+	SV_MergeFatLeafs (fat, entry->data, sv.worldmodel);
+
+	fat->stats.misses++;
+	fat->stats.misstime += Sys_DoubleTime () - time;
+	return entry->data;
+}
+
+/*
+=============
+SV_EdictInPVS
+=============
+*/
+qboolean SV_EdictInPVS (edict_t *test, byte *pvs)
+{
+	int i;
+	for (i = 0 ; i < test->num_leafs ; i++)
+		if (pvs[test->leafnums[i] >> 3] & (1 << (test->leafnums[i] & 7)))
+			return true;
+	return false;
+}
+
+/*
+=============
+SV_VisibleToClient -- johnfitz
+
+PVS test encapsulated in a nice function
+=============
+*/
+qboolean SV_VisibleToClient (edict_t *client, edict_t *test, qmodel_t *worldmodel)
+{
+	byte	*pvs;
+	vec3_t	org;
+
+	VectorAdd (client->v.origin, client->v.view_ofs, org);
+	pvs = SV_FatPVS (org, worldmodel);
+
+	return SV_EdictInPVS (test, pvs);
+}
+
+#define	PVS_BLOCK	256
+
+typedef struct
+{
+	pvsquery_t	query;
+	int			always;
+	int			next;		// first edict of the next block
+	int			count, index;
+	int			list[PVS_BLOCK];
+} pvsiter_t;
+
+/*
+=============
+SV_BeginEdictsInPVS
+
+Sets it up for walking the edicts in pvs, and always, with
+SV_NextEdictInPVS
+=============
+*/
+static void SV_BeginEdictsInPVS (pvsiter_t *it, byte *pvs, int always)
+{
+	SV_PVSQuery (pvs, &it->query);
+	it->always = always;
+	it->next = 1;
+	it->count = it->index = 0;
+}
+
+/*
+=============
+SV_NextEdictInPVS
+
+Returns the number of the next edict, or 0 after the last one
+=============
+*/
+static int SV_NextEdictInPVS (pvsiter_t *it)
+{
+	while (it->index == it->count)
+	{
+		if (it->next >= sv.num_edicts)
+			return 0;
+		it->count = SV_EdictsInPVS (&it->query, it->next, q_min (it->next + PVS_BLOCK, sv.num_edicts), it->always, it->list);
+		it->index = 0;
+		it->next += PVS_BLOCK;
+	}
+	return it->list[it->index++];
+}
+
+//=============================================================================
+
+typedef struct
+{
+	int		cursize;	// msg->cursize at the overflow check
+	int		num;		// the edict that was checked
+} sendmark_t;
+
+/*
+=============================================================================
+
+ENTITY PRIORITY
+
+With sv_interest set, on frames when the entities a client can see won't
+all fit in its datagram, they are ranked by how much it matters that the
+client has them up to date. Players and missiles rank over monsters, and
+monsters over everything else. Entities that look bigger (size over
+distance) rank higher, and so do entities that haven't been sent for a
+while. Fast updates are then written most important first, so the least
+important entities are left out, not the highest numbered ones. Delta
+snapshots are still written in edict order, but it is the least important
+entities that keep their old state, and before that, changes to entities
+past sv_interest_near are held back: up to sv_interest_interval seconds
+at sv_interest_far, and static ones at least half that. Frames that fit
+are sent as they are.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	int				num;
+	float			priority;
+	float			interval;	// seconds a change can wait to be sent
+	int				bits;		// of the snapshot delta, -1 if nothing changed
+	qboolean		send;
+	qboolean		written;	// into the snapshot, lastsent is set on commit
+	const snapentity_t	*old;	// in the frame the delta is from, or NULL
+	snapentity_t	cur;
+} interestent_t;
+
+typedef struct
+{
+	double			*lastsent;	// sv.time each edict was last sent, by number
+	int				maxedicts;
+	interestent_t	*ents;		// the visible entities, for the frame being built
+	int				numents;
+	int				maxents;
+	interestent_t	**order;
+// stats
+	int				frames;
+	int				sent;
+	int				deferred;	// changes held back by the rate limit
+	int				dropped;	// left out for lack of room
+} clientinterest_t;
+
+cvar_t	sv_interest = {"sv_interest", "0", CVAR_NONE};
+cvar_t	sv_interest_near = {"sv_interest_near", "512", CVAR_NONE};
+cvar_t	sv_interest_far = {"sv_interest_far", "2048", CVAR_NONE};
+cvar_t	sv_interest_interval = {"sv_interest_interval", "0.2", CVAR_NONE};
+
+static clientinterest_t	*sv_interests;	// svs.maxclientslimit, by client number
+
+/*
+=============
+SV_ResetInterest
+
+Called when client starts a new level
+=============
+*/
+void SV_ResetInterest (client_t *client)
+{
+	clientinterest_t	*ci;
+	int					i;
+
+	if (!sv_interests)
+	{
+		sv_interests = (clientinterest_t *) calloc (svs.maxclientslimit, sizeof(clientinterest_t));
+		if (!sv_interests)
+			Sys_Error ("SV_ResetInterest: out of memory");
+	}
+
+	ci = &sv_interests[client - svs.clients];
+	if (ci->maxedicts != sv.max_edicts)
+	{
+		ci->maxedicts = sv.max_edicts;
+		ci->lastsent = (double *) realloc (ci->lastsent, ci->maxedicts * sizeof(double));
+		if (!ci->lastsent)
+			Sys_Error ("SV_ResetInterest: out of memory");
+	}
+	for (i = 0; i < ci->maxedicts; i++)
+		ci->lastsent[i] = 0;
+	ci->numents = 0;
+}
+
+/*
+=============
+SV_ClientInterest
+=============
+*/
+static clientinterest_t *SV_ClientInterest (edict_t *clent)
+{
+	return &sv_interests[NUM_FOR_EDICT(clent) - 1];
+}
+
+/*
+=============
+SV_AddInterest
+
+Appends edict e to the client's visible entities
+=============
+*/
+static interestent_t *SV_AddInterest (clientinterest_t *ci, int e)
+{
+	interestent_t	*ie;
+
+	if (ci->numents == ci->maxents)
+	{
+		ci->maxents = q_max (256, ci->maxents * 2);
+		ci->ents = (interestent_t *) realloc (ci->ents, ci->maxents * sizeof(interestent_t));
+		ci->order = (interestent_t **) realloc (ci->order, ci->maxents * sizeof(interestent_t *));
+		if (!ci->ents || !ci->order)
+			Sys_Error ("SV_AddInterest: out of memory");
+	}
+	ie = &ci->ents[ci->numents++];
+	ie->num = e;
+	ie->priority = 0;
+	ie->interval = 0;
+	ie->bits = -1;
+	ie->send = true;
+	ie->written = false;
+	ie->old = NULL;
+	return ie;
+}
+
+/*
+=============
+SV_EntityPriority
+
+Sets ie's priority and interval for a client looking from org
+=============
+*/
+static void SV_EntityPriority (clientinterest_t *ci, interestent_t *ie, edict_t *clent, vec3_t org)
+{
+	edict_t	*ent = EDICT_NUM(ie->num);
+	vec3_t	center, size;
+	float	dist, weight, age, far;
+	int		i;
+
+	if (ent == clent)
+	{
+		ie->priority = 1e30f;
+		ie->interval = 0;
+		return;
+	}
+
+	for (i = 0; i < 3; i++)
+		center[i] = 0.5f * (ent->v.absmin[i] + ent->v.absmax[i]) - org[i];
+	VectorSubtract (ent->v.absmax, ent->v.absmin, size);
+	dist = VectorLength (center);
+
+	if (ie->num <= svs.maxclients)
+		weight = 4;		// players
+	else if (ent->v.movetype == MOVETYPE_FLYMISSILE || ent->v.movetype == MOVETYPE_BOUNCE)
+		weight = 3;		// missiles and grenades
+	else if ((int)ent->v.flags & FL_MONSTER)
+		weight = 2;
+	else
+		weight = 1;
+
+	age = q_min (sv.time - ci->lastsent[ie->num], 1.0);
+	ie->priority = weight * (1.f + 4.f * VectorLength (size) / q_max (dist, 64.f)) * (1.f + 10.f * age);
+
+	// the rate limit, never for players and missiles
+	far = q_max (sv_interest_far.value, sv_interest_near.value + 1.f);
+	ie->interval = CLAMP (0.f, (dist - sv_interest_near.value) / (far - sv_interest_near.value), 1.f);
+	if (ent->v.movetype == MOVETYPE_NONE && ie->interval > 0.f)
+		ie->interval = q_max (ie->interval, 0.5f);
+	if (weight >= 3)
+		ie->interval = 0;
+	ie->interval *= sv_interest_interval.value;
+}
+
+static int SV_CompareInterest (const void *a, const void *b)
+{
+	const interestent_t *ia = *(const interestent_t * const *)a;
+	const interestent_t *ib = *(const interestent_t * const *)b;
+
+	if (ia->priority != ib->priority)
+		return ia->priority > ib->priority ? -1 : 1;
+	return ia->num - ib->num;
+}
+
+/*
+=============
+SV_RankInterest
+
+Ranks the client's visible entities, most important first, in ci->order
+=============
+*/
+static void SV_RankInterest (clientinterest_t *ci, edict_t *clent)
+{
+	vec3_t	org;
+	int		i;
+
+	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
+	for (i = 0; i < ci->numents; i++)
+	{
+		SV_EntityPriority (ci, &ci->ents[i], clent, org);
+		ci->order[i] = &ci->ents[i];
+	}
+	qsort (ci->order, ci->numents, sizeof(ci->order[0]), SV_CompareInterest);
+}
+
+/*
+=============
+SV_InterestStats_f
+=============
+*/
+void SV_InterestStats_f (void)
+{
+	clientinterest_t	*ci;
+	client_t			*client;
+	int					i;
+
+	if (!sv.active || !sv_interests)
+	{
+		Con_Printf ("no clients\n");
+		return;
+	}
+
+	Con_Printf ("%-16s %8s %10s %10s %10s\n", "client", "frames", "sent/f", "deferred/f", "dropped/f");
+	for (i = 0, client = svs.clients; i < svs.maxclients; i++, client++)
+	{
+		if (!client->active)
+			continue;
+		ci = &sv_interests[i];
+		Con_Printf ("%-16.16s %8i %10.1f %10.1f %10.1f\n", client->name, ci->frames,
+			ci->frames ? (double) ci->sent / ci->frames : 0.0,
+			ci->frames ? (double) ci->deferred / ci->frames : 0.0,
+			ci->frames ? (double) ci->dropped / ci->frames : 0.0);
+		ci->frames = ci->sent = ci->deferred = ci->dropped = 0;
+	}
+}
+
+/*
+=============
+SV_WriteEntityUpdates
+
+Writes updates for the entities in pvs and returns false if msg ran out of
+room. With sv_interest set they are written most important first. Without
+marks, ent->alpha and the send times are updated on the way. With marks,
+nothing but msg is written, so it can run on a send thread; instead each
+entity that reaches the overflow check is recorded for
+SV_SpliceEntityUpdates. *nummarks is set to -1 if the updates have to be
+written on the main thread after all.
+=============
+*/
+static qboolean SV_WriteEntityUpdates (edict_t *clent, byte *pvs, sizebuf_t *msg, sendmark_t *marks, int *nummarks)
+{
+	int		e, i;
+	int		bits;
+	float	miss;
+	edict_t	*ent;
+	byte	alpha;
+	eval_t	*val;
+	pvsiter_t	it;
+	clientinterest_t	*ci = SV_ClientInterest (clent);
+	int		k;
+
+// find all entities (excpet the client) that touch the pvs
+	ci->numents = 0;
+	SV_BeginEdictsInPVS (&it, pvs, NUM_FOR_EDICT(clent));
+	while ((e = SV_NextEdictInPVS (&it)) != 0)
+	{
+		ent = EDICT_NUM(e);
+
+		if (ent != clent)	// clent is ALLWAYS sent
+		{
+			// a bad string is a Host_Error, which only the main thread can raise
+			if (marks && !PR_StringValid (ent->v.model))
+			{
+				*nummarks = -1;
+				return false;
+			}
+
+			// ignore ents without visible models
+			if (!ent->v.modelindex || !PR_GetString(ent->v.model)[0])
+				continue;
+
+			//johnfitz -- don't send model>255 entities if protocol is 15
+			if (sv.protocol == PROTOCOL_NETQUAKE && (int)ent->v.modelindex & 0xFF00)
+				continue;
+
+			// only entities touching a PV leaf get here
+			// ericw -- added ent->num_leafs < MAX_ENT_LEAFS condition.
+			//
+			// if ent->num_leafs == MAX_ENT_LEAFS, the ent is visible from too many leafs
+			// for us to say whether it's in the PVS, so don't try to vis cull it.
+			// this commonly happens with rotators, because they often have huge bboxes
+			// spanning the entire map, or really tall lifts, etc.
+		}
+
+		SV_AddInterest (ci, e);
+	}
+
+	if (sv_interest.value && msg->cursize + ci->numents * 39 > msg->maxsize)
+		SV_RankInterest (ci, clent);
+	else
+	{
+		for (k = 0; k < ci->numents; k++)
+			ci->order[k] = &ci->ents[k];
+	}
+	if (!marks)
+		ci->frames++;
+
+// send them
+	for (k = 0; k < ci->numents; k++)
+	{
+		e = ci->order[k]->num;
+		ent = EDICT_NUM(e);
+
+		// johnfitz -- max size for protocol 15 is 18 bytes, not 16 as originally
+		// assumed here.  And, for protocol 85 the max size is actually 24 bytes.
+		// For float coords and angles the limit is 39. 
+		// FIXME: Use tighter limit according to protocol flags and send bits.
+		if (marks)
+		{
+			marks[*nummarks].cursize = msg->cursize;
+			marks[*nummarks].num = e;
+			(*nummarks)++;
+		}
+		if (msg->cursize + 39 > msg->maxsize)
+		{
+			if (!marks)
+				ci->dropped += ci->numents - k;
+			return false;
+		}
+		if (!marks)
+		{
+			ci->lastsent[e] = sv.time;
+			ci->sent++;
 		}
 
 // send an update
@@ -697,17 +1662,21 @@ void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
 			bits |= U_MODEL;
 
 		//johnfitz -- alpha
+		alpha = ent->alpha;
 		if (pr_alpha_supported)
 		{
 			// TODO: find a cleaner place to put this code
-			eval_t	*val;
-			val = GetEdictFieldValue(ent, "alpha");
+			val = E_EXTFIELD(ent, alpha);
 			if (val)
-				ent->alpha = ENTALPHA_ENCODE(val->_float);
+			{
+				alpha = ENTALPHA_ENCODE(val->_float);
+				if (!marks)
+					ent->alpha = alpha;
+			}
 		}
 
 		//don't send invisible entities unless they have effects
-		if (ent->alpha == ENTALPHA_ZERO && !((int)ent->v.effects & pr_effects_mask))
+		if (alpha == ENTALPHA_ZERO && !((int)ent->v.effects & pr_effects_mask))
 			continue;
 		//johnfitz
 
@@ -715,7 +1684,7 @@ void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
 		if (sv.protocol != PROTOCOL_NETQUAKE)
 		{
 
-			if (ent->baseline.alpha != ent->alpha) bits |= U_ALPHA;
+			if (ent->baseline.alpha != alpha) bits |= U_ALPHA;
 			if (bits & U_FRAME && (int)ent->v.frame & 0xFF00) bits |= U_FRAME2;
 			if (bits & U_MODEL && (int)ent->v.modelindex & 0xFF00) bits |= U_MODEL2;
 			if (ent->sendinterval) bits |= U_LERPFINISH;
@@ -775,7 +1744,7 @@ void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
 
 		//johnfitz -- PROTOCOL_FITZQUAKE
 		if (bits & U_ALPHA)
-			MSG_WriteByte(msg, ent->alpha);
+			MSG_WriteByte(msg, alpha);
 		if (bits & U_FRAME2)
 			MSG_WriteByte(msg, (int)ent->v.frame >> 8);
 		if (bits & U_MODEL2)
@@ -785,241 +1754,1405 @@ void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
 		//johnfitz
 	}
 
-	//johnfitz -- devstats
-stats:
-	if (msg->cursize > 1024 && dev_peakstats.packetsize <= 1024)
-		Con_DWarning ("%i byte packet exceeds standard limit of 1024 (max = %d).\n", msg->cursize, msg->maxsize);
-	dev_stats.packetsize = msg->cursize;
-	dev_peakstats.packetsize = q_max(msg->cursize, dev_peakstats.packetsize);
-	//johnfitz
+	return true;
+}
+
+/*
+=============
+SV_EntityUpdatesDone
+=============
+*/
+static void SV_EntityUpdatesDone (sizebuf_t *msg, qboolean overflowed)
+{
+	//johnfitz -- less spammy overflow message
+	if (overflowed && (!dev_overflows.packetsize || dev_overflows.packetsize + CONSOLE_RESPAM_TIME < realtime))
+	{
+		Con_Printf ("Packet overflow!\n");
+		dev_overflows.packetsize = realtime;
+	}
+	//johnfitz
+
+	//johnfitz -- devstats
+	if (msg->cursize > 1024 && dev_peakstats.packetsize <= 1024)
+		Con_DWarning ("%i byte packet exceeds standard limit of 1024 (max = %d).\n", msg->cursize, msg->maxsize);
+	dev_stats.packetsize = msg->cursize;
+	dev_peakstats.packetsize = q_max(msg->cursize, dev_peakstats.packetsize);
+	//johnfitz
+}
+
+/*
+=============
+SV_WriteEntitiesToClient
+
+=============
+*/
+void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
+{
+	byte	*pvs;
+	vec3_t	org;
+	int		i;
+
+// find the client's PVS
+	i = NUM_FOR_EDICT (clent) - 1;
+	if (i >= 0 && i < svs.maxclients && svs.clients[i].edict == clent)
+		pvs = SV_ClientFatPVS (&sv_fatpvs, &svs.clients[i]);
+	else
+	{
+		VectorAdd (clent->v.origin, clent->v.view_ofs, org);
+		pvs = SV_FatPVS (org, sv.worldmodel);
+	}
+
+	SV_EntityUpdatesDone (msg, !SV_WriteEntityUpdates (clent, pvs, msg, NULL, NULL));
+}
+
+/*
+=============
+SV_CleanupEnts
+
+=============
+*/
+void SV_CleanupEnts (void)
+{
+	int		e;
+	edict_t	*ent;
+
+	ent = NEXT_EDICT(sv.edicts);
+	for (e=1 ; e<sv.num_edicts ; e++, ent = NEXT_EDICT(ent))
+	{
+		ent->v.effects = (int)ent->v.effects & ~EF_MUZZLEFLASH;
+	}
+}
+
+/*
+==================
+SV_WriteClientdataToMessage
+
+==================
+*/
+void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg)
+{
+	int		bits;
+	int		i;
+	edict_t	*other;
+	int		items;
+	eval_t	*val;
+
+//
+// send a damage message
+//
+	if (ent->v.dmg_take || ent->v.dmg_save)
+	{
+		other = PROG_TO_EDICT(ent->v.dmg_inflictor);
+		MSG_WriteByte (msg, svc_damage);
+		MSG_WriteByte (msg, ent->v.dmg_save);
+		MSG_WriteByte (msg, ent->v.dmg_take);
+		for (i=0 ; i<3 ; i++)
+			MSG_WriteCoord (msg, other->v.origin[i] + 0.5*(other->v.mins[i] + other->v.maxs[i]), sv.protocolflags );
+
+		ent->v.dmg_take = 0;
+		ent->v.dmg_save = 0;
+	}
+
+//
+// send the current viewpos offset from the view entity
+//
+	SV_SetIdealPitch ();		// how much to look up / down ideally
+
+// a fixangle might get lost in a dropped packet.  Oh well.
+	if ( ent->v.fixangle )
+	{
+		MSG_WriteByte (msg, svc_setangle);
+		for (i=0 ; i < 3 ; i++)
+			MSG_WriteAngle (msg, ent->v.angles[i], sv.protocolflags );
+		ent->v.fixangle = 0;
+	}
+
+	bits = 0;
+
+	if (ent->v.view_ofs[2] != DEFAULT_VIEWHEIGHT)
+		bits |= SU_VIEWHEIGHT;
+
+	if (ent->v.idealpitch)
+		bits |= SU_IDEALPITCH;
+
+// stuff the sigil bits into the high bits of items for sbar, or else
+// mix in items2
+	val = E_EXTFIELD(ent, items2);
+
+	if (val)
+		items = (int)ent->v.items | ((int)val->_float << 23);
+	else
+		items = (int)ent->v.items | ((int)pr_global_struct->serverflags << 28);
+
+	bits |= SU_ITEMS;
+
+	if ( (int)ent->v.flags & FL_ONGROUND)
+		bits |= SU_ONGROUND;
+
+	if ( ent->v.waterlevel >= 2)
+		bits |= SU_INWATER;
+
+	for (i=0 ; i<3 ; i++)
+	{
+		if (ent->v.punchangle[i])
+			bits |= (SU_PUNCH1<<i);
+		if (ent->v.velocity[i])
+			bits |= (SU_VELOCITY1<<i);
+	}
+
+	if (ent->v.weaponframe)
+		bits |= SU_WEAPONFRAME;
+
+	if (ent->v.armorvalue)
+		bits |= SU_ARMOR;
+
+//	if (ent->v.weapon)
+	  bits |= SU_WEAPON;
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (sv.protocol != PROTOCOL_NETQUAKE)
+	{
+		if (bits & SU_WEAPON && SV_ModelIndex(PR_GetString(ent->v.weaponmodel)) & 0xFF00) bits |= SU_WEAPON2;
+		if ((int)ent->v.armorvalue & 0xFF00) bits |= SU_ARMOR2;
+		if ((int)ent->v.currentammo & 0xFF00) bits |= SU_AMMO2;
+		if ((int)ent->v.ammo_shells & 0xFF00) bits |= SU_SHELLS2;
+		if ((int)ent->v.ammo_nails & 0xFF00) bits |= SU_NAILS2;
+		if ((int)ent->v.ammo_rockets & 0xFF00) bits |= SU_ROCKETS2;
+		if ((int)ent->v.ammo_cells & 0xFF00) bits |= SU_CELLS2;
+		if (bits & SU_WEAPONFRAME && (int)ent->v.weaponframe & 0xFF00) bits |= SU_WEAPONFRAME2;
+		if (bits & SU_WEAPON && ent->alpha != ENTALPHA_DEFAULT) bits |= SU_WEAPONALPHA; //for now, weaponalpha = client entity alpha
+		if (bits >= 65536) bits |= SU_EXTEND1;
+		if (bits >= 16777216) bits |= SU_EXTEND2;
+	}
+	//johnfitz
+
+// send the data
+
+	MSG_WriteByte (msg, svc_clientdata);
+	MSG_WriteShort (msg, bits);
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (bits & SU_EXTEND1) MSG_WriteByte(msg, bits>>16);
+	if (bits & SU_EXTEND2) MSG_WriteByte(msg, bits>>24);
+	//johnfitz
+
+	if (bits & SU_VIEWHEIGHT)
+		MSG_WriteChar (msg, ent->v.view_ofs[2]);
+
+	if (bits & SU_IDEALPITCH)
+		MSG_WriteChar (msg, ent->v.idealpitch);
+
+	for (i=0 ; i<3 ; i++)
+	{
+		if (bits & (SU_PUNCH1<<i))
+			MSG_WriteChar (msg, ent->v.punchangle[i]);
+		if (bits & (SU_VELOCITY1<<i))
+			MSG_WriteChar (msg, ent->v.velocity[i]/16);
+	}
+
+// [always sent]	if (bits & SU_ITEMS)
+	MSG_WriteLong (msg, items);
+
+	if (bits & SU_WEAPONFRAME)
+		MSG_WriteByte (msg, ent->v.weaponframe);
+	if (bits & SU_ARMOR)
+		MSG_WriteByte (msg, ent->v.armorvalue);
+	if (bits & SU_WEAPON)
+		MSG_WriteByte (msg, SV_ModelIndex(PR_GetString(ent->v.weaponmodel)));
+
+	MSG_WriteShort (msg, ent->v.health);
+	MSG_WriteByte (msg, ent->v.currentammo);
+	MSG_WriteByte (msg, ent->v.ammo_shells);
+	MSG_WriteByte (msg, ent->v.ammo_nails);
+	MSG_WriteByte (msg, ent->v.ammo_rockets);
+	MSG_WriteByte (msg, ent->v.ammo_cells);
+
+	if (standard_quake)
+	{
+		MSG_WriteByte (msg, ent->v.weapon);
+	}
+	else
+	{
+		for(i=0;i<32;i++)
+		{
+			if ( ((int)ent->v.weapon) & (1<<i) )
+			{
+				MSG_WriteByte (msg, i);
+				break;
+			}
+		}
+	}
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (bits & SU_WEAPON2)
+		MSG_WriteByte (msg, SV_ModelIndex(PR_GetString(ent->v.weaponmodel)) >> 8);
+	if (bits & SU_ARMOR2)
+		MSG_WriteByte (msg, (int)ent->v.armorvalue >> 8);
+	if (bits & SU_AMMO2)
+		MSG_WriteByte (msg, (int)ent->v.currentammo >> 8);
+	if (bits & SU_SHELLS2)
+		MSG_WriteByte (msg, (int)ent->v.ammo_shells >> 8);
+	if (bits & SU_NAILS2)
+		MSG_WriteByte (msg, (int)ent->v.ammo_nails >> 8);
+	if (bits & SU_ROCKETS2)
+		MSG_WriteByte (msg, (int)ent->v.ammo_rockets >> 8);
+	if (bits & SU_CELLS2)
+		MSG_WriteByte (msg, (int)ent->v.ammo_cells >> 8);
+	if (bits & SU_WEAPONFRAME2)
+		MSG_WriteByte (msg, (int)ent->v.weaponframe >> 8);
+	if (bits & SU_WEAPONALPHA)
+		MSG_WriteByte (msg, ent->alpha); //for now, weaponalpha = client entity alpha
+	//johnfitz
+}
+
+/*
+=============================================================================
+
+DELTA SNAPSHOTS
+
+A client that sends "snapshots <version>" during signon, to a server with
+sv_deltasnapshots set, gets its entities as svc_snapshot messages instead
+of fast updates. Every snapshot has a sequence number and is a delta from
+the last one the client acknowledged with clc_ackframe, or from the
+baselines if there is none: only entities that changed since then are
+written, and entities that left are written as removals. Both sides keep
+the last SNAPSHOT_BACKUP frames with the state the client ended up with,
+so an entity that isn't mentioned is the same as in the frame the delta
+is from. If a snapshot runs out of room, the entities that didn't fit keep
+their old state in the new frame too.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	int			sequence;	// of the last frame built
+	snapframe_t	frames[SNAPSHOT_BACKUP];
+} clientsnap_t;
+
+typedef struct
+{
+	int		sequence;
+	int		sent;
+	int		deferred;
+	int		dropped;
+} snapcommit_t;
+
+#define	SNAPSHOT_RESERVE	128		// room left in the datagram for svc_time and the client data
+#define	MAX_SNAPENTITY		39		// entnum, bits and every field at full size
+
+cvar_t	sv_deltasnapshots = {"sv_deltasnapshots", "0", CVAR_NONE};
+
+static clientsnap_t	*sv_snapshots;	// svs.maxclientslimit, by client number
+
+/*
+=============
+SV_EnableSnapshots
+
+Called for the "snapshots" command a client sends during signon
+=============
+*/
+void SV_EnableSnapshots (client_t *client, int version)
+{
+	clientsnap_t	*snap;
+	int				i;
+
+	client->snapshots = false;
+	client->snapshot_acked = 0;
+	if (!sv_deltasnapshots.value || version != SNAPSHOT_VERSION || sv.protocol == PROTOCOL_NETQUAKE)
+		return;
+
+	if (!sv_snapshots)
+	{
+		sv_snapshots = (clientsnap_t *) calloc (svs.maxclientslimit, sizeof(clientsnap_t));
+		if (!sv_snapshots)
+			Sys_Error ("SV_EnableSnapshots: out of memory");
+	}
+
+	snap = &sv_snapshots[client - svs.clients];
+	snap->sequence = 0;
+	for (i = 0; i < SNAPSHOT_BACKUP; i++)
+		snap->frames[i].sequence = 0;
+	client->snapshots = true;
+}
+
+/*
+=============
+SV_AddSnapshotEntity
+=============
+*/
+static snapentity_t *SV_AddSnapshotEntity (snapframe_t *frame)
+{
+	if (frame->numentities == frame->maxentities)
+	{
+		frame->maxentities = q_max (64, frame->maxentities * 2);
+		frame->entities = (snapentity_t *) realloc (frame->entities, frame->maxentities * sizeof(snapentity_t));
+		if (!frame->entities)
+			Sys_Error ("SV_AddSnapshotEntity: out of memory");
+	}
+	return &frame->entities[frame->numentities++];
+}
+
+/*
+=============
+SV_SnapshotState
+
+What a fast update for ent would send
+=============
+*/
+static void SV_SnapshotState (edict_t *ent, int e, snapentity_t *s)
+{
+	eval_t	*val;
+
+	s->num = e;
+	VectorCopy (ent->v.origin, s->state.origin);
+	VectorCopy (ent->v.angles, s->state.angles);
+	s->state.modelindex = (int)ent->v.modelindex;
+	s->state.frame = (int)ent->v.frame;
+	s->state.colormap = (int)ent->v.colormap;
+	s->state.skin = (int)ent->v.skin;
+	s->state.effects = (int)ent->v.effects & pr_effects_mask;
+
+	s->state.alpha = ent->alpha;
+	if (pr_alpha_supported)
+	{
+		val = E_EXTFIELD(ent, alpha);
+		if (val)
+			s->state.alpha = ENTALPHA_ENCODE(val->_float);
+	}
+
+	s->flags = 0;
+	s->lerpfinish = 0;
+	if (ent->v.movetype == MOVETYPE_STEP)
+		s->flags |= U_STEP;
+	if (ent->sendinterval)
+	{
+		s->flags |= U_LERPFINISH;
+		s->lerpfinish = (byte)(Q_rint((ent->v.nextthink-sv.time)*255));
+	}
+}
+
+/*
+=============
+SV_EntityDeltaBits
+
+The bits a delta from from to to is written with, or -1 if there is no
+need to write it. With force set the entity is written even if nothing
+changed, so the client knows it is there.
+=============
+*/
+static int SV_EntityDeltaBits (const snapentity_t *from, const snapentity_t *to, qboolean force)
+{
+	int		i, bits;
+	float	miss;
+
+	bits = 0;
+	for (i=0 ; i<3 ; i++)
+	{
+		miss = to->state.origin[i] - from->state.origin[i];
+		if ( miss < -0.1 || miss > 0.1 )
+			bits |= U_ORIGIN1<<i;
+	}
+	if (to->state.angles[0] != from->state.angles[0])
+		bits |= U_ANGLE1;
+	if (to->state.angles[1] != from->state.angles[1])
+		bits |= U_ANGLE2;
+	if (to->state.angles[2] != from->state.angles[2])
+		bits |= U_ANGLE3;
+	if (to->state.colormap != from->state.colormap)
+		bits |= U_COLORMAP;
+	if (to->state.skin != from->state.skin)
+		bits |= U_SKIN;
+	if (to->state.frame != from->state.frame)
+		bits |= U_FRAME;
+	if ((to->state.effects ^ from->state.effects) & pr_effects_mask)
+		bits |= U_EFFECTS;
+	if (to->state.modelindex != from->state.modelindex)
+		bits |= U_MODEL;
+	if (to->state.alpha != from->state.alpha)
+		bits |= U_ALPHA;
+
+	if (!bits && !force && to->flags == from->flags && to->lerpfinish == from->lerpfinish)
+		return -1;
+
+	// the flags always say how things are now
+	bits |= to->flags;
+	if (bits & U_FRAME && to->state.frame & 0xFF00) bits |= U_FRAME2;
+	if (bits & U_MODEL && to->state.modelindex & 0xFF00) bits |= U_MODEL2;
+	if (bits >= 65536) bits |= U_EXTEND1;
+	if (bits >= 16777216) bits |= U_EXTEND2;
+	if (bits >= 256) bits |= U_MOREBITS;
+
+	return bits;
+}
+
+/*
+=============
+SV_EntityDeltaSize
+
+Bytes SV_WriteEntityDelta writes for bits
+=============
+*/
+static int SV_EntityDeltaSize (int bits)
+{
+	static const int	onebyte[] = {U_MOREBITS, U_EXTEND1, U_EXTEND2, U_MODEL, U_FRAME, U_COLORMAP,
+		U_SKIN, U_EFFECTS, U_ALPHA, U_FRAME2, U_MODEL2, U_LERPFINISH};
+	int		i, size, coord, angle;
+
+	if (bits < 0)
+		return 0;
+
+	if (sv.protocolflags & (PRFL_FLOATCOORD | PRFL_INT32COORD))
+		coord = 4;
+	else if (sv.protocolflags & PRFL_24BITCOORD)
+		coord = 3;
+	else
+		coord = 2;
+	if (sv.protocolflags & PRFL_FLOATANGLE)
+		angle = 4;
+	else if (sv.protocolflags & PRFL_SHORTANGLE)
+		angle = 2;
+	else
+		angle = 1;
+
+	size = 2 + 1;	// number and bits
+	for (i = 0; i < (int) countof(onebyte); i++)
+		if (bits & onebyte[i])
+			size++;
+	for (i = 0; i < 3; i++)
+	{
+		if (bits & (U_ORIGIN1<<i))
+			size += coord;
+		if (bits & (i == 0 ? U_ANGLE1 : i == 1 ? U_ANGLE2 : U_ANGLE3))
+			size += angle;
+	}
+	return size;
+}
+
+/*
+=============
+SV_WriteEntityDelta
+
+Writes the fields of to that differ from from, and sets sent to what the
+client will have. bits is from SV_EntityDeltaBits.
+=============
+*/
+static void SV_WriteEntityDelta (const snapentity_t *from, const snapentity_t *to, snapentity_t *sent, sizebuf_t *msg, int bits)
+{
+	int		i;
+
+	*sent = *from;
+	sent->num = to->num;
+	if (bits < 0)
+		return;
+
+	MSG_WriteShort (msg, to->num);
+	MSG_WriteByte (msg, bits & 255);
+	if (bits & U_MOREBITS)
+		MSG_WriteByte (msg, bits>>8);
+	if (bits & U_EXTEND1)
+		MSG_WriteByte (msg, bits>>16);
+	if (bits & U_EXTEND2)
+		MSG_WriteByte (msg, bits>>24);
+
+	if (bits & U_MODEL)
+		MSG_WriteByte (msg, to->state.modelindex);
+	if (bits & U_FRAME)
+		MSG_WriteByte (msg, to->state.frame);
+	if (bits & U_COLORMAP)
+		MSG_WriteByte (msg, to->state.colormap);
+	if (bits & U_SKIN)
+		MSG_WriteByte (msg, to->state.skin);
+	if (bits & U_EFFECTS)
+		MSG_WriteByte (msg, to->state.effects);
+	for (i=0 ; i<3 ; i++)
+	{
+		if (bits & (U_ORIGIN1<<i))
+		{
+			MSG_WriteCoord (msg, to->state.origin[i], sv.protocolflags);
+			sent->state.origin[i] = to->state.origin[i];
+		}
+		if (bits & (i == 0 ? U_ANGLE1 : i == 1 ? U_ANGLE2 : U_ANGLE3))
+		{
+			MSG_WriteAngle (msg, to->state.angles[i], sv.protocolflags);
+			sent->state.angles[i] = to->state.angles[i];
+		}
+	}
+	if (bits & U_ALPHA)
+		MSG_WriteByte (msg, to->state.alpha);
+	if (bits & U_FRAME2)
+		MSG_WriteByte (msg, to->state.frame >> 8);
+	if (bits & U_MODEL2)
+		MSG_WriteByte (msg, to->state.modelindex >> 8);
+	if (bits & U_LERPFINISH)
+		MSG_WriteByte (msg, to->lerpfinish);
+
+	if (bits & U_MODEL)
+		sent->state.modelindex = to->state.modelindex;
+	if (bits & U_FRAME)
+		sent->state.frame = to->state.frame;
+	if (bits & U_COLORMAP)
+		sent->state.colormap = to->state.colormap;
+	if (bits & U_SKIN)
+		sent->state.skin = to->state.skin;
+	if (bits & U_EFFECTS)
+		sent->state.effects = to->state.effects;
+	if (bits & U_ALPHA)
+		sent->state.alpha = to->state.alpha;
+	sent->flags = to->flags;
+	sent->lerpfinish = to->lerpfinish;
+}
+
+/*
+=============
+SV_RemoveSnapshotEntity
+
+Writes a removal for an entity that is in the frame the delta is from, or
+keeps it in frame if there is no room left. Returns true once out of room.
+=============
+*/
+static qboolean SV_RemoveSnapshotEntity (snapframe_t *frame, const snapentity_t *old, sizebuf_t *msg, qboolean overflowed)
+{
+	if (!overflowed && msg->cursize + 2 + 2 > msg->maxsize)
+		overflowed = true;
+	if (overflowed)
+		*SV_AddSnapshotEntity (frame) = *old;
+	else
+		MSG_WriteShort (msg, (short)(old->num | SNAP_REMOVE));
+	return overflowed;
+}
+
+/*
+=============
+SV_WriteSnapshot
+
+Writes a svc_snapshot of the entities in pvs into msg and the client's next
+frame slot. Returns 0 if msg ran out of room. Nothing else changes until
+SV_CommitSnapshot, so a snapshot built on a send thread can be thrown away
+and built again. With threaded set, -1 means it has to be built on the
+main thread after all.
+=============
+*/
+static int SV_WriteSnapshot (client_t *client, byte *pvs, sizebuf_t *msg, qboolean threaded, snapcommit_t *commit)
+{
+	clientsnap_t	*snap = &sv_snapshots[client - svs.clients];
+	clientinterest_t	*ci = SV_ClientInterest (client->edict);
+	interestent_t	*ie;
+	snapframe_t		*from, *to;
+	snapentity_t	base;
+	const snapentity_t	*old;
+	edict_t			*clent = client->edict;
+	edict_t			*ent;
+	int				e, k, r, numref, numremoved, sequence, acked, size, room;
+	qboolean		overflowed, scheduled;
+	pvsiter_t		it;
+
+	sequence = snap->sequence + 1;
+	acked = client->snapshot_acked;
+	from = NULL;
+	if (acked > 0 && acked < sequence && sequence - acked < SNAPSHOT_BACKUP &&
+		snap->frames[acked & SNAPSHOT_MASK].sequence == acked)
+		from = &snap->frames[acked & SNAPSHOT_MASK];
+	numref = from ? from->numentities : 0;
+
+// find the entities to send and what they are in the frame the delta is from
+	ci->numents = 0;
+	numremoved = 0;
+	size = 0;
+	r = 0;
+	SV_BeginEdictsInPVS (&it, pvs, NUM_FOR_EDICT(clent));
+	while ((e = SV_NextEdictInPVS (&it)) != 0)
+	{
+		ent = EDICT_NUM(e);
+		if (ent != clent)	// clent is ALLWAYS sent
+		{
+			// a bad string is a Host_Error, which only the main thread can raise
+			if (threaded && !PR_StringValid (ent->v.model))
+				return -1;
+
+			// ignore ents without visible models
+			if (!ent->v.modelindex || !PR_GetString(ent->v.model)[0])
+				continue;
+		}
+
+		ie = SV_AddInterest (ci, e);
+		SV_SnapshotState (ent, e, &ie->cur);
+
+		//don't send invisible entities unless they have effects
+		if (ie->cur.state.alpha == ENTALPHA_ZERO && !ie->cur.state.effects)
+		{
+			ci->numents--;
+			continue;
+		}
+
+		// the entities before this one have left
+		for ( ; r < numref && from->entities[r].num < e; r++)
+			numremoved++;
+
+		if (r < numref && from->entities[r].num == e)
+			ie->old = &from->entities[r++];
+		else
+		{
+			base.num = e;
+			base.flags = 0;
+			base.lerpfinish = 0;
+			base.state = ent->baseline;
+		}
+		ie->bits = SV_EntityDeltaBits (ie->old ? ie->old : &base, &ie->cur, !ie->old);
+		size += SV_EntityDeltaSize (ie->bits);
+	}
+	numremoved += numref - r;
+	memset (commit, 0, sizeof(*commit));
+
+// with sv_interest, when it doesn't all fit, hold back changes that can
+// wait and, if it still doesn't, the least important ones
+	scheduled = sv_interest.value != 0;
+	room = msg->maxsize - msg->cursize - (1 + 4 + 4) - 2 - numremoved * 2;
+	if (scheduled && room >= 0 && size > room)
+	{
+		SV_RankInterest (ci, clent);
+		for (k = 0; k < ci->numents; k++)
+		{
+			ie = &ci->ents[k];
+			if (ie->old && ie->bits >= 0 && sv.time - ci->lastsent[ie->num] < ie->interval)
+			{
+				ie->send = false;
+				size -= SV_EntityDeltaSize (ie->bits);
+				commit->deferred++;
+			}
+		}
+		for (k = 0; k < ci->numents && size > room; k++)
+		{
+			ie = ci->order[ci->numents - 1 - k];
+			if (!ie->send || ie->bits < 0 || EDICT_NUM(ie->num) == clent)
+				continue;
+			ie->send = false;
+			size -= SV_EntityDeltaSize (ie->bits);
+			commit->dropped++;
+		}
+	}
+	else if (room < 0)
+		scheduled = false;
+
+// write them in edict order
+	to = &snap->frames[sequence & SNAPSHOT_MASK];
+	to->sequence = 0;
+	to->numentities = 0;
+
+	MSG_WriteByte (msg, svc_snapshot);
+	MSG_WriteLong (msg, sequence);
+	MSG_WriteLong (msg, from ? acked : 0);
+
+	overflowed = false;
+	r = 0;
+	for (k = 0; k < ci->numents; k++)
+	{
+		ie = &ci->ents[k];
+		e = ie->num;
+
+		// the entities before this one have left
+		for ( ; r < numref && from->entities[r].num < e; r++)
+			overflowed = SV_RemoveSnapshotEntity (to, &from->entities[r], msg, overflowed);
+		if (ie->old)
+			r++;
+
+		if (!scheduled && !overflowed && msg->cursize + MAX_SNAPENTITY + 2 > msg->maxsize)
+			overflowed = true;
+		if (overflowed || !ie->send)
+		{
+			if (ie->old)
+				*SV_AddSnapshotEntity (to) = *ie->old;
+			if (overflowed)
+				commit->dropped++;
+			continue;
+		}
+
+		if (ie->old)
+			old = ie->old;
+		else
+		{
+			base.num = e;
+			base.flags = 0;
+			base.lerpfinish = 0;
+			base.state = EDICT_NUM(e)->baseline;
+			old = &base;
+		}
+		SV_WriteEntityDelta (old, &ie->cur, SV_AddSnapshotEntity (to), msg, ie->bits);
+		ie->written = true;
+		commit->sent++;
+	}
+
+	for ( ; r < numref; r++)
+		overflowed = SV_RemoveSnapshotEntity (to, &from->entities[r], msg, overflowed);
+
+	MSG_WriteShort (msg, 0);
+
+	commit->sequence = sequence;
+
+	return !overflowed;
+}
+
+/*
+=============
+SV_CommitSnapshot
+
+Makes the snapshot SV_WriteSnapshot last built for client the one it gets
+=============
+*/
+static void SV_CommitSnapshot (client_t *client, const snapcommit_t *commit)
+{
+	clientsnap_t		*snap = &sv_snapshots[client - svs.clients];
+	clientinterest_t	*ci = SV_ClientInterest (client->edict);
+	int					k;
+
+	snap->frames[commit->sequence & SNAPSHOT_MASK].sequence = commit->sequence;
+	snap->sequence = commit->sequence;
+
+	for (k = 0; k < ci->numents; k++)
+		if (ci->ents[k].written)
+			ci->lastsent[ci->ents[k].num] = sv.time;
+	ci->frames++;
+	ci->sent += commit->sent;
+	ci->deferred += commit->deferred;
+	ci->dropped += commit->dropped;
+}
+
+/*
+=============
+SV_SnapshotDone
+
+The ent->alpha refreshes SV_WriteEntityUpdates would have done
+=============
+*/
+static void SV_SnapshotDone (client_t *client)
+{
+	clientsnap_t	*snap = &sv_snapshots[client - svs.clients];
+	snapframe_t		*frame = &snap->frames[snap->sequence & SNAPSHOT_MASK];
+	snapentity_t	*s;
+	edict_t			*ent;
+	eval_t			*val;
+	int				i;
+
+	if (!pr_alpha_supported)
+		return;
+
+	for (i = 0, s = frame->entities; i < frame->numentities; i++, s++)
+	{
+		if (s->num >= sv.num_edicts)
+			continue;
+		ent = EDICT_NUM(s->num);
+		if (ent->free)
+			continue;
+		val = E_EXTFIELD(ent, alpha);
+		if (val)
+			ent->alpha = ENTALPHA_ENCODE(val->_float);
+	}
+}
+
+/*
+=============
+SV_DropSnapshot
+
+The client's last frame couldn't be sent after all
+=============
+*/
+static void SV_DropSnapshot (client_t *client)
+{
+	clientsnap_t	*snap = &sv_snapshots[client - svs.clients];
+
+	snap->frames[snap->sequence & SNAPSHOT_MASK].sequence = 0;
+}
+
+/*
+=============================================================================
+
+PARALLEL SNAPSHOTS
+
+With sv_sendthreads set, the entity updates of every spawned client are
+built before any datagram goes out, split between the main thread and
+that many worker threads. A worker only reads edicts and writes to its
+client's job, so each job holds the updates as they would be written to an
+empty datagram. Before each overflow check it also records msg->cursize
+and the edict. SV_SendClientDatagram then writes svc_time and the client
+data itself, as before, and SV_SpliceEntityUpdates copies the job's bytes
+up to the first mark that would not have fit after them. That is the same
+point where the serial code stops, so the datagram is the same byte for
+byte. The ent->alpha refreshes that the serial code does on the way are
+replayed from the marks.
+
+Dropping a client runs QC, which can change what everyone else sees, so
+the clients after a drop are built serially. sv_sendverify 1 builds every
+spliced datagram a second time serially and reports any difference.
+
+A delta snapshot doesn't depend on what is in the datagram before it, so
+for a client that gets them the job is just the snapshot. The job leaves
+the client's sequence, send times and counters alone, SV_AppendSnapshot
+commits them only if the job is used. sv_sendverify 1 checks these against
+a serial build too.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	client_t	*client;
+	sizebuf_t	msg;		// entity updates only, as if msg started out empty
+	sendmark_t	*marks;
+	int			nummarks;
+	int			maxmarks;
+	int			snapshot;	// SV_WriteSnapshot's result, for clients that get them
+	snapcommit_t	commit;		// and what to commit if the job is used
+} sendjob_t;
+
+cvar_t	sv_sendthreads = {"sv_sendthreads", "0", CVAR_NONE};
+cvar_t	sv_sendverify = {"sv_sendverify", "0", CVAR_NONE};
+
+static sendjob_t	*sv_sendjobs;		// svs.maxclientslimit, by client number
+static sendjob_t	*sv_sendlist[MAX_SCOREBOARD];
+static int			sv_numsendjobs;
+
+static struct
+{
+	int		frames;
+	int		jobs;
+	int		serial;		// rebuilt serially after a drop
+	int		verified;
+	int		mismatches;
+	double	time;
+} sv_sendstats;
+
+#if defined(USE_SDL2)
+static SDL_Thread	*sv_sendthread[MAX_SEND_THREADS];
+static int			sv_numsendthreads;
+static SDL_sem		*sv_sendstart, *sv_senddone;
+static SDL_atomic_t	sv_sendnext;
+static qboolean		sv_sendquit;
+static qboolean		sv_sendfailed;		// don't try again until sv_sendthreads changes
+#endif
+
+/*
+=============
+SV_DatagramSize
+=============
+*/
+static int SV_DatagramSize (client_t *client)
+{
+	//johnfitz -- if client is nonlocal, use smaller max size so packets aren't fragmented
+	if (Q_strcmp(NET_QSocketGetAddressString(client->netconnection), "LOCAL") != 0)
+		return DATAGRAM_MTU;
+	//johnfitz
+	return MAX_DATAGRAM;
+}
+
+/*
+=============
+SV_BuildSendJob
+
+Runs on any thread
+=============
+*/
+static void SV_BuildSendJob (sendjob_t *job, fatpvs_t *fat)
+{
+	edict_t	*clent = job->client->edict;
+	byte	*pvs;
+
+	pvs = SV_ClientFatPVS (fat, job->client);
+
+	job->msg.cursize = 0;
+	job->nummarks = 0;
+	if (job->client->snapshots)
+	{
+		job->snapshot = SV_WriteSnapshot (job->client, pvs, &job->msg, true, &job->commit);
+		if (job->snapshot < 0)
+			job->nummarks = -1;
+	}
+	else
+		SV_WriteEntityUpdates (clent, pvs, &job->msg, job->marks, &job->nummarks);
+}
+
+#if defined(USE_SDL2)
+/*
+=============
+SV_RunSendJobs
+=============
+*/
+static void SV_RunSendJobs (fatpvs_t *fat)
+{
+	int		i;
+
+	while ((i = SDL_AtomicAdd (&sv_sendnext, 1)) < sv_numsendjobs)
+		SV_BuildSendJob (sv_sendlist[i], fat);
+}
+
+/*
+=============
+SV_SendThread
+=============
+*/
+static int SDLCALL SV_SendThread (void *data)
+{
+	while (1)
+	{
+		SDL_SemWait (sv_sendstart);
+		if (sv_sendquit)
+			break;
+		SV_RunSendJobs ((fatpvs_t *) data);
+		SDL_SemPost (sv_senddone);
+	}
+	return 0;
+}
+
+/*
+=============
+SV_StopSendThreads
+=============
+*/
+static void SV_StopSendThreads (void)
+{
+	int		i;
+
+	if (!sv_numsendthreads)
+		return;
+
+	sv_sendquit = true;
+	for (i = 0; i < sv_numsendthreads; i++)
+		SDL_SemPost (sv_sendstart);
+	for (i = 0; i < sv_numsendthreads; i++)
+		SDL_WaitThread (sv_sendthread[i], NULL);
+	sv_numsendthreads = 0;
+	sv_sendquit = false;
+
+	SDL_DestroySemaphore (sv_sendstart);
+	SDL_DestroySemaphore (sv_senddone);
+	sv_sendstart = sv_senddone = NULL;
+}
+
+/*
+=============
+SV_StartSendThreads
+=============
+*/
+static void SV_StartSendThreads (void)
+{
+	int		i, n;
+
+	n = CLAMP (0, (int)sv_sendthreads.value, MAX_SEND_THREADS);
+	if (!n || sv_sendfailed)
+		return;
+
+	sv_sendstart = SDL_CreateSemaphore (0);
+	sv_senddone = SDL_CreateSemaphore (0);
+	if (!sv_sendstart || !sv_senddone)
+	{
+		Con_Warning ("sv_sendthreads: couldn't create semaphores: %s\n", SDL_GetError ());
+		if (sv_sendstart)
+			SDL_DestroySemaphore (sv_sendstart);
+		if (sv_senddone)
+			SDL_DestroySemaphore (sv_senddone);
+		sv_sendstart = sv_senddone = NULL;
+		sv_sendfailed = true;
+		return;
+	}
+	for (i = 0; i < n; i++)
+	{
+		sv_sendthread[i] = SDL_CreateThread (SV_SendThread, "snapshot", &sv_sendfatpvs[i]);
+		if (!sv_sendthread[i])
+		{
+			Con_Warning ("sv_sendthreads: couldn't create thread: %s\n", SDL_GetError ());
+			sv_sendfailed = true;
+			break;
+		}
+		sv_numsendthreads++;
+	}
+
+	if (!sv_numsendthreads)
+	{
+		SDL_DestroySemaphore (sv_sendstart);
+		SDL_DestroySemaphore (sv_senddone);
+		sv_sendstart = sv_senddone = NULL;
+	}
 }
+#endif
 
 /*
 =============
-SV_CleanupEnts
+SV_SendThreads_f
 
+sv_sendthreads callback, the threads start with the next frame that has
+jobs for them
 =============
 */
-void SV_CleanupEnts (void)
+void SV_SendThreads_f (cvar_t *var)
 {
-	int		e;
-	edict_t	*ent;
+#if defined(USE_SDL2)
+	SV_StopSendThreads ();
+	sv_sendfailed = false;
+#else
+	if (var->value)
+		Con_Printf ("sv_sendthreads: not supported in this build\n");
+#endif
+}
 
-	ent = NEXT_EDICT(sv.edicts);
-	for (e=1 ; e<sv.num_edicts ; e++, ent = NEXT_EDICT(ent))
-	{
-		ent->v.effects = (int)ent->v.effects & ~EF_MUZZLEFLASH;
-	}
+/*
+=============
+SV_Shutdown
+
+Called when the server goes down, and on quitting
+=============
+*/
+void SV_Shutdown (void)
+{
+#if defined(USE_SDL2)
+	SV_StopSendThreads ();
+#endif
 }
 
 /*
-==================
-SV_WriteClientdataToMessage
+=============
+SV_BuildSendJobs
 
-==================
+Returns false if the snapshots are to be built serially
+=============
 */
-void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg)
+static qboolean SV_BuildSendJobs (void)
 {
-	int		bits;
-	int		i;
-	edict_t	*other;
-	int		items;
-	eval_t	*val;
+#if defined(USE_SDL2)
+	sendjob_t	*job;
+	client_t	*client;
+	double		time;
+	int			i;
 
-//
-// send a damage message
-//
-	if (ent->v.dmg_take || ent->v.dmg_save)
-	{
-		other = PROG_TO_EDICT(ent->v.dmg_inflictor);
-		MSG_WriteByte (msg, svc_damage);
-		MSG_WriteByte (msg, ent->v.dmg_save);
-		MSG_WriteByte (msg, ent->v.dmg_take);
-		for (i=0 ; i<3 ; i++)
-			MSG_WriteCoord (msg, other->v.origin[i] + 0.5*(other->v.mins[i] + other->v.maxs[i]), sv.protocolflags );
+	if (!sv_numsendthreads)
+		SV_StartSendThreads ();
+	if (!sv_numsendthreads)
+		return false;
 
-		ent->v.dmg_take = 0;
-		ent->v.dmg_save = 0;
-	}
+	sv_numsendjobs = 0;
+	for (i = 0, client = svs.clients; i < svs.maxclients; i++, client++)
+		if (client->active && client->spawned)
+			sv_numsendjobs++;
+	if (sv_numsendjobs < 2)
+		return false;
 
-//
-// send the current viewpos offset from the view entity
-//
-	SV_SetIdealPitch ();		// how much to look up / down ideally
+	if (!sv_sendjobs)
+	{
+		sv_sendjobs = (sendjob_t *) calloc (svs.maxclientslimit, sizeof(sendjob_t));
+		if (!sv_sendjobs)
+			Sys_Error ("SV_BuildSendJobs: out of memory");
+	}
 
-// a fixangle might get lost in a dropped packet.  Oh well.
-	if ( ent->v.fixangle )
+	sv_numsendjobs = 0;
+	for (i = 0, client = svs.clients; i < svs.maxclients; i++, client++)
 	{
-		MSG_WriteByte (msg, svc_setangle);
-		for (i=0 ; i < 3 ; i++)
-			MSG_WriteAngle (msg, ent->v.angles[i], sv.protocolflags );
-		ent->v.fixangle = 0;
+		if (!client->active || !client->spawned)
+			continue;
+		job = &sv_sendjobs[i];
+		if (!job->msg.data)
+		{
+			job->msg.data = (byte *) malloc (MAX_DATAGRAM);
+			if (!job->msg.data)
+				Sys_Error ("SV_BuildSendJobs: out of memory");
+		}
+		if (job->maxmarks < sv.num_edicts)
+		{
+			job->maxmarks = sv.max_edicts;
+			job->marks = (sendmark_t *) realloc (job->marks, job->maxmarks * sizeof(sendmark_t));
+			if (!job->marks)
+				Sys_Error ("SV_BuildSendJobs: out of memory");
+		}
+		job->client = client;
+		job->msg.maxsize = SV_DatagramSize (client);
+		if (client->snapshots)
+			job->msg.maxsize -= SNAPSHOT_RESERVE;
+		sv_sendlist[sv_numsendjobs++] = job;
 	}
 
-	bits = 0;
+	time = Sys_DoubleTime ();
+	SDL_AtomicSet (&sv_sendnext, 0);
+	for (i = 0; i < sv_numsendthreads; i++)
+		SDL_SemPost (sv_sendstart);
+	SV_RunSendJobs (&sv_fatpvs);
+	for (i = 0; i < sv_numsendthreads; i++)
+		SDL_SemWait (sv_senddone);
 
-	if (ent->v.view_ofs[2] != DEFAULT_VIEWHEIGHT)
-		bits |= SU_VIEWHEIGHT;
+	sv_sendstats.time += Sys_DoubleTime () - time;
+	sv_sendstats.frames++;
+	sv_sendstats.jobs += sv_numsendjobs;
 
-	if (ent->v.idealpitch)
-		bits |= SU_IDEALPITCH;
+	return true;
+#else
+	return false;
+#endif
+}
 
-// stuff the sigil bits into the high bits of items for sbar, or else
-// mix in items2
-	val = GetEdictFieldValue(ent, "items2");
+/*
+=============
+SV_VerifyEntityUpdates
 
-	if (val)
-		items = (int)ent->v.items | ((int)val->_float << 23);
-	else
-		items = (int)ent->v.items | ((int)pr_global_struct->serverflags << 28);
+Writes the entity updates after msg's first start bytes again, the serial
+way, and checks that they come out the same
+=============
+*/
+static void SV_VerifyEntityUpdates (client_t *client, sizebuf_t *msg, int start)
+{
+	static byte	buf[MAX_DATAGRAM];
+	sizebuf_t	check;
+	vec3_t		org;
+	byte		*pvs;
+	clientinterest_t	*ci;
+	int			i, stats[3];
+
+	memset (&check, 0, sizeof(check));
+	check.data = buf;
+	check.maxsize = msg->maxsize;
+	check.cursize = start;
+	memcpy (buf, msg->data, start);
+
+	VectorAdd (client->edict->v.origin, client->edict->v.view_ofs, org);
+	pvs = SV_FatPVS (org, sv.worldmodel);
+	ci = SV_ClientInterest (client->edict);
+	stats[0] = ci->frames;
+	stats[1] = ci->sent;
+	stats[2] = ci->dropped;
+	SV_WriteEntityUpdates (client->edict, pvs, &check, NULL, NULL);
+	ci->frames = stats[0];
+	ci->sent = stats[1];
+	ci->dropped = stats[2];
+
+	sv_sendstats.verified++;
+	if (check.cursize == msg->cursize && !memcmp (check.data + start, msg->data + start, msg->cursize - start))
+		return;
 
-	bits |= SU_ITEMS;
+	for (i = start; i < q_min (check.cursize, msg->cursize); i++)
+		if (check.data[i] != msg->data[i])
+			break;
+	sv_sendstats.mismatches++;
+	Con_Printf ("sv_sendverify: %s's datagram differs at byte %i (%i bytes, %i serially)\n",
+		client->name, i, msg->cursize, check.cursize);
+}
 
-	if ( (int)ent->v.flags & FL_ONGROUND)
-		bits |= SU_ONGROUND;
+/*
+=============
+SV_SpliceEntityUpdates
 
-	if ( ent->v.waterlevel >= 2)
-		bits |= SU_INWATER;
+Appends a job's entity updates to msg, up to where the serial code would
+have run out of room
+=============
+*/
+static void SV_SpliceEntityUpdates (sendjob_t *job, sizebuf_t *msg)
+{
+	sendmark_t	*mark;
+	edict_t		*ent;
+	eval_t		*val;
+	clientinterest_t	*ci;
+	int			i, j, start, end;
 
-	for (i=0 ; i<3 ; i++)
+	start = msg->cursize;
+	end = job->msg.cursize;
+	for (i = 0, mark = job->marks; i < job->nummarks; i++, mark++)
 	{
-		if (ent->v.punchangle[i])
-			bits |= (SU_PUNCH1<<i);
-		if (ent->v.velocity[i])
-			bits |= (SU_VELOCITY1<<i);
+		if (start + mark->cursize + 39 > msg->maxsize)
+		{
+			end = mark->cursize;
+			break;
+		}
 	}
+	SZ_Write (msg, job->msg.data, end);
 
-	if (ent->v.weaponframe)
-		bits |= SU_WEAPONFRAME;
-
-	if (ent->v.armorvalue)
-		bits |= SU_ARMOR;
-
-//	if (ent->v.weapon)
-	  bits |= SU_WEAPON;
-
-	//johnfitz -- PROTOCOL_FITZQUAKE
-	if (sv.protocol != PROTOCOL_NETQUAKE)
+	// the alpha refreshes the serial code would have done
+	if (pr_alpha_supported)
 	{
-		if (bits & SU_WEAPON && SV_ModelIndex(PR_GetString(ent->v.weaponmodel)) & 0xFF00) bits |= SU_WEAPON2;
-		if ((int)ent->v.armorvalue & 0xFF00) bits |= SU_ARMOR2;
-		if ((int)ent->v.currentammo & 0xFF00) bits |= SU_AMMO2;
-		if ((int)ent->v.ammo_shells & 0xFF00) bits |= SU_SHELLS2;
-		if ((int)ent->v.ammo_nails & 0xFF00) bits |= SU_NAILS2;
-		if ((int)ent->v.ammo_rockets & 0xFF00) bits |= SU_ROCKETS2;
-		if ((int)ent->v.ammo_cells & 0xFF00) bits |= SU_CELLS2;
-		if (bits & SU_WEAPONFRAME && (int)ent->v.weaponframe & 0xFF00) bits |= SU_WEAPONFRAME2;
-		if (bits & SU_WEAPON && ent->alpha != ENTALPHA_DEFAULT) bits |= SU_WEAPONALPHA; //for now, weaponalpha = client entity alpha
-		if (bits >= 65536) bits |= SU_EXTEND1;
-		if (bits >= 16777216) bits |= SU_EXTEND2;
+		for (j = 0, mark = job->marks; j < i; j++, mark++)
+		{
+			ent = EDICT_NUM(mark->num);
+			val = E_EXTFIELD(ent, alpha);
+			if (val)
+				ent->alpha = ENTALPHA_ENCODE(val->_float);
+		}
 	}
-	//johnfitz
 
-// send the data
+	if (sv_sendverify.value)
+		SV_VerifyEntityUpdates (job->client, msg, start);
 
-	MSG_WriteByte (msg, svc_clientdata);
-	MSG_WriteShort (msg, bits);
+	// and the send times, which the job's ranking was based on
+	ci = SV_ClientInterest (job->client->edict);
+	for (j = 0, mark = job->marks; j < i; j++, mark++)
+		ci->lastsent[mark->num] = sv.time;
+	ci->frames++;
+	ci->sent += i;
+	if (i < job->nummarks)
+		ci->dropped += ci->numents - i;
 
-	//johnfitz -- PROTOCOL_FITZQUAKE
-	if (bits & SU_EXTEND1) MSG_WriteByte(msg, bits>>16);
-	if (bits & SU_EXTEND2) MSG_WriteByte(msg, bits>>24);
-	//johnfitz
+	SV_EntityUpdatesDone (msg, i < job->nummarks);
+}
 
-	if (bits & SU_VIEWHEIGHT)
-		MSG_WriteChar (msg, ent->v.view_ofs[2]);
+/*
+=============
+SV_SendStats_f
+=============
+*/
+void SV_SendStats_f (void)
+{
+#if defined(USE_SDL2)
+	Con_Printf ("%i send threads\n", sv_numsendthreads);
+#else
+	Con_Printf ("send threads not supported in this build\n");
+#endif
+	Con_Printf ("%i frames built in parallel, %i snapshots, %.3f ms per frame\n", sv_sendstats.frames,
+		sv_sendstats.jobs, sv_sendstats.frames ? sv_sendstats.time * 1000.0 / sv_sendstats.frames : 0.0);
+	Con_Printf ("%i snapshots rebuilt serially after a client was dropped\n", sv_sendstats.serial);
+	Con_Printf ("%i snapshots verified, %i differed\n", sv_sendstats.verified, sv_sendstats.mismatches);
+	memset (&sv_sendstats, 0, sizeof(sv_sendstats));
+}
 
-	if (bits & SU_IDEALPITCH)
-		MSG_WriteChar (msg, ent->v.idealpitch);
+/*
+=============
+SV_FatPVSStats_f
 
-	for (i=0 ; i<3 ; i++)
+The time saved is what the cache hits would have cost as misses, so it
+doesn't count what the row LRU and the SIMD merge save on the misses
+themselves; compare the uncached time with sv_fatpvscache 0 for that.
+=============
+*/
+void SV_FatPVSStats_f (void)
+{
+	fatpvsstats_t	total, *stats;
+	int				i, n, lookups, rows;
+	double			missavg;
+
+	memset (&total, 0, sizeof(total));
+	n = MAX_SEND_THREADS + 1;
+	for (i = 0; i < n; i++)
 	{
-		if (bits & (SU_PUNCH1<<i))
-			MSG_WriteChar (msg, ent->v.punchangle[i]);
-		if (bits & (SU_VELOCITY1<<i))
-			MSG_WriteChar (msg, ent->v.velocity[i]/16);
+		stats = i ? &sv_sendfatpvs[i - 1].stats : &sv_fatpvs.stats;
+		total.hits += stats->hits;
+		total.misses += stats->misses;
+		total.uncached += stats->uncached;
+		total.rowhits += stats->rowhits;
+		total.rowmisses += stats->rowmisses;
+		total.hittime += stats->hittime;
+		total.misstime += stats->misstime;
+		total.uncachedtime += stats->uncachedtime;
+		memset (stats, 0, sizeof(*stats));
 	}
 
-// [always sent]	if (bits & SU_ITEMS)
-	MSG_WriteLong (msg, items);
+	lookups = total.hits + total.misses;
+	rows = total.rowhits + total.rowmisses;
+	missavg = total.misses ? total.misstime / total.misses : 0.0;
+
+	Con_Printf ("%i frames, %i client fat PVS lookups, %.1f%% hits\n", sv_fatframes,
+		lookups, lookups ? total.hits * 100.0 / lookups : 0.0);
+	Con_Printf ("%.2f us per hit, %.2f us per miss, %i uncached at %.2f us\n",
+		total.hits ? total.hittime * 1e6 / total.hits : 0.0, missavg * 1e6,
+		total.uncached, total.uncached ? total.uncachedtime * 1e6 / total.uncached : 0.0);
+	Con_Printf ("%i rows, %.1f%% from the row cache\n", rows, rows ? total.rowhits * 100.0 / rows : 0.0);
+	Con_Printf ("%.3f ms saved per frame\n", sv_fatframes ?
+		(total.hits * missavg - total.hittime) * 1000.0 / sv_fatframes : 0.0);
+	sv_fatframes = 0;
+}
 
-	if (bits & SU_WEAPONFRAME)
-		MSG_WriteByte (msg, ent->v.weaponframe);
-	if (bits & SU_ARMOR)
-		MSG_WriteByte (msg, ent->v.armorvalue);
-	if (bits & SU_WEAPON)
-		MSG_WriteByte (msg, SV_ModelIndex(PR_GetString(ent->v.weaponmodel)));
+/*
+=============
+SV_VerifySnapshot
 
-	MSG_WriteShort (msg, ent->v.health);
-	MSG_WriteByte (msg, ent->v.currentammo);
-	MSG_WriteByte (msg, ent->v.ammo_shells);
-	MSG_WriteByte (msg, ent->v.ammo_nails);
-	MSG_WriteByte (msg, ent->v.ammo_rockets);
-	MSG_WriteByte (msg, ent->v.ammo_cells);
+Compares a snapshot built on a send thread with the serial one
+=============
+*/
+static void SV_VerifySnapshot (client_t *client, const sizebuf_t *built, const sizebuf_t *serial)
+{
+	int		i;
 
-	if (standard_quake)
+	sv_sendstats.verified++;
+	if (built->cursize == serial->cursize && !memcmp (built->data, serial->data, serial->cursize))
+		return;
+
+	for (i = 0; i < q_min (built->cursize, serial->cursize); i++)
+		if (built->data[i] != serial->data[i])
+			break;
+	sv_sendstats.mismatches++;
+	Con_Printf ("sv_sendverify: %s's snapshot differs at byte %i (%i bytes, %i serially)\n",
+		client->name, i, built->cursize, serial->cursize);
+}
+
+/*
+=============
+SV_AppendSnapshot
+
+Writes the client's snapshot to msg, building it here unless job has it.
+It is always built in a buffer SNAPSHOT_RESERVE bytes short of a datagram,
+so it comes out the same either way. With sv_sendverify set the job's is
+only compared, the serial one is what gets sent.
+=============
+*/
+static void SV_AppendSnapshot (client_t *client, sendjob_t *job, sizebuf_t *msg)
+{
+	byte		buf[MAX_DATAGRAM];
+	sizebuf_t	snapmsg;
+	snapcommit_t	commit;
+	byte		*pvs;
+	int			result;
+
+	if (job && job->nummarks >= 0 && !sv_sendverify.value)
 	{
-		MSG_WriteByte (msg, ent->v.weapon);
+		snapmsg = job->msg;
+		result = job->snapshot;
+		commit = job->commit;
 	}
 	else
 	{
-		for(i=0;i<32;i++)
-		{
-			if ( ((int)ent->v.weapon) & (1<<i) )
-			{
-				MSG_WriteByte (msg, i);
-				break;
-			}
-		}
+		memset (&snapmsg, 0, sizeof(snapmsg));
+		snapmsg.data = buf;
+		snapmsg.maxsize = SV_DatagramSize (client) - SNAPSHOT_RESERVE;
+
+		pvs = SV_ClientFatPVS (&sv_fatpvs, client);
+		result = SV_WriteSnapshot (client, pvs, &snapmsg, false, &commit);
+		if (job && job->nummarks >= 0)
+			SV_VerifySnapshot (client, &job->msg, &snapmsg);
 	}
+	SV_CommitSnapshot (client, &commit);
 
-	//johnfitz -- PROTOCOL_FITZQUAKE
-	if (bits & SU_WEAPON2)
-		MSG_WriteByte (msg, SV_ModelIndex(PR_GetString(ent->v.weaponmodel)) >> 8);
-	if (bits & SU_ARMOR2)
-		MSG_WriteByte (msg, (int)ent->v.armorvalue >> 8);
-	if (bits & SU_AMMO2)
-		MSG_WriteByte (msg, (int)ent->v.currentammo >> 8);
-	if (bits & SU_SHELLS2)
-		MSG_WriteByte (msg, (int)ent->v.ammo_shells >> 8);
-	if (bits & SU_NAILS2)
-		MSG_WriteByte (msg, (int)ent->v.ammo_nails >> 8);
-	if (bits & SU_ROCKETS2)
-		MSG_WriteByte (msg, (int)ent->v.ammo_rockets >> 8);
-	if (bits & SU_CELLS2)
-		MSG_WriteByte (msg, (int)ent->v.ammo_cells >> 8);
-	if (bits & SU_WEAPONFRAME2)
-		MSG_WriteByte (msg, (int)ent->v.weaponframe >> 8);
-	if (bits & SU_WEAPONALPHA)
-		MSG_WriteByte (msg, ent->alpha); //for now, weaponalpha = client entity alpha
-	//johnfitz
+	if (msg->cursize + snapmsg.cursize > msg->maxsize)
+	{
+		SV_DropSnapshot (client);
+		result = 0;
+	}
+	else
+		SZ_Write (msg, snapmsg.data, snapmsg.cursize);
+
+	SV_SnapshotDone (client);
+	SV_EntityUpdatesDone (msg, !result);
 }
 
 /*
 =======================
 SV_SendClientDatagram
+
+job has the entity updates if they have been built in parallel
 =======================
 */
-qboolean SV_SendClientDatagram (client_t *client)
+static qboolean SV_SendClientDatagram (client_t *client, sendjob_t *job)
 {
 	byte		buf[MAX_DATAGRAM];
 	sizebuf_t	msg;
 
-	msg.data = buf;
-	msg.maxsize = sizeof(buf);
+	// the local client's can go over without a copy
+	if (!NET_GetSendBuffer (client->netconnection, &msg))
+		msg.data = buf;
+	msg.maxsize = SV_DatagramSize (client);
 	msg.cursize = 0;
 
-	//johnfitz -- if client is nonlocal, use smaller max size so packets aren't fragmented
-	if (Q_strcmp(NET_QSocketGetAddressString(client->netconnection), "LOCAL") != 0)
-		msg.maxsize = DATAGRAM_MTU;
-	//johnfitz
-
 	MSG_WriteByte (&msg, svc_time);
 	MSG_WriteFloat (&msg, sv.time);
 
 // add the client specific data to the datagram
 	SV_WriteClientdataToMessage (client->edict, &msg);
 
-	SV_WriteEntitiesToClient (client->edict, &msg);
+	if (client->snapshots)
+		SV_AppendSnapshot (client, job, &msg);
+	else if (job && job->nummarks >= 0)
+		SV_SpliceEntityUpdates (job, &msg);
+	else
+		SV_WriteEntitiesToClient (client->edict, &msg);
 
 // copy the server datagram if there is space
 	if (msg.cursize + sv.datagram.cursize < msg.maxsize)
@@ -1105,20 +3238,34 @@ SV_SendClientMessages
 */
 void SV_SendClientMessages (void)
 {
-	int			i;
+	int			i, connections;
+	qboolean	parallel, built;
 
 // update frags, names, etc
 	SV_UpdateToReliableMessages ();
+	sv_fatframes++;
 
-// build individual updates
+// build the entity updates on the send threads
+	parallel = built = SV_BuildSendJobs ();
+	connections = net_activeconnections;
+
+// build individual updates, the datagrams go out together at the end
+	NET_BatchSends (true);
 	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
 	{
+		// once a client has been dropped (and ClientDisconnect has run)
+		// the rest are built from the edicts as they are now
+		if (net_activeconnections != connections)
+			parallel = false;
+
 		if (!host_client->active)
 			continue;
 
 		if (host_client->spawned)
 		{
-			if (!SV_SendClientDatagram (host_client))
+			if (built && !parallel)
+				sv_sendstats.serial++;
+			if (!SV_SendClientDatagram (host_client, parallel ? &sv_sendjobs[i] : NULL))
 				continue;
 		}
 		else
@@ -1146,7 +3293,7 @@ void SV_SendClientMessages (void)
 			continue;
 		}
 
-		if (host_client->message.cursize || host_client->dropasap)
+		if (host_client->message.cursize || host_client->signon || host_client->dropasap)
 		{
 			if (!NET_CanSendMessage (host_client->netconnection))
 			{
@@ -1156,6 +3303,14 @@ void SV_SendClientMessages (void)
 
 			if (host_client->dropasap)
 				SV_DropClient (false);	// went to another level
+			else if (host_client->signon)
+			{
+				if (SV_SendSignon (host_client) == -1)
+					SV_DropClient (true);
+				host_client->last_message = realtime;
+				if (!host_client->signon && !host_client->message.cursize)
+					host_client->sendsignon = false;
+			}
 			else
 			{
 				if (NET_SendMessage (host_client->netconnection
@@ -1167,7 +3322,7 @@ void SV_SendClientMessages (void)
 			}
 		}
 	}
-
+	NET_BatchSends (false);
 
 // clear muzzle flashes
 	SV_CleanupEnts ();
@@ -1409,6 +3564,7 @@ void SV_SpawnServer (const char *server)
 //
 	//memset (&sv, 0, sizeof(sv));
 	Host_ClearMemory ();
+	SV_ResetSignon ();
 
 	q_strlcpy (sv.name, server, sizeof(sv.name));
 
@@ -1472,6 +3628,8 @@ void SV_SpawnServer (const char *server)
 // clear world interaction links
 //
 	SV_ClearWorld ();
+	SV_InitThinkQueue ();
+	SV_ClearFatPVSCache ();
 
 	sv.sound_precache[0] = dummy;
 	sv.model_precache[0] = dummy;
@@ -284,6 +284,7 @@ int SV_FlyMove (edict_t *ent, float time, trace_t *steptrace)
 		{	// actually covered some distance
 			VectorCopy (trace.endpos, ent->v.origin);
 			VectorCopy (ent->v.velocity, original_velocity);
+			SV_RadiusGridDirty (ent);	// touch functions may run before the relink
 			numplanes = 0;
 		}
 
@@ -388,7 +389,7 @@ void SV_AddGravity (edict_t *ent)
 	float	ent_gravity;
 	eval_t	*val;
 
-	val = GetEdictFieldValue(ent, "gravity");
+	val = E_EXTFIELD(ent, gravity);
 	if (val && val->_float)
 		ent_gravity = val->_float;
 	else
@@ -438,6 +439,12 @@ trace_t SV_PushEntity (edict_t *ent, vec3_t push)
 }
 
 
+// SV_PushMove's lists of what it moved, not hunk memory: with
+// host_serverthread the main thread can be using the cache meanwhile
+static edict_t	**sv_pushededicts;
+static vec3_t	*sv_pushedfrom;
+static int		sv_pushedmax;
+
 /*
 ============
 SV_PushMove
@@ -452,7 +459,6 @@ void SV_PushMove (edict_t *pusher, float movetime)
 	int			num_moved;
 	edict_t		**moved_edict; //johnfitz -- dynamically allocate
 	vec3_t		*moved_from; //johnfitz -- dynamically allocate
-	int			mark; //johnfitz
 
 	if (!pusher->v.velocity[0] && !pusher->v.velocity[1] && !pusher->v.velocity[2])
 	{
@@ -476,9 +482,16 @@ void SV_PushMove (edict_t *pusher, float movetime)
 	SV_LinkEdict (pusher, false);
 
 	//johnfitz -- dynamically allocate
-	mark = Hunk_LowMark ();
-	moved_edict = (edict_t **) Hunk_Alloc (sv.num_edicts*sizeof(edict_t *));
-	moved_from = (vec3_t *) Hunk_Alloc (sv.num_edicts*sizeof(vec3_t));
+	if (sv_pushedmax < sv.num_edicts)
+	{
+		sv_pushedmax = sv.max_edicts;
+		sv_pushededicts = (edict_t **) realloc (sv_pushededicts, sv_pushedmax * sizeof(edict_t *));
+		sv_pushedfrom = (vec3_t *) realloc (sv_pushedfrom, sv_pushedmax * sizeof(vec3_t));
+		if (!sv_pushededicts || !sv_pushedfrom)
+			Sys_Error ("SV_PushMove: out of memory");
+	}
+	moved_edict = sv_pushededicts;
+	moved_from = sv_pushedfrom;
 	//johnfitz
 
 // see if any solid entities are inside the final position
@@ -512,7 +525,10 @@ void SV_PushMove (edict_t *pusher, float movetime)
 
 	// remove the onground flag for non-players
 		if (check->v.movetype != MOVETYPE_WALK)
+		{
 			check->v.flags = (int)check->v.flags & ~FL_ONGROUND;
+			SV_ScheduleThink (check);
+		}
 
 		VectorCopy (check->v.origin, entorig);
 		VectorCopy (check->v.origin, moved_from[num_moved]);
@@ -534,6 +550,7 @@ void SV_PushMove (edict_t *pusher, float movetime)
 			{	// corpse
 				check->v.mins[0] = check->v.mins[1] = 0;
 				VectorCopy (check->v.mins, check->v.maxs);
+				SV_RadiusGridDirty (check);
 				continue;
 			}
 
@@ -559,13 +576,9 @@ void SV_PushMove (edict_t *pusher, float movetime)
 				VectorCopy (moved_from[i], moved_edict[i]->v.origin);
 				SV_LinkEdict (moved_edict[i], false);
 			}
-			Hunk_FreeToLowMark (mark); //johnfitz
 			return;
 		}
 	}
-
-	Hunk_FreeToLowMark (mark); //johnfitz
-
 }
 
 /*
@@ -787,6 +800,7 @@ int SV_TryUnstick (edict_t *ent, vec3_t oldvel)
 
 // go back to the original pos and try again
 		VectorCopy (oldorg, ent->v.origin);
+		SV_RadiusGridDirty (ent);
 	}
 
 	VectorCopy (vec3_origin, ent->v.velocity);
@@ -891,6 +905,7 @@ void SV_WalkMove (edict_t *ent)
 // cause the player to hop up higher on a slope too steep to climb
 		VectorCopy (nosteporg, ent->v.origin);
 		VectorCopy (nostepvel, ent->v.velocity);
+		SV_RadiusGridDirty (ent);
 	}
 }
 
@@ -1163,6 +1178,282 @@ void SV_Physics_Step (edict_t *ent)
 }
 
 
+/*
+===============================================================================
+
+THINK SCHEDULER
+
+Most edicts on a map are MOVETYPE_NONE, or tossed objects lying on the
+ground, and all SV_Physics does for them is call SV_RunThink, which returns
+at once unless nextthink is due. Such edicts are idle: they keep a timer in
+a heap ordered by nextthink and are only visited once it is due. Everything
+else has its bit set in sv_thinkbits and is visited every frame. The frame
+loop still walks edicts in ascending order, it just skips clear bits, so
+think order is unchanged.
+
+Whatever could make an idle edict do something sets its bit again: QC
+stores to nextthink, movetype or flags (FIELDWATCH_THINK), OP_STATE, a
+pusher lifting it off the ground, and an edict being allocated or parsed.
+A visited edict is classified again afterwards. Stale timers only cause a
+harmless extra visit.
+
+===============================================================================
+*/
+
+typedef struct
+{
+	float	time;
+	int		num;
+} thinktimer_t;
+
+static unsigned		*sv_thinkbits;		// edicts to visit on the next frame
+static float		*sv_thinkqueued;	// nextthink each edict's timer was queued with
+static edict_t		*sv_thinkedicts;	// sv.edicts the above were set up for
+static int			sv_thinkmaxedicts;
+static thinktimer_t	*sv_thinkheap;
+static int			sv_thinkheapsize;
+static int			sv_thinkheapmax;
+
+static int			sv_thinkframes;
+static double		sv_thinkvisited;
+static double		sv_thinkskipped;
+static double		sv_thinkfired;
+
+cvar_t	sv_thinkqueue = {"sv_thinkqueue","1",CVAR_NONE};
+
+#define THINK_VALID()	(sv_thinkbits && sv_thinkedicts == sv.edicts)
+
+/*
+================
+SV_InitThinkQueue
+
+Called for each new map, after the edicts have been allocated
+================
+*/
+void SV_InitThinkQueue (void)
+{
+	int		words;
+
+	words = (sv.max_edicts + 31) >> 5;
+	sv_thinkbits = (unsigned *) Hunk_AllocName (words * sizeof(unsigned), "thinkq");
+	sv_thinkqueued = (float *) Hunk_AllocName (sv.max_edicts * sizeof(float), "thinkq");
+	sv_thinkedicts = sv.edicts;
+	sv_thinkmaxedicts = sv.max_edicts;
+	SV_ResetThinkQueue ();
+}
+
+/*
+================
+SV_ResetThinkQueue
+
+Forgets all timers and visits every edict on the next frame, for when the
+edicts changed behind the queue's back
+================
+*/
+void SV_ResetThinkQueue (void)
+{
+	if (!THINK_VALID ())
+		return;
+	memset (sv_thinkbits, 0xff, ((sv_thinkmaxedicts + 31) >> 5) * sizeof(unsigned));
+	memset (sv_thinkqueued, 0, sv_thinkmaxedicts * sizeof(float));
+	sv_thinkheapsize = 0;
+}
+
+/*
+================
+SV_ScheduleThink
+
+ent may no longer be idle, visit it on the next frame it can be reached
+================
+*/
+void SV_ScheduleThink (edict_t *ent)
+{
+	int		num;
+
+	if (!THINK_VALID ())
+		return;
+	num = NUM_FOR_EDICT (ent);
+	if (num < sv_thinkmaxedicts)
+		sv_thinkbits[num >> 5] |= 1u << (num & 31);
+}
+
+/*
+================
+SV_PushThinkTimer
+================
+*/
+static void SV_PushThinkTimer (float time, int num)
+{
+	thinktimer_t	t;
+	int				i, parent;
+
+	if (sv_thinkheapsize == sv_thinkheapmax)
+	{
+		sv_thinkheapmax = sv_thinkheapmax ? sv_thinkheapmax * 2 : 1024;
+		sv_thinkheap = (thinktimer_t *) realloc (sv_thinkheap, sv_thinkheapmax * sizeof(*sv_thinkheap));
+		if (!sv_thinkheap)
+			Sys_Error ("SV_PushThinkTimer: out of memory");
+	}
+
+	t.time = time;
+	t.num = num;
+	for (i = sv_thinkheapsize++; i > 0; i = parent)
+	{
+		parent = (i - 1) >> 1;
+		if (sv_thinkheap[parent].time <= t.time)
+			break;
+		sv_thinkheap[i] = sv_thinkheap[parent];
+	}
+	sv_thinkheap[i] = t;
+}
+
+/*
+================
+SV_PopThinkTimer
+================
+*/
+static thinktimer_t SV_PopThinkTimer (void)
+{
+	thinktimer_t	top, last;
+	int				i, child;
+
+	top = sv_thinkheap[0];
+	last = sv_thinkheap[--sv_thinkheapsize];
+	for (i = 0; (child = i * 2 + 1) < sv_thinkheapsize; i = child)
+	{
+		if (child + 1 < sv_thinkheapsize && sv_thinkheap[child + 1].time < sv_thinkheap[child].time)
+			child++;
+		if (last.time <= sv_thinkheap[child].time)
+			break;
+		sv_thinkheap[i] = sv_thinkheap[child];
+	}
+	sv_thinkheap[i] = last;
+
+	return top;
+}
+
+/*
+================
+SV_FireThinkTimers
+
+Sets the bits of idle edicts whose nextthink is due this frame, using the
+same test as SV_RunThink
+================
+*/
+static void SV_FireThinkTimers (void)
+{
+	thinktimer_t	t;
+
+	while (sv_thinkheapsize && !(sv_thinkheap[0].time > sv.time + host_frametime))
+	{
+		t = SV_PopThinkTimer ();
+		if (sv_thinkqueued[t.num] == t.time)
+			sv_thinkqueued[t.num] = 0;
+		sv_thinkbits[t.num >> 5] |= 1u << (t.num & 31);
+		sv_thinkfired++;
+	}
+}
+
+/*
+================
+SV_ClassifyThink
+
+Called after ent has been run. Clears its bit if it will have nothing to do
+until its nextthink, mirroring the movetype dispatch in SV_Physics.
+================
+*/
+static void SV_ClassifyThink (edict_t *ent, int num)
+{
+	float	thinktime;
+
+	if (ent->free)
+	{
+		sv_thinkbits[num >> 5] &= ~(1u << (num & 31));
+		return;
+	}
+	if (num <= svs.maxclients)
+		return;	// clients and the world (a pusher)
+	if (ent->v.movetype == MOVETYPE_NONE)
+		;
+	else if (ent->v.movetype == MOVETYPE_TOSS
+	|| ent->v.movetype == MOVETYPE_GIB
+	|| ent->v.movetype == MOVETYPE_BOUNCE
+	|| ent->v.movetype == MOVETYPE_FLY
+	|| ent->v.movetype == MOVETYPE_FLYMISSILE)
+	{
+		if (!((int)ent->v.flags & FL_ONGROUND))
+			return;
+	}
+	else
+		return;
+
+	thinktime = ent->v.nextthink;
+	if (thinktime != thinktime)
+		return;	// NaN is never skipped by SV_RunThink
+	if (thinktime > 0 && sv_thinkqueued[num] != thinktime)
+	{
+		SV_PushThinkTimer (thinktime, num);
+		sv_thinkqueued[num] = thinktime;
+	}
+	sv_thinkbits[num >> 5] &= ~(1u << (num & 31));
+}
+
+/*
+================
+SV_NextThinkEdict
+
+Returns the first edict at or after i that has to be visited, or cap
+================
+*/
+static int SV_NextThinkEdict (int i, int cap)
+{
+	unsigned	bits;
+
+	while (i < cap)
+	{
+		bits = sv_thinkbits[i >> 5] >> (i & 31);
+		if (bits)
+		{
+			while (!(bits & 1))
+			{
+				bits >>= 1;
+				i++;
+			}
+			return i;
+		}
+		i = (i | 31) + 1;
+	}
+	return cap;
+}
+
+/*
+================
+SV_ThinkStats_f
+
+Prints how many edicts the frame loop visited and skipped since the last call
+================
+*/
+void SV_ThinkStats_f (void)
+{
+	double	total;
+
+	if (!sv.active)
+	{
+		Con_Printf ("sv_thinkstats: no map running\n");
+		return;
+	}
+
+	total = sv_thinkvisited + sv_thinkskipped;
+	Con_Printf ("%i frames: %.0f edicts visited, %.0f skipped (%.1f%%), %.0f timers fired\n",
+		sv_thinkframes, sv_thinkvisited, sv_thinkskipped,
+		total > 0 ? sv_thinkskipped * 100.0 / total : 0.0, sv_thinkfired);
+	Con_Printf ("%.1f visited per frame, %i timers queued\n",
+		sv_thinkframes ? sv_thinkvisited / sv_thinkframes : 0.0, sv_thinkheapsize);
+
+	sv_thinkframes = 0;
+	sv_thinkvisited = sv_thinkskipped = sv_thinkfired = 0;
+}
+
 //============================================================================
 
 /*
@@ -1176,6 +1467,8 @@ void SV_Physics (void)
 	int	i;
 	int	entity_cap; // For sv_freezenonclients 
 	edict_t	*ent;
+	int	visited;
+	qboolean	scheduled, skip;
 
 // let the progs know that a new frame has started
 	pr_global_struct->self = EDICT_TO_PROG(sv.edicts);
@@ -1188,18 +1481,35 @@ void SV_Physics (void)
 //
 // treat each object in turn
 //
-	ent = sv.edicts;
 
 	if (sv_freezenonclients.value)
 	  entity_cap = svs.maxclients + 1; // Only run physics on clients and the world
 	else
 	  entity_cap = sv.num_edicts;
 
+	scheduled = THINK_VALID ();
+	if (scheduled)
+		SV_FireThinkTimers ();
+	skip = scheduled && sv_thinkqueue.value && !pr_global_struct->force_retouch;
+	visited = 0;
+
 	//for (i=0 ; i<sv.num_edicts ; i++, ent = NEXT_EDICT(ent))
-	for (i=0 ; i<entity_cap ; i++, ent = NEXT_EDICT(ent))
+	for (i=0 ; i<entity_cap ; i++)
 	{
+		if (skip)
+		{
+			i = SV_NextThinkEdict (i, entity_cap);
+			if (i == entity_cap)
+				break;
+		}
+		ent = EDICT_NUM(i);
 		if (ent->free)
+		{
+			if (scheduled)
+				SV_ClassifyThink (ent, i);
 			continue;
+		}
+		visited++;
 
 		if (pr_global_struct->force_retouch)
 		{
@@ -1224,8 +1534,15 @@ void SV_Physics (void)
 			SV_Physics_Toss (ent);
 		else
 			Sys_Error ("SV_Physics: bad movetype %i", (int)ent->v.movetype);
+
+		if (scheduled)
+			SV_ClassifyThink (ent, i);
 	}
 
+	sv_thinkframes++;
+	sv_thinkvisited += visited;
+	sv_thinkskipped += entity_cap - visited;
+
 	if (pr_global_struct->force_retouch)
 		pr_global_struct->force_retouch--;
 
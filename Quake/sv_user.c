@@ -560,6 +560,8 @@ nextmsg:
 					ret = 1;
 				else if (q_strncasecmp(s, "prespawn", 8) == 0)
 					ret = 1;
+				else if (q_strncasecmp(s, "snapshots", 9) == 0)
+					ret = 1;
 				else if (q_strncasecmp(s, "kick", 4) == 0)
 					ret = 1;
 				else if (q_strncasecmp(s, "ping", 4) == 0)
@@ -582,6 +584,10 @@ nextmsg:
 			case clc_move:
 				SV_ReadClientMove (&host_client->cmd);
 				break;
+
+			case clc_ackframe:
+				host_client->snapshot_acked = MSG_ReadLong ();
+				break;
 			}
 		}
 	} while (ret == 1);
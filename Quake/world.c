@@ -178,306 +178,1368 @@ hull_t *SV_HullForEntity (edict_t *ent, vec3_t mins, vec3_t maxs, vec3_t offset)
 /*
 ===============================================================================
 
-ENTITY AREA CHECKING
+FINDRADIUS GRID
+
+Every non-free edict is kept in a 2D hash of its bbox center, bucketed by
+RGRID_CELLSIZE columns, so findradius only has to test the buckets under the
+search sphere. QC and the engine can change origin, mins and maxs without
+relinking, so anything that may have moved since its last SV_LinkEdict is
+put on the dirty list instead, which every query tests in full. The exact
+same distance test as the linear scan is applied to every candidate, and
+the chain is built in the same edict order.
 
 ===============================================================================
 */
 
-typedef struct areanode_s
+#define	RGRID_CELLSIZE	256
+#define	RGRID_BUCKETS	4096			// power of two
+#define	RGRID_DIRTY		RGRID_BUCKETS	// always tested
+#define	RGRID_NONE		-1
+#define	RGRID_RANGE		1048576.f		// centers further out stay on the dirty list
+
+typedef struct
 {
-	int		axis;		// -1 = leaf node
-	float	dist;
-	struct areanode_s	*children[2];
-	link_t	trigger_edicts;
-	link_t	solid_edicts;
-} areanode_t;
+	edict_t	*edicts;	// sv.edicts the grid was built for
+	int		*bucket;	// per edict: list it is on, or RGRID_NONE
+	int		*next;
+	int		*prev;
+	int		*matches;
+	int		maxedicts;
+	int		heads[RGRID_BUCKETS + 1];
+	int		visited[RGRID_BUCKETS];
+	int		visitframe;
+} radiusgrid_t;
 
-#define	AREA_DEPTH	7
-#define	AREA_NODES	(2<<AREA_DEPTH)
+static radiusgrid_t	sv_rgrid;
 
-static	areanode_t	sv_areanodes[AREA_NODES];
-static	int			sv_numareanodes;
+#define	RGRID_VALID()	(sv_rgrid.edicts && sv_rgrid.edicts == sv.edicts)
+
+cvar_t	sv_findradius_grid = {"sv_findradius_grid", "1", CVAR_NONE};
 
 /*
 ===============
-SV_CreateAreaNode
+SV_RadiusGridSetup
 
+mem must hold 4 * maxedicts ints
 ===============
 */
-areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
+static void SV_RadiusGridSetup (int maxedicts, int *mem)
 {
-	areanode_t	*anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1, mins2, maxs2;
+	int		i;
 
-	anode = &sv_areanodes[sv_numareanodes];
-	sv_numareanodes++;
+	memset (&sv_rgrid, 0, sizeof(sv_rgrid));
+	sv_rgrid.edicts = sv.edicts;
+	sv_rgrid.maxedicts = maxedicts;
+	sv_rgrid.bucket = mem;
+	sv_rgrid.next = mem + maxedicts;
+	sv_rgrid.prev = mem + maxedicts * 2;
+	sv_rgrid.matches = mem + maxedicts * 3;
 
-	ClearLink (&anode->trigger_edicts);
-	ClearLink (&anode->solid_edicts);
+	for (i = 0; i <= RGRID_BUCKETS; i++)
+		sv_rgrid.heads[i] = -1;
 
-	if (depth == AREA_DEPTH)
+	// nothing is known about existing edicts yet
+	for (i = maxedicts - 1; i > 0; i--)
 	{
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
+		sv_rgrid.bucket[i] = RGRID_DIRTY;
+		sv_rgrid.prev[i] = -1;
+		sv_rgrid.next[i] = sv_rgrid.heads[RGRID_DIRTY];
+		if (sv_rgrid.next[i] != -1)
+			sv_rgrid.prev[sv_rgrid.next[i]] = i;
+		sv_rgrid.heads[RGRID_DIRTY] = i;
 	}
+	sv_rgrid.bucket[0] = RGRID_NONE;
+}
 
-	VectorSubtract (maxs, mins, size);
-	if (size[0] > size[1])
-		anode->axis = 0;
-	else
-		anode->axis = 1;
-
-	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy (mins, mins1);
-	VectorCopy (mins, mins2);
-	VectorCopy (maxs, maxs1);
-	VectorCopy (maxs, maxs2);
-
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
-
-	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
+/*
+===============
+SV_RadiusGridRemove
+===============
+*/
+static void SV_RadiusGridRemove (int num)
+{
+	int		b = sv_rgrid.bucket[num];
 
-	return anode;
+	if (b == RGRID_NONE)
+		return;
+	if (sv_rgrid.prev[num] != -1)
+		sv_rgrid.next[sv_rgrid.prev[num]] = sv_rgrid.next[num];
+	else
+		sv_rgrid.heads[b] = sv_rgrid.next[num];
+	if (sv_rgrid.next[num] != -1)
+		sv_rgrid.prev[sv_rgrid.next[num]] = sv_rgrid.prev[num];
+	sv_rgrid.bucket[num] = RGRID_NONE;
 }
 
 /*
 ===============
-SV_ClearWorld
-
+SV_RadiusGridInsert
 ===============
 */
-void SV_ClearWorld (void)
+static void SV_RadiusGridInsert (int num, int b)
 {
-	SV_InitBoxHull ();
+	if (sv_rgrid.bucket[num] == b)
+		return;
+	SV_RadiusGridRemove (num);
+
+	sv_rgrid.bucket[num] = b;
+	sv_rgrid.prev[num] = -1;
+	sv_rgrid.next[num] = sv_rgrid.heads[b];
+	if (sv_rgrid.next[num] != -1)
+		sv_rgrid.prev[sv_rgrid.next[num]] = num;
+	sv_rgrid.heads[b] = num;
+}
 
-	memset (sv_areanodes, 0, sizeof(sv_areanodes));
-	sv_numareanodes = 0;
-	SV_CreateAreaNode (0, sv.worldmodel->mins, sv.worldmodel->maxs);
+static int SV_RadiusGridHash (int x, int y)
+{
+	return ((unsigned)x * 73856093u ^ (unsigned)y * 19349663u) & (RGRID_BUCKETS - 1);
 }
 
+static int SV_RadiusGridCell (float f)
+{
+	return (int) floor (f * (1.f / RGRID_CELLSIZE));
+}
 
 /*
 ===============
-SV_UnlinkEdict
+SV_RadiusGridDirty
 
+Called when ent may have moved without being relinked
 ===============
 */
-void SV_UnlinkEdict (edict_t *ent)
+void SV_RadiusGridDirty (edict_t *ent)
 {
-	if (!ent->area.prev)
-		return;		// not linked in anywhere
-	RemoveLink (&ent->area);
-	ent->area.prev = ent->area.next = NULL;
+	if (RGRID_VALID () && ent != sv.edicts)
+		SV_RadiusGridInsert (NUM_FOR_EDICT (ent), RGRID_DIRTY);
 }
 
-
 /*
-====================
-SV_AreaTriggerEdicts
+===============
+SV_RadiusGridLink
 
-Spike -- just builds a list of entities within the area, rather than walking
-them and risking the list getting corrupt.
-====================
+Files ent under its current center
+===============
 */
-static void
-SV_AreaTriggerEdicts ( edict_t *ent, areanode_t *node, edict_t **list, int *listcount, const int listspace )
+static void SV_RadiusGridLink (edict_t *ent)
 {
-	link_t		*l, *next;
-	edict_t		*touch;
-
-// touch linked edicts
-	for (l = node->trigger_edicts.next ; l != &node->trigger_edicts ; l = next)
-	{
-		next = l->next;
-		touch = EDICT_FROM_AREA(l);
-		if (touch == ent)
-			continue;
-		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
-			continue;
-		if (ent->v.absmin[0] > touch->v.absmax[0]
-		|| ent->v.absmin[1] > touch->v.absmax[1]
-		|| ent->v.absmin[2] > touch->v.absmax[2]
-		|| ent->v.absmax[0] < touch->v.absmin[0]
-		|| ent->v.absmax[1] < touch->v.absmin[1]
-		|| ent->v.absmax[2] < touch->v.absmin[2] )
-			continue;
-
-		if (*listcount == listspace)
-			return; // should never happen
-
-		list[*listcount] = touch;
-		(*listcount)++;
-	}
+	float	x, y;
+	int		b;
 
-// recurse down both sides
-	if (node->axis == -1)
+	if (!RGRID_VALID () || ent == sv.edicts)
 		return;
 
-	if ( ent->v.absmax[node->axis] > node->dist )
-		SV_AreaTriggerEdicts ( ent, node->children[0], list, listcount, listspace );
-	if ( ent->v.absmin[node->axis] < node->dist )
-		SV_AreaTriggerEdicts ( ent, node->children[1], list, listcount, listspace );
+	x = ent->v.origin[0] + (ent->v.mins[0] + ent->v.maxs[0]) * 0.5f;
+	y = ent->v.origin[1] + (ent->v.mins[1] + ent->v.maxs[1]) * 0.5f;
+	if (fabs (x) < RGRID_RANGE && fabs (y) < RGRID_RANGE)	// also false for NaN
+		b = SV_RadiusGridHash (SV_RadiusGridCell (x), SV_RadiusGridCell (y));
+	else
+		b = RGRID_DIRTY;
+
+	SV_RadiusGridInsert (NUM_FOR_EDICT (ent), b);
 }
 
 /*
-====================
-SV_TouchLinks
+===============
+SV_InRadius
 
-ericw -- copy the touching edicts to an array so we can avoid
-iteating the trigger_edicts linked list while calling PR_ExecuteProgram
-which could potentially corrupt the list while it's being iterated.
-Based on code from Spike.
-====================
+rad is the squared radius
+===============
 */
-void SV_TouchLinks (edict_t *ent)
+static qboolean SV_InRadius (edict_t *ent, const float *org, float rad)
 {
-	edict_t		**list;
-	edict_t		*touch;
-	int		old_self, old_other;
-	int		i, listcount;
+	float d, lensq;
 
-	list = alloca (sv.num_edicts*sizeof(edict_t *));
+	d = org[0] - (ent->v.origin[0] + (ent->v.mins[0] + ent->v.maxs[0]) * 0.5);
+	lensq = d * d;
+	if (lensq > rad)
+		return false;
+	d = org[1] - (ent->v.origin[1] + (ent->v.mins[1] + ent->v.maxs[1]) * 0.5);
+	lensq += d * d;
+	if (lensq > rad)
+		return false;
+	d = org[2] - (ent->v.origin[2] + (ent->v.mins[2] + ent->v.maxs[2]) * 0.5);
+	lensq += d * d;
+	if (lensq > rad)
+		return false;
 
-	listcount = 0;
-	SV_AreaTriggerEdicts (ent, sv_areanodes, list, &listcount, sv.num_edicts);
+	return true;
+}
 
-	for (i = 0; i < listcount; i++)
+/*
+===============
+SV_FindRadiusScan
+===============
+*/
+static edict_t *SV_FindRadiusScan (const float *org, float rad)
+{
+	edict_t	*ent, *chain;
+	int		i;
+
+	chain = (edict_t *)sv.edicts;
+
+	ent = NEXT_EDICT(sv.edicts);
+	for (i = 1; i < sv.num_edicts; i++, ent = NEXT_EDICT(ent))
 	{
-		touch = list[i];
-	// re-validate in case of PR_ExecuteProgram having side effects that make
-	// edicts later in the list no longer touch
-		if (touch == ent)
+		if (ent->free)
 			continue;
-		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
+		if (ent->v.solid == SOLID_NOT)
 			continue;
-		if (ent->v.absmin[0] > touch->v.absmax[0]
-		|| ent->v.absmin[1] > touch->v.absmax[1]
-		|| ent->v.absmin[2] > touch->v.absmax[2]
-		|| ent->v.absmax[0] < touch->v.absmin[0]
-		|| ent->v.absmax[1] < touch->v.absmin[1]
-		|| ent->v.absmax[2] < touch->v.absmin[2] )
+		if (!SV_InRadius (ent, org, rad))
 			continue;
-		old_self = pr_global_struct->self;
-		old_other = pr_global_struct->other;
-
-		pr_global_struct->self = EDICT_TO_PROG(touch);
-		pr_global_struct->other = EDICT_TO_PROG(ent);
-		pr_global_struct->time = sv.time;
-		PR_ExecuteProgram (touch->v.touch);
 
-		pr_global_struct->self = old_self;
-		pr_global_struct->other = old_other;
+		ent->v.chain = EDICT_TO_PROG(chain);
+		chain = ent;
 	}
+
+	return chain;
 }
 
+static int SV_CompareEdictNums (const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
 
 /*
 ===============
-SV_FindTouchedLeafs
-
+SV_FindRadiusGrid
 ===============
 */
-void SV_FindTouchedLeafs (edict_t *ent, mnode_t *node)
+static edict_t *SV_FindRadiusGrid (const float *org, float radius, float rad)
 {
-	mplane_t	*splitplane;
-	mleaf_t		*leaf;
-	int			sides;
-	int			leafnum;
-
-	if (node->contents == CONTENTS_SOLID)
-		return;
-
-// add an efrag if the node is a leaf
-
-	if ( node->contents < 0)
+	edict_t	*ent, *chain;
+	float	r;
+	int		x, y, x0, y0, x1, y1, b, i, next, count;
+
+	// covers the float rounding of both the grid and the exact test
+	r = fabs (radius) * 1.0001f + 1.f;
+	x0 = SV_RadiusGridCell (org[0] - r);
+	x1 = SV_RadiusGridCell (org[0] + r);
+	y0 = SV_RadiusGridCell (org[1] - r);
+	y1 = SV_RadiusGridCell (org[1] + r);
+
+	if (++sv_rgrid.visitframe == 0)
 	{
-		if (ent->num_leafs == MAX_ENT_LEAFS)
-			return;
-
-		leaf = (mleaf_t *)node;
-		leafnum = leaf - sv.worldmodel->leafs - 1;
+		memset (sv_rgrid.visited, 0, sizeof(sv_rgrid.visited));
+		sv_rgrid.visitframe = 1;
+	}
 
-		ent->leafnums[ent->num_leafs] = leafnum;
-		ent->num_leafs++;
-		return;
+	count = 0;
+	for (i = sv_rgrid.heads[RGRID_DIRTY]; i != -1; i = next)
+	{
+		next = sv_rgrid.next[i];
+		ent = EDICT_NUM(i);
+		if (i >= sv.num_edicts || ent->free)
+		{
+			SV_RadiusGridRemove (i);	// back on the grid when allocated again
+			continue;
+		}
+		if (ent->v.solid != SOLID_NOT && SV_InRadius (ent, org, rad))
+			sv_rgrid.matches[count++] = i;
 	}
 
-// NODE_MIXED
+	for (y = y0; y <= y1; y++)
+	{
+		for (x = x0; x <= x1; x++)
+		{
+			b = SV_RadiusGridHash (x, y);
+			if (sv_rgrid.visited[b] == sv_rgrid.visitframe)
+				continue;
+			sv_rgrid.visited[b] = sv_rgrid.visitframe;
 
-	splitplane = node->plane;
-	sides = BOX_ON_PLANE_SIDE(ent->v.absmin, ent->v.absmax, splitplane);
+			for (i = sv_rgrid.heads[b]; i != -1; i = sv_rgrid.next[i])
+			{
+				ent = EDICT_NUM(i);
+				if (ent->free || ent->v.solid == SOLID_NOT)
+					continue;
+				if (SV_InRadius (ent, org, rad))
+					sv_rgrid.matches[count++] = i;
+			}
+		}
+	}
 
-// recurse down the contacted sides
-	if (sides & 1)
-		SV_FindTouchedLeafs (ent, node->children[0]);
+	// same order as the linear scan: highest edict first
+	qsort (sv_rgrid.matches, count, sizeof(int), SV_CompareEdictNums);
+	chain = (edict_t *)sv.edicts;
+	for (i = 0; i < count; i++)
+	{
+		ent = EDICT_NUM(sv_rgrid.matches[i]);
+		ent->v.chain = EDICT_TO_PROG(chain);
+		chain = ent;
+	}
 
-	if (sides & 2)
-		SV_FindTouchedLeafs (ent, node->children[1]);
+	return chain;
 }
 
 /*
 ===============
-SV_BoxInPVS
+SV_FindRadius
+
+Returns a chain of the entities that aren't SOLID_NOT whose bbox centers
+are within radius of org, in the same order as a walk over all edicts
 ===============
 */
-qboolean SV_BoxInPVS (vec3_t mins, vec3_t maxs, byte *pvs, mnode_t *node)
+edict_t *SV_FindRadius (const float *org, float radius)
 {
-	mplane_t	*splitplane;
-	mleaf_t		*leaf;
-	int			sides;
-	int			leafnum;
-
-	if (node->contents == CONTENTS_SOLID)
-		return false;
-
-	if (node->contents < 0)
-	{
-		leaf = (mleaf_t *)node;
-		leafnum = leaf - sv.worldmodel->leafs - 1;
-		return pvs[leafnum >> 3] & (1 << (leafnum & 7));
-	}
-
-	splitplane = node->plane;
-	sides = BOX_ON_PLANE_SIDE(mins, maxs, splitplane);
+	float	rad = radius * radius;
+	float	r;
 
-	if (sides & 1 && SV_BoxInPVS (mins, maxs, pvs, node->children[0]))
-		return true;
+	if (!sv_findradius_grid.value || !RGRID_VALID ())
+		return SV_FindRadiusScan (org, rad);
 
-	if (sides & 2 && SV_BoxInPVS (mins, maxs, pvs, node->children[1]))
-		return true;
+	// huge or non-finite queries would touch every bucket anyway
+	r = fabs (radius);
+	if (!(r < RGRID_CELLSIZE * 16) || !(fabs (org[0]) < RGRID_RANGE) || !(fabs (org[1]) < RGRID_RANGE))
+		return SV_FindRadiusScan (org, rad);
 
-	return false;
+	return SV_FindRadiusGrid (org, radius, rad);
 }
 
 /*
 ===============
-SV_LinkEdict
+SV_FindRadiusBench_f
 
+Runs random findradius queries against synthetic edict sets of increasing
+size, with both the linear scan and the grid, and checks that the results
+match
 ===============
 */
-void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
+void SV_FindRadiusBench_f (void)
 {
-	areanode_t	*node;
-
-	if (ent->area.prev)
-		SV_UnlinkEdict (ent);	// unlink from old position
+	static const int	counts[] = {1024, 8192, 32768};
+	static const float	radii[] = {128.f, 512.f, 1000.f};
+	const int		numqueries = 1000;
+	edict_t		*saved_edicts, *ent, *a, *b;
+	int			saved_num, saved_max;
+	radiusgrid_t	saved_grid;
+	int			*mem, *expect;
+	float		(*queries)[4];
+	vec3_t		lo, size;
+	unsigned	seed;
+	int			c, i, j, k, n, matches, mismatches;
+	double		t, scantime, gridtime;
+
+	if (!sv.active)
+	{
+		Con_Printf ("sv_findradius_bench: no map running\n");
+		return;
+	}
 
-	if (ent == sv.edicts)
-		return;		// don't add the world
+	saved_edicts = sv.edicts;
+	saved_num = sv.num_edicts;
+	saved_max = sv.max_edicts;
+	saved_grid = sv_rgrid;
 
-	if (ent->free)
-		return;
+	VectorCopy (sv.worldmodel->mins, lo);
+	VectorSubtract (sv.worldmodel->maxs, sv.worldmodel->mins, size);
+	queries = (float (*)[4]) malloc (numqueries * sizeof(*queries));
 
-// set the abs box
-	VectorAdd (ent->v.origin, ent->v.mins, ent->v.absmin);
-	VectorAdd (ent->v.origin, ent->v.maxs, ent->v.absmax);
+	Con_Printf ("%i queries, radius %g-%g, map %s\n", numqueries, radii[0], radii[countof(radii) - 1], sv.name);
 
-//
-// to make items easier to pick up and allow them to be grabbed off
-// of shelves, the abs sizes are expanded
+	for (c = 0; c < (int) countof(counts); c++)
+	{
+		n = counts[c];
+		sv.edicts = (edict_t *) calloc (n, pr_edict_size);
+		mem = (int *) malloc (4 * n * sizeof(int));
+		expect = (int *) malloc (n * sizeof(int));
+		if (!sv.edicts || !mem || !expect || !queries)
+			Sys_Error ("SV_FindRadiusBench_f: out of memory");
+		sv.num_edicts = sv.max_edicts = n;
+		SV_RadiusGridSetup (n, mem);
+
+		// a mix of monsters, items, triggers, free slots and non-solid
+		// entities scattered over the map bounds
+		seed = 0x12345678u;
+		for (i = 1; i < n; i++)
+		{
+			ent = EDICT_NUM(i);
+			for (j = 0; j < 3; j++)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				ent->v.origin[j] = lo[j] + size[j] * (seed >> 8) * (1.f / 16777216.f);
+				ent->v.mins[j] = j < 2 ? -16.f : -24.f;
+				ent->v.maxs[j] = j < 2 ? 16.f : (i & 1) ? 40.f : 32.f;
+			}
+			switch (seed >> 28)
+			{
+			case 0:
+				ent->free = true;
+				break;
+			case 1: case 2: case 3:
+				ent->v.solid = SOLID_NOT;
+				break;
+			case 4: case 5:
+				ent->v.solid = SOLID_TRIGGER;
+				break;
+			default:
+				ent->v.solid = SOLID_SLIDEBOX;
+				break;
+			}
+			if (ent->free)
+				SV_RadiusGridRemove (i);
+			else if (seed & 0xf00)	// a few stay dirty, as if moved by QC
+				SV_RadiusGridLink (ent);
+		}
+
+		for (i = 0; i < numqueries; i++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			ent = EDICT_NUM(1 + (seed >> 8) % (n - 1));
+			VectorCopy (ent->v.origin, queries[i]);
+			queries[i][3] = radii[i % countof(radii)];
+		}
+
+		t = Sys_DoubleTime ();
+		for (i = 0; i < numqueries; i++)
+			SV_FindRadiusScan (queries[i], queries[i][3] * queries[i][3]);
+		scantime = Sys_DoubleTime () - t;
+
+		t = Sys_DoubleTime ();
+		for (i = 0; i < numqueries; i++)
+			SV_FindRadiusGrid (queries[i], queries[i][3], queries[i][3] * queries[i][3]);
+		gridtime = Sys_DoubleTime () - t;
+
+		matches = mismatches = 0;
+		for (i = 0; i < numqueries; i++)
+		{
+			a = SV_FindRadiusScan (queries[i], queries[i][3] * queries[i][3]);
+			for (j = 0; a != sv.edicts; a = PROG_TO_EDICT(a->v.chain))
+				expect[j++] = NUM_FOR_EDICT(a);
+			matches += j;
+
+			b = SV_FindRadiusGrid (queries[i], queries[i][3], queries[i][3] * queries[i][3]);
+			for (k = 0; k < j && b != sv.edicts; b = PROG_TO_EDICT(b->v.chain), k++)
+				if (NUM_FOR_EDICT(b) != expect[k])
+					break;
+			if (k != j || b != sv.edicts)
+				mismatches++;
+		}
+
+		Con_Printf ("%6i edicts: scan %8.2f ms, grid %8.2f ms, %5.1fx, %.1f hits/query, %s\n",
+			n, scantime * 1000.0, gridtime * 1000.0, gridtime > 0.0 ? scantime / gridtime : 0.0,
+			(double) matches / numqueries, mismatches ? "MISMATCH" : "chains identical");
+
+		free (sv.edicts);
+		free (mem);
+		free (expect);
+	}
+
+	free (queries);
+	sv.edicts = saved_edicts;
+	sv.num_edicts = saved_num;
+	sv.max_edicts = saved_max;
+	sv_rgrid = saved_grid;
+}
+
+/*
+===============================================================================
+
+PVS CANDIDATES
+
+Besides its leafnums, every edict has a 128 bit mask of the coarse leaf
+clusters it touches, kept next to the others in one array. A cluster is a
+run of 1 << sv_visshift leafs, numbered so that a map has at most 127 of
+them; bit 127 is set for edicts that touch MAX_ENT_LEAFS leafs, which are
+never culled. A pvs gets the same kind of mask, so edicts whose mask doesn't
+intersect it are rejected with one AND per edict, and only the rest are
+tested leaf by leaf.
+
+===============================================================================
+*/
+
+#define	VIS_OVERFLOW	127
+
+static unsigned	(*sv_vismasks)[4];	// sv.max_edicts
+static int		sv_visshift;
+
+/*
+===============
+SV_VisMaskSetup
+
+mem must hold sv.max_edicts masks
+===============
+*/
+static void SV_VisMaskSetup (unsigned (*mem)[4])
+{
+	int		numleafs = sv.worldmodel->numleafs;
+
+	sv_vismasks = mem;
+	for (sv_visshift = 3; (numleafs - 1) >> sv_visshift >= VIS_OVERFLOW; sv_visshift++)
+		;
+}
+
+/*
+===============
+SV_SetVisMask
+
+Called after ent's leafnums have been found
+===============
+*/
+static void SV_SetVisMask (edict_t *ent)
+{
+	unsigned	*mask = sv_vismasks[NUM_FOR_EDICT(ent)];
+	int			i, c;
+
+	if (ent->num_leafs == MAX_ENT_LEAFS)
+	{
+		mask[0] = mask[1] = mask[2] = mask[3] = 0xffffffffu;
+		return;
+	}
+
+	mask[0] = mask[1] = mask[2] = mask[3] = 0;
+	for (i = 0; i < ent->num_leafs; i++)
+	{
+		c = ent->leafnums[i] >> sv_visshift;
+		mask[c >> 5] |= 1u << (c & 31);
+	}
+}
+
+/*
+===============
+SV_PVSQuery
+
+Sets up q for finding the edicts in pvs, which must be a sv.worldmodel pvs
+===============
+*/
+void SV_PVSQuery (byte *pvs, pvsquery_t *q)
+{
+	int		i, c, bytes, shift;
+
+	q->pvs = pvs;
+	q->mask[0] = q->mask[1] = q->mask[2] = 0;
+	q->mask[3] = 1u << (VIS_OVERFLOW & 31);
+
+	bytes = (sv.worldmodel->numleafs+7)>>3;
+	shift = sv_visshift - 3;
+	for (i = 0; i < bytes; i++)
+	{
+		if (!pvs[i])
+			continue;
+		c = i >> shift;
+		q->mask[c >> 5] |= 1u << (c & 31);
+	}
+}
+
+/*
+===============
+SV_EdictsInPVS
+
+Fills list with the numbers of the edicts in [start, end) that touch a leaf
+in q's pvs or touch MAX_ENT_LEAFS leafs, the same ones SV_EdictInPVS and
+the num_leafs check would let through, in order. always is added
+regardless. Returns the count. Runs on any thread.
+===============
+*/
+int SV_EdictsInPVS (const pvsquery_t *q, int start, int end, int always, int *list)
+{
+	edict_t	*ent;
+	int		e, i, n;
+#ifdef USE_SSE2
+	__m128i	qmask = _mm_loadu_si128 ((const __m128i *) q->mask);
+	__m128i	zero = _mm_setzero_si128 ();
+	__m128i	m;
+#endif
+
+	for (e = start, n = 0; e < end; e++)
+	{
+#ifdef USE_SSE2
+		m = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) sv_vismasks[e]), qmask);
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (m, zero)) == 0xffff)
+#else
+		if (!((sv_vismasks[e][0] & q->mask[0]) | (sv_vismasks[e][1] & q->mask[1]) |
+			(sv_vismasks[e][2] & q->mask[2]) | (sv_vismasks[e][3] & q->mask[3])))
+#endif
+		{
+			if (e == always)
+				list[n++] = e;
+			continue;
+		}
+
+		ent = EDICT_NUM(e);
+		if (e != always && ent->num_leafs < MAX_ENT_LEAFS)
+		{
+			for (i = 0; i < ent->num_leafs; i++)
+				if (q->pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i] & 7)))
+					break;
+			if (i == ent->num_leafs)
+				continue;
+		}
+		list[n++] = e;
+	}
+
+	return n;
+}
+
+/*
+===============================================================================
+
+ENTITY AREA CHECKING
+
+===============================================================================
+*/
+
+typedef struct areanode_s
+{
+	int		axis;		// -1 = leaf node
+	float	dist;
+	struct areanode_s	*children[2];
+	link_t	trigger_edicts;
+	link_t	solid_edicts;
+} areanode_t;
+
+#define	AREA_DEPTH	7
+#define	AREA_NODES	(2<<AREA_DEPTH)
+
+static	areanode_t	sv_areanodes[AREA_NODES];
+static	int			sv_numareanodes;
+
+/*
+The areanode tree splits the world bounds a fixed number of times, so on big
+maps, or where a lot of edicts gather in one place, most of them end up on a
+few nodes. sv_broadphase 1 links edicts into a loose octree instead. A node
+is split once OCT_SPLIT edicts sit on it, and edicts then go down
+as far as their size allows; each cell's bounds are doubled so that the box
+of an edict whose center is in the cell always fits inside. Sparse areas
+stay a few big nodes, crowded ones get small cells. Every node also keeps
+the box around everything that was ever linked below it, which is usually
+much tighter than the doubled cell, and subtrees with nothing of the kind
+searched for are skipped.
+
+SV_Move keeps the first of several equally good hits and lets a start-solid
+hit replace a closer one, and touch functions run in list order, so the
+order edicts are visited in matters. Every linked edict remembers the
+areanode it would be on and when it was linked, and the octree sorts what
+it finds into the order the areanode tree would have visited it in. Both
+structures give the same results.
+*/
+typedef struct octnode_s
+{
+	vec3_t	center;
+	float	half;		// half the cell size, the loose bounds are twice that
+	int		count[2];	// solid and trigger edicts linked here and below
+	int		numhere;	// edicts on this node's own lists
+	int		splitat;	// numhere that makes it split again
+	int		depth;
+	vec3_t	mins, maxs;	// around all edicts linked here and below since the map started
+	struct octnode_s	*parent;
+	struct octnode_s	*children[8];
+	link_t	trigger_edicts;
+	link_t	solid_edicts;
+} octnode_t;
+
+#define	OCT_DEPTH	10
+#define	OCT_NODES	8192
+#define	OCT_MINHALF	32		// smaller cells cost more to walk than they save
+#define	OCT_SPLIT	16
+
+static	octnode_t	*sv_octnodes;
+static	int			sv_numoctnodes;
+static	edict_t		**sv_octlist;	// SV_Move candidates
+static	unsigned	sv_areaseq;		// link counter
+
+static	int			sv_areamode;	// sv_broadphase value the edicts are linked for
+
+cvar_t	sv_broadphase = {"sv_broadphase","0",CVAR_NONE};
+
+/*
+===============
+SV_CreateAreaNode
+
+===============
+*/
+areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
+{
+	areanode_t	*anode;
+	vec3_t		size;
+	vec3_t		mins1, maxs1, mins2, maxs2;
+
+	anode = &sv_areanodes[sv_numareanodes];
+	sv_numareanodes++;
+
+	ClearLink (&anode->trigger_edicts);
+	ClearLink (&anode->solid_edicts);
+
+	if (depth == AREA_DEPTH)
+	{
+		anode->axis = -1;
+		anode->children[0] = anode->children[1] = NULL;
+		return anode;
+	}
+
+	VectorSubtract (maxs, mins, size);
+	if (size[0] > size[1])
+		anode->axis = 0;
+	else
+		anode->axis = 1;
+
+	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
+	VectorCopy (mins, mins1);
+	VectorCopy (mins, mins2);
+	VectorCopy (maxs, maxs1);
+	VectorCopy (maxs, maxs2);
+
+	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+
+	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
+	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
+
+	return anode;
+}
+
+/*
+===============
+SV_CreateOctNode
+===============
+*/
+static octnode_t *SV_CreateOctNode (octnode_t *parent, int child)
+{
+	octnode_t	*node;
+	int			i;
+
+	if (sv_numoctnodes == OCT_NODES)
+		return NULL;
+	node = &sv_octnodes[sv_numoctnodes++];
+	memset (node, 0, sizeof(*node));
+	ClearLink (&node->trigger_edicts);
+	ClearLink (&node->solid_edicts);
+
+	node->parent = parent;
+	node->splitat = OCT_SPLIT;
+	for (i = 0; i < 3; i++)
+	{
+		node->mins[i] = 999999;
+		node->maxs[i] = -999999;
+	}
+	if (!parent)
+		return node;
+	node->depth = parent->depth + 1;
+	node->half = parent->half * 0.5f;
+	for (i = 0; i < 3; i++)
+		node->center[i] = parent->center[i] + ((child & (1 << i)) ? node->half : -node->half);
+	parent->children[child] = node;
+
+	return node;
+}
+
+/*
+===============
+SV_OctRemove
+===============
+*/
+static void SV_OctRemove (edict_t *ent)
+{
+	octnode_t	*node;
+
+	node = &sv_octnodes[ent->areanode >> 1];
+	node->numhere--;
+	for ( ; node; node = node->parent)
+		node->count[ent->areanode & 1]--;
+	RemoveLink (&ent->area);
+}
+
+/*
+===============
+SV_ResetAreas
+
+Empties the areanode tree and the octree, and selects which one edicts are
+linked into
+===============
+*/
+static void SV_ResetAreas (int mode)
+{
+	octnode_t	*root;
+	int			i;
+
+	memset (sv_areanodes, 0, sizeof(sv_areanodes));
+	sv_numareanodes = 0;
+	SV_CreateAreaNode (0, sv.worldmodel->mins, sv.worldmodel->maxs);
+
+	sv_numoctnodes = 0;
+	root = SV_CreateOctNode (NULL, 0);
+	for (i = 0; i < 3; i++)
+	{
+		root->center[i] = 0.5f * (sv.worldmodel->mins[i] + sv.worldmodel->maxs[i]);
+		root->half = q_max (root->half, sv.worldmodel->maxs[i] - sv.worldmodel->mins[i] + 1.f);	// room for strays outside the map
+	}
+
+	sv_areaseq = 0;
+	sv_areamode = mode;
+}
+
+/*
+===============
+SV_ClearWorld
+
+===============
+*/
+void SV_ClearWorld (void)
+{
+	SV_InitBoxHull ();
+
+	sv_octnodes = (octnode_t *) Hunk_AllocName (OCT_NODES * sizeof(octnode_t), "octree");
+	sv_octlist = (edict_t **) Hunk_AllocName (MAX_EDICTS * sizeof(edict_t *), "octree");
+	SV_ResetAreas (sv_broadphase.value ? 1 : 0);
+
+	SV_RadiusGridSetup (sv.max_edicts, (int *) Hunk_AllocName (4 * sv.max_edicts * sizeof(int), "rgrid"));
+	SV_VisMaskSetup ((unsigned (*)[4]) Hunk_AllocName (sv.max_edicts * 4 * sizeof(unsigned), "vismask"));
+}
+
+
+/*
+===============
+SV_UnlinkEdict
+
+===============
+*/
+void SV_UnlinkEdict (edict_t *ent)
+{
+	SV_RadiusGridDirty (ent);
+
+	if (!ent->area.prev)
+		return;		// not linked in anywhere
+	if (sv_areamode)
+		SV_OctRemove (ent);
+	else
+		RemoveLink (&ent->area);
+	ent->area.prev = ent->area.next = NULL;
+}
+
+
+/*
+====================
+SV_AreaTriggerEdicts
+
+Spike -- just builds a list of entities within the area, rather than walking
+them and risking the list getting corrupt.
+====================
+*/
+static void
+SV_AreaTriggerEdicts ( edict_t *ent, areanode_t *node, edict_t **list, int *listcount, const int listspace )
+{
+	link_t		*l, *next;
+	edict_t		*touch;
+
+// touch linked edicts
+	for (l = node->trigger_edicts.next ; l != &node->trigger_edicts ; l = next)
+	{
+		next = l->next;
+		touch = EDICT_FROM_AREA(l);
+		if (touch == ent)
+			continue;
+		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
+			continue;
+		if (ent->v.absmin[0] > touch->v.absmax[0]
+		|| ent->v.absmin[1] > touch->v.absmax[1]
+		|| ent->v.absmin[2] > touch->v.absmax[2]
+		|| ent->v.absmax[0] < touch->v.absmin[0]
+		|| ent->v.absmax[1] < touch->v.absmin[1]
+		|| ent->v.absmax[2] < touch->v.absmin[2] )
+			continue;
+
+		if (*listcount == listspace)
+			return; // should never happen
+
+		list[*listcount] = touch;
+		(*listcount)++;
+	}
+
+// recurse down both sides
+	if (node->axis == -1)
+		return;
+
+	if ( ent->v.absmax[node->axis] > node->dist )
+		SV_AreaTriggerEdicts ( ent, node->children[0], list, listcount, listspace );
+	if ( ent->v.absmin[node->axis] < node->dist )
+		SV_AreaTriggerEdicts ( ent, node->children[1], list, listcount, listspace );
+}
+
+/*
+====================
+SV_OctGather
+
+Adds the edicts of the given kind (1 = triggers) whose absolute box touches
+mins/maxs
+====================
+*/
+static void SV_OctGather (int kind, const float *mins, const float *maxs, edict_t **list, int *count, const int space)
+{
+	octnode_t	*stack[OCT_DEPTH * 8 + 8];
+	octnode_t	*node, *child;
+	link_t		*head, *l;
+	edict_t		*touch;
+	int			i, j, depth;
+
+	if (!sv_octnodes->count[kind])
+		return;
+	stack[0] = sv_octnodes;	// the root also holds whatever didn't fit in the world bounds
+	depth = 1;
+
+	while (depth)
+	{
+		node = stack[--depth];
+
+		head = kind ? &node->trigger_edicts : &node->solid_edicts;
+		for (l = head->next ; l != head ; l = l->next)
+		{
+			touch = EDICT_FROM_AREA(l);
+			if (mins[0] > touch->v.absmax[0]
+			|| mins[1] > touch->v.absmax[1]
+			|| mins[2] > touch->v.absmax[2]
+			|| maxs[0] < touch->v.absmin[0]
+			|| maxs[1] < touch->v.absmin[1]
+			|| maxs[2] < touch->v.absmin[2] )
+				continue;
+			if (*count == space)
+				return;
+			list[(*count)++] = touch;
+		}
+
+		for (i = 0; i < 8; i++)
+		{
+			child = node->children[i];
+			if (!child || !child->count[kind])
+				continue;
+			for (j = 0; j < 3; j++)
+				if (mins[j] > child->maxs[j] || maxs[j] < child->mins[j])
+					break;
+			if (j == 3)
+				stack[depth++] = child;
+		}
+	}
+}
+
+/*
+====================
+SV_CompareAreaOrder
+
+Orders edicts the way walking the areanode tree meets them: nodes are
+numbered in the order they are walked, and lists are kept in link order
+====================
+*/
+static int SV_CompareAreaOrder (const void *a, const void *b)
+{
+	const edict_t *ea = *(const edict_t **)a;
+	const edict_t *eb = *(const edict_t **)b;
+
+	if (ea->areaorder != eb->areaorder)
+		return ea->areaorder - eb->areaorder;
+	if (ea->areaseq != eb->areaseq)
+		return ea->areaseq < eb->areaseq ? -1 : 1;
+	return 0;
+}
+
+/*
+====================
+SV_OctGatherSorted
+====================
+*/
+static int SV_OctGatherSorted (int kind, const float *mins, const float *maxs, edict_t **list, const int space)
+{
+	int		count = 0;
+
+	SV_OctGather (kind, mins, maxs, list, &count, space);
+	if (count > 1)
+		qsort (list, count, sizeof(edict_t *), SV_CompareAreaOrder);
+	return count;
+}
+
+/*
+====================
+SV_TriggerEdicts
+
+Lists the triggers that ent's absolute box touches
+====================
+*/
+static void SV_TriggerEdicts (edict_t *ent, edict_t **list, int *listcount, const int listspace)
+{
+	edict_t	*touch;
+	int		i, first, count;
+
+	if (!sv_areamode)
+	{
+		SV_AreaTriggerEdicts (ent, sv_areanodes, list, listcount, listspace);
+		return;
+	}
+
+	first = *listcount;
+	count = SV_OctGatherSorted (1, ent->v.absmin, ent->v.absmax, list + first, listspace - first);
+	for (i = 0; i < count; i++)
+	{
+		touch = list[first + i];
+		if (touch == ent)
+			continue;
+		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
+			continue;
+		list[(*listcount)++] = touch;
+	}
+}
+
+/*
+====================
+SV_TouchLinks
+
+ericw -- copy the touching edicts to an array so we can avoid
+iteating the trigger_edicts linked list while calling PR_ExecuteProgram
+which could potentially corrupt the list while it's being iterated.
+Based on code from Spike.
+====================
+*/
+void SV_TouchLinks (edict_t *ent)
+{
+	edict_t		**list;
+	edict_t		*touch;
+	int		old_self, old_other;
+	int		i, listcount;
+
+	list = alloca (sv.num_edicts*sizeof(edict_t *));
+
+	listcount = 0;
+	SV_TriggerEdicts (ent, list, &listcount, sv.num_edicts);
+
+	for (i = 0; i < listcount; i++)
+	{
+		touch = list[i];
+	// re-validate in case of PR_ExecuteProgram having side effects that make
+	// edicts later in the list no longer touch
+		if (touch == ent)
+			continue;
+		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
+			continue;
+		if (ent->v.absmin[0] > touch->v.absmax[0]
+		|| ent->v.absmin[1] > touch->v.absmax[1]
+		|| ent->v.absmin[2] > touch->v.absmax[2]
+		|| ent->v.absmax[0] < touch->v.absmin[0]
+		|| ent->v.absmax[1] < touch->v.absmin[1]
+		|| ent->v.absmax[2] < touch->v.absmin[2] )
+			continue;
+		old_self = pr_global_struct->self;
+		old_other = pr_global_struct->other;
+
+		pr_global_struct->self = EDICT_TO_PROG(touch);
+		pr_global_struct->other = EDICT_TO_PROG(ent);
+		pr_global_struct->time = sv.time;
+		PR_ExecuteProgram (touch->v.touch);
+
+		pr_global_struct->self = old_self;
+		pr_global_struct->other = old_other;
+	}
+}
+
+
+/*
+===============
+SV_FindTouchedLeafs
+
+===============
+*/
+void SV_FindTouchedLeafs (edict_t *ent, mnode_t *node)
+{
+	mplane_t	*splitplane;
+	mleaf_t		*leaf;
+	int			sides;
+	int			leafnum;
+
+	if (node->contents == CONTENTS_SOLID)
+		return;
+
+// add an efrag if the node is a leaf
+
+	if ( node->contents < 0)
+	{
+		if (ent->num_leafs == MAX_ENT_LEAFS)
+			return;
+
+		leaf = (mleaf_t *)node;
+		leafnum = leaf - sv.worldmodel->leafs - 1;
+
+		ent->leafnums[ent->num_leafs] = leafnum;
+		ent->num_leafs++;
+		return;
+	}
+
+// NODE_MIXED
+
+	splitplane = node->plane;
+	sides = BOX_ON_PLANE_SIDE(ent->v.absmin, ent->v.absmax, splitplane);
+
+// recurse down the contacted sides
+	if (sides & 1)
+		SV_FindTouchedLeafs (ent, node->children[0]);
+
+	if (sides & 2)
+		SV_FindTouchedLeafs (ent, node->children[1]);
+}
+
+/*
+===============
+SV_BoxInPVS
+===============
+*/
+qboolean SV_BoxInPVS (vec3_t mins, vec3_t maxs, byte *pvs, mnode_t *node)
+{
+	mplane_t	*splitplane;
+	mleaf_t		*leaf;
+	int			sides;
+	int			leafnum;
+
+	if (node->contents == CONTENTS_SOLID)
+		return false;
+
+	if (node->contents < 0)
+	{
+		leaf = (mleaf_t *)node;
+		leafnum = leaf - sv.worldmodel->leafs - 1;
+		return pvs[leafnum >> 3] & (1 << (leafnum & 7));
+	}
+
+	splitplane = node->plane;
+	sides = BOX_ON_PLANE_SIDE(mins, maxs, splitplane);
+
+	if (sides & 1 && SV_BoxInPVS (mins, maxs, pvs, node->children[0]))
+		return true;
+
+	if (sides & 2 && SV_BoxInPVS (mins, maxs, pvs, node->children[1]))
+		return true;
+
+	return false;
+}
+
+/*
+===============
+SV_OctChild
+
+Returns the child of node that ent's box fits in, or -1 if it has to stay on
+node
+===============
+*/
+static int SV_OctChild (octnode_t *node, edict_t *ent)
+{
+	vec3_t	center;
+	float	radius, half;
+	int		i, c;
+
+	half = node->half * 0.5f;
+	if (node->depth == OCT_DEPTH || half < OCT_MINHALF)
+		return -1;
+
+	radius = 0.f;
+	for (i = 0; i < 3; i++)
+	{
+		center[i] = 0.5f * (ent->v.absmin[i] + ent->v.absmax[i]);
+		radius = q_max (radius, 0.5f * (ent->v.absmax[i] - ent->v.absmin[i]));
+		if (!(fabs (center[i] - node->center[i]) <= node->half))
+			return -1;	// outside the root, or NaN
+	}
+	if (!(radius <= half))
+		return -1;
+
+	c = 0;
+	for (i = 0; i < 3; i++)
+		if (center[i] >= node->center[i])
+			c |= 1 << i;
+	return c;
+}
+
+/*
+===============
+SV_OctInsert
+===============
+*/
+static void SV_OctInsert (octnode_t *node, edict_t *ent, qboolean trigger)
+{
+	int		i;
+
+	InsertLinkBefore (&ent->area, trigger ? &node->trigger_edicts : &node->solid_edicts);
+	ent->areanode = ((node - sv_octnodes) << 1) | (trigger ? 1 : 0);
+	node->numhere++;
+	for ( ; node; node = node->parent)
+	{
+		node->count[trigger ? 1 : 0]++;
+		for (i = 0; i < 3; i++)
+		{
+			node->mins[i] = q_min (node->mins[i], ent->v.absmin[i]);
+			node->maxs[i] = q_max (node->maxs[i], ent->v.absmax[i]);
+		}
+	}
+}
+
+/*
+===============
+SV_OctSplit
+
+Moves the edicts on node that fit in a child down into it
+===============
+*/
+static void SV_OctSplit (octnode_t *node)
+{
+	link_t		*head, *l, *next;
+	edict_t		*ent;
+	octnode_t	*child;
+	int			i, c, kind;
+
+	for (kind = 0; kind < 2; kind++)
+	{
+		head = kind ? &node->trigger_edicts : &node->solid_edicts;
+		for (l = head->next ; l != head ; l = next)
+		{
+			next = l->next;
+			ent = EDICT_FROM_AREA(l);
+			c = SV_OctChild (node, ent);
+			if (c == -1)
+				continue;
+			child = node->children[c];
+			if (!child)
+				child = SV_CreateOctNode (node, c);
+			if (!child)
+			{	// out of nodes
+				node->splitat = node->numhere + OCT_SPLIT;
+				return;
+			}
+			SV_OctRemove (ent);
+			SV_OctInsert (child, ent, kind);
+		}
+	}
+	// whatever is left is too big for the children
+	node->splitat = node->numhere + OCT_SPLIT;
+
+	for (i = 0; i < 8; i++)
+		if (node->children[i] && node->children[i]->numhere >= node->children[i]->splitat)
+			SV_OctSplit (node->children[i]);
+}
+
+/*
+===============
+SV_AreaLink
+
+Links ent into the current broadphase structure by its absolute box
+===============
+*/
+static void SV_AreaLink (edict_t *ent, qboolean trigger)
+{
+	areanode_t	*node;
+	octnode_t	*oct;
+	int			c;
+
+// find the first node that the ent's box crosses
+	node = sv_areanodes;
+	while (1)
+	{
+		if (node->axis == -1)
+			break;
+		if (ent->v.absmin[node->axis] > node->dist)
+			node = node->children[0];
+		else if (ent->v.absmax[node->axis] < node->dist)
+			node = node->children[1];
+		else
+			break;		// crosses the node
+	}
+	ent->areaorder = node - sv_areanodes;
+	ent->areaseq = sv_areaseq++;
+
+	if (!sv_areamode)
+	{
+	// link it in
+		if (trigger)
+			InsertLinkBefore (&ent->area, &node->trigger_edicts);
+		else
+			InsertLinkBefore (&ent->area, &node->solid_edicts);
+		return;
+	}
+
+	oct = sv_octnodes;
+	for (c = SV_OctChild (oct, ent); c != -1 && oct->children[c]; c = SV_OctChild (oct, ent))
+		oct = oct->children[c];
+	SV_OctInsert (oct, ent, trigger);
+
+	if (oct->numhere >= oct->splitat)
+		SV_OctSplit (oct);
+}
+
+/*
+===============
+SV_RelinkAreas
+
+Moves every linked edict into a fresh structure of the given kind, keeping
+each one on the list (solid or trigger) it was on, in the same order
+===============
+*/
+static void SV_RelinkAreas (int mode)
+{
+	edict_t		**linked;
+	link_t		*head, *l;
+	int			i, j, numlinked;
+
+	linked = (edict_t **) malloc (sv.num_edicts * 2 * sizeof(edict_t *));
+	if (!linked)
+		Sys_Error ("SV_RelinkAreas: out of memory");
+
+	numlinked = 0;
+	for (i = 0; i < (sv_areamode ? sv_numoctnodes : sv_numareanodes); i++)
+	{
+		for (j = 0; j < 2; j++)
+		{
+			if (sv_areamode)
+				head = j ? &sv_octnodes[i].trigger_edicts : &sv_octnodes[i].solid_edicts;
+			else
+				head = j ? &sv_areanodes[i].trigger_edicts : &sv_areanodes[i].solid_edicts;
+			for (l = head->next; l != head && numlinked < sv.num_edicts; l = l->next)
+			{
+				linked[numlinked * 2] = EDICT_FROM_AREA(l);
+				linked[numlinked * 2 + 1] = j ? linked[numlinked * 2] : NULL;
+				numlinked++;
+			}
+		}
+	}
+
+	// keep the order the areanode tree has them in
+	qsort (linked, numlinked, 2 * sizeof(edict_t *), SV_CompareAreaOrder);
+
+	SV_ResetAreas (mode);
+	for (i = 0; i < numlinked; i++)
+		SV_AreaLink (linked[i * 2], linked[i * 2 + 1] != NULL);
+
+	free (linked);
+}
+
+/*
+===============
+SV_BroadphaseChanged
+===============
+*/
+void SV_BroadphaseChanged (cvar_t *var)
+{
+	int	mode = var->value ? 1 : 0;
+
+	if (!sv.active || !sv_octnodes || mode == sv_areamode)
+		return;
+	SV_RelinkAreas (mode);
+}
+
+/*
+===============
+SV_LinkEdict
+
+===============
+*/
+void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
+{
+	if (ent->area.prev)
+		SV_UnlinkEdict (ent);	// unlink from old position
+
+	if (ent == sv.edicts)
+		return;		// don't add the world
+
+	if (ent->free)
+		return;
+
+	SV_RadiusGridLink (ent);
+
+// set the abs box
+	VectorAdd (ent->v.origin, ent->v.mins, ent->v.absmin);
+	VectorAdd (ent->v.origin, ent->v.maxs, ent->v.absmax);
+
+//
+// to make items easier to pick up and allow them to be grabbed off
+// of shelves, the abs sizes are expanded
 //
 	if ((int)ent->v.flags & FL_ITEM)
 	{
@@ -501,30 +1563,14 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
 	ent->num_leafs = 0;
 	if (ent->v.modelindex)
 		SV_FindTouchedLeafs (ent, sv.worldmodel->nodes);
+	SV_SetVisMask (ent);
 
 	if (ent->v.solid == SOLID_NOT)
 		return;
 
-// find the first node that the ent's box crosses
-	node = sv_areanodes;
-	while (1)
-	{
-		if (node->axis == -1)
-			break;
-		if (ent->v.absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if (ent->v.absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else
-			break;		// crosses the node
-	}
-
-// link it in
-
-	if (ent->v.solid == SOLID_TRIGGER)
-		InsertLinkBefore (&ent->area, &node->trigger_edicts);
-	else
-		InsertLinkBefore (&ent->area, &node->solid_edicts);
+	if (sv_areaseq == 0xffffffffu)
+		SV_RelinkAreas (sv_areamode);	// number them from 0 again
+	SV_AreaLink (ent, ent->v.solid == SOLID_TRIGGER);
 
 // if touch_triggers, touch all entities at this node and decend for more
 	if (touch_triggers)
@@ -765,6 +1811,281 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 }
 
 
+/*
+===============================================================================
+
+BATCHED HULL TESTS
+
+Points or lines that go through the same hull are tested together,
+HULL_BATCH at a time. While a group goes down the same side of a node, that
+node's plane is tested against all of them at once. A line that straddles
+the plane leaves the group there and is finished by SV_RecursiveHullCheck
+from that node. That is exactly the call the recursive version would have
+made, because nothing is clipped before a line crosses a plane. The
+distances are computed with the same float and double operations as the
+scalar code, so every result is identical to a separate
+SV_HullPointContents or SV_RecursiveHullCheck call.
+
+===============================================================================
+*/
+
+#define	HULL_BATCH	4
+
+// the scalar code has to do its float math in SSE registers as well
+#if defined(USE_SSE2) && (!defined(__FLT_EVAL_METHOD__) || __FLT_EVAL_METHOD__ == 0)
+	#define HULL_SIMD
+#endif
+
+cvar_t	sv_hullbatch = {"sv_hullbatch", "1", CVAR_NONE};
+
+typedef struct
+{
+#ifdef HULL_SIMD
+	__m128		v[3];			// x, y and z of each point
+	__m128d		lo[3], hi[3];	// the same as doubles, two points each
+#else
+	float		v[3][HULL_BATCH];
+#endif
+} hullpoints_t;
+
+typedef struct
+{
+	int		num;
+	int		lanes;		// bit mask of the group's points or lines
+} hullgroup_t;
+
+/*
+==================
+SV_HullLoadPoints
+==================
+*/
+static void SV_HullLoadPoints (hullpoints_t *hp, vec3_t *points, int n)
+{
+	float	rows[3][HULL_BATCH];
+	int		i, j;
+
+	memset (rows, 0, sizeof(rows));
+	for (i = 0; i < n; i++)
+		for (j = 0; j < 3; j++)
+			rows[j][i] = points[i][j];
+
+#ifdef HULL_SIMD
+	for (j = 0; j < 3; j++)
+	{
+		hp->v[j] = _mm_loadu_ps (rows[j]);
+		hp->lo[j] = _mm_cvtps_pd (hp->v[j]);
+		hp->hi[j] = _mm_cvtps_pd (_mm_movehl_ps (hp->v[j], hp->v[j]));
+	}
+#else
+	memcpy (hp->v, rows, sizeof(rows));
+#endif
+}
+
+/*
+==================
+SV_HullPlaneSides
+
+Sets bit i of *front if point i is in front of the plane (d >= 0) and of
+*back if it is behind it (d < 0). A NaN distance sets neither.
+==================
+*/
+static void SV_HullPlaneSides (mplane_t *plane, const hullpoints_t *hp, int *front, int *back)
+{
+#ifdef HULL_SIMD
+	__m128	d;
+	__m128d	n0, n1, n2, dist, lo, hi;
+
+	if (plane->type < 3)
+		d = _mm_sub_ps (hp->v[plane->type], _mm_set1_ps (plane->dist));
+	else
+	{
+		// DoublePrecisionDotProduct, same operations in the same order
+		n0 = _mm_set1_pd (plane->normal[0]);
+		n1 = _mm_set1_pd (plane->normal[1]);
+		n2 = _mm_set1_pd (plane->normal[2]);
+		dist = _mm_set1_pd (plane->dist);
+		lo = _mm_add_pd (_mm_mul_pd (n0, hp->lo[0]), _mm_mul_pd (n1, hp->lo[1]));
+		lo = _mm_sub_pd (_mm_add_pd (lo, _mm_mul_pd (n2, hp->lo[2])), dist);
+		hi = _mm_add_pd (_mm_mul_pd (n0, hp->hi[0]), _mm_mul_pd (n1, hp->hi[1]));
+		hi = _mm_sub_pd (_mm_add_pd (hi, _mm_mul_pd (n2, hp->hi[2])), dist);
+		// rounded to float before the sign is looked at, as in the scalar code
+		d = _mm_movelh_ps (_mm_cvtpd_ps (lo), _mm_cvtpd_ps (hi));
+	}
+
+	*front = _mm_movemask_ps (_mm_cmpge_ps (d, _mm_setzero_ps ()));
+	*back = _mm_movemask_ps (_mm_cmplt_ps (d, _mm_setzero_ps ()));
+#else
+	vec3_t	p;
+	float	d;
+	int		i;
+
+	*front = *back = 0;
+	for (i = 0; i < HULL_BATCH; i++)
+	{
+		if (plane->type < 3)
+			d = hp->v[plane->type][i] - plane->dist;
+		else
+		{
+			p[0] = hp->v[0][i];
+			p[1] = hp->v[1][i];
+			p[2] = hp->v[2][i];
+			d = DoublePrecisionDotProduct (plane->normal, p) - plane->dist;
+		}
+		if (d >= 0)
+			*front |= 1 << i;
+		else if (d < 0)
+			*back |= 1 << i;
+	}
+#endif
+}
+
+/*
+==================
+SV_HullPointContentsBatch
+
+contents[i] = SV_HullPointContents (hull, num, points[i]) for count points
+==================
+*/
+void SV_HullPointContentsBatch (hull_t *hull, int num, int count, vec3_t *points, int *contents)
+{
+	hullpoints_t	hp;
+	hullgroup_t		stack[HULL_BATCH];
+	mclipnode_t		*node;
+	int				first, n, i, sp, cur, lanes, front, back;
+
+	for (first = 0; first < count; first += HULL_BATCH, points += HULL_BATCH, contents += HULL_BATCH)
+	{
+		n = q_min (count - first, HULL_BATCH);
+		if (n == 1 || !sv_hullbatch.value)
+		{
+			for (i = 0; i < n; i++)
+				contents[i] = SV_HullPointContents (hull, num, points[i]);
+			continue;
+		}
+
+		SV_HullLoadPoints (&hp, points, n);
+		stack[0].num = num;
+		stack[0].lanes = (1 << n) - 1;
+		sp = 1;
+
+		// a group splits at most n - 1 times, so the stack never holds more than n
+		while (sp)
+		{
+			sp--;
+			cur = stack[sp].num;
+			lanes = stack[sp].lanes;
+
+			// down together until a leaf or a single point is left
+			while (cur >= 0 && (lanes & (lanes - 1)))
+			{
+				if (cur < hull->firstclipnode || cur > hull->lastclipnode)
+					Sys_Error ("SV_HullPointContentsBatch: bad node number");
+
+				node = hull->clipnodes + cur;
+				SV_HullPlaneSides (hull->planes + node->planenum, &hp, &front, &back);
+				back &= lanes;
+				if (!back)
+					cur = node->children[0];
+				else if (back == lanes)
+					cur = node->children[1];
+				else
+				{
+					stack[sp].num = node->children[1];
+					stack[sp].lanes = back;
+					sp++;
+					cur = node->children[0];
+					lanes &= ~back;
+				}
+			}
+
+			for (i = 0; i < n; i++)
+				if (lanes & (1 << i))
+					contents[i] = SV_HullPointContents (hull, cur, points[i]);
+		}
+	}
+}
+
+/*
+==================
+SV_RecursiveHullCheckBatch
+
+SV_RecursiveHullCheck (hull, num, 0, 1, p1[i], p2[i], &traces[i]) for count
+lines. The traces have to be set up as for SV_RecursiveHullCheck.
+==================
+*/
+void SV_RecursiveHullCheckBatch (hull_t *hull, int num, int count, vec3_t *p1, vec3_t *p2, trace_t *traces)
+{
+	hullpoints_t	from, to;
+	hullgroup_t		stack[HULL_BATCH];
+	mclipnode_t		*node;
+	int				first, n, i, sp, cur, lanes;
+	int				front1, back1, front2, back2, front, back, cross;
+
+	for (first = 0; first < count; first += HULL_BATCH, p1 += HULL_BATCH, p2 += HULL_BATCH, traces += HULL_BATCH)
+	{
+		n = q_min (count - first, HULL_BATCH);
+		if (n == 1 || !sv_hullbatch.value)
+		{
+			for (i = 0; i < n; i++)
+				SV_RecursiveHullCheck (hull, num, 0, 1, p1[i], p2[i], &traces[i]);
+			continue;
+		}
+
+		SV_HullLoadPoints (&from, p1, n);
+		SV_HullLoadPoints (&to, p2, n);
+		stack[0].num = num;
+		stack[0].lanes = (1 << n) - 1;
+		sp = 1;
+
+		while (sp)
+		{
+			sp--;
+			cur = stack[sp].num;
+			lanes = stack[sp].lanes;
+
+			while (cur >= 0 && (lanes & (lanes - 1)))
+			{
+				if (cur < hull->firstclipnode || cur > hull->lastclipnode)
+					Sys_Error ("SV_RecursiveHullCheckBatch: bad node number");
+
+				node = hull->clipnodes + cur;
+				SV_HullPlaneSides (hull->planes + node->planenum, &from, &front1, &back1);
+				SV_HullPlaneSides (hull->planes + node->planenum, &to, &front2, &back2);
+				front = front1 & front2 & lanes;
+				back = back1 & back2 & lanes;
+
+				// lines crossing the plane are finished one at a time from here
+				cross = lanes & ~(front | back);
+				for (i = 0; cross; i++, cross >>= 1)
+					if (cross & 1)
+						SV_RecursiveHullCheck (hull, cur, 0, 1, p1[i], p2[i], &traces[i]);
+
+				if (front && back)
+				{
+					stack[sp].num = node->children[1];
+					stack[sp].lanes = back;
+					sp++;
+				}
+				if (front)
+				{
+					cur = node->children[0];
+					lanes = front;
+				}
+				else
+				{
+					cur = node->children[1];
+					lanes = back;
+				}
+			}
+
+			for (i = 0; i < n; i++)
+				if (lanes & (1 << i))
+					SV_RecursiveHullCheck (hull, cur, 0, 1, p1[i], p2[i], &traces[i]);
+		}
+	}
+}
+
+
 /*
 ==================
 SV_ClipMoveToEntity
@@ -806,8 +2127,118 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, vec3_t start, vec3_t mins, vec3_t max
 	return trace;
 }
 
+/*
+==================
+SV_ClipMoveToEntityBatch
+
+SV_ClipMoveToEntity for count moves of the same size
+==================
+*/
+void SV_ClipMoveToEntityBatch (edict_t *ent, int count, vec3_t *start, vec3_t mins, vec3_t maxs, vec3_t *end, trace_t *traces)
+{
+	trace_t		*trace;
+	vec3_t		offset;
+	vec3_t		start_l[HULL_BATCH], end_l[HULL_BATCH];
+	hull_t		*hull;
+	int			first, n, i;
+
+	hull = SV_HullForEntity (ent, mins, maxs, offset);
+
+	for (first = 0; first < count; first += HULL_BATCH)
+	{
+		n = q_min (count - first, HULL_BATCH);
+		for (i = 0; i < n; i++)
+		{
+			trace = &traces[first + i];
+			memset (trace, 0, sizeof(trace_t));
+			trace->fraction = 1;
+			trace->allsolid = true;
+			VectorCopy (end[first + i], trace->endpos);
+
+			VectorSubtract (start[first + i], offset, start_l[i]);
+			VectorSubtract (end[first + i], offset, end_l[i]);
+		}
+
+		SV_RecursiveHullCheckBatch (hull, hull->firstclipnode, n, start_l, end_l, &traces[first]);
+
+		for (i = 0; i < n; i++)
+		{
+			trace = &traces[first + i];
+			if (trace->fraction != 1)
+				VectorAdd (trace->endpos, offset, trace->endpos);
+			if (trace->fraction < 1 || trace->startsolid)
+				trace->ent = ent;
+		}
+	}
+}
+
 //===========================================================================
 
+/*
+====================
+SV_ClipToEdict
+
+Returns false once the move is known to be all solid
+====================
+*/
+static qboolean SV_ClipToEdict (edict_t *touch, moveclip_t *clip)
+{
+	trace_t		trace;
+
+	if (touch->v.solid == SOLID_NOT)
+		return true;
+	if (touch == clip->passedict)
+		return true;
+	if (touch->v.solid == SOLID_TRIGGER)
+		Sys_Error ("Trigger in clipping list");
+
+	if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
+		return true;
+
+	if (clip->boxmins[0] > touch->v.absmax[0]
+	|| clip->boxmins[1] > touch->v.absmax[1]
+	|| clip->boxmins[2] > touch->v.absmax[2]
+	|| clip->boxmaxs[0] < touch->v.absmin[0]
+	|| clip->boxmaxs[1] < touch->v.absmin[1]
+	|| clip->boxmaxs[2] < touch->v.absmin[2] )
+		return true;
+
+	if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0])
+		return true;	// points never interact
+
+// might intersect, so do an exact clip
+	if (clip->trace.allsolid)
+		return false;
+	if (clip->passedict)
+	{
+	 	if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
+			return true;	// don't clip against own missiles
+		if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
+			return true;	// don't clip against owner
+	}
+
+	if ((int)touch->v.flags & FL_MONSTER)
+		trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins2, clip->maxs2, clip->end);
+	else
+		trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins, clip->maxs, clip->end);
+	if (trace.allsolid || trace.startsolid ||
+	trace.fraction < clip->trace.fraction)
+	{
+		trace.ent = touch;
+	 	if (clip->trace.startsolid)
+		{
+			clip->trace = trace;
+			clip->trace.startsolid = true;
+		}
+		else
+			clip->trace = trace;
+	}
+	else if (trace.startsolid)
+		clip->trace.startsolid = true;
+
+	return true;
+}
+
 /*
 ====================
 SV_ClipToLinks
@@ -818,64 +2249,13 @@ Mins and maxs enclose the entire area swept by the move
 void SV_ClipToLinks ( areanode_t *node, moveclip_t *clip )
 {
 	link_t		*l, *next;
-	edict_t		*touch;
-	trace_t		trace;
 
 // touch linked edicts
 	for (l = node->solid_edicts.next ; l != &node->solid_edicts ; l = next)
 	{
 		next = l->next;
-		touch = EDICT_FROM_AREA(l);
-		if (touch->v.solid == SOLID_NOT)
-			continue;
-		if (touch == clip->passedict)
-			continue;
-		if (touch->v.solid == SOLID_TRIGGER)
-			Sys_Error ("Trigger in clipping list");
-
-		if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
-			continue;
-
-		if (clip->boxmins[0] > touch->v.absmax[0]
-		|| clip->boxmins[1] > touch->v.absmax[1]
-		|| clip->boxmins[2] > touch->v.absmax[2]
-		|| clip->boxmaxs[0] < touch->v.absmin[0]
-		|| clip->boxmaxs[1] < touch->v.absmin[1]
-		|| clip->boxmaxs[2] < touch->v.absmin[2] )
-			continue;
-
-		if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0])
-			continue;	// points never interact
-
-	// might intersect, so do an exact clip
-		if (clip->trace.allsolid)
+		if (!SV_ClipToEdict (EDICT_FROM_AREA(l), clip))
 			return;
-		if (clip->passedict)
-		{
-		 	if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
-				continue;	// don't clip against own missiles
-			if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
-				continue;	// don't clip against owner
-		}
-
-		if ((int)touch->v.flags & FL_MONSTER)
-			trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins2, clip->maxs2, clip->end);
-		else
-			trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins, clip->maxs, clip->end);
-		if (trace.allsolid || trace.startsolid ||
-		trace.fraction < clip->trace.fraction)
-		{
-			trace.ent = touch;
-		 	if (clip->trace.startsolid)
-			{
-				clip->trace = trace;
-				clip->trace.startsolid = true;
-			}
-			else
-				clip->trace = trace;
-		}
-		else if (trace.startsolid)
-			clip->trace.startsolid = true;
 	}
 
 // recurse down both sides
@@ -888,6 +2268,21 @@ void SV_ClipToLinks ( areanode_t *node, moveclip_t *clip )
 		SV_ClipToLinks ( node->children[1], clip );
 }
 
+/*
+====================
+SV_ClipToOctree
+====================
+*/
+static void SV_ClipToOctree (moveclip_t *clip)
+{
+	int		i, count;
+
+	count = SV_OctGatherSorted (0, clip->boxmins, clip->boxmaxs, sv_octlist, MAX_EDICTS);
+	for (i = 0; i < count; i++)
+		if (!SV_ClipToEdict (sv_octlist[i], clip))
+			return;
+}
+
 
 /*
 ==================
@@ -921,18 +2316,19 @@ boxmaxs[0] = boxmaxs[1] = boxmaxs[2] = 9999;
 
 /*
 ==================
-SV_Move
+SV_ClipMoveToEdicts
+
+Clips a move that has already been clipped to the world to everything else
 ==================
 */
-trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict)
+static trace_t SV_ClipMoveToEdicts (trace_t *worldtrace, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict)
 {
 	moveclip_t	clip;
 	int			i;
 
 	memset ( &clip, 0, sizeof ( moveclip_t ) );
 
-// clip to world
-	clip.trace = SV_ClipMoveToEntity ( sv.edicts, start, mins, maxs, end );
+	clip.trace = *worldtrace;
 
 	clip.start = start;
 	clip.end = end;
@@ -959,8 +2355,675 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 	SV_MoveBounds ( start, clip.mins2, clip.maxs2, end, clip.boxmins, clip.boxmaxs );
 
 // clip to entities
-	SV_ClipToLinks ( sv_areanodes, &clip );
+	if (sv_areamode)
+		SV_ClipToOctree (&clip);
+	else
+		SV_ClipToLinks ( sv_areanodes, &clip );
 
 	return clip.trace;
 }
 
+/*
+==================
+SV_Move
+==================
+*/
+trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict)
+{
+	trace_t		trace;
+
+// clip to world
+	trace = SV_ClipMoveToEntity ( sv.edicts, start, mins, maxs, end );
+
+	return SV_ClipMoveToEdicts (&trace, start, mins, maxs, end, type, passedict);
+}
+
+/*
+==================
+SV_MoveBatch
+
+SV_Move for count moves of the same size, type and passedict. The world is
+clipped against all of them together.
+==================
+*/
+void SV_MoveBatch (int count, vec3_t *start, vec3_t mins, vec3_t maxs, vec3_t *end, int type, edict_t *passedict, trace_t *traces)
+{
+	trace_t		trace;
+	int			i;
+
+	SV_ClipMoveToEntityBatch (sv.edicts, count, start, mins, maxs, end, traces);
+
+	for (i = 0; i < count; i++)
+	{
+		trace = traces[i];
+		traces[i] = SV_ClipMoveToEdicts (&trace, start[i], mins, maxs, end[i], type, passedict);
+	}
+}
+
+
+/*
+===============================================================================
+
+BROADPHASE BENCHMARK
+
+===============================================================================
+*/
+
+typedef struct
+{
+	vec3_t		start, end, mins, maxs;
+	int			type;
+	edict_t		*passedict;
+} benchmove_t;
+
+typedef struct
+{
+	link_t		area;
+	int			areanode;
+	int			areaorder;
+	unsigned	areaseq;
+} arealink_t;
+
+typedef struct
+{
+	areanode_t	areanodes[AREA_NODES];
+	int			numareanodes;
+	octnode_t	*octnodes;
+	int			numoctnodes;
+	int			mode;
+	unsigned	seq;
+	arealink_t	*links;		// per edict
+	edict_t		*edicts;
+	int			num_edicts, max_edicts;
+} areasave_t;
+
+/*
+===============
+SV_SaveAreas
+
+Everything an area link can point at is in these arrays or the edicts, so
+copying them back restores the exact lists, order included
+===============
+*/
+static areasave_t *SV_SaveAreas (void)
+{
+	areasave_t	*save;
+	int			i;
+
+	save = (areasave_t *) malloc (sizeof(*save));
+	if (!save)
+		Sys_Error ("SV_SaveAreas: out of memory");
+	memcpy (save->areanodes, sv_areanodes, sizeof(sv_areanodes));
+	save->numareanodes = sv_numareanodes;
+	save->octnodes = (octnode_t *) malloc (sv_numoctnodes * sizeof(octnode_t));
+	save->links = (arealink_t *) malloc (sv.num_edicts * sizeof(arealink_t));
+	if (!save->octnodes || !save->links)
+		Sys_Error ("SV_SaveAreas: out of memory");
+	memcpy (save->octnodes, sv_octnodes, sv_numoctnodes * sizeof(octnode_t));
+	save->numoctnodes = sv_numoctnodes;
+	save->mode = sv_areamode;
+	save->seq = sv_areaseq;
+	for (i = 0; i < sv.num_edicts; i++)
+	{
+		save->links[i].area = EDICT_NUM(i)->area;
+		save->links[i].areanode = EDICT_NUM(i)->areanode;
+		save->links[i].areaorder = EDICT_NUM(i)->areaorder;
+		save->links[i].areaseq = EDICT_NUM(i)->areaseq;
+	}
+	save->edicts = sv.edicts;
+	save->num_edicts = sv.num_edicts;
+	save->max_edicts = sv.max_edicts;
+
+	return save;
+}
+
+/*
+===============
+SV_RestoreAreas
+===============
+*/
+static void SV_RestoreAreas (areasave_t *save)
+{
+	int		i;
+
+	sv.edicts = save->edicts;
+	sv.num_edicts = save->num_edicts;
+	sv.max_edicts = save->max_edicts;
+	memcpy (sv_areanodes, save->areanodes, sizeof(sv_areanodes));
+	sv_numareanodes = save->numareanodes;
+	memcpy (sv_octnodes, save->octnodes, save->numoctnodes * sizeof(octnode_t));
+	sv_numoctnodes = save->numoctnodes;
+	sv_areamode = save->mode;
+	sv_areaseq = save->seq;
+	for (i = 0; i < sv.num_edicts; i++)
+	{
+		EDICT_NUM(i)->area = save->links[i].area;
+		EDICT_NUM(i)->areanode = save->links[i].areanode;
+		EDICT_NUM(i)->areaorder = save->links[i].areaorder;
+		EDICT_NUM(i)->areaseq = save->links[i].areaseq;
+	}
+}
+
+/*
+===============
+SV_FreeAreas
+===============
+*/
+static void SV_FreeAreas (areasave_t *save)
+{
+	free (save->octnodes);
+	free (save->links);
+	free (save);
+}
+
+struct worldsave_s
+{
+	areasave_t	*areas;
+	byte		*edicts;		// all sv.max_edicts of them
+	int			num_edicts;
+	link_t		free_edicts;
+	unsigned	(*vismasks)[4];
+};
+
+/*
+===============
+SV_SaveWorld
+===============
+*/
+worldsave_t *SV_SaveWorld (void)
+{
+	worldsave_t	*save;
+
+	save = (worldsave_t *) malloc (sizeof(*save));
+	if (!save)
+		Sys_Error ("SV_SaveWorld: out of memory");
+	save->edicts = (byte *) malloc (sv.max_edicts * pr_edict_size);
+	save->vismasks = (unsigned (*)[4]) malloc (sv.max_edicts * sizeof(*save->vismasks));
+	if (!save->edicts || !save->vismasks)
+		Sys_Error ("SV_SaveWorld: out of memory");
+
+	save->areas = SV_SaveAreas ();
+	memcpy (save->edicts, sv.edicts, sv.max_edicts * pr_edict_size);
+	save->num_edicts = sv.num_edicts;
+	save->free_edicts = sv.free_edicts;
+	memcpy (save->vismasks, sv_vismasks, sv.max_edicts * sizeof(*save->vismasks));
+
+	return save;
+}
+
+/*
+===============
+SV_RestoreWorld
+
+The links inside the edicts and the area lists are copied back together, so
+they agree again. The findradius grid and the think queue only cache what
+the edicts say, so they are made to look at every edict once more.
+===============
+*/
+void SV_RestoreWorld (worldsave_t *save)
+{
+	memcpy (sv.edicts, save->edicts, sv.max_edicts * pr_edict_size);
+	sv.num_edicts = save->num_edicts;
+	sv.free_edicts = save->free_edicts;
+	SV_RestoreAreas (save->areas);
+	memcpy (sv_vismasks, save->vismasks, sv.max_edicts * sizeof(*save->vismasks));
+
+	if (RGRID_VALID ())
+		SV_RadiusGridSetup (sv_rgrid.maxedicts, sv_rgrid.bucket);
+	SV_ResetThinkQueue ();
+}
+
+/*
+===============
+SV_FreeWorld
+===============
+*/
+void SV_FreeWorld (worldsave_t *save)
+{
+	SV_FreeAreas (save->areas);
+	free (save->edicts);
+	free (save->vismasks);
+	free (save);
+}
+
+/*
+===============
+SV_BenchRandom
+===============
+*/
+static float SV_BenchRandom (unsigned *seed)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return (*seed >> 8) * (1.f / 16777216.f);
+}
+
+/*
+===============
+SV_TraceBenchMoves
+
+Random moves of a few hull sizes starting at the given edicts, or anywhere in
+the world if there are none
+===============
+*/
+static void SV_TraceBenchMoves (benchmove_t *moves, int nummoves, edict_t **ents, int numents, unsigned seed)
+{
+	static const float	hulls[3][6] = {
+		{0, 0, 0, 0, 0, 0},
+		{-16, -16, -24, 16, 16, 32},
+		{-32, -32, -24, 32, 32, 64},
+	};
+	benchmove_t	*m;
+	edict_t		*ent;
+	vec3_t		dir;
+	float		len;
+	int			i, j;
+
+	for (i = 0, m = moves; i < nummoves; i++, m++)
+	{
+		ent = numents ? ents[(int)(SV_BenchRandom (&seed) * numents) % numents] : NULL;
+		for (j = 0; j < 3; j++)
+		{
+			if (ent)
+				m->start[j] = 0.5f * (ent->v.absmin[j] + ent->v.absmax[j]);
+			else
+				m->start[j] = sv.worldmodel->mins[j] + SV_BenchRandom (&seed) * (sv.worldmodel->maxs[j] - sv.worldmodel->mins[j]);
+			dir[j] = SV_BenchRandom (&seed) * 2.f - 1.f;
+			m->mins[j] = hulls[i % 3][j];
+			m->maxs[j] = hulls[i % 3][j + 3];
+		}
+		VectorNormalize (dir);
+		// mostly movement and ground checks, some long sight and shot lines
+		if (i & 3)
+			len = 8.f + SV_BenchRandom (&seed) * 128.f;
+		else
+			len = 64.f + SV_BenchRandom (&seed) * 2048.f;
+		VectorMA (m->start, len, dir, m->end);
+		m->type = (i / 3) % 3;	// MOVE_NORMAL, MOVE_NOMONSTERS, MOVE_MISSILE
+		m->passedict = ent;
+	}
+}
+
+/*
+===============
+SV_TraceBenchRun
+
+Returns the time the traces took, and in *triggertime the time the same
+boxes took as trigger queries
+===============
+*/
+static double SV_TraceBenchRun (benchmove_t *moves, int nummoves, trace_t *results, int *triggers, double *triggertime)
+{
+	edict_t		**list, *box;
+	double		t, tracetime;
+	int			i, j, listcount;
+
+	t = Sys_DoubleTime ();
+	for (i = 0; i < nummoves; i++)
+		results[i] = SV_Move (moves[i].start, moves[i].mins, moves[i].maxs, moves[i].end, moves[i].type, moves[i].passedict);
+	tracetime = Sys_DoubleTime () - t;
+
+	list = (edict_t **) malloc (sv.num_edicts * sizeof(edict_t *));
+	box = (edict_t *) calloc (1, pr_edict_size);
+	if (!list || !box)
+		Sys_Error ("SV_TraceBenchRun: out of memory");
+
+	t = Sys_DoubleTime ();
+	for (i = 0; i < nummoves; i++)
+	{
+		SV_MoveBounds (moves[i].start, moves[i].mins, moves[i].maxs, moves[i].end, box->v.absmin, box->v.absmax);
+		listcount = 0;
+		SV_TriggerEdicts (box, list, &listcount, sv.num_edicts);
+		// order differs between the structures, keep something that doesn't
+		triggers[i * 2] = listcount;
+		triggers[i * 2 + 1] = 0;
+		for (j = 0; j < listcount; j++)
+			triggers[i * 2 + 1] += NUM_FOR_EDICT(list[j]);
+	}
+	*triggertime = Sys_DoubleTime () - t;
+
+	free (list);
+	free (box);
+
+	return tracetime;
+}
+
+/*
+===============
+SV_TraceBenchCompare
+
+Counts the moves whose results differ. Edicts touched at exactly the same
+fraction can be reported in a different order, so when everything but the
+edict matches the move is counted as a tie instead.
+===============
+*/
+static int SV_TraceBenchCompare (trace_t *a, trace_t *b, int *ta, int *tb, int nummoves, int *ties)
+{
+	int		i, differ;
+
+	differ = *ties = 0;
+	for (i = 0; i < nummoves; i++, a++, b++)
+	{
+		if (a->fraction != b->fraction || a->allsolid != b->allsolid || a->startsolid != b->startsolid
+		|| a->inopen != b->inopen || a->inwater != b->inwater || !VectorCompare (a->endpos, b->endpos)
+		|| !VectorCompare (a->plane.normal, b->plane.normal) || a->plane.dist != b->plane.dist
+		|| ta[i * 2] != tb[i * 2] || ta[i * 2 + 1] != tb[i * 2 + 1])
+			differ++;
+		else if (a->ent != b->ent)
+			(*ties)++;
+	}
+	return differ;
+}
+
+/*
+===============
+SV_TraceBenchPrint
+===============
+*/
+static void SV_TraceBenchPrint (const char *what, benchmove_t *moves, int nummoves)
+{
+	trace_t		*results[2];
+	int			*triggers[2];
+	double		tracetime[2], triggertime[2];
+	int			mode, differ, ties;
+
+	for (mode = 0; mode < 2; mode++)
+	{
+		results[mode] = (trace_t *) malloc (nummoves * sizeof(trace_t));
+		triggers[mode] = (int *) malloc (nummoves * 2 * sizeof(int));
+		if (!results[mode] || !triggers[mode])
+			Sys_Error ("SV_TraceBenchPrint: out of memory");
+		SV_RelinkAreas (mode);
+		tracetime[mode] = SV_TraceBenchRun (moves, nummoves, results[mode], triggers[mode], &triggertime[mode]);
+	}
+
+	differ = SV_TraceBenchCompare (results[0], results[1], triggers[0], triggers[1], nummoves, &ties);
+	Con_Printf ("%s: %i traces\n", what, nummoves);
+	Con_Printf ("  traces   areanode %8.2f ms, octree %8.2f ms, %5.2fx\n", tracetime[0] * 1000.0,
+		tracetime[1] * 1000.0, tracetime[1] > 0.0 ? tracetime[0] / tracetime[1] : 0.0);
+	Con_Printf ("  triggers areanode %8.2f ms, octree %8.2f ms, %5.2fx\n", triggertime[0] * 1000.0,
+		triggertime[1] * 1000.0, triggertime[1] > 0.0 ? triggertime[0] / triggertime[1] : 0.0);
+	if (differ)
+		Con_Printf ("  %i results DIFFER, %i ties\n", differ, ties);
+	else
+		Con_Printf ("  results identical, %i ties hit a different edict\n", ties);
+
+	for (mode = 0; mode < 2; mode++)
+	{
+		free (results[mode]);
+		free (triggers[mode]);
+	}
+}
+
+/*
+===============
+SV_TraceBench_f
+
+sv_tracebench [traces] [edicts]
+
+Runs the same random moves through SV_Move and the trigger search with the
+areanode tree and the octree: first against the current map's edicts, then
+against synthetic edicts bunched into a few clusters, as in a big fight.
+The server's own links are put back afterwards.
+===============
+*/
+void SV_TraceBench_f (void)
+{
+	areasave_t	*save;
+	benchmove_t	*moves;
+	edict_t		**ents, *ent;
+	vec3_t		clusters[4];
+	unsigned	seed;
+	int			nummoves, numsynth, numents, i, j, c;
+	char		what[64];
+
+	if (!sv.active)
+	{
+		Con_Printf ("sv_tracebench: no map running\n");
+		return;
+	}
+
+	nummoves = Cmd_Argc () >= 2 ? atoi (Cmd_Argv (1)) : 20000;
+	numsynth = Cmd_Argc () >= 3 ? atoi (Cmd_Argv (2)) : 4096;
+	nummoves = q_max (nummoves, 1);
+	numsynth = CLAMP (2, numsynth, MAX_EDICTS);
+
+	moves = (benchmove_t *) malloc (nummoves * sizeof(*moves));
+	ents = (edict_t **) malloc (q_max (sv.num_edicts, numsynth) * sizeof(edict_t *));
+	if (!moves || !ents)
+		Sys_Error ("SV_TraceBench_f: out of memory");
+
+	save = SV_SaveAreas ();
+
+// the map as it is
+	numents = 0;
+	for (i = 1; i < sv.num_edicts; i++)
+		if (!EDICT_NUM(i)->free && EDICT_NUM(i)->area.prev)
+			ents[numents++] = EDICT_NUM(i);
+	SV_TraceBenchMoves (moves, nummoves, ents, numents, 0x12345678u);
+	q_snprintf (what, sizeof(what), "%s, %i linked edicts", sv.name, numents);
+	SV_TraceBenchPrint (what, moves, nummoves);
+
+// synthetic clusters: monsters, items, projectiles and triggers
+	sv.edicts = (edict_t *) calloc (numsynth, pr_edict_size);
+	if (!sv.edicts)
+		Sys_Error ("SV_TraceBench_f: out of memory");
+	memcpy (sv.edicts, save->edicts, pr_edict_size);	// the world
+	sv.num_edicts = sv.max_edicts = numsynth;
+
+	seed = 0x9e3779b9u;
+	for (c = 0; c < (int) countof(clusters); c++)
+	{
+		ent = numents ? ents[(int)(SV_BenchRandom (&seed) * numents) % numents] : NULL;
+		for (j = 0; j < 3; j++)
+			clusters[c][j] = ent ? ent->v.origin[j] : sv.worldmodel->mins[j] + SV_BenchRandom (&seed) * (sv.worldmodel->maxs[j] - sv.worldmodel->mins[j]);
+	}
+	for (i = 1; i < numsynth; i++)
+	{
+		ent = EDICT_NUM(i);
+		c = i % countof(clusters);
+		for (j = 0; j < 3; j++)
+			ent->v.origin[j] = clusters[c][j] + (SV_BenchRandom (&seed) + SV_BenchRandom (&seed) - 1.f) * 384.f;
+		switch (i % 10)
+		{
+		case 0: case 1: case 2: case 3: case 4:
+			ent->v.solid = SOLID_SLIDEBOX;
+			ent->v.flags = FL_MONSTER;
+			ent->v.mins[0] = -16; ent->v.mins[1] = -16; ent->v.mins[2] = -24;
+			ent->v.maxs[0] = 16; ent->v.maxs[1] = 16; ent->v.maxs[2] = 40;
+			break;
+		case 5: case 6:
+			ent->v.solid = SOLID_BBOX;	// projectiles
+			break;
+		case 7:
+			ent->v.solid = SOLID_TRIGGER;
+			ent->v.touch = 1;
+			ent->v.mins[0] = -16; ent->v.mins[1] = -16; ent->v.mins[2] = 0;
+			ent->v.maxs[0] = 16; ent->v.maxs[1] = 16; ent->v.maxs[2] = 56;
+			break;
+		default:
+			ent->v.solid = SOLID_BBOX;
+			ent->v.mins[0] = -16; ent->v.mins[1] = -16; ent->v.mins[2] = -16;
+			ent->v.maxs[0] = 16; ent->v.maxs[1] = 16; ent->v.maxs[2] = 16;
+			break;
+		}
+		VectorSubtract (ent->v.maxs, ent->v.mins, ent->v.size);
+		for (j = 0; j < 3; j++)
+		{
+			ent->v.absmin[j] = ent->v.origin[j] + ent->v.mins[j] - 1;
+			ent->v.absmax[j] = ent->v.origin[j] + ent->v.maxs[j] + 1;
+		}
+		ents[i - 1] = ent;
+	}
+
+	SV_ResetAreas (0);
+	for (i = 1; i < numsynth; i++)
+		SV_AreaLink (EDICT_NUM(i), EDICT_NUM(i)->v.solid == SOLID_TRIGGER);
+	SV_TraceBenchMoves (moves, nummoves, ents, numsynth - 1, 0x2545f491u);
+	q_snprintf (what, sizeof(what), "%i clustered edicts", numsynth - 1);
+	SV_TraceBenchPrint (what, moves, nummoves);
+
+	free (sv.edicts);
+	sv.edicts = NULL;
+
+	free (moves);
+	free (ents);
+	SV_RestoreAreas (save);
+	SV_FreeAreas (save);
+}
+
+
+/*
+===============================================================================
+
+HULL BENCHMARK
+
+===============================================================================
+*/
+
+/*
+===============
+SV_HullBenchLines
+
+Groups of HULL_BATCH lines like the ones monster movement traces: drops
+under the corners of a box, as in SV_CheckBottom, and short moves in
+different directions from one spot
+===============
+*/
+static void SV_HullBenchLines (vec3_t *p1, vec3_t *p2, int numgroups, float size, unsigned seed)
+{
+	vec3_t	org;
+	float	yaw, len;
+	int		g, i, j;
+
+	for (g = 0; g < numgroups; g++, p1 += HULL_BATCH, p2 += HULL_BATCH)
+	{
+		for (j = 0; j < 3; j++)
+			org[j] = sv.worldmodel->mins[j] + SV_BenchRandom (&seed) * (sv.worldmodel->maxs[j] - sv.worldmodel->mins[j]);
+		for (i = 0; i < HULL_BATCH; i++)
+		{
+			if (g & 1)
+			{
+				p1[i][0] = p2[i][0] = org[0] + ((i & 1) ? size : -size);
+				p1[i][1] = p2[i][1] = org[1] + ((i & 2) ? size : -size);
+				p1[i][2] = org[2];
+				p2[i][2] = org[2] - 36;
+			}
+			else
+			{
+				yaw = SV_BenchRandom (&seed) * 2 * M_PI;
+				len = 8 + SV_BenchRandom (&seed) * 56;
+				VectorCopy (org, p1[i]);
+				p2[i][0] = org[0] + cos (yaw) * len;
+				p2[i][1] = org[1] + sin (yaw) * len;
+				p2[i][2] = org[2] + (SV_BenchRandom (&seed) - 0.5f) * 16;
+			}
+		}
+	}
+}
+
+/*
+===============
+SV_HullBench_f
+
+sv_hullbench [lines]
+
+Runs the same point and line tests through each of the world's clipping
+hulls one at a time and batched, and checks that the results are the same
+bit for bit
+===============
+*/
+void SV_HullBench_f (void)
+{
+	static const float	sizes[3] = {16, 16, 32};
+	hull_t		*hull;
+	vec3_t		*p1, *p2;
+	trace_t		*traces[2], *trace;
+	int			*contents[2];
+	double		t, pointtime[2], tracetime[2];
+	int			numgroups, count, h, mode, i, differ;
+
+	if (!sv.active)
+	{
+		Con_Printf ("sv_hullbench: no map running\n");
+		return;
+	}
+
+	numgroups = (Cmd_Argc () >= 2 ? atoi (Cmd_Argv (1)) : 200000) / HULL_BATCH;
+	numgroups = q_max (numgroups, 1);
+	count = numgroups * HULL_BATCH;
+
+	p1 = (vec3_t *) malloc (count * sizeof(vec3_t));
+	p2 = (vec3_t *) malloc (count * sizeof(vec3_t));
+	for (mode = 0; mode < 2; mode++)
+	{
+		traces[mode] = (trace_t *) malloc (count * sizeof(trace_t));
+		contents[mode] = (int *) malloc (count * sizeof(int));
+		if (!traces[mode] || !contents[mode])
+			Sys_Error ("SV_HullBench_f: out of memory");
+	}
+	if (!p1 || !p2)
+		Sys_Error ("SV_HullBench_f: out of memory");
+
+	if (!sv_hullbatch.value)
+		Con_Printf ("sv_hullbatch is 0, both runs are one at a time\n");
+#ifndef HULL_SIMD
+	Con_Printf ("no SIMD plane tests in this build\n");
+#endif
+
+	for (h = 0; h < 3; h++)
+	{
+		hull = &sv.worldmodel->hulls[h];
+		SV_HullBenchLines (p1, p2, numgroups, sizes[h], 0x12345678u + h);
+
+		for (mode = 0; mode < 2; mode++)
+		{
+			t = Sys_DoubleTime ();
+			if (mode)
+				SV_HullPointContentsBatch (hull, hull->firstclipnode, count, p2, contents[mode]);
+			else
+				for (i = 0; i < count; i++)
+					contents[mode][i] = SV_HullPointContents (hull, hull->firstclipnode, p2[i]);
+			pointtime[mode] = Sys_DoubleTime () - t;
+
+			for (i = 0, trace = traces[mode]; i < count; i++, trace++)
+			{
+				memset (trace, 0, sizeof(trace_t));
+				trace->fraction = 1;
+				trace->allsolid = true;
+				VectorCopy (p2[i], trace->endpos);
+			}
+
+			t = Sys_DoubleTime ();
+			if (mode)
+				SV_RecursiveHullCheckBatch (hull, hull->firstclipnode, count, p1, p2, traces[mode]);
+			else
+				for (i = 0; i < count; i++)
+					SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, p1[i], p2[i], &traces[mode][i]);
+			tracetime[mode] = Sys_DoubleTime () - t;
+		}
+
+		differ = 0;
+		for (i = 0; i < count; i++)
+			if (contents[0][i] != contents[1][i] || memcmp (&traces[0][i], &traces[1][i], sizeof(trace_t)))
+				differ++;
+
+		Con_Printf ("hull %i: %i points, %i lines\n", h, count, count);
+		Con_Printf ("  points single %8.2f ms, batched %8.2f ms, %5.2fx\n", pointtime[0] * 1000.0,
+			pointtime[1] * 1000.0, pointtime[1] > 0.0 ? pointtime[0] / pointtime[1] : 0.0);
+		Con_Printf ("  lines  single %8.2f ms, batched %8.2f ms, %5.2fx, %.2f Mlines/s\n", tracetime[0] * 1000.0,
+			tracetime[1] * 1000.0, tracetime[1] > 0.0 ? tracetime[0] / tracetime[1] : 0.0,
+			tracetime[1] > 0.0 ? count / tracetime[1] * 1e-6 : 0.0);
+		if (differ)
+			Con_Printf ("  %i results DIFFER\n", differ);
+		else
+			Con_Printf ("  results identical\n");
+	}
+
+	for (mode = 0; mode < 2; mode++)
+	{
+		free (traces[mode]);
+		free (contents[mode]);
+	}
+	free (p1);
+	free (p2);
+}
@@ -60,6 +60,43 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers);
 // sets ent->v.absmin and ent->v.absmax
 // if touchtriggers, calls prog functions for the intersected triggers
 
+void SV_RadiusGridDirty (edict_t *ent);
+// call when origin, mins or maxs may have changed and the entity is not
+// about to be relinked, so findradius doesn't miss it
+
+edict_t *SV_FindRadius (const float *org, float radius);
+// returns a chain (through .chain) of the non-free, non-SOLID_NOT entities
+// whose bbox center is within radius of org, highest edict number first
+
+void SV_FindRadiusBench_f (void);
+
+typedef struct worldsave_s worldsave_t;
+
+worldsave_t *SV_SaveWorld (void);
+void SV_RestoreWorld (worldsave_t *save);
+void SV_FreeWorld (worldsave_t *save);
+// copies of every edict and how they are linked, see PR_Bench_f; a save can
+// be restored any number of times before it is freed
+
+typedef struct
+{
+	unsigned	mask[4];	// leaf clusters with a pvs bit, and the overflow bit
+	byte		*pvs;
+} pvsquery_t;
+
+void SV_PVSQuery (byte *pvs, pvsquery_t *q);
+int SV_EdictsInPVS (const pvsquery_t *q, int start, int end, int always, int *list);
+// fills list with the edicts in [start, end) that touch pvs, or touch too
+// many leafs to be culled, plus always; the same edicts as testing each one
+// with SV_EdictInPVS and the MAX_ENT_LEAFS rule, but with one SIMD AND per
+// edict against masks of coarse leaf clusters kept by SV_LinkEdict
+
+void SV_BroadphaseChanged (cvar_t *var);
+// sv_broadphase callback, relinks everything into the areanode tree (0) or
+// the loose octree (1)
+
+void SV_TraceBench_f (void);
+
 int SV_PointContents (vec3_t p);
 int SV_TruePointContents (vec3_t p);
 // returns the CONTENTS_* value from the world at the given point.
@@ -83,5 +120,14 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 
 qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace);
 
+void SV_MoveBatch (int count, vec3_t *start, vec3_t mins, vec3_t maxs, vec3_t *end, int type, edict_t *passedict, trace_t *traces);
+void SV_ClipMoveToEntityBatch (edict_t *ent, int count, vec3_t *start, vec3_t mins, vec3_t maxs, vec3_t *end, trace_t *traces);
+void SV_HullPointContentsBatch (hull_t *hull, int num, int count, vec3_t *points, int *contents);
+void SV_RecursiveHullCheckBatch (hull_t *hull, int num, int count, vec3_t *p1, vec3_t *p2, trace_t *traces);
+// the same as a call to the single versions for each point or move, with the
+// world's planes tested against several of them at once
+
+void SV_HullBench_f (void);
+
 #endif	/* _QUAKE_WORLD_H */
 